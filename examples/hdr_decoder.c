@@ -2,76 +2,659 @@
  * hdr_decoder.c
  * Written by Michael Barker and released to the public domain,
  * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Decodes a histogram log and prints the percentiles of each entry, or of
+ * each aggregation window.  Decoding is pipelined: a reader thread splits the
+ * input into batches of whole lines, a pool of workers base64 decodes and
+ * inflates the batches, and the main thread prints the results in order.
  */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
 
 #include <hdr/hdr_histogram.h>
 #include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_thread.h>
 
 #if defined(_MSC_VER)
 #pragma warning(push)
 #pragma warning(disable: 4996)
 #endif
 
-int main(int argc, char** argv)
+#define BATCH_SIZE (1024 * 1024)
+#define MAX_WORKERS 64
+#define IDLE_SLEEP_US 50
+
+struct options
 {
-    int rc = 0;
-    FILE* f;
-    struct hdr_log_reader reader;
-    struct hdr_histogram* h = NULL;
-    hdr_timespec timestamp, interval;
+    const char* path;
+    const char* tag;
+    double start;
+    double end;
+    double window;
+    int workers;
+};
+
+/* A decoded entry, or the sum of the consecutive entries of a batch that */
+/* fall into the same aggregation window.                                  */
+struct result
+{
+    int64_t window;
+    struct hdr_histogram* histogram;
+};
+
+enum slot_state
+{
+    SLOT_FREE,
+    SLOT_READ,
+    SLOT_DECODING,
+    SLOT_DECODED
+};
+
+struct slot
+{
+    enum slot_state state;
+    int64_t sequence;
+    char* lines;
+    size_t lines_len;
+    size_t lines_capacity;
+    struct result* results;
+    size_t results_len;
+    size_t results_capacity;
+    int error;
+};
+
+struct pipeline
+{
+    const struct options* options;
+    FILE* file;
+    struct hdr_mutex mutex;
+    struct slot* slots;
+    int slot_count;
+    /* Guarded by mutex. */
+    int64_t batches_read;
+    bool read_done;
+    bool stopping;
+    int read_error;
+};
+
+/* ########  ########    ###    ########  ######## ########  */
+/* ##     ## ##         ## ##   ##     ## ##       ##     ## */
+/* ##     ## ##        ##   ##  ##     ## ##       ##     ## */
+/* ########  ######   ##     ## ##     ## ######   ########  */
+/* ##   ##   ##       ######### ##     ## ##       ##   ##   */
+/* ##    ##  ##       ##     ## ##     ## ##       ##    ##  */
+/* ##     ## ######## ##     ## ########  ######## ##     ## */
+
+static bool reserve(void** buffer, size_t* capacity, size_t len, size_t element_size)
+{
+    void* grown;
+    size_t new_capacity = 0 == *capacity ? 16 : *capacity;
 
-    if (argc == 1)
+    if (len <= *capacity)
     {
-        f = stdin;
+        return true;
+    }
+
+    while (new_capacity < len)
+    {
+        new_capacity *= 2;
+    }
+
+    if ((grown = realloc(*buffer, new_capacity * element_size)) == NULL)
+    {
+        return false;
+    }
+
+    *buffer = grown;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+static struct slot* wait_for_slot(struct pipeline* p, int64_t sequence, enum slot_state state)
+{
+    struct slot* slot = &p->slots[sequence % p->slot_count];
+
+    while (true)
+    {
+        bool ready, stopping;
+
+        hdr_mutex_lock(&p->mutex);
+        ready = slot->state == state;
+        stopping = p->stopping;
+        hdr_mutex_unlock(&p->mutex);
+
+        if (ready)
+        {
+            return slot;
+        }
+        if (stopping)
+        {
+            return NULL;
+        }
+
+        hdr_usleep(IDLE_SLEEP_US);
+    }
+}
+
+/* Reads the input in large blocks, handing each batch of whole lines to the */
+/* workers.  A trailing partial line is carried over to the next batch.     */
+static void* read_batches(void* arg)
+{
+    struct pipeline* p = (struct pipeline*) arg;
+    char* carry = NULL;
+    size_t carry_len = 0;
+    size_t carry_capacity = 0;
+    int64_t sequence = 0;
+    int error = 0;
+    bool eof = false;
+
+    while (!eof)
+    {
+        struct slot* slot;
+        size_t read_len;
+        char* last_newline;
+
+        if ((slot = wait_for_slot(p, sequence, SLOT_FREE)) == NULL)
+        {
+            break;
+        }
+
+        if (!reserve((void**) &slot->lines, &slot->lines_capacity, carry_len + BATCH_SIZE + 1, 1))
+        {
+            error = ENOMEM;
+            break;
+        }
+
+        memcpy(slot->lines, carry, carry_len);
+        read_len = fread(slot->lines + carry_len, 1, BATCH_SIZE, p->file);
+        slot->lines_len = carry_len + read_len;
+        carry_len = 0;
+
+        if (read_len < BATCH_SIZE)
+        {
+            if (ferror(p->file))
+            {
+                error = EIO;
+                break;
+            }
+            eof = true;
+        }
+        else
+        {
+            size_t line_end;
+
+            slot->lines[slot->lines_len] = '\0';
+            last_newline = strrchr(slot->lines, '\n');
+            line_end = NULL != last_newline ? (size_t) (last_newline - slot->lines) + 1 : 0;
+            carry_len = slot->lines_len - line_end;
+            if (!reserve((void**) &carry, &carry_capacity, carry_len, 1))
+            {
+                error = ENOMEM;
+                break;
+            }
+            memcpy(carry, slot->lines + line_end, carry_len);
+            slot->lines_len = line_end;
+
+            if (0 == line_end)
+            {
+                /* A line longer than the batch, keep reading. */
+                continue;
+            }
+        }
+
+        slot->lines[slot->lines_len] = '\0';
+        slot->results_len = 0;
+        slot->error = 0;
+        slot->sequence = sequence;
+
+        hdr_mutex_lock(&p->mutex);
+        slot->state = SLOT_READ;
+        p->batches_read = ++sequence;
+        hdr_mutex_unlock(&p->mutex);
+    }
+
+    free(carry);
+
+    hdr_mutex_lock(&p->mutex);
+    p->read_done = true;
+    p->read_error = error;
+    hdr_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/* ########  ########  ######   #######  ########  ######## */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##       */
+/* ##     ## ##       ##       ##     ## ##     ## ##       */
+/* ##     ## ######   ##       ##     ## ##     ## ######   */
+/* ##     ## ##       ##       ##     ## ##     ## ##       */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##       */
+/* ########  ########  ######   #######  ########  ######## */
+
+/* Parses [Tag=<tag>,]<start>,<interval>,<max>,<histogram>, terminating the */
+/* tag and histogram in place.                                              */
+static bool parse_line(char* line, char** tag, double* start, char** histogram, size_t* histogram_len)
+{
+    char* p = line;
+    char* end;
+    int field;
+
+    *tag = NULL;
+    if (0 == strncmp(p, "Tag=", 4))
+    {
+        *tag = p + 4;
+        if ((p = strchr(p, ',')) == NULL)
+        {
+            return false;
+        }
+        *p++ = '\0';
+    }
+
+    *start = strtod(p, &end);
+    if (end == p)
+    {
+        return false;
+    }
+
+    /* Skip the start, interval and max fields. */
+    for (field = 0; field < 3; field++)
+    {
+        if ((p = strchr(p, ',')) == NULL)
+        {
+            return false;
+        }
+        p++;
+    }
+
+    *histogram = p;
+    *histogram_len = strcspn(p, "\r\n");
+    p[*histogram_len] = '\0';
+
+    return 0 < *histogram_len;
+}
+
+static bool selected(const struct options* options, const char* tag, double start)
+{
+    if (start < options->start || options->end <= start)
+    {
+        return false;
+    }
+
+    if (NULL == options->tag)
+    {
+        return true;
+    }
+
+    return NULL != tag && 0 == strcmp(options->tag, tag);
+}
+
+static int decode_batch(const struct options* options, struct hdr_log_decoder* decoder, struct slot* slot)
+{
+    char* line = slot->lines;
+    int64_t entry = 0;
+
+    while ('\0' != *line)
+    {
+        char* next = strchr(line, '\n');
+        char* tag;
+        char* histogram;
+        size_t histogram_len;
+        double start;
+        int64_t window;
+        struct result* last;
+        int rc;
+
+        if (NULL != next)
+        {
+            *next++ = '\0';
+        }
+        else
+        {
+            next = line + strlen(line);
+        }
+
+        if ('#' == *line || '"' == *line || '\0' == *line || '\r' == *line)
+        {
+            line = next;
+            continue;
+        }
+
+        if (!parse_line(line, &tag, &start, &histogram, &histogram_len))
+        {
+            return EINVAL;
+        }
+
+        line = next;
+        if (!selected(options, tag, start))
+        {
+            continue;
+        }
+
+        /* Without aggregation every entry is a window of its own. */
+        if (0 < options->window)
+        {
+            double quotient = start / options->window;
+            window = (int64_t) quotient;
+            window -= (double) window > quotient ? 1 : 0;
+        }
+        else
+        {
+            window = entry++;
+        }
+        last = 0 < slot->results_len ? &slot->results[slot->results_len - 1] : NULL;
+
+        if (NULL == last || last->window != window)
+        {
+            if (!reserve((void**) &slot->results, &slot->results_capacity, slot->results_len + 1, sizeof(struct result)))
+            {
+                return ENOMEM;
+            }
+
+            last = &slot->results[slot->results_len++];
+            last->window = window;
+            last->histogram = NULL;
+        }
+
+        if ((rc = hdr_log_decode_with(decoder, &last->histogram, histogram, histogram_len)) != 0)
+        {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+static void* decode_batches(void* arg)
+{
+    struct pipeline* p = (struct pipeline*) arg;
+    struct hdr_log_decoder* decoder = NULL;
+    int error = hdr_log_decoder_init(&decoder);
+
+    while (0 == error)
+    {
+        struct slot* claimed = NULL;
+        bool done;
+        int i;
+
+        hdr_mutex_lock(&p->mutex);
+        for (i = 0; i < p->slot_count; i++)
+        {
+            struct slot* slot = &p->slots[i];
+            if (SLOT_READ == slot->state && (NULL == claimed || slot->sequence < claimed->sequence))
+            {
+                claimed = slot;
+            }
+        }
+        if (NULL != claimed)
+        {
+            claimed->state = SLOT_DECODING;
+        }
+        done = p->stopping || (p->read_done && NULL == claimed);
+        hdr_mutex_unlock(&p->mutex);
+
+        if (done)
+        {
+            break;
+        }
+        if (NULL == claimed)
+        {
+            hdr_usleep(IDLE_SLEEP_US);
+            continue;
+        }
+
+        claimed->error = decode_batch(p->options, decoder, claimed);
+
+        hdr_mutex_lock(&p->mutex);
+        claimed->state = SLOT_DECODED;
+        hdr_mutex_unlock(&p->mutex);
+    }
+
+    hdr_log_decoder_close(decoder);
+
+    return NULL;
+}
+
+/* ##      ## ########  #### ######## ######## ########  */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ########   ##     ##    ######   ########  */
+/* ##  ##  ## ##   ##    ##     ##    ##       ##   ##   */
+/* ##  ##  ## ##    ##   ##     ##    ##       ##    ##  */
+/*  ###  ###  ##     ## ####    ##    ######## ##     ## */
+
+static void flush_window(struct result* window)
+{
+    if (NULL != window->histogram)
+    {
+        hdr_percentiles_print(window->histogram, stdout, 5, 1.0, CLASSIC);
+        hdr_close(window->histogram);
+        window->histogram = NULL;
+    }
+}
+
+/* Prints the decoded batches in input order, summing results that continue */
+/* the window of the previous batch.                                        */
+static int write_results(struct pipeline* p)
+{
+    struct result current = { -1, NULL };
+    int64_t sequence = 0;
+    int error = 0;
+
+    while (0 == error)
+    {
+        struct slot* slot;
+        bool finished;
+        size_t i;
+
+        hdr_mutex_lock(&p->mutex);
+        finished = p->read_done && sequence == p->batches_read;
+        error = p->read_error;
+        hdr_mutex_unlock(&p->mutex);
+
+        if (finished || 0 != error)
+        {
+            break;
+        }
+
+        slot = &p->slots[sequence % p->slot_count];
+        hdr_mutex_lock(&p->mutex);
+        finished = SLOT_DECODED == slot->state && slot->sequence == sequence;
+        hdr_mutex_unlock(&p->mutex);
+
+        if (!finished)
+        {
+            hdr_usleep(IDLE_SLEEP_US);
+            continue;
+        }
+
+        error = slot->error;
+        for (i = 0; i < slot->results_len; i++)
+        {
+            struct result* result = &slot->results[i];
+
+            /* A failed batch is dropped whole, nothing more is printed. */
+            if (0 != error)
+            {
+                hdr_close(result->histogram);
+            }
+            else if (NULL != current.histogram && current.window == result->window)
+            {
+                hdr_add(current.histogram, result->histogram);
+                hdr_close(result->histogram);
+            }
+            else
+            {
+                flush_window(&current);
+                current = *result;
+            }
+            result->histogram = NULL;
+        }
+
+        hdr_mutex_lock(&p->mutex);
+        slot->state = SLOT_FREE;
+        hdr_mutex_unlock(&p->mutex);
+        sequence++;
+    }
+
+    if (0 == error)
+    {
+        flush_window(&current);
     }
     else
     {
-        f = fopen(argv[1], "r");
+        hdr_close(current.histogram);
+    }
+
+    return error;
+}
+
+static bool parse_options(int argc, char** argv, struct options* options)
+{
+    int i;
+
+    memset(options, 0, sizeof(*options));
+    options->start = -HUGE_VAL;
+    options->end = HUGE_VAL;
+    options->workers = 4;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (0 == strcmp("-tag", arg) && has_value)
+        {
+            options->tag = argv[++i];
+        }
+        else if (0 == strcmp("-start", arg) && has_value)
+        {
+            options->start = atof(argv[++i]);
+        }
+        else if (0 == strcmp("-end", arg) && has_value)
+        {
+            options->end = atof(argv[++i]);
+        }
+        else if (0 == strcmp("-window", arg) && has_value)
+        {
+            options->window = atof(argv[++i]);
+        }
+        else if (0 == strcmp("-threads", arg) && has_value)
+        {
+            options->workers = atoi(argv[++i]);
+        }
+        else if ('-' == arg[0] || NULL != options->path)
+        {
+            return false;
+        }
+        else
+        {
+            options->path = arg;
+        }
+    }
+
+    return 0 < options->workers && options->workers <= MAX_WORKERS;
+}
+
+int main(int argc, char** argv)
+{
+    struct options options;
+    struct pipeline pipeline;
+    struct hdr_log_reader reader;
+    hdr_thread reader_thread;
+    hdr_thread workers[MAX_WORKERS];
+    FILE* f;
+    int rc = 0;
+    int i;
+
+    if (!parse_options(argc, argv, &options))
+    {
+        fprintf(
+            stderr,
+            "Usage: %s [-tag tag] [-start seconds] [-end seconds] [-window seconds] [-threads n] [file]\n",
+            argv[0]);
+        return -1;
     }
 
+    f = NULL == options.path ? stdin : fopen(options.path, "r");
     if (!f)
     {
-        fprintf(stderr, "Failed to open file(%s):%s\n", argv[1], strerror(errno));
+        fprintf(stderr, "Failed to open file(%s):%s\n", options.path, strerror(errno));
         return -1;
     }
 
-    if (hdr_log_reader_init(&reader))
+    if (hdr_log_reader_init_with_decoder(&reader))
     {
         fprintf(stderr, "Failed to init reader\n");
         return -1;
     }
 
     rc = hdr_log_read_header(&reader, f);
+    hdr_log_reader_close(&reader);
     if(rc)
     {
         fprintf(stderr, "Failed to read header: %s\n", hdr_strerror(rc));
         return -1;
     }
 
-    while (true)
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.options = &options;
+    pipeline.file = f;
+    pipeline.slot_count = options.workers * 2 + 1;
+    pipeline.slots = (struct slot*) calloc((size_t) pipeline.slot_count, sizeof(struct slot));
+    if (NULL == pipeline.slots || 0 != hdr_mutex_init(&pipeline.mutex))
     {
-        rc = hdr_log_read(&reader, f, &h, &timestamp, &interval);
+        fprintf(stderr, "Failed to init pipeline\n");
+        return -1;
+    }
 
-        if (0 == rc)
-        {
-            hdr_percentiles_print(h, stdout, 5, 1.0, CLASSIC);
-        }
-        else if (EOF == rc)
-        {
-            break;
-        }
-        else
+    hdr_thread_create(&reader_thread, read_batches, &pipeline);
+    for (i = 0; i < options.workers; i++)
+    {
+        hdr_thread_create(&workers[i], decode_batches, &pipeline);
+    }
+
+    rc = write_results(&pipeline);
+
+    hdr_mutex_lock(&pipeline.mutex);
+    pipeline.stopping = true;
+    hdr_mutex_unlock(&pipeline.mutex);
+
+    hdr_thread_join(&reader_thread);
+    for (i = 0; i < options.workers; i++)
+    {
+        hdr_thread_join(&workers[i]);
+    }
+
+    for (i = 0; i < pipeline.slot_count; i++)
+    {
+        size_t j;
+        for (j = 0; j < pipeline.slots[i].results_len; j++)
         {
-            fprintf(stderr, "Failed to print histogram: %s\n", hdr_strerror(rc));
-            return -1;
+            hdr_close(pipeline.slots[i].results[j].histogram);
         }
+        free(pipeline.slots[i].lines);
+        free(pipeline.slots[i].results);
+    }
+    free(pipeline.slots);
+    hdr_mutex_destroy(&pipeline.mutex);
+
+    if (stdin != f)
+    {
+        fclose(f);
+    }
+
+    if (rc)
+    {
+        fprintf(stderr, "Failed to print histogram: %s\n", hdr_strerror(rc));
+        return -1;
     }
 
     return 0;
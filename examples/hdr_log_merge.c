@@ -0,0 +1,133 @@
+/**
+ * hdr_log_merge.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_log_merge.h>
+
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4996)
+#endif
+
+static void usage(const char* name)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-i interval_seconds] [-t threads] [-b buckets_per_round] [-o output] input...\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    struct hdr_log_merge_options options;
+    FILE** inputs = NULL;
+    FILE* output = stdout;
+    int64_t dropped = 0;
+    int input_count = 0;
+    int rc = 0;
+    int i;
+
+    hdr_log_merge_options_init(&options);
+
+    inputs = (FILE**) calloc((size_t) argc, sizeof(FILE*));
+    if (NULL == inputs)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (0 == strcmp("-i", arg) && has_value)
+        {
+            const char* seconds = argv[++i];
+            if (hdr_timespec_parse(&options.interval, seconds, strlen(seconds)) != strlen(seconds))
+            {
+                usage(argv[0]);
+                rc = -1;
+                goto cleanup;
+            }
+        }
+        else if (0 == strcmp("-t", arg) && has_value)
+        {
+            options.threads = atoi(argv[++i]);
+        }
+        else if (0 == strcmp("-b", arg) && has_value)
+        {
+            options.buckets_per_round = atoi(argv[++i]);
+        }
+        else if (0 == strcmp("-o", arg) && has_value)
+        {
+            if ((output = fopen(argv[++i], "w")) == NULL)
+            {
+                fprintf(stderr, "Failed to open file(%s):%s\n", argv[i], strerror(errno));
+                rc = -1;
+                goto cleanup;
+            }
+        }
+        else if ('-' == arg[0])
+        {
+            usage(argv[0]);
+            rc = -1;
+            goto cleanup;
+        }
+        else
+        {
+            if ((inputs[input_count] = fopen(arg, "r")) == NULL)
+            {
+                fprintf(stderr, "Failed to open file(%s):%s\n", arg, strerror(errno));
+                rc = -1;
+                goto cleanup;
+            }
+            input_count++;
+        }
+    }
+
+    if (0 == input_count)
+    {
+        usage(argv[0]);
+        rc = -1;
+        goto cleanup;
+    }
+
+    if ((rc = hdr_log_merge(inputs, (size_t) input_count, output, &options, &dropped)) != 0)
+    {
+        fprintf(stderr, "Failed to merge logs: %s\n", hdr_strerror(rc));
+        rc = -1;
+    }
+    if (0 != dropped)
+    {
+        fprintf(stderr, "Dropped %" PRId64 " values outside the merged histograms' range\n", dropped);
+    }
+
+cleanup:
+    for (i = 0; i < input_count; i++)
+    {
+        fclose(inputs[i]);
+    }
+    free(inputs);
+    if (stdout != output && NULL != output)
+    {
+        fclose(output);
+    }
+
+    return rc;
+}
+
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
@@ -0,0 +1,172 @@
+/**
+ * hdr_binary_log.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A binary companion to the text histogram log.  Each record holds the same
+ * compressed V2 histogram payload as a text log line, but unencoded and with
+ * a fixed size, big endian record header in place of the CSV prefix.  When the
+ * writer is closed a zero length end-of-records marker is written, followed
+ * by an index of record start timestamps and file offsets as a footer,
+ * allowing a reader to seek straight to a point in time.  A reader that
+ * cannot seek, e.g. on a pipe, stops at the marker.
+ *
+ * File layout:
+ *
+ *     header:  magic "HDRB", version, start timestamp
+ *     records: length, start timestamp, interval, max, tag length, tag, payload
+ *     footer:  zero length, index entries, index offset, index entry count, magic "HDRI"
+ *
+ * Like hdr_histogram_log.h this requires zlib.
+ */
+
+#ifndef HDR_BINARY_LOG_H
+#define HDR_BINARY_LOG_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <hdr/hdr_time.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+
+#define HDR_BINARY_LOG_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hdr_binary_log_index_entry
+{
+    hdr_timespec start_timestamp;
+    int64_t offset;
+};
+
+struct hdr_binary_log_writer
+{
+    FILE* file;
+    struct hdr_log_encoder* encoder;
+    uint8_t* record;
+    size_t record_capacity;
+    struct hdr_binary_log_index_entry* index;
+    size_t index_len;
+    size_t index_capacity;
+    int64_t offset;
+};
+
+/**
+ * Initialise the writer and write the file header.
+ *
+ * @param writer 'This' pointer
+ * @param file The stream to write to, opened in binary mode.
+ * @param start_timestamp The time that the log started, may be NULL.
+ * @return 0 on success, ENOMEM, HDR_DEFLATE_INIT_FAIL or EIO on failure.
+ */
+int hdr_binary_log_writer_init(
+    struct hdr_binary_log_writer* writer, FILE* file, const hdr_timespec* start_timestamp);
+
+/**
+ * Append a histogram to the log.  The tag in the entry is optional, the max
+ * in the entry is ignored and taken from the histogram.
+ *
+ * @param writer 'This' pointer
+ * @param entry The start timestamp, interval and tag for the record.
+ * @param histogram The histogram to write.
+ * @return 0 on success, EINVAL if the tag is too long, ENOMEM,
+ * HDR_DEFLATE_FAIL or EIO on failure.
+ */
+int hdr_binary_log_write(
+    struct hdr_binary_log_writer* writer,
+    const struct hdr_log_entry* entry,
+    const struct hdr_histogram* histogram);
+
+/**
+ * Write the end-of-records marker and the index footer, then free the
+ * writer's resources.  The file is not closed.  A log that is never closed
+ * can still be read sequentially up to its last complete record.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success, EIO if the footer could not be written.
+ */
+int hdr_binary_log_writer_close(struct hdr_binary_log_writer* writer);
+
+struct hdr_binary_log_reader
+{
+    FILE* file;
+    struct hdr_log_decoder* decoder;
+    uint8_t* record;
+    size_t record_capacity;
+    hdr_timespec start_timestamp;
+    struct hdr_binary_log_index_entry* index;
+    size_t index_len;
+    int64_t position;
+    int64_t records_end;
+};
+
+/**
+ * Initialise the reader, read the file header and, if the stream is seekable
+ * and the log was closed cleanly, load the index footer.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read from, opened in binary mode.
+ * @return 0 on success.  HDR_LOG_INVALID_VERSION if the file is not a
+ * binary log of a supported version, ENOMEM, HDR_INFLATE_INIT_FAIL or EIO on
+ * failure.
+ */
+int hdr_binary_log_reader_init(struct hdr_binary_log_reader* reader, FILE* file);
+
+/**
+ * Read the next record.  The histogram and entry are filled in as for
+ * hdr_log_read_entry, including the handling of the tag buffer.
+ *
+ * @param reader 'This' pointer
+ * @param entry Captures the timestamps, max and tag of the record.
+ * @param histogram Pointer to allocate a histogram to or add into.
+ * @return 0 on success, EOF (-1) when there are no more records, -EINVAL if
+ * a record is truncated or corrupt, or an error from decoding the histogram.
+ */
+int hdr_binary_log_read(
+    struct hdr_binary_log_reader* reader, struct hdr_log_entry* entry, struct hdr_histogram** histogram);
+
+/**
+ * Position the reader at the first record that starts at or after the
+ * timestamp, using the index footer.
+ *
+ * @param reader 'This' pointer
+ * @param timestamp The time to seek to.
+ * @return 0 on success, EOF (-1) if no record starts at or after timestamp,
+ * EINVAL if the log has no index, EIO if the seek failed.
+ */
+int hdr_binary_log_seek(struct hdr_binary_log_reader* reader, const hdr_timespec* timestamp);
+
+/**
+ * Free the reader's resources.  The file is not closed.
+ *
+ * @param reader 'This' pointer
+ */
+void hdr_binary_log_reader_close(struct hdr_binary_log_reader* reader);
+
+/**
+ * Convert a text histogram log into a binary log.
+ *
+ * @param text The text log to read.
+ * @param binary The stream to write the binary log to.
+ * @return 0 on success or an error from reading or writing.
+ */
+int hdr_binary_log_from_text(FILE* text, FILE* binary);
+
+/**
+ * Convert a binary log into a text histogram log.
+ *
+ * @param binary The binary log to read.
+ * @param text The stream to write the text log to.
+ * @return 0 on success or an error from reading or writing.
+ */
+int hdr_binary_log_to_text(FILE* binary, FILE* text);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
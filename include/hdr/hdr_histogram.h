@@ -14,6 +14,40 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+/**
+ * Flag for hdr_init_with_flags.  Allocates the histogram and its counts as a
+ * single block laid out so that min_value, max_value and total_count, the
+ * fields recording writes, share a cache line with nothing else and counts
+ * starts on a cache line boundary.  Recording threads updating them then no
+ * longer invalidate the lines holding the fields every recording thread reads
+ * to find and address a count.
+ */
+#define HDR_HISTOGRAM_CACHE_ALIGNED 0x1
+
+/**
+ * Flag for hdr_init_with_flags.  Recording does not maintain min_value and
+ * max_value, avoiding the compare and swap loops in atomic recording.  Instead
+ * an occupancy summary (one bit per 64 counts, stored after counts) is kept and
+ * hdr_min/hdr_max derive the values from the lowest and highest non-zero
+ * counts when called.  The min_value and max_value fields must not be read
+ * directly on a histogram created with this flag.
+ */
+#define HDR_HISTOGRAM_LAZY_MIN_MAX 0x2
+
+/**
+ * Flag for hdr_init_with_flags.  Recording also accumulates the exact sum and
+ * sum of squares of the recorded values as 128 bit integers (stored after
+ * counts), making hdr_mean and hdr_stddev constant time and free of bucket
+ * quantisation.  Counts added without their values, from a histogram without
+ * this flag, by an hdr_add that drops values, by hdr_record_values_at_index or
+ * by hdr_reset_internal_counters, contribute their median equivalent values
+ * instead.  The encoded form of such a histogram only carries the moments
+ * when encoded with HDR_LOG_ENCODE_MOMENTS.
+ */
+#define HDR_HISTOGRAM_MOMENTS 0x4
+
+#define HDR_HISTOGRAM_CACHE_LINE_SIZE 64
+
 struct hdr_histogram
 {
     int64_t lowest_discernible_value;
@@ -25,13 +59,17 @@ struct hdr_histogram
     int64_t sub_bucket_mask;
     int32_t sub_bucket_count;
     int32_t bucket_count;
-    int64_t min_value;
-    int64_t max_value;
     int32_t normalizing_index_offset;
-    double conversion_ratio;
     int32_t counts_len;
-    int64_t total_count;
+    double conversion_ratio;
     int64_t* counts;
+    uint32_t flags;
+    void* allocation;
+    /* Written by recording, kept last so that the cache aligned layout can */
+    /* give them a line of their own.                                      */
+    int64_t min_value;
+    int64_t max_value;
+    int64_t total_count;
 };
 
 #ifdef __cplusplus
@@ -64,6 +102,26 @@ int hdr_init(
     int significant_figures,
     struct hdr_histogram** result);
 
+/**
+ * Allocate the memory and initialise the hdr_histogram, as hdr_init, with
+ * additional layout options.
+ *
+ * @param lowest_discernible_value See hdr_init.
+ * @param highest_trackable_value See hdr_init.
+ * @param significant_figures See hdr_init.
+ * @param flags Zero or more of the HDR_HISTOGRAM_* flags or'd together, e.g.
+ * HDR_HISTOGRAM_CACHE_ALIGNED.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid or an
+ * unknown flag is set, ENOMEM if malloc failed.
+ */
+int hdr_init_with_flags(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    uint32_t flags,
+    struct hdr_histogram** result);
+
 /**
  * Free the memory and close the hdr_histogram.
  *
@@ -235,6 +293,77 @@ bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value,
  */
 int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from);
 
+/**
+ * Executor for hdr_add_many: calls task(task_arg, i) for every i from 0 to
+ * tasks - 1, possibly concurrently, and returns once all of them have
+ * completed.
+ */
+typedef void (*hdr_run_tasks_fn)(
+    void* pool, void (*task)(void* task_arg, int32_t i), void* task_arg, int32_t tasks);
+
+struct hdr_add_many_options
+{
+    /* Number of slices of the counts summed concurrently. */
+    int threads;
+    /* Runs the slices, NULL to start a thread for each. */
+    hdr_run_tasks_fn run_tasks;
+    /* Passed to run_tasks. */
+    void* pool;
+};
+
+/**
+ * Fill in the default options: a single thread and no executor.
+ *
+ * @param options The options to initialise.
+ */
+void hdr_add_many_options_init(struct hdr_add_many_options* options);
+
+/**
+ * Adds all of the values from each histogram in 'from' to 'h', as a series of
+ * hdr_add calls would.  Inputs with the same bucket layout as h are summed
+ * straight into it; other inputs sharing a layout are first summed into a
+ * histogram of their own layout, which is then added to h.  The counts of
+ * each sum are split into contiguous slices summed concurrently, each input
+ * being read only over its recorded range.  The inputs must not be modified
+ * during the call.
+ *
+ * @param h "This" pointer
+ * @param from Histograms to copy values from.
+ * @param from_len The number of histograms in from.
+ * @param options The number of threads or an executor, NULL for the defaults.
+ * @return The number of values dropped when copying.
+ */
+int64_t hdr_add_many(
+    struct hdr_histogram* h,
+    const struct hdr_histogram* const* from,
+    size_t from_len,
+    const struct hdr_add_many_options* options);
+
+/**
+ * Re-bucket a histogram into a new, usually coarser, configuration, e.g. to
+ * keep long term copies of 3 significant figure histograms at 2 significant
+ * figures.  The result has the same flags as h.  When the new configuration
+ * is no finer than that of h (no more significant figures and no smaller
+ * lowest_discernible_value), each of its buckets covers a contiguous run of
+ * counts in h, which is summed directly rather than recorded value by value;
+ * hdr_add takes the same path for such histograms.  Values above
+ * highest_trackable_value are dropped.
+ *
+ * @param h The histogram to downsample.
+ * @param lowest_discernible_value The lowest discernible value of the result.
+ * @param highest_trackable_value The highest trackable value of the result.
+ * @param significant_figures The significant figures of the result.
+ * @param result Output parameter which will be updated with the allocated histogram.
+ * @return 0 on success, EINVAL if the configuration is invalid or ENOMEM if
+ * the allocation fails.
+ */
+int hdr_downsample(
+    const struct hdr_histogram* h,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_histogram** result);
+
 /**
  * Adds all of the values from 'from' to 'this' histogram.  Will return the
  * number of values that are dropped when copying.  Values will be dropped
@@ -285,7 +414,8 @@ int64_t hdr_value_at_percentile(const struct hdr_histogram* h, double percentile
 int hdr_value_at_percentiles(const struct hdr_histogram *h, const double *percentiles, int64_t *values, size_t length);
 
 /**
- * Gets the standard deviation for the values in the histogram.
+ * Gets the standard deviation for the values in the histogram.  Exact and
+ * constant time for histograms created with HDR_HISTOGRAM_MOMENTS.
  *
  * @param h "This" pointer
  * @return The standard deviation
@@ -293,7 +423,8 @@ int hdr_value_at_percentiles(const struct hdr_histogram *h, const double *percen
 double hdr_stddev(const struct hdr_histogram* h);
 
 /**
- * Gets the mean for the values in the histogram.
+ * Gets the mean for the values in the histogram.  Exact and constant time for
+ * histograms created with HDR_HISTOGRAM_MOMENTS.
  *
  * @param h "This" pointer
  * @return The mean
@@ -336,6 +467,42 @@ int64_t hdr_count_at_value(const struct hdr_histogram* h, int64_t value);
 
 int64_t hdr_count_at_index(const struct hdr_histogram* h, int32_t index);
 
+/**
+ * Get the count of recorded values between two values (to within the
+ * histogram resolution at each end).
+ *
+ * @param h "This" pointer
+ * @param lowest_value The lower bound of the range
+ * @param highest_value The upper bound of the range
+ * @return The total count of values recorded in the histogram within the value range that is
+ * {@literal >=} lowestEquivalentValue(<i>lowest_value</i>) and {@literal <=} highestEquivalentValue(<i>highest_value</i>)
+ */
+int64_t hdr_count_between_values(const struct hdr_histogram* h, int64_t lowest_value, int64_t highest_value);
+
+/**
+ * Get the count of recorded values at or below a value (to within the
+ * histogram resolution at the value level).  Only the buckets on the shorter
+ * side of the value are scanned, counting down from the total when the
+ * value is nearer the max.
+ *
+ * @param h "This" pointer
+ * @param value The upper bound
+ * @return The total count of values recorded in the histogram that are
+ * {@literal <=} highestEquivalentValue(<i>value</i>)
+ */
+int64_t hdr_count_le_value(const struct hdr_histogram* h, int64_t value);
+
+/**
+ * Get the percentage of recorded values at or below a value (to within the
+ * histogram resolution at the value level), the inverse of
+ * hdr_value_at_percentile.  An empty histogram reports 100.
+ *
+ * @param h "This" pointer
+ * @param value The upper bound
+ * @return The percentile, from 0 to 100, of the given value
+ */
+double hdr_percentile_at_or_below_value(const struct hdr_histogram* h, int64_t value);
+
 int64_t hdr_value_at_index(const struct hdr_histogram* h, int32_t index);
 
 struct hdr_iter_percentiles
@@ -402,7 +569,8 @@ struct hdr_iter
         struct hdr_iter_log log;
     } specifics;
 
-    bool (* _next_fp)(struct hdr_iter* iter);
+    /** the kind of iteration hdr_iter_next performs, set by the initialiser */
+    int32_t _type;
 
 };
 
@@ -450,10 +618,51 @@ void hdr_iter_log_init(
  */
 bool hdr_iter_next(struct hdr_iter* iter);
 
+/**
+ * A range of values and the count recorded within it, as filled in by the
+ * batch iteration functions below.
+ */
+struct hdr_iter_run
+{
+    int64_t lowest_value;
+    int64_t highest_value;
+    int64_t count;
+};
+
+/**
+ * Fill runs with the next non-zero buckets of an iterator initialised with
+ * hdr_iter_recorded_init, one (lowest equivalent value, highest equivalent
+ * value, count) triple per bucket.  Call repeatedly until it returns 0.
+ * Saves a call through hdr_iter_next for every bucket when exporting a
+ * histogram.  The iterator's fields are left describing the last bucket
+ * written, so this may be mixed with hdr_iter_next.
+ *
+ * @param iter 'This' pointer
+ * @param runs The buffer to fill
+ * @param runs_len The capacity of runs
+ * @return The number of runs written, 0 once iteration is complete.
+ */
+size_t hdr_iter_recorded_runs(struct hdr_iter* iter, struct hdr_iter_run* runs, size_t runs_len);
+
+/**
+ * Fill runs with the next exponentially sized buckets of an iterator
+ * initialised with hdr_iter_log_init, including empty ones.  Each run holds
+ * the previous and current reporting levels (value_iterated_from and
+ * value_iterated_to) and the count added in that step, ready to be used as
+ * exponential bucket boundaries.  Call repeatedly until it returns 0.
+ *
+ * @param iter 'This' pointer
+ * @param runs The buffer to fill
+ * @param runs_len The capacity of runs
+ * @return The number of runs written, 0 once iteration is complete.
+ */
+size_t hdr_iter_log_runs(struct hdr_iter* iter, struct hdr_iter_run* runs, size_t runs_len);
+
 typedef enum
 {
     CLASSIC,
-    CSV
+    CSV,
+    JSON
 } format_type;
 
 /**
@@ -464,7 +673,8 @@ typedef enum
  * @param stream The FILE to write the output to
  * @param ticks_per_half_distance The number of iteration steps per half-distance to 100%
  * @param value_scale Scale the output values by this amount
- * @param format_type Format to use, e.g. CSV.
+ * @param format_type Format to use, e.g. CSV.  JSON writes a single object
+ * holding a "percentiles" array along with the summary statistics.
  * @return 0 on success, error code on failure.  EIO if an error occurs writing
  * the output.
  */
@@ -509,6 +719,33 @@ int64_t hdr_median_equivalent_value(const struct hdr_histogram* h, int64_t value
  */
 void hdr_reset_internal_counters(struct hdr_histogram* h);
 
+/**
+ * Add count to the counts at index, which must be a valid index for h, as if
+ * hdr_value_at_index(h, index) had been recorded count times.  Used by the
+ * logging code to accumulate decoded counts without an intermediate histogram.
+ */
+void hdr_record_values_at_index(struct hdr_histogram* h, int32_t index, int64_t count);
+
+/**
+ * The moments of a histogram created with HDR_HISTOGRAM_MOMENTS, NULL for any
+ * other histogram: the sum then the sum of squares of the recorded values, each
+ * a 128 bit two's complement integer held as two words, low word first.  Used
+ * by the logging code to carry the moments through the encoded form.
+ */
+const int64_t* hdr_moments(const struct hdr_histogram* h);
+
+/**
+ * Replace the moments of a histogram created with HDR_HISTOGRAM_MOMENTS with
+ * moments in the layout returned by hdr_moments.
+ */
+void hdr_set_moments(struct hdr_histogram* h, const int64_t* moments);
+
+/**
+ * Add moments in the layout returned by hdr_moments to those of a histogram
+ * created with HDR_HISTOGRAM_MOMENTS.
+ */
+void hdr_add_moments(struct hdr_histogram* h, const int64_t* moments);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,9 +23,19 @@
 
 #define HDR_LOG_TAG_MAX_BUFFER_LEN (1024)
 
+/**
+ * Flag for hdr_log_encoder_init_with_flags.  Histograms created with
+ * HDR_HISTOGRAM_MOMENTS are encoded with their moments in a trailer after the
+ * counts, which hdr_log_decode restores.  Decoders that do not know the
+ * trailer, including older versions of this library, fail on such an encoding
+ * with HDR_INFLATE_FAIL, so it is only for logs read by this version or later.
+ */
+#define HDR_LOG_ENCODE_MOMENTS 0x1
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stddef.h>
 
 #include <hdr/hdr_time.h>
 #include <hdr/hdr_histogram.h>
@@ -40,10 +50,174 @@ extern "C" {
 int hdr_log_encode(struct hdr_histogram* histogram, char** encoded_histogram);
 
 /**
- * Decode and decompress the histogram with gzip.
+ * Decode and decompress the histogram with gzip.  If *histogram is NULL a new
+ * histogram is allocated for the caller, otherwise the decoded counts are
+ * added directly into *histogram.  Counts are added in place when the
+ * encoded histogram has the same bucket layout, otherwise each value is
+ * re-recorded into *histogram; values outside its range are dropped.
  */
 int hdr_log_decode(struct hdr_histogram** histogram, char* base64_histogram, size_t base64_len);
 
+/**
+ * Reusable compression state for encoding histograms.  Holds a zlib deflate
+ * stream and a small scratch buffer, so that once the first histogram has been
+ * encoded, encoding into a caller supplied buffer does not allocate.  An
+ * encoder must not be shared between threads without external locking.
+ */
+struct hdr_log_encoder;
+
+/**
+ * Receives the compressed bytes of an encoded histogram.
+ *
+ * @param sink_arg The argument passed along with the sink.
+ * @param data The compressed histogram.
+ * @param len The number of bytes in data.
+ * @return 0 on success, otherwise an error that is returned to the caller.
+ */
+typedef int (*hdr_log_sink_fn)(void* sink_arg, const uint8_t* data, size_t len);
+
+/**
+ * Allocate and initialise an encoder.
+ *
+ * @param encoder Output parameter to capture the encoder.
+ * @return 0 on success, ENOMEM or HDR_DEFLATE_INIT_FAIL on failure.
+ */
+int hdr_log_encoder_init(struct hdr_log_encoder** encoder);
+
+/**
+ * Allocate and initialise an encoder, as hdr_log_encoder_init, with encoding
+ * options.  Without flags the encoding is the same as hdr_log_encode's.
+ *
+ * @param encoder Output parameter to capture the encoder.
+ * @param flags Zero or more of the HDR_LOG_ENCODE_* flags or'd together.
+ * @return 0 on success, EINVAL if an unknown flag is set, ENOMEM or
+ * HDR_DEFLATE_INIT_FAIL on failure.
+ */
+int hdr_log_encoder_init_with_flags(struct hdr_log_encoder** encoder, uint32_t flags);
+
+/**
+ * Free the encoder and its compression state.
+ */
+void hdr_log_encoder_close(struct hdr_log_encoder* encoder);
+
+/**
+ * Gets an upper bound on the compressed size of the histogram, suitable for
+ * sizing the buffer passed to hdr_log_encode_compressed_into.
+ */
+size_t hdr_log_encoder_bound(const struct hdr_histogram* h);
+
+/**
+ * Gets an upper bound on the compressed size of any histogram, whatever its
+ * configuration, e.g. to reject an implausible length read from a file.
+ */
+size_t hdr_log_encoder_max_bound(void);
+
+/**
+ * Encode and compress the histogram into the supplied buffer.  The counts are
+ * encoded in small chunks and streamed through the encoder's deflate state,
+ * without an intermediate buffer for the whole encoded histogram.
+ *
+ * @param encoder The encoder to use.
+ * @param h The histogram to encode.
+ * @param buffer The buffer to write the compressed histogram to.
+ * @param buffer_len The size of the buffer.
+ * @param compressed_len Output parameter to capture the compressed length.
+ * @return 0 on success.  ENOBUFS if the buffer is too small, HDR_DEFLATE_FAIL
+ * if compression fails.
+ */
+int hdr_log_encode_compressed_into(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    uint8_t* buffer,
+    size_t buffer_len,
+    size_t* compressed_len);
+
+/**
+ * Encode and compress the histogram, passing the result to the sink.  The
+ * compressed format is prefixed with its length, so the output is collected
+ * in a buffer owned by the encoder, which only grows when a larger histogram
+ * is encoded, before being handed to the sink in a single call.
+ *
+ * @param encoder The encoder to use.
+ * @param h The histogram to encode.
+ * @param sink The callback to receive the compressed histogram.
+ * @param sink_arg The argument passed to the sink.
+ * @return 0 on success, ENOMEM, HDR_DEFLATE_FAIL or the error returned by
+ * the sink on failure.
+ */
+int hdr_log_encode_compressed_to_sink(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    hdr_log_sink_fn sink,
+    void* sink_arg);
+
+/**
+ * Encode and compress the histogram using the encoder's reusable state and
+ * base64 buffer.  The returned string is NUL terminated, owned by the encoder
+ * and valid until the next call that uses the encoder.
+ *
+ * @param encoder The encoder to use.
+ * @param h The histogram to encode.
+ * @param encoded_histogram Output parameter to capture the base64 string.
+ * @param encoded_len Output parameter to capture the length of the string.
+ * @return 0 on success, ENOMEM or HDR_DEFLATE_FAIL on failure.
+ */
+int hdr_log_encode_with(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    const char** encoded_histogram,
+    size_t* encoded_len);
+
+/**
+ * Reusable decompression state for decoding histograms.  Holds a zlib inflate
+ * stream and the scratch buffers used while decoding, which only grow.  A
+ * decoder must not be shared between threads without external locking.
+ */
+struct hdr_log_decoder;
+
+/**
+ * Allocate and initialise a decoder.
+ *
+ * @param decoder Output parameter to capture the decoder.
+ * @return 0 on success, ENOMEM or HDR_INFLATE_INIT_FAIL on failure.
+ */
+int hdr_log_decoder_init(struct hdr_log_decoder** decoder);
+
+/**
+ * Free the decoder and its decompression state.
+ */
+void hdr_log_decoder_close(struct hdr_log_decoder* decoder);
+
+/**
+ * Get the total count of values the decoder has dropped, since it was
+ * initialised, because they were outside the range of a histogram that
+ * they were decoded into.
+ *
+ * @param decoder The decoder.
+ * @return The count of dropped values.
+ */
+int64_t hdr_log_decoder_dropped(const struct hdr_log_decoder* decoder);
+
+/**
+ * Decode and decompress a compressed histogram using the decoder's reusable
+ * state.  *histogram is allocated or added into as for hdr_log_decode.
+ *
+ * @param decoder The decoder to use.
+ * @param buffer The compressed histogram.
+ * @param length The length of the compressed histogram.
+ * @param histogram Pointer to allocate a histogram to or add into.
+ * @return 0 on success or an error number as for hdr_log_decode.
+ */
+int hdr_log_decode_compressed_from(
+    struct hdr_log_decoder* decoder, uint8_t* buffer, size_t length, struct hdr_histogram** histogram);
+
+/**
+ * Decode and decompress a base64 encoded histogram using the decoder's
+ * reusable state, see hdr_log_decode.
+ */
+int hdr_log_decode_with(
+    struct hdr_log_decoder* decoder, struct hdr_histogram** histogram, const char* base64_histogram, size_t base64_len);
+
 struct hdr_log_entry
 {
     hdr_timespec start_timestamp;
@@ -56,16 +230,34 @@ struct hdr_log_entry
 struct hdr_log_writer
 {
     uint32_t nonce;
+    struct hdr_log_encoder* encoder;
 };
 
 /**
- * Initialise the log writer.
+ * Initialise the log writer.  Allocates nothing, so each entry written sets
+ * up and tears down its own encoder.
  *
  * @param writer 'This' pointer
  * @return 0 on success.
  */
 int hdr_log_writer_init(struct hdr_log_writer* writer);
 
+/**
+ * Initialise the log writer with an encoder that is reused for every entry
+ * written.  The encoder must be released with hdr_log_writer_close.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success, ENOMEM or HDR_DEFLATE_INIT_FAIL on failure.
+ */
+int hdr_log_writer_init_with_encoder(struct hdr_log_writer* writer);
+
+/**
+ * Free the resources held by the log writer, if any.
+ *
+ * @param writer 'This' pointer
+ */
+void hdr_log_writer_close(struct hdr_log_writer* writer);
+
 /**
  * Write the header to the log, this will constist of a user defined string,
  * the current timestamp, version information and the CSV header.
@@ -140,21 +332,127 @@ int hdr_log_write_entry(
     struct hdr_log_entry* entry,
     struct hdr_histogram* histogram);
 
+/**
+ * Formats log lines into a reusable in-memory buffer and hands the buffer to
+ * a sink in a single call once it reaches a threshold, or when flushed.  The
+ * lines written are the same as those of hdr_log_write_header and
+ * hdr_log_write_entry.
+ */
+struct hdr_log_buffered_writer
+{
+    struct hdr_log_encoder* encoder;
+    uint8_t* buffer;
+    size_t len;
+    size_t capacity;
+    size_t flush_threshold;
+    hdr_log_sink_fn sink;
+    void* sink_arg;
+};
+
+/**
+ * Initialise a buffered writer that flushes to a callback.
+ *
+ * @param writer 'This' pointer
+ * @param sink The callback to receive the formatted lines.
+ * @param sink_arg The argument passed to the sink.
+ * @param flush_threshold Flush once the buffer holds at least this many bytes,
+ * 0 to flush only when hdr_log_buffered_writer_flush is called.
+ * @return 0 on success, ENOMEM or HDR_DEFLATE_INIT_FAIL on failure.
+ */
+int hdr_log_buffered_writer_init(
+    struct hdr_log_buffered_writer* writer, hdr_log_sink_fn sink, void* sink_arg, size_t flush_threshold);
+
+/**
+ * Initialise a buffered writer that flushes to a stream with one fwrite.
+ *
+ * @see hdr_log_buffered_writer_init
+ */
+int hdr_log_buffered_writer_init_file(struct hdr_log_buffered_writer* writer, FILE* file, size_t flush_threshold);
+
+/**
+ * Initialise a buffered writer that flushes directly to a file descriptor,
+ * bypassing stdio.
+ *
+ * @see hdr_log_buffered_writer_init
+ */
+int hdr_log_buffered_writer_init_fd(struct hdr_log_buffered_writer* writer, int fd, size_t flush_threshold);
+
+/**
+ * Append the log header, as for hdr_log_write_header.
+ *
+ * @param writer 'This' pointer
+ * @param user_prefix User defined string to include in the header, may be NULL.
+ * @param timestamp The start time of the log, may be NULL.
+ * @return 0 on success, ENOMEM, EIO or an error from the sink on failure.
+ */
+int hdr_log_buffered_write_header(
+    struct hdr_log_buffered_writer* writer, const char* user_prefix, const hdr_timespec* timestamp);
+
+/**
+ * Append an entry, as for hdr_log_write_entry.
+ *
+ * @param writer 'This' pointer
+ * @param entry Prefix information for the log line, including timestamps and tag.
+ * @param histogram The histogram to encode and log.
+ * @return 0 on success, ENOMEM, HDR_DEFLATE_FAIL or an error from the sink
+ * on failure.
+ */
+int hdr_log_buffered_write_entry(
+    struct hdr_log_buffered_writer* writer,
+    const struct hdr_log_entry* entry,
+    const struct hdr_histogram* histogram);
+
+/**
+ * Hand everything buffered to the sink.  If the sink fails the lines are kept
+ * to be retried by the next flush.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success or the error from the sink.
+ */
+int hdr_log_buffered_writer_flush(struct hdr_log_buffered_writer* writer);
+
+/**
+ * Flush the writer and free its resources.  The file or descriptor is not
+ * closed.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success or the error from the final flush.
+ */
+int hdr_log_buffered_writer_close(struct hdr_log_buffered_writer* writer);
+
 struct hdr_log_reader
 {
     int major_version;
     int minor_version;
     hdr_timespec start_timestamp;
+    struct hdr_log_decoder* decoder;
 };
 
 /**
- * Initialise the log reader.
+ * Initialise the log reader.  Allocates nothing, so each entry read sets up
+ * and tears down its own decoder.
  *
  * @param reader 'This' pointer
- * @return 0 on success
+ * @return 0 on success.
  */
 int hdr_log_reader_init(struct hdr_log_reader* reader);
 
+/**
+ * Initialise the log reader with a decoder that is reused for every entry
+ * read.  The decoder must be released with hdr_log_reader_close.
+ *
+ * @param reader 'This' pointer
+ * @return 0 on success, ENOMEM or HDR_INFLATE_INIT_FAIL on failure.
+ */
+int hdr_log_reader_init_with_decoder(struct hdr_log_reader* reader);
+
+/**
+ * Free the resources held by the log reader, if any.
+ *
+ * @param reader 'This' pointer
+ */
+void hdr_log_reader_close(struct hdr_log_reader* reader);
+
 /**
  * Reads the the header information from the log.  Will capure information
  * such as version number and start timestamp from the header.
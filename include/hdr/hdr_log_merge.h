@@ -0,0 +1,83 @@
+/**
+ * hdr_log_merge.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Merges many histogram logs, e.g. one per host, into a single log whose
+ * entries cover common, fixed width time buckets.  Inputs are read and merged
+ * concurrently by a pool of worker threads.  Memory use is bounded by the
+ * number of buckets processed per round, not by the length of the logs.
+ *
+ * Like hdr_histogram_log.h this requires zlib.
+ */
+
+#ifndef HDR_LOG_MERGE_H
+#define HDR_LOG_MERGE_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <hdr/hdr_time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hdr_log_merge_options
+{
+    /* Configuration of the merged histograms. */
+    int64_t lowest_discernible_value;
+    int64_t highest_trackable_value;
+    int significant_figures;
+    /* Width of each output time bucket. */
+    hdr_timespec interval;
+    /* Number of worker threads. */
+    int threads;
+    /* Buckets merged per round, each worker holds one histogram per bucket. */
+    int buckets_per_round;
+};
+
+/**
+ * Fill in the default options: histograms of 1 to 24 hours in microseconds
+ * with 3 significant figures, 1 second buckets, 4 threads and 64 buckets
+ * per round.
+ *
+ * @param options The options to initialise.
+ */
+void hdr_log_merge_options_init(struct hdr_log_merge_options* options);
+
+/**
+ * Merge the entries of a number of histogram logs into a single log.
+ *
+ * The absolute start time of each entry is its start timestamp, or if that is
+ * earlier than the StartTime of its log, its start timestamp as an offset
+ * from the log's StartTime.  Each entry is added to the output bucket that
+ * contains its absolute start time.  Buckets are counted from the earliest
+ * entry of all the inputs, which becomes the StartTime of the output log.
+ * Entries of each input must be in start time order; an entry that arrives
+ * after its bucket has been written is added to the earliest open bucket.
+ * Tags are ignored, every entry is merged.  Empty buckets are not written.
+ * Values outside the range of the merged histograms are dropped and counted.
+ *
+ * @param inputs The logs to read.
+ * @param input_count The number of logs.
+ * @param output The stream to write the merged log to.
+ * @param options The merge options, NULL for the defaults.
+ * @param dropped Set to the count of dropped values, even on failure, may be
+ * NULL.
+ * @return 0 on success, EINVAL if the options are invalid, ENOMEM, or an
+ * error from reading or writing a log.
+ */
+int hdr_log_merge(
+    FILE* const* inputs,
+    size_t input_count,
+    FILE* output,
+    const struct hdr_log_merge_options* options,
+    int64_t* dropped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
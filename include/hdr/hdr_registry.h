@@ -0,0 +1,157 @@
+/**
+ * hdr_registry.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A set of interval recorders, one per series, keyed by a label string such
+ * as "endpoint=/users;method=GET".  Looking up a series is lock-free, so it is
+ * safe from any number of recording threads, while creating one takes a lock.
+ * Series live until the registry is destroyed, which is what lets readers walk
+ * the table without any reclamation scheme.
+ *
+ * Once per interval a single thread calls hdr_registry_sample to sample every
+ * series, then hdr_registry_write to log them, each entry tagged with its
+ * series' labels.
+ */
+
+#ifndef HDR_REGISTRY_H
+#define HDR_REGISTRY_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <hdr/hdr_thread.h>
+#include <hdr/hdr_interval_recorder.h>
+#include <hdr/hdr_histogram_log.h>
+
+struct hdr_registry_series
+{
+    /* The next series in the same bucket, fixed once published. */
+    struct hdr_registry_series* next;
+    /* The next series created, set once when that series is published. */
+    struct hdr_registry_series* next_created;
+    uint64_t hash;
+    const char* labels;
+    size_t labels_len;
+    struct hdr_interval_recorder recorder;
+    /* Whether recorder.inactive holds the latest interval's values. */
+    bool sampled;
+};
+
+struct hdr_registry
+{
+    struct hdr_registry_series** buckets;
+    uint64_t bucket_mask;
+    struct hdr_registry_series* first;
+    struct hdr_registry_series* last;
+    int64_t series_count;
+    hdr_mutex* create_mutex;
+    int64_t lowest_discernible_value;
+    int64_t highest_trackable_value;
+    int significant_figures;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise the registry.  Every series records into histograms with the
+ * given configuration.
+ *
+ * @param r 'This' pointer
+ * @param lowest_discernible_value The smallest possible value that is distinguishable from 0.
+ * @param highest_trackable_value The largest possible value to be put into the histograms.
+ * @param significant_figures The level of precision for the histograms.
+ * @param expected_series The number of series the lookup table is sized for.
+ * Lookups get slower beyond it, as the table does not grow.
+ * @return 0 on success, EINVAL if the histogram configuration is invalid,
+ * ENOMEM if allocation failed.
+ */
+int hdr_registry_init(
+    struct hdr_registry* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    size_t expected_series);
+
+/**
+ * Destroy every series and free the registry's resources.  No recorder
+ * returned by the registry may be used afterwards.
+ *
+ * @param r 'This' pointer
+ */
+void hdr_registry_destroy(struct hdr_registry* r);
+
+/**
+ * Find the recorder for a series without creating it.  Lock-free.
+ *
+ * @param r 'This' pointer
+ * @param labels The series' labels.
+ * @param labels_len The length of labels.
+ * @return The recorder or NULL if there is no such series.
+ */
+struct hdr_interval_recorder* hdr_registry_find(
+    struct hdr_registry* r, const char* labels, size_t labels_len);
+
+/**
+ * Find the recorder for a series, creating the series if it does not exist.
+ * Lock-free when the series exists.  Callers recording often should keep the
+ * returned recorder rather than looking it up for every value.
+ *
+ * @param r 'This' pointer
+ * @param labels The series' labels, written to the log as the entries' tag,
+ * so they must not be empty or contain ',' or whitespace.
+ * @param labels_len The length of labels.
+ * @param result Output parameter for the series' recorder.
+ * @return 0 on success, EINVAL if the labels are invalid, ENOMEM if allocation
+ * failed.
+ */
+int hdr_registry_recorder(
+    struct hdr_registry* r, const char* labels, size_t labels_len, struct hdr_interval_recorder** result);
+
+/**
+ * @param r 'This' pointer
+ * @return The number of series created.
+ */
+int64_t hdr_registry_series_count(struct hdr_registry* r);
+
+/**
+ * Sample every series with hdr_interval_recorder_sample_and_recycle, keeping
+ * the previous interval's histogram of each series for recycling.  Series
+ * with nothing recorded since the last sample are skipped without flipping
+ * their recorder, so idle series cost a single read.  Must not be called
+ * concurrently with itself, hdr_registry_write or hdr_registry_destroy.
+ *
+ * @param r 'This' pointer
+ * @return The number of series with values in the interval.
+ */
+int64_t hdr_registry_sample(struct hdr_registry* r);
+
+/**
+ * Write an entry tagged with its labels for every series that had values in
+ * the interval taken by the last hdr_registry_sample, in the order the series
+ * were created.  The same restrictions as hdr_registry_sample apply.
+ *
+ * @param r 'This' pointer
+ * @param writer The log writer, initialise it with hdr_log_writer_init_with_encoder
+ * to reuse one encoder for every entry.
+ * @param file The file to write to.
+ * @param start_timestamp The start of the interval.
+ * @param interval The length of the interval.
+ * @return 0 on success or the first error from hdr_log_write_entry.
+ */
+int hdr_registry_write(
+    struct hdr_registry* r,
+    struct hdr_log_writer* writer,
+    FILE* file,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* interval);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/**
+ * hdr_sample_queue.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * An optional front-end for the interval recorder.  Each recording thread
+ * owns a single producer/single consumer ring of raw values, so recording a
+ * value is a plain store and a release of the write index.  The rings are
+ * drained, either explicitly or from a background thread, into the active
+ * histogram of an hdr_interval_recorder, which is then sampled as usual.
+ */
+
+#ifndef HDR_SAMPLE_QUEUE_H
+#define HDR_SAMPLE_QUEUE_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hdr/hdr_thread.h>
+#include <hdr/hdr_interval_recorder.h>
+
+#define HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE 64
+
+typedef enum
+{
+    /** Discard the new value when the producer's ring is full. */
+    HDR_SAMPLE_QUEUE_DROP,
+    /** Discard the oldest unread value to make room for the new value. */
+    HDR_SAMPLE_QUEUE_OVERWRITE,
+    /** Spin (yielding) until the drain makes room for the new value. */
+    HDR_SAMPLE_QUEUE_BLOCK
+} hdr_sample_queue_policy;
+
+/**
+ * The ring owned by a single recording thread.  The fields written by the
+ * producer and the field written by the drain live on separate cache lines.
+ */
+struct hdr_sample_queue_producer
+{
+    int64_t* buffer;
+    int64_t mask;
+    hdr_sample_queue_policy policy;
+    uint8_t _config_padding[HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE - 2 * sizeof(int64_t) - sizeof(hdr_sample_queue_policy)];
+
+    int64_t write_index;
+    int64_t cached_read_index;
+    int64_t dropped_count;
+    int64_t overwritten_count;
+    uint8_t _producer_padding[HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE - 4 * sizeof(int64_t)];
+
+    int64_t read_index;
+    uint8_t _consumer_padding[HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE - sizeof(int64_t)];
+};
+
+struct hdr_sample_queue
+{
+    struct hdr_interval_recorder* recorder;
+    struct hdr_sample_queue_producer* producers;
+    void* producers_allocation;
+    int64_t producers_acquired;
+    int32_t producer_count;
+    int64_t* drain_buffer;
+    int64_t drain_buffer_len;
+    hdr_mutex* drain_mutex;
+    hdr_thread drain_thread;
+    int64_t running;
+    unsigned int idle_sleep_us;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise the sample queue.
+ *
+ * @param q 'This' pointer
+ * @param recorder The recorder that values are drained into.  It must be
+ * initialised with a histogram and must not be written to other than through
+ * this queue while the queue is in use.
+ * @param producer_count The maximum number of producers that can be acquired.
+ * @param capacity The number of values each producer's ring can hold, rounded
+ * up to the next power of 2.
+ * @param policy What a producer does when its ring is full.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * allocation failed.
+ */
+int hdr_sample_queue_init(
+    struct hdr_sample_queue* q,
+    struct hdr_interval_recorder* recorder,
+    int32_t producer_count,
+    int64_t capacity,
+    hdr_sample_queue_policy policy);
+
+/**
+ * Stop the background drain if it is running and free the producer rings.
+ * The recorder is not destroyed.
+ *
+ * @param q 'This' pointer
+ */
+void hdr_sample_queue_destroy(struct hdr_sample_queue* q);
+
+/**
+ * Claim a producer ring for the calling thread.  The returned producer must
+ * only be used from a single thread.
+ *
+ * @param q 'This' pointer
+ * @return The producer or NULL if all of the producers have been acquired.
+ */
+struct hdr_sample_queue_producer* hdr_sample_queue_acquire_producer(struct hdr_sample_queue* q);
+
+/**
+ * Queue a value for recording.  The value is checked against the recorder's
+ * histogram when it is drained, not when it is queued.
+ *
+ * @param p The producer owned by the calling thread.
+ * @param value Value to record.
+ * @return false if the value was dropped because the ring was full, true
+ * otherwise.
+ */
+bool hdr_sample_queue_record_value(struct hdr_sample_queue_producer* p, int64_t value);
+
+/**
+ * Move all of the currently queued values into the recorder's active
+ * histogram.  Safe to call concurrently with the background drain.
+ *
+ * @param q 'This' pointer
+ * @return The number of values drained.
+ */
+int64_t hdr_sample_queue_drain(struct hdr_sample_queue* q);
+
+/**
+ * Drain the queue and then sample the recorder, see
+ * hdr_interval_recorder_sample_and_recycle.
+ *
+ * @param q 'This' pointer
+ * @param histogram_to_recycle
+ * @return the histogram that was previous being recorded to.
+ */
+struct hdr_histogram* hdr_sample_queue_sample_and_recycle(
+    struct hdr_sample_queue* q,
+    struct hdr_histogram* histogram_to_recycle);
+
+/**
+ * Start a background thread that continually drains the queue.
+ *
+ * @param q 'This' pointer
+ * @param idle_sleep_us How long the thread sleeps when it finds the queue empty.
+ * @return 0 on success, EINVAL if already running or an error from creating
+ * the thread.
+ */
+int hdr_sample_queue_start(struct hdr_sample_queue* q, unsigned int idle_sleep_us);
+
+/**
+ * Stop the background drain, waiting for it to finish a final drain.
+ *
+ * @param q 'This' pointer
+ */
+void hdr_sample_queue_stop(struct hdr_sample_queue* q);
+
+/**
+ * @param q 'This' pointer
+ * @return The total number of values dropped by all producers under
+ * HDR_SAMPLE_QUEUE_DROP.
+ */
+int64_t hdr_sample_queue_dropped_count(struct hdr_sample_queue* q);
+
+/**
+ * @param q 'This' pointer
+ * @return The total number of queued values discarded by all producers under
+ * HDR_SAMPLE_QUEUE_OVERWRITE.
+ */
+int64_t hdr_sample_queue_overwritten_count(struct hdr_sample_queue* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * hdr_self_instrumentation.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * When the library is built with HDR_HISTOGRAM_SELF_INSTRUMENTATION=ON a
+ * sample of the calls to some of its own operations are timed with
+ * hdr_gettime and recorded, in nanoseconds, into an internal histogram per
+ * operation.  This makes the cost of recording observable in a live system.
+ * Without the build option the operations are not timed and the functions
+ * below report that self instrumentation is unavailable.
+ */
+
+#ifndef HDR_SELF_INSTRUMENTATION_H
+#define HDR_SELF_INSTRUMENTATION_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hdr/hdr_histogram.h>
+
+typedef enum
+{
+    /** hdr_record_value */
+    HDR_SELF_RECORD_VALUE,
+    /** hdr_interval_recorder_record_value and hdr_interval_recorder_record_value_atomic */
+    HDR_SELF_INTERVAL_RECORDER_RECORD_VALUE,
+    /** hdr_phaser_flip_phase */
+    HDR_SELF_PHASER_FLIP_PHASE,
+    HDR_SELF_OPERATION_COUNT
+} hdr_self_operation;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @return true if the library was built with self instrumentation.
+ */
+bool hdr_self_instrumentation_enabled(void);
+
+/**
+ * Set how often calls are timed, 1 in every sample_interval calls on each
+ * thread.  The default is HDR_SELF_INSTRUMENTATION_SAMPLE_INTERVAL from the
+ * build, 1024 unless overridden.  A thread picks up the new interval after
+ * its next sampled call.
+ *
+ * @param sample_interval Must be at least 1.
+ * @return 0 on success, EINVAL if sample_interval is 0 or self instrumentation
+ * is not enabled.
+ */
+int hdr_self_instrumentation_set_sample_interval(uint32_t sample_interval);
+
+/**
+ * Copy the timings recorded so far for an operation.  The caller owns the
+ * resulting histogram and should release it with hdr_close.
+ *
+ * @param operation The operation to copy timings for.
+ * @param result Output parameter for a histogram of the sampled call durations
+ * in nanoseconds.
+ * @return 0 on success, EINVAL if the operation is unknown or self
+ * instrumentation is not enabled, ENOMEM if allocation failed.
+ */
+int hdr_self_instrumentation_snapshot(hdr_self_operation operation, struct hdr_histogram** result);
+
+/**
+ * Discard the timings recorded so far for all operations.
+ */
+void hdr_self_instrumentation_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
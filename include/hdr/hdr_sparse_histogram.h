@@ -0,0 +1,170 @@
+/**
+ * hdr_sparse_histogram.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A histogram for series that only ever touch a few buckets, e.g. rarely hit
+ * endpoints.  Counts are held as (index, count) pairs sorted by index, using
+ * the counts indices of an hdr_histogram with the same configuration, instead
+ * of the full counts array.  Once the pairs would outnumber an eighth of that
+ * array the histogram converts itself to an hdr_histogram, and from then on
+ * every call is passed through to it.
+ */
+
+#ifndef HDR_SPARSE_HISTOGRAM_H
+#define HDR_SPARSE_HISTOGRAM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <hdr/hdr_histogram.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hdr_sparse_histogram
+{
+    /* Configuration, total_count, min_value and max_value while sparse. */
+    /* layout.counts is always NULL.                                     */
+    struct hdr_histogram layout;
+    int32_t* indices;
+    int64_t* counts;
+    int32_t len;
+    int32_t capacity;
+    /* The converted histogram, NULL while sparse. */
+    struct hdr_histogram* dense;
+};
+
+/**
+ * Iterates over the recorded values, as hdr_iter_recorded_init does.
+ */
+struct hdr_sparse_iter
+{
+    const struct hdr_sparse_histogram* h;
+    int32_t position;
+    struct hdr_iter dense_iter;
+    /** count at the current value */
+    int64_t count;
+    /** sum of all of the counts up to and including the current value */
+    int64_t cumulative_count;
+    /** the lowest value of the current bucket */
+    int64_t value;
+    int64_t highest_equivalent_value;
+    int64_t lowest_equivalent_value;
+    int64_t median_equivalent_value;
+};
+
+/**
+ * Allocate and initialise a sparse histogram, taking the same configuration
+ * as hdr_init.
+ *
+ * @param lowest_discernible_value The smallest possible value that is distinguishable from 0.
+ * @param highest_trackable_value The largest possible value to be put into the histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if the configuration is invalid or ENOMEM if
+ * the allocation fails.
+ */
+int hdr_sparse_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_sparse_histogram** result);
+
+/**
+ * Free the memory and close the sparse histogram.
+ */
+void hdr_sparse_close(struct hdr_sparse_histogram* h);
+
+/**
+ * Empty the histogram, releasing a converted histogram so that it is sparse
+ * again.
+ */
+void hdr_sparse_reset(struct hdr_sparse_histogram* h);
+
+/**
+ * Get the memory size of the histogram, including the pairs or the converted
+ * histogram.
+ */
+size_t hdr_sparse_get_memory_size(const struct hdr_sparse_histogram* h);
+
+/**
+ * Records a value in the histogram.
+ *
+ * @return false if the value is out of range or there is no memory to hold
+ * the value's bucket, true otherwise.
+ */
+bool hdr_sparse_record_value(struct hdr_sparse_histogram* h, int64_t value);
+
+/**
+ * Records count occurrences of a value in the histogram.
+ *
+ * @return false if the value is out of range or there is no memory to hold
+ * the value's bucket, true otherwise.
+ */
+bool hdr_sparse_record_values(struct hdr_sparse_histogram* h, int64_t value, int64_t count);
+
+/**
+ * The total number of recorded values.
+ */
+int64_t hdr_sparse_total_count(const struct hdr_sparse_histogram* h);
+
+/**
+ * As hdr_min, the lowest recorded value or INT64_MAX if nothing is recorded.
+ */
+int64_t hdr_sparse_min(const struct hdr_sparse_histogram* h);
+
+/**
+ * As hdr_max, the highest recorded value or 0 if nothing is recorded.
+ */
+int64_t hdr_sparse_max(const struct hdr_sparse_histogram* h);
+
+/**
+ * As hdr_value_at_percentile, the value at a percentile, e.g. 99.9.
+ */
+int64_t hdr_sparse_value_at_percentile(const struct hdr_sparse_histogram* h, double percentile);
+
+/**
+ * Initialise an iterator over the recorded values of h.
+ */
+void hdr_sparse_iter_init(struct hdr_sparse_iter* iter, const struct hdr_sparse_histogram* h);
+
+/**
+ * Move to the next recorded value.
+ *
+ * @return false once there are no more values.
+ */
+bool hdr_sparse_iter_next(struct hdr_sparse_iter* iter);
+
+/**
+ * Adds all of the values from 'from' to h, as hdr_add does.
+ *
+ * @return The number of values dropped when copying.
+ */
+int64_t hdr_sparse_add(struct hdr_sparse_histogram* h, const struct hdr_sparse_histogram* from);
+
+/**
+ * Adds all of the values from the sparse histogram 'from' to the histogram h,
+ * as hdr_add does.  Counts go straight to their index when both have the same
+ * configuration.
+ *
+ * @return The number of values dropped when copying.
+ */
+int64_t hdr_sparse_add_to(struct hdr_histogram* h, const struct hdr_sparse_histogram* from);
+
+/**
+ * Allocate an hdr_histogram holding the values of h, e.g. to encode it with
+ * hdr_histogram_log.h.  Its encoded form is what a histogram recording the
+ * same values would have.
+ *
+ * @return 0 on success, or ENOMEM if the allocation fails.
+ */
+int hdr_sparse_to_dense(const struct hdr_sparse_histogram* h, struct hdr_histogram** result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
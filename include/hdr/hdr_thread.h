@@ -20,6 +20,11 @@ typedef struct hdr_mutex
     uint8_t _critical_section[40];
 } hdr_mutex;
 
+typedef struct hdr_thread
+{
+    void* _handle;
+} hdr_thread;
+
 #else
 
 #include <pthread.h>
@@ -31,6 +36,11 @@ typedef struct hdr_mutex
 {
     pthread_mutex_t _mutex;
 } hdr_mutex;
+
+typedef struct hdr_thread
+{
+    pthread_t _thread;
+} hdr_thread;
 #endif
 
 #ifdef __cplusplus
@@ -46,6 +56,9 @@ void hdr_mutex_destroy(struct hdr_mutex* mutex);
 void hdr_mutex_lock(struct hdr_mutex* mutex);
 void hdr_mutex_unlock(struct hdr_mutex* mutex);
 
+int hdr_thread_create(struct hdr_thread* thread, void* (*start_routine)(void*), void* arg);
+int hdr_thread_join(struct hdr_thread* thread);
+
 void hdr_yield(void);
 int hdr_usleep(unsigned int useconds);
 
@@ -7,6 +7,7 @@
 #ifndef HDR_TIME_H__
 #define HDR_TIME_H__
 
+#include <stddef.h>
 #include <time.h>
 
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
@@ -40,6 +41,36 @@ double hdr_timespec_as_double(const hdr_timespec* t);
 /* Assumes only millisecond accuracy. */
 void hdr_timespec_from_double(hdr_timespec* t, double value);
 
+/* Longest text written by hdr_timespec_format: a sign, 19 digits of seconds, */
+/* the decimal point and 9 digits of nanoseconds.                             */
+#define HDR_TIMESPEC_MAX_LEN 32
+
+/**
+ * Parse a timestamp written as decimal seconds, "[-]<seconds>[.<fraction>]",
+ * from the start of an in-memory buffer using fixed-point arithmetic.  Up to
+ * 9 fractional digits are kept exactly, any further digits are truncated.
+ * The result is normalised so that 0 <= tv_nsec < 1000000000.
+ *
+ * @param t The timestamp to populate.
+ * @param str The text to parse, which does not need to be NUL terminated.
+ * @param len The number of bytes available in str.
+ * @return The number of bytes consumed or 0 if str does not start with a
+ * timestamp or the seconds have more than 18 digits.
+ */
+size_t hdr_timespec_parse(hdr_timespec* t, const char* str, size_t len);
+
+/**
+ * Format a timestamp as decimal seconds.  At least 3 decimal places are
+ * written, extended to 6 or 9 when the timestamp has sub-millisecond
+ * precision, so hdr_timespec_parse reads back exactly the same value.
+ *
+ * @param buffer Receives the text and must have room for HDR_TIMESPEC_MAX_LEN
+ * bytes.  No NUL terminator is written.
+ * @param t The timestamp to format.
+ * @return The number of bytes written.
+ */
+size_t hdr_timespec_format(char* buffer, const hdr_timespec* t);
+
 #ifdef __cplusplus
 }
 #endif
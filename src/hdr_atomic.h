@@ -38,6 +38,19 @@ static void __inline hdr_atomic_store_64(int64_t* field, int64_t value)
 	*field = value;
 }
 
+static int64_t __inline hdr_atomic_load_acquire_64(int64_t* field)
+{
+    int64_t value = *field;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static void __inline hdr_atomic_store_release_64(int64_t* field, int64_t value)
+{
+    _ReadWriteBarrier();
+    *field = value;
+}
+
 static int64_t __inline hdr_atomic_exchange_64(volatile int64_t* field, int64_t value)
 {
 #if defined(_WIN64)
@@ -85,6 +98,8 @@ static bool __inline hdr_atomic_compare_exchange_64(volatile int64_t* field, int
 #define hdr_atomic_store_pointer(f,v) __atomic_store_n(f,v, __ATOMIC_SEQ_CST)
 #define hdr_atomic_load_64(x) __atomic_load_n(x, __ATOMIC_SEQ_CST)
 #define hdr_atomic_store_64(f,v) __atomic_store_n(f,v, __ATOMIC_SEQ_CST)
+#define hdr_atomic_load_acquire_64(x) __atomic_load_n(x, __ATOMIC_ACQUIRE)
+#define hdr_atomic_store_release_64(f,v) __atomic_store_n(f,v, __ATOMIC_RELEASE)
 #define hdr_atomic_exchange_64(f,i) __atomic_exchange_n(f,i, __ATOMIC_SEQ_CST)
 #define hdr_atomic_add_fetch_64(field, value) __atomic_add_fetch(field, value, __ATOMIC_SEQ_CST)
 #define hdr_atomic_compare_exchange_64(field, expected, desired) __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
@@ -118,6 +133,19 @@ static inline void hdr_atomic_store_64(int64_t* field, int64_t value)
     asm volatile ("lock; xchgq %0, %1" : "+q" (value), "+m" (*field));
 }
 
+static inline int64_t hdr_atomic_load_acquire_64(int64_t* field)
+{
+    int64_t i = *field;
+    asm volatile ("" ::: "memory");
+    return i;
+}
+
+static inline void hdr_atomic_store_release_64(int64_t* field, int64_t value)
+{
+    asm volatile ("" ::: "memory");
+    *field = value;
+}
+
 static inline int64_t hdr_atomic_exchange_64(volatile int64_t* field, int64_t value)
 {
     int64_t result = 0;
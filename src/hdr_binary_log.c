@@ -0,0 +1,688 @@
+/**
+ * hdr_binary_log.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_binary_log.h>
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+#define FAIL_AND_CLEANUP(label, error_name, error) \
+    do                      \
+    {                       \
+        error_name = error; \
+        goto label;         \
+    }                       \
+    while (0)
+
+#define BINARY_LOG_MAGIC UINT32_C(0x48445242)  /* "HDRB" */
+#define BINARY_INDEX_MAGIC UINT32_C(0x48445249)  /* "HDRI" */
+
+/* magic, version, start seconds, start nanoseconds, reserved */
+#define HEADER_LEN 24
+/* length prefix of each record */
+#define RECORD_LENGTH_LEN 4
+/* start seconds, start nanoseconds, interval seconds, interval nanoseconds, max, tag length */
+#define RECORD_FIXED_LEN 34
+/* start seconds, start nanoseconds, offset */
+#define INDEX_ENTRY_LEN 20
+/* index offset, index entry count, magic */
+#define TRAILER_LEN 16
+/* a zero length prefix, ending the records ahead of the index */
+#define END_OF_RECORDS_LEN RECORD_LENGTH_LEN
+
+#define MAX_TAG_LEN UINT16_MAX
+
+/* ########  ######## ########  ######  */
+/* ##     ## ##          ##    ##    ## */
+/* ##     ## ##          ##    ##       */
+/* ########  ######      ##     ######  */
+/* ##     ## ##          ##          ## */
+/* ##     ## ##          ##    ##    ## */
+/* ########  ########    ##     ######  */
+
+static void put_be16(uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t) (value >> 8);
+    p[1] = (uint8_t) value;
+}
+
+static void put_be32(uint8_t* p, uint32_t value)
+{
+    put_be16(p, (uint16_t) (value >> 16));
+    put_be16(p + 2, (uint16_t) value);
+}
+
+static void put_be64(uint8_t* p, uint64_t value)
+{
+    put_be32(p, (uint32_t) (value >> 32));
+    put_be32(p + 4, (uint32_t) value);
+}
+
+static uint16_t get_be16(const uint8_t* p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_be32(const uint8_t* p)
+{
+    return ((uint32_t) get_be16(p) << 16) | get_be16(p + 2);
+}
+
+static uint64_t get_be64(const uint8_t* p)
+{
+    return ((uint64_t) get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void put_timespec(uint8_t* p, const hdr_timespec* t)
+{
+    put_be64(p, (uint64_t) (int64_t) t->tv_sec);
+    put_be32(p + 8, (uint32_t) (int32_t) t->tv_nsec);
+}
+
+static void get_timespec(const uint8_t* p, hdr_timespec* t)
+{
+    t->tv_sec = (time_t) (int64_t) get_be64(p);
+    t->tv_nsec = (long) (int32_t) get_be32(p + 8);
+}
+
+static int compare_timespec(const hdr_timespec* a, const hdr_timespec* b)
+{
+    if (a->tv_sec != b->tv_sec)
+    {
+        return a->tv_sec < b->tv_sec ? -1 : 1;
+    }
+    if (a->tv_nsec != b->tv_nsec)
+    {
+        return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static int file_seek(FILE* f, int64_t offset, int whence)
+{
+#if defined(_MSC_VER)
+    return _fseeki64(f, offset, whence);
+#else
+    return fseeko(f, (off_t) offset, whence);
+#endif
+}
+
+static int64_t file_tell(FILE* f)
+{
+#if defined(_MSC_VER)
+    return _ftelli64(f);
+#else
+    return (int64_t) ftello(f);
+#endif
+}
+
+/* Grows *buffer to hold at least len bytes.  The buffer is kept on failure. */
+static int ensure_capacity(uint8_t** buffer, size_t* capacity, size_t len)
+{
+    uint8_t* grown;
+
+    if (len <= *capacity)
+    {
+        return 0;
+    }
+
+    if ((grown = (uint8_t*) hdr_realloc(*buffer, len)) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    *buffer = grown;
+    *capacity = len;
+
+    return 0;
+}
+
+/* ##      ## ########  #### ######## ######## ########  */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ########   ##     ##    ######   ########  */
+/* ##  ##  ## ##   ##    ##     ##    ##       ##   ##   */
+/* ##  ##  ## ##    ##   ##     ##    ##       ##    ##  */
+/*  ###  ###  ##     ## ####    ##    ######## ##     ## */
+
+int hdr_binary_log_writer_init(
+    struct hdr_binary_log_writer* writer, FILE* file, const hdr_timespec* start_timestamp)
+{
+    uint8_t header[HEADER_LEN];
+    hdr_timespec zero;
+    int rc;
+
+    memset(writer, 0, sizeof(*writer));
+    memset(&zero, 0, sizeof(zero));
+    writer->file = file;
+
+    if ((rc = hdr_log_encoder_init(&writer->encoder)) != 0)
+    {
+        return rc;
+    }
+
+    put_be32(header, BINARY_LOG_MAGIC);
+    put_be32(header + 4, HDR_BINARY_LOG_VERSION);
+    put_timespec(header + 8, NULL != start_timestamp ? start_timestamp : &zero);
+    put_be32(header + 20, 0);
+
+    if (fwrite(header, HEADER_LEN, 1, file) != 1)
+    {
+        hdr_log_encoder_close(writer->encoder);
+        writer->encoder = NULL;
+        return EIO;
+    }
+
+    writer->offset = HEADER_LEN;
+
+    return 0;
+}
+
+static int append_index_entry(struct hdr_binary_log_writer* writer, const hdr_timespec* start_timestamp)
+{
+    if (writer->index_len == writer->index_capacity)
+    {
+        size_t capacity = 0 == writer->index_capacity ? 64 : writer->index_capacity * 2;
+        struct hdr_binary_log_index_entry* index = (struct hdr_binary_log_index_entry*) hdr_realloc(
+            writer->index, capacity * sizeof(struct hdr_binary_log_index_entry));
+        if (NULL == index)
+        {
+            return ENOMEM;
+        }
+
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+
+    writer->index[writer->index_len].start_timestamp = *start_timestamp;
+    writer->index[writer->index_len].offset = writer->offset;
+    writer->index_len++;
+
+    return 0;
+}
+
+int hdr_binary_log_write(
+    struct hdr_binary_log_writer* writer,
+    const struct hdr_log_entry* entry,
+    const struct hdr_histogram* histogram)
+{
+    size_t tag_len = NULL != entry->tag ? entry->tag_len : 0;
+    size_t prefix_len = RECORD_LENGTH_LEN + RECORD_FIXED_LEN + tag_len;
+    size_t payload_len;
+    size_t record_len;
+    uint8_t* p;
+    int rc;
+
+    if (tag_len > MAX_TAG_LEN)
+    {
+        return EINVAL;
+    }
+
+    if ((rc = ensure_capacity(
+        &writer->record, &writer->record_capacity, prefix_len + hdr_log_encoder_bound(histogram))) != 0)
+    {
+        return rc;
+    }
+
+    if ((rc = hdr_log_encode_compressed_into(
+        writer->encoder, histogram, writer->record + prefix_len, writer->record_capacity - prefix_len,
+        &payload_len)) != 0)
+    {
+        return rc;
+    }
+
+    record_len = prefix_len + payload_len;
+
+    p = writer->record;
+    put_be32(p, (uint32_t) (record_len - RECORD_LENGTH_LEN));
+    put_timespec(p + 4, &entry->start_timestamp);
+    put_timespec(p + 16, &entry->interval);
+    put_be64(p + 28, (uint64_t) hdr_max(histogram));
+    put_be16(p + 36, (uint16_t) tag_len);
+    if (0 < tag_len)
+    {
+        memcpy(p + 38, entry->tag, tag_len);
+    }
+
+    if ((rc = append_index_entry(writer, &entry->start_timestamp)) != 0)
+    {
+        return rc;
+    }
+
+    if (fwrite(writer->record, record_len, 1, writer->file) != 1)
+    {
+        writer->index_len--;
+        return EIO;
+    }
+
+    writer->offset += (int64_t) record_len;
+
+    return 0;
+}
+
+int hdr_binary_log_writer_close(struct hdr_binary_log_writer* writer)
+{
+    uint8_t buffer[INDEX_ENTRY_LEN];
+    uint8_t trailer[TRAILER_LEN];
+    int result = 0;
+    size_t i;
+
+    /* Lets a reader that cannot seek to the footer stop before the index. */
+    memset(buffer, 0, END_OF_RECORDS_LEN);
+    if (fwrite(buffer, END_OF_RECORDS_LEN, 1, writer->file) != 1)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, EIO);
+    }
+
+    for (i = 0; i < writer->index_len; i++)
+    {
+        put_timespec(buffer, &writer->index[i].start_timestamp);
+        put_be64(buffer + 12, (uint64_t) writer->index[i].offset);
+
+        if (fwrite(buffer, INDEX_ENTRY_LEN, 1, writer->file) != 1)
+        {
+            FAIL_AND_CLEANUP(cleanup, result, EIO);
+        }
+    }
+
+    put_be64(trailer, (uint64_t) (writer->offset + END_OF_RECORDS_LEN));
+    put_be32(trailer + 8, (uint32_t) writer->index_len);
+    put_be32(trailer + 12, BINARY_INDEX_MAGIC);
+
+    if (fwrite(trailer, TRAILER_LEN, 1, writer->file) != 1 || fflush(writer->file) != 0)
+    {
+        result = EIO;
+    }
+
+cleanup:
+    hdr_log_encoder_close(writer->encoder);
+    hdr_free(writer->record);
+    hdr_free(writer->index);
+    memset(writer, 0, sizeof(*writer));
+
+    return result;
+}
+
+/* ########  ########    ###    ########  ######## ########  */
+/* ##     ## ##         ## ##   ##     ## ##       ##     ## */
+/* ##     ## ##        ##   ##  ##     ## ##       ##     ## */
+/* ########  ######   ##     ## ##     ## ######   ########  */
+/* ##   ##   ##       ######### ##     ## ##       ##   ##   */
+/* ##    ##  ##       ##     ## ##     ## ##       ##    ##  */
+/* ##     ## ######## ##     ## ########  ######## ##     ## */
+
+/* Loads the index footer when the log was closed cleanly, otherwise leaves
+ * the reader to read sequentially to the end of the file. */
+static int load_index(struct hdr_binary_log_reader* reader)
+{
+    uint8_t trailer[TRAILER_LEN];
+    uint8_t buffer[INDEX_ENTRY_LEN];
+    int64_t file_len, index_offset;
+    uint32_t index_len;
+    size_t i;
+
+    if (file_seek(reader->file, 0, SEEK_END) != 0 ||
+        (file_len = file_tell(reader->file)) < HEADER_LEN + TRAILER_LEN ||
+        file_seek(reader->file, file_len - TRAILER_LEN, SEEK_SET) != 0 ||
+        fread(trailer, TRAILER_LEN, 1, reader->file) != 1)
+    {
+        return 0;
+    }
+
+    index_offset = (int64_t) get_be64(trailer);
+    index_len = get_be32(trailer + 8);
+
+    if (BINARY_INDEX_MAGIC != get_be32(trailer + 12) ||
+        index_offset < HEADER_LEN + END_OF_RECORDS_LEN ||
+        index_offset + (int64_t) index_len * INDEX_ENTRY_LEN != file_len - TRAILER_LEN ||
+        file_seek(reader->file, index_offset, SEEK_SET) != 0)
+    {
+        return 0;
+    }
+
+    if (0 < index_len)
+    {
+        reader->index = (struct hdr_binary_log_index_entry*) hdr_calloc(
+            index_len, sizeof(struct hdr_binary_log_index_entry));
+        if (NULL == reader->index)
+        {
+            return ENOMEM;
+        }
+    }
+
+    for (i = 0; i < index_len; i++)
+    {
+        if (fread(buffer, INDEX_ENTRY_LEN, 1, reader->file) != 1)
+        {
+            hdr_free(reader->index);
+            reader->index = NULL;
+            return EIO;
+        }
+
+        get_timespec(buffer, &reader->index[i].start_timestamp);
+        reader->index[i].offset = (int64_t) get_be64(buffer + 12);
+    }
+
+    reader->index_len = index_len;
+    reader->records_end = index_offset - END_OF_RECORDS_LEN;
+
+    return 0;
+}
+
+int hdr_binary_log_reader_init(struct hdr_binary_log_reader* reader, FILE* file)
+{
+    uint8_t header[HEADER_LEN];
+    int result;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    reader->records_end = -1;
+
+    if (fread(header, HEADER_LEN, 1, file) != 1)
+    {
+        return EIO;
+    }
+
+    if (BINARY_LOG_MAGIC != get_be32(header) || HDR_BINARY_LOG_VERSION != get_be32(header + 4))
+    {
+        return HDR_LOG_INVALID_VERSION;
+    }
+
+    get_timespec(header + 8, &reader->start_timestamp);
+    reader->position = HEADER_LEN;
+
+    if ((result = hdr_log_decoder_init(&reader->decoder)) != 0)
+    {
+        return result;
+    }
+
+    if ((result = load_index(reader)) != 0 || file_seek(file, HEADER_LEN, SEEK_SET) != 0)
+    {
+        /* A stream that cannot seek is read sequentially. */
+        if (0 != result)
+        {
+            hdr_binary_log_reader_close(reader);
+            return result;
+        }
+        clearerr(file);
+        reader->records_end = -1;
+    }
+
+    return 0;
+}
+
+/* The longest record, less its length prefix, that a writer can produce. */
+static size_t max_record_len(void)
+{
+    return RECORD_FIXED_LEN + MAX_TAG_LEN + hdr_log_encoder_max_bound();
+}
+
+int hdr_binary_log_read(
+    struct hdr_binary_log_reader* reader, struct hdr_log_entry* entry, struct hdr_histogram** histogram)
+{
+    uint8_t length[RECORD_LENGTH_LEN];
+    uint32_t record_len;
+    size_t tag_len, read_len;
+    uint8_t* p;
+
+    if (NULL == entry)
+    {
+        return -EINVAL;
+    }
+
+    if (0 <= reader->records_end && reader->records_end <= reader->position)
+    {
+        return EOF;
+    }
+
+    read_len = fread(length, 1, RECORD_LENGTH_LEN, reader->file);
+    if (0 == read_len)
+    {
+        return EOF;
+    }
+
+    record_len = get_be32(length);
+    if (RECORD_LENGTH_LEN == read_len && 0 == record_len)
+    {
+        return EOF;
+    }
+
+    /* A corrupt length must not size the record buffer. */
+    if (RECORD_LENGTH_LEN != read_len || record_len < RECORD_FIXED_LEN || record_len > max_record_len())
+    {
+        return -EINVAL;
+    }
+
+    if (0 <= reader->records_end &&
+        (int64_t) RECORD_LENGTH_LEN + record_len > reader->records_end - reader->position)
+    {
+        return -EINVAL;
+    }
+
+    if (ensure_capacity(&reader->record, &reader->record_capacity, record_len) != 0)
+    {
+        return -ENOMEM;
+    }
+
+    if (fread(reader->record, record_len, 1, reader->file) != 1)
+    {
+        return -EINVAL;
+    }
+
+    reader->position += RECORD_LENGTH_LEN + (int64_t) record_len;
+
+    p = reader->record;
+    tag_len = get_be16(p + 32);
+    if (RECORD_FIXED_LEN + tag_len > record_len)
+    {
+        return -EINVAL;
+    }
+
+    get_timespec(p, &entry->start_timestamp);
+    get_timespec(p + 12, &entry->interval);
+    entry->max.tv_sec = (time_t) (int64_t) get_be64(p + 24);
+    entry->max.tv_nsec = 0;
+
+    if (NULL != entry->tag && 0 < entry->tag_len)
+    {
+        size_t copy_len = tag_len < entry->tag_len ? tag_len : entry->tag_len;
+        memcpy(entry->tag, p + RECORD_FIXED_LEN, copy_len);
+        if (copy_len < entry->tag_len)
+        {
+            entry->tag[copy_len] = '\0';
+        }
+    }
+
+    return hdr_log_decode_compressed_from(
+        reader->decoder, p + RECORD_FIXED_LEN + tag_len, record_len - RECORD_FIXED_LEN - tag_len, histogram);
+}
+
+int hdr_binary_log_seek(struct hdr_binary_log_reader* reader, const hdr_timespec* timestamp)
+{
+    size_t lo = 0;
+    size_t hi = reader->index_len;
+
+    if (reader->records_end < 0)
+    {
+        return EINVAL;
+    }
+
+    /* Records are indexed in the order written, which is by start timestamp. */
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_timespec(&reader->index[mid].start_timestamp, timestamp) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (lo == reader->index_len)
+    {
+        return EOF;
+    }
+
+    if (file_seek(reader->file, reader->index[lo].offset, SEEK_SET) != 0)
+    {
+        return EIO;
+    }
+
+    reader->position = reader->index[lo].offset;
+
+    return 0;
+}
+
+void hdr_binary_log_reader_close(struct hdr_binary_log_reader* reader)
+{
+    hdr_log_decoder_close(reader->decoder);
+    hdr_free(reader->record);
+    hdr_free(reader->index);
+    memset(reader, 0, sizeof(*reader));
+}
+
+/*  ######   #######  ##    ## ##     ## ######## ########  ########  */
+/* ##    ## ##     ## ###   ## ##     ## ##       ##     ##    ##     */
+/* ##       ##     ## ####  ## ##     ## ##       ##     ##    ##     */
+/* ##       ##     ## ## ## ## ##     ## ######   ########     ##     */
+/* ##       ##     ## ##  ####  ##   ##  ##       ##   ##      ##     */
+/* ##    ## ##     ## ##   ###   ## ##   ##       ##    ##     ##     */
+/*  ######   #######  ##    ##    ###    ######## ##     ##    ##     */
+
+int hdr_binary_log_from_text(FILE* text, FILE* binary)
+{
+    struct hdr_log_reader reader;
+    struct hdr_binary_log_writer writer;
+    char tag[HDR_LOG_TAG_MAX_BUFFER_LEN];
+    int result;
+    int rc;
+
+    if ((result = hdr_log_reader_init_with_decoder(&reader)) != 0)
+    {
+        return result;
+    }
+
+    if ((result = hdr_log_read_header(&reader, text)) != 0 ||
+        (result = hdr_binary_log_writer_init(&writer, binary, &reader.start_timestamp)) != 0)
+    {
+        hdr_log_reader_close(&reader);
+        return result;
+    }
+
+    while (true)
+    {
+        struct hdr_log_entry entry;
+        struct hdr_histogram* h = NULL;
+
+        memset(&entry, 0, sizeof(entry));
+        memset(tag, 0, sizeof(tag));
+        entry.tag = tag;
+        entry.tag_len = sizeof(tag) - 1;
+
+        if ((rc = hdr_log_read_entry(&reader, text, &entry, &h)) != 0)
+        {
+            hdr_close(h);
+            result = EOF == rc ? 0 : rc;
+            break;
+        }
+
+        entry.tag_len = strlen(tag);
+        if (0 == entry.tag_len)
+        {
+            entry.tag = NULL;
+        }
+
+        rc = hdr_binary_log_write(&writer, &entry, h);
+        hdr_close(h);
+        if (rc != 0)
+        {
+            result = rc;
+            break;
+        }
+    }
+
+    rc = hdr_binary_log_writer_close(&writer);
+    hdr_log_reader_close(&reader);
+
+    return 0 != result ? result : rc;
+}
+
+int hdr_binary_log_to_text(FILE* binary, FILE* text)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_writer writer;
+    char tag[HDR_LOG_TAG_MAX_BUFFER_LEN];
+    int result;
+    int rc;
+
+    if ((result = hdr_binary_log_reader_init(&reader, binary)) != 0)
+    {
+        return result;
+    }
+
+    if ((result = hdr_log_writer_init_with_encoder(&writer)) != 0)
+    {
+        hdr_binary_log_reader_close(&reader);
+        return result;
+    }
+
+    if ((result = hdr_log_write_header(&writer, text, NULL, &reader.start_timestamp)) != 0)
+    {
+        goto cleanup;
+    }
+
+    while (true)
+    {
+        struct hdr_log_entry entry;
+        struct hdr_histogram* h = NULL;
+
+        memset(&entry, 0, sizeof(entry));
+        memset(tag, 0, sizeof(tag));
+        entry.tag = tag;
+        entry.tag_len = sizeof(tag) - 1;
+
+        if ((rc = hdr_binary_log_read(&reader, &entry, &h)) != 0)
+        {
+            hdr_close(h);
+            result = EOF == rc ? 0 : rc;
+            break;
+        }
+
+        entry.tag_len = strlen(tag);
+        if (0 == entry.tag_len)
+        {
+            entry.tag = NULL;
+        }
+
+        rc = hdr_log_write_entry(&writer, text, &entry, h);
+        hdr_close(h);
+        if (rc != 0)
+        {
+            result = rc;
+            break;
+        }
+    }
+
+cleanup:
+    hdr_log_writer_close(&writer);
+    hdr_binary_log_reader_close(&reader);
+
+    return result;
+}
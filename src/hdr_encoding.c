@@ -6,11 +6,19 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <math.h>
 
 #include "hdr_encoding.h"
 #include "hdr_tests.h"
 
+/* The SSE4.1 decode kernel is compiled in on x86 with GCC and Clang and */
+/* chosen at run time, elsewhere only the scalar codecs are used.        */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HDR_ENCODING_SSE41 1
+#include <smmintrin.h>
+#endif
+
 int zig_zag_encode_i64(uint8_t* buffer, int64_t signed_value)
 {
     int bytesWritten;
@@ -162,49 +170,252 @@ int zig_zag_decode_i64(const uint8_t* buffer, int64_t* signed_value)
     return bytesRead;
 }
 
-static const char base64_table[] =
+/* Counts payloads hold long runs of single byte values, small counts and */
+/* short zero runs, between runs of larger counts.  The SSE4.1 kernel     */
+/* decodes 16 bytes at a time, Masked-VByte style: the bytes' high bits   */
+/* give how many leading values are single bytes, and decoding resumes    */
+/* at the first one that is not.  A matching encode kernel measured       */
+/* slower than the scalar encoder on the benchmark counts, whose runs     */
+/* of small counts are often short, so encoding stays scalar.             */
+
+#if defined(HDR_ENCODING_SSE41)
+
+static bool has_sse41(void)
+{
+    return 0 != __builtin_cpu_supports("sse4.1");
+}
+
+/* Zig-zag decodes the low two bytes as single byte values into values[0..1]. */
+__attribute__((target("sse4.1")))
+static inline void store_single_byte_pair_sse41(int64_t* values, __m128i bytes)
+{
+    __m128i v = _mm_cvtepu8_epi64(bytes);
+    __m128i sign = _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(v, _mm_set1_epi64x(1)));
+
+    _mm_storeu_si128((__m128i*) values, _mm_xor_si128(_mm_srli_epi64(v, 1), sign));
+}
+
+/* Decodes while 16 values fit in values and a full value after 16 bytes  */
+/* fits in the buffer, so that neither needs checking per value.          */
+__attribute__((target("sse4.1")))
+static size_t zig_zag_decode_i64_bulk_sse41(
+    const uint8_t* buffer, size_t buffer_len, int64_t* values, size_t values_len, size_t* bytes_read)
+{
+    size_t data_index = 0;
+    size_t count = 0;
+
+    while (count + 16 <= values_len && data_index + 16 + MAX_BYTES_LEB128 <= buffer_len)
     {
-        'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
-        'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
-        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
-        'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
-        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/', '\0'
-    };
+        __m128i bytes;
+        uint32_t continued;
+        int64_t* out = &values[count];
+        uint32_t n;
 
-static char get_base_64(uint32_t _24_bit_value, int shift)
+        /* Runs of multi-byte values are cheaper a value at a time. */
+        if (buffer[data_index] & 0x80)
+        {
+            data_index += (size_t) zig_zag_decode_i64(&buffer[data_index], &values[count++]);
+            continue;
+        }
+
+        bytes = _mm_loadu_si128((const __m128i*) &buffer[data_index]);
+        continued = (uint32_t) _mm_movemask_epi8(bytes);
+
+        store_single_byte_pair_sse41(&out[0], bytes);
+        store_single_byte_pair_sse41(&out[2], _mm_srli_si128(bytes, 2));
+        store_single_byte_pair_sse41(&out[4], _mm_srli_si128(bytes, 4));
+        store_single_byte_pair_sse41(&out[6], _mm_srli_si128(bytes, 6));
+        store_single_byte_pair_sse41(&out[8], _mm_srli_si128(bytes, 8));
+        store_single_byte_pair_sse41(&out[10], _mm_srli_si128(bytes, 10));
+        store_single_byte_pair_sse41(&out[12], _mm_srli_si128(bytes, 12));
+        store_single_byte_pair_sse41(&out[14], _mm_srli_si128(bytes, 14));
+
+        if (0 == continued)
+        {
+            count += 16;
+            data_index += 16;
+            continue;
+        }
+
+        /* The values from the first multi-byte one on are decoded again. */
+        n = (uint32_t) __builtin_ctz(continued);
+        count += n;
+        data_index += n;
+    }
+
+    *bytes_read = data_index;
+
+    return count;
+}
+
+#endif
+
+static int32_t zig_zag_encoded_len(int64_t signed_value)
 {
-    uint32_t _6_bit_value = 0x3F & (_24_bit_value >> shift);
-    return base64_table[_6_bit_value];
+    uint64_t value = ((uint64_t) signed_value << 1) ^ (uint64_t) (signed_value >> 63);
+    int32_t length = 1;
+
+    while (value >= 0x80 && length < MAX_BYTES_LEB128)
+    {
+        value >>= 7;
+        length++;
+    }
+
+    return length;
 }
 
-static int from_base_64(int c)
+/* Consumes the next count, or the whole run of zeros starting at *index. */
+static int64_t next_payload_value(const int64_t* counts, int32_t counts_len, int32_t* index)
 {
-    if ('A' <= c && c <= 'Z')
+    int32_t i = *index;
+    int64_t value = counts[i++];
+
+    if (value == 0)
     {
-        return c - 'A';
+        int32_t zeros = 1;
+
+        while (i < counts_len && 0 == counts[i])
+        {
+            zeros++;
+            i++;
+        }
+
+        value = -zeros;
     }
-    else if ('a' <= c && c <= 'z')
+
+    *index = i;
+
+    return value;
+}
+
+int32_t zig_zag_encode_counts_chunk(
+    uint8_t* buffer, int32_t buffer_len, const int64_t* counts, int32_t counts_len, int32_t* counts_index)
+{
+    int32_t data_index = 0;
+    int32_t i = *counts_index;
+
+    while (i < counts_len && buffer_len - data_index >= MAX_BYTES_LEB128)
     {
-        return (c - 'a') + 26;
+        data_index += zig_zag_encode_i64(&buffer[data_index], next_payload_value(counts, counts_len, &i));
     }
-    else if ('0' <= c && c <= '9')
+
+    *counts_index = i;
+
+    return data_index;
+}
+
+int32_t zig_zag_encode_counts(uint8_t* buffer, const int64_t* counts, int32_t counts_len)
+{
+    int32_t counts_index = 0;
+
+    return zig_zag_encode_counts_chunk(buffer, INT32_MAX, counts, counts_len, &counts_index);
+}
+
+int32_t zig_zag_counts_encoded_len(const int64_t* counts, int32_t counts_len)
+{
+    int32_t length = 0;
+    int32_t i = 0;
+
+    while (i < counts_len)
     {
-        return (c - '0') + 52;
+        length += zig_zag_encoded_len(next_payload_value(counts, counts_len, &i));
     }
-    else if ('+' == c)
+
+    return length;
+}
+
+size_t zig_zag_decode_i64_bulk(
+    const uint8_t* buffer, size_t buffer_len, int64_t* values, size_t values_len, size_t* bytes_read)
+{
+    size_t data_index = 0;
+    size_t count = 0;
+
+#if defined(HDR_ENCODING_SSE41)
+    if (has_sse41())
     {
-        return 62;
+        count = zig_zag_decode_i64_bulk_sse41(buffer, buffer_len, values, values_len, &data_index);
     }
-    else if ('/' == c)
+#endif
+
+    /* A value is at most MAX_BYTES_LEB128 bytes, so these need no checks. */
+    while (count < values_len && data_index + MAX_BYTES_LEB128 <= buffer_len)
     {
-        return 63;
+        if (buffer[data_index] < 0x80)
+        {
+            uint64_t value = buffer[data_index++];
+            values[count++] = (int64_t) (value >> 1) ^ -((int64_t) (value & 1));
+        }
+        else
+        {
+            data_index += (size_t) zig_zag_decode_i64(&buffer[data_index], &values[count++]);
+        }
     }
-    else if ('=' == c)
+
+    /* The tail, checking each value is complete before decoding it. */
+    while (count < values_len && data_index < buffer_len)
     {
-        return 0;
+        size_t remaining = buffer_len - data_index;
+        size_t length = 1;
+
+        while (length < MAX_BYTES_LEB128 && length <= remaining && (buffer[data_index + length - 1] & 0x80) != 0)
+        {
+            length++;
+        }
+
+        if (length > remaining)
+        {
+            break;
+        }
+
+        data_index += (size_t) zig_zag_decode_i64(&buffer[data_index], &values[count++]);
     }
 
-    return EINVAL;
+    *bytes_read = data_index;
+
+    return count;
+}
+
+static const char base64_table[] =
+    {
+        'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+        'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+        'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/', '\0'
+    };
+
+static char get_base_64(uint32_t _24_bit_value, int shift)
+{
+    uint32_t _6_bit_value = 0x3F & (_24_bit_value >> shift);
+    return base64_table[_6_bit_value];
+}
+
+/* Maps each character to its 6 bit value, '=' to 0 and anything else to BASE64_INVALID. */
+#define BASE64_INVALID 0xFF
+
+static const uint8_t base64_decode_table[256] =
+    {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+        0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF,
+        0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+        0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+    };
+
+static uint32_t from_base_64(char c)
+{
+    return base64_decode_table[(uint8_t) c];
 }
 
 size_t hdr_base64_encoded_len(size_t decoded_size)
@@ -272,9 +483,29 @@ int hdr_base64_encode(
         return EINVAL;
     }
 
-    for (i = 0, j = 0; input_len - i >= 3 && j < output_len; i += 3, j += 4)
+    /* Two blocks per iteration: 48 input bits become 8 output chars. */
+    for (i = 0, j = 0; input_len - i >= 6; i += 6, j += 8)
+    {
+        uint64_t _48_bit_value =
+            ((uint64_t) input[i] << 40) | ((uint64_t) input[i + 1] << 32) |
+            ((uint64_t) input[i + 2] << 24) | ((uint64_t) input[i + 3] << 16) |
+            ((uint64_t) input[i + 4] << 8) | (uint64_t) input[i + 5];
+
+        output[j]     = base64_table[(_48_bit_value >> 42) & 0x3F];
+        output[j + 1] = base64_table[(_48_bit_value >> 36) & 0x3F];
+        output[j + 2] = base64_table[(_48_bit_value >> 30) & 0x3F];
+        output[j + 3] = base64_table[(_48_bit_value >> 24) & 0x3F];
+        output[j + 4] = base64_table[(_48_bit_value >> 18) & 0x3F];
+        output[j + 5] = base64_table[(_48_bit_value >> 12) & 0x3F];
+        output[j + 6] = base64_table[(_48_bit_value >> 6) & 0x3F];
+        output[j + 7] = base64_table[_48_bit_value & 0x3F];
+    }
+
+    if (input_len - i >= 3)
     {
         hdr_base64_encode_block(&input[i], &output[j]);
+        i += 3;
+        j += 4;
     }
 
     remaining = input_len - i;
@@ -305,6 +536,7 @@ int hdr_base64_decode(
     const char* input, size_t input_len, uint8_t* output, size_t output_len)
 {
     size_t i, j;
+    uint32_t invalid = 0;
 
     if (input_len < 4 ||
         (input_len & 3u) != 0 ||
@@ -313,10 +545,42 @@ int hdr_base64_decode(
         return -EINVAL;
     }
 
-    for (i = 0, j = 0; i < input_len; i += 4, j += 3)
+    /* Two blocks per iteration, checking for invalid characters once at the end. */
+    for (i = 0, j = 0; input_len - i >= 8; i += 8, j += 6)
     {
+        uint32_t c0 = from_base_64(input[i]);
+        uint32_t c1 = from_base_64(input[i + 1]);
+        uint32_t c2 = from_base_64(input[i + 2]);
+        uint32_t c3 = from_base_64(input[i + 3]);
+        uint32_t c4 = from_base_64(input[i + 4]);
+        uint32_t c5 = from_base_64(input[i + 5]);
+        uint32_t c6 = from_base_64(input[i + 6]);
+        uint32_t c7 = from_base_64(input[i + 7]);
+        uint64_t _48_bit_value =
+            ((uint64_t) c0 << 42) | ((uint64_t) c1 << 36) | ((uint64_t) c2 << 30) | ((uint64_t) c3 << 24) |
+            ((uint64_t) c4 << 18) | ((uint64_t) c5 << 12) | ((uint64_t) c6 << 6) | (uint64_t) c7;
+
+        invalid |= c0 | c1 | c2 | c3 | c4 | c5 | c6 | c7;
+
+        output[j]     = (uint8_t) (_48_bit_value >> 40);
+        output[j + 1] = (uint8_t) (_48_bit_value >> 32);
+        output[j + 2] = (uint8_t) (_48_bit_value >> 24);
+        output[j + 3] = (uint8_t) (_48_bit_value >> 16);
+        output[j + 4] = (uint8_t) (_48_bit_value >> 8);
+        output[j + 5] = (uint8_t) _48_bit_value;
+    }
+
+    if (i < input_len)
+    {
+        invalid |= from_base_64(input[i]) | from_base_64(input[i + 1]) |
+                   from_base_64(input[i + 2]) | from_base_64(input[i + 3]);
         hdr_base64_decode_block(&input[i], &output[j]);
     }
 
+    if (invalid > 0x3F)
+    {
+        return -EINVAL;
+    }
+
     return 0;
 }
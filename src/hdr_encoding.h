@@ -8,6 +8,7 @@
 #define HDR_ENCODING_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define MAX_BYTES_LEB128 9
 
@@ -33,6 +34,59 @@ int zig_zag_encode_i64(uint8_t* buffer, int64_t signed_value);
  */
 int zig_zag_decode_i64(const uint8_t* buffer, int64_t* signed_value);
 
+/**
+ * Writes histogram counts to the given buffer as LEB128 ZigZag values, with
+ * each run of zero counts written as a single negative run length, i.e. the
+ * V2 histogram payload format.
+ *
+ * @param buffer the buffer to write to, must have room for
+ * MAX_BYTES_LEB128 * counts_len bytes
+ * @param counts the counts to write
+ * @param counts_len the number of counts to write
+ * @return the number of bytes written to the buffer
+ */
+int32_t zig_zag_encode_counts(uint8_t* buffer, const int64_t* counts, int32_t counts_len);
+
+/**
+ * Writes as many histogram counts as fit into the given buffer in the same
+ * format as zig_zag_encode_counts, resuming from and advancing *counts_index.
+ * A run of zero counts is always consumed whole.
+ *
+ * @param buffer the buffer to write to
+ * @param buffer_len the number of bytes available in the buffer
+ * @param counts the counts to write
+ * @param counts_len the total number of counts
+ * @param counts_index in/out index of the next count to write
+ * @return the number of bytes written to the buffer
+ */
+int32_t zig_zag_encode_counts_chunk(
+    uint8_t* buffer, int32_t buffer_len, const int64_t* counts, int32_t counts_len, int32_t* counts_index);
+
+/**
+ * Gets the number of bytes zig_zag_encode_counts would write for the counts.
+ *
+ * @param counts the counts to measure
+ * @param counts_len the number of counts
+ * @return the encoded length in bytes
+ */
+int32_t zig_zag_counts_encoded_len(const int64_t* counts, int32_t counts_len);
+
+/**
+ * Read up to values_len LEB128 ZigZag encoded values from the given buffer.
+ * Reads never go past buffer_len.
+ *
+ * @param buffer the buffer to read from
+ * @param buffer_len the number of bytes available in the buffer
+ * @param values out array to capture the read values
+ * @param values_len the maximum number of values to read
+ * @param bytes_read out value to capture the number of bytes consumed
+ * @return the number of values read.  If fewer than values_len values were
+ * read and *bytes_read is less than buffer_len then the last value in the
+ * buffer is truncated.
+ */
+size_t zig_zag_decode_i64_bulk(
+    const uint8_t* buffer, size_t buffer_len, int64_t* values, size_t values_len, size_t* bytes_read);
+
 /**
  * Gets the length in bytes of base64 data, given the input size.
  *
@@ -68,6 +122,8 @@ size_t hdr_base64_decoded_len(size_t encoded_size);
  * @param input_len the size in bytes of the endcoded data
  * @param output the buffer to write the decoded data to
  * @param output_len the number of bytes to write to the output data
+ * @return 0 on success, -EINVAL if the lengths do not match or the input contains a
+ * character outside of the base64 alphabet.
  */
 int hdr_base64_decode(
     const char* input, size_t input_len, uint8_t* output, size_t output_len);
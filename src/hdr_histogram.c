@@ -7,15 +7,19 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <errno.h>
 #include <inttypes.h>
 
 #include <hdr/hdr_histogram.h>
+#include <hdr/hdr_thread.h>
 #include "hdr_tests.h"
 #include "hdr_atomic.h"
+#include "hdr_instrument.h"
 
 #ifndef HDR_MALLOC_INCLUDE
 #define HDR_MALLOC_INCLUDE "hdr_malloc.h"
@@ -114,6 +118,223 @@ static void update_min_max_atomic(struct hdr_histogram* h, int64_t value)
     while (!hdr_atomic_compare_exchange_64(&h->max_value, &current_max_value, value));
 }
 
+/* Occupancy summary for HDR_HISTOGRAM_LAZY_MIN_MAX, one bit for each block of */
+/* 64 counts, stored directly after the counts.                                */
+#define HDR_OCCUPANCY_BLOCK_SHIFT 6
+
+static int32_t occupancy_words(int32_t counts_len)
+{
+    int32_t blocks = (counts_len + (1 << HDR_OCCUPANCY_BLOCK_SHIFT) - 1) >> HDR_OCCUPANCY_BLOCK_SHIFT;
+    return (blocks + 63) / 64;
+}
+
+static int64_t* occupancy_of(const struct hdr_histogram* h)
+{
+    return h->counts + h->counts_len;
+}
+
+static void occupancy_mark(struct hdr_histogram* h, int32_t index)
+{
+    int32_t block = index >> HDR_OCCUPANCY_BLOCK_SHIFT;
+    int64_t bit = (int64_t) (UINT64_C(1) << (block & 63));
+    occupancy_of(h)[block >> 6] |= bit;
+}
+
+static void occupancy_mark_atomic(struct hdr_histogram* h, int32_t index)
+{
+    int32_t block = index >> HDR_OCCUPANCY_BLOCK_SHIFT;
+    int64_t bit = (int64_t) (UINT64_C(1) << (block & 63));
+    int64_t* word = &occupancy_of(h)[block >> 6];
+    int64_t current = hdr_atomic_load_64(word);
+
+    /* The bit is almost always set already, so this is normally just a read. */
+    while (0 == (current & bit) && !hdr_atomic_compare_exchange_64(word, &current, current | bit))
+    {
+    }
+}
+
+static int32_t lowest_occupied_index(const struct hdr_histogram* h)
+{
+    const int64_t* occupancy = occupancy_of(h);
+    int32_t words = occupancy_words(h->counts_len);
+    int32_t w, b, i;
+
+    for (w = 0; w < words; w++)
+    {
+        uint64_t word = (uint64_t) hdr_atomic_load_64(&occupancy[w]);
+        for (b = 0; word != 0; b++, word >>= 1)
+        {
+            int32_t start, end;
+            if (0 == (word & 1))
+            {
+                continue;
+            }
+
+            start = ((w * 64) + b) << HDR_OCCUPANCY_BLOCK_SHIFT;
+            end = start + (1 << HDR_OCCUPANCY_BLOCK_SHIFT);
+            end = end < h->counts_len ? end : h->counts_len;
+            for (i = start; i < end; i++)
+            {
+                if (0 != counts_get_normalised(h, i))
+                {
+                    return i;
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+static int32_t highest_occupied_index(const struct hdr_histogram* h)
+{
+    const int64_t* occupancy = occupancy_of(h);
+    int32_t w, b, i;
+
+    for (w = occupancy_words(h->counts_len) - 1; w >= 0; w--)
+    {
+        uint64_t word = (uint64_t) hdr_atomic_load_64(&occupancy[w]);
+        for (b = 63; word != 0; b--, word <<= 1)
+        {
+            int32_t start, end;
+            if (0 == (word & (UINT64_C(1) << 63)))
+            {
+                continue;
+            }
+
+            start = ((w * 64) + b) << HDR_OCCUPANCY_BLOCK_SHIFT;
+            end = start + (1 << HDR_OCCUPANCY_BLOCK_SHIFT);
+            end = end < h->counts_len ? end : h->counts_len;
+            for (i = end - 1; i >= start; i--)
+            {
+                if (0 != counts_get_normalised(h, i))
+                {
+                    return i;
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+/* Moments for HDR_HISTOGRAM_MOMENTS, stored after the counts and any         */
+/* occupancy summary.  The sum and the sum of squares of the recorded values */
+/* are each a 128 bit two's complement integer, low word first.              */
+#define HDR_MOMENT_SUM 0
+#define HDR_MOMENT_SUM_OF_SQUARES 2
+#define HDR_MOMENTS_WORDS 4
+
+static int64_t* moments_of(const struct hdr_histogram* h)
+{
+    int64_t* moments = h->counts + h->counts_len;
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        moments += occupancy_words(h->counts_len);
+    }
+
+    return moments;
+}
+
+/* Full 64 x 64 bit product, returning the low word. */
+static uint64_t multiply_64(uint64_t a, uint64_t b, uint64_t* high)
+{
+#if defined(__SIZEOF_INT128__)
+    __extension__ unsigned __int128 product = (unsigned __int128) a * b;
+    *high = (uint64_t) (product >> 64);
+    return (uint64_t) product;
+#else
+    uint64_t lo_lo = (a & 0xffffffffU) * (b & 0xffffffffU);
+    uint64_t hi_lo = (a >> 32) * (b & 0xffffffffU);
+    uint64_t lo_hi = (a & 0xffffffffU) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffffU) + lo_hi;
+    *high = (a >> 32) * (b >> 32) + (hi_lo >> 32) + (cross >> 32);
+    return (cross << 32) | (lo_lo & 0xffffffffU);
+#endif
+}
+
+/* Low 128 bits of a 128 bit value (low word first) times a 64 bit value. */
+static void multiply_128(const uint64_t* a, uint64_t b, uint64_t* result)
+{
+    uint64_t high;
+    result[0] = multiply_64(a[0], b, &high);
+    result[1] = high + a[1] * b;
+}
+
+static void negate_128(uint64_t* a)
+{
+    a[0] = ~a[0] + 1;
+    a[1] = ~a[1] + (0 == a[0] ? 1 : 0);
+}
+
+static void add_128(uint64_t* a, const uint64_t* b)
+{
+    uint64_t low = a[0] + b[0];
+    a[1] = a[1] + b[1] + (low < b[0] ? 1 : 0);
+    a[0] = low;
+}
+
+static double double_of_128(const uint64_t* a)
+{
+    return ldexp((double) (int64_t) a[1], 64) + (double) a[0];
+}
+
+/* value * count and value^2 * count, in the layout of the moments. */
+static void moment_terms(int64_t value, int64_t count, uint64_t* terms)
+{
+    uint64_t magnitude = count < 0 ? 0 - (uint64_t) count : (uint64_t) count;
+    uint64_t square[2];
+
+    terms[0] = multiply_64((uint64_t) value, magnitude, &terms[1]);
+    square[0] = multiply_64((uint64_t) value, (uint64_t) value, &square[1]);
+    multiply_128(square, magnitude, &terms[2]);
+
+    if (count < 0)
+    {
+        negate_128(&terms[0]);
+        negate_128(&terms[2]);
+    }
+}
+
+static void moments_add(int64_t* moments, const uint64_t* terms)
+{
+    uint64_t moment[2];
+    int i;
+
+    for (i = 0; i < HDR_MOMENTS_WORDS; i += 2)
+    {
+        moment[0] = (uint64_t) moments[i];
+        moment[1] = (uint64_t) moments[i + 1];
+        add_128(moment, &terms[i]);
+        moments[i] = (int64_t) moment[0];
+        moments[i + 1] = (int64_t) moment[1];
+    }
+}
+
+/* The thread whose add wraps the low word carries into the high word, so */
+/* concurrent adds stay exact without a 128 bit compare and swap.  A reader */
+/* racing with a carry may briefly see the low word without it.             */
+static void moments_add_atomic(int64_t* moments, const uint64_t* terms)
+{
+    int i;
+
+    for (i = 0; i < HDR_MOMENTS_WORDS; i += 2)
+    {
+        uint64_t low = (uint64_t) hdr_atomic_add_fetch_64(&moments[i], (int64_t) terms[i]);
+        uint64_t high = terms[i + 1] + (low < terms[i] ? 1 : 0);
+        if (0 != high)
+        {
+            hdr_atomic_add_fetch_64(&moments[i + 1], (int64_t) high);
+        }
+    }
+}
+
+static void moments_record(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    uint64_t terms[HDR_MOMENTS_WORDS];
+    moment_terms(value, count, terms);
+    moments_add(moments_of(h), terms);
+}
 
 /* ##     ## ######## #### ##       #### ######## ##    ## */
 /* ##     ##    ##     ##  ##        ##     ##     ##  ##  */
@@ -222,15 +443,6 @@ int64_t hdr_size_of_equivalent_value_range(const struct hdr_histogram* h, int64_
     return INT64_C(1) << (h->unit_magnitude + adjusted_bucket);
 }
 
-static int64_t size_of_equivalent_value_range_given_bucket_indices(
-    const struct hdr_histogram *h,
-    int32_t bucket_index,
-    int32_t sub_bucket_index)
-{
-    const int32_t adjusted_bucket  = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
-    return INT64_C(1) << (h->unit_magnitude + adjusted_bucket);
-}
-
 static int64_t lowest_equivalent_value(const struct hdr_histogram* h, int64_t value)
 {
     int32_t bucket_index     = get_bucket_index(h, value);
@@ -238,14 +450,6 @@ static int64_t lowest_equivalent_value(const struct hdr_histogram* h, int64_t va
     return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
 }
 
-static int64_t lowest_equivalent_value_given_bucket_indices(
-    const struct hdr_histogram *h,
-    int32_t bucket_index,
-    int32_t sub_bucket_index)
-{
-    return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
-}
-
 int64_t hdr_next_non_equivalent_value(const struct hdr_histogram *h, int64_t value)
 {
     return lowest_equivalent_value(h, value) + hdr_size_of_equivalent_value_range(h, value);
@@ -313,6 +517,32 @@ void hdr_reset_internal_counters(struct hdr_histogram* h)
     }
 
     h->total_count = observed_total_count;
+
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        memset(occupancy_of(h), 0, sizeof(int64_t) * (size_t) occupancy_words(h->counts_len));
+        for (i = 0; i < h->counts_len; i++)
+        {
+            if (0 != counts_get_direct(h, i))
+            {
+                occupancy_mark(h, i);
+            }
+        }
+    }
+
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        /* Only the counts are known, so each stands at its median equivalent value. */
+        memset(moments_of(h), 0, sizeof(int64_t) * HDR_MOMENTS_WORDS);
+        for (i = 0; i < h->counts_len; i++)
+        {
+            int64_t count = counts_get_normalised(h, i);
+            if (0 != count)
+            {
+                moments_record(h, hdr_median_equivalent_value(h, hdr_value_at_index(h, i)), count);
+            }
+        }
+    }
 }
 
 static int32_t buckets_needed_to_cover_value(int64_t value, int32_t sub_bucket_count, int32_t unit_magnitude)
@@ -403,6 +633,63 @@ void hdr_init_preallocated(struct hdr_histogram* h, struct hdr_histogram_bucket_
     h->bucket_count                    = cfg->bucket_count;
     h->counts_len                      = cfg->counts_len;
     h->total_count                     = 0;
+    h->flags                           = 0;
+    h->allocation                      = NULL;
+}
+
+static int64_t* align_to_cache_line(void* p)
+{
+    const uintptr_t mask = HDR_HISTOGRAM_CACHE_LINE_SIZE - 1;
+    return (int64_t*) (((uintptr_t) p + mask) & ~mask);
+}
+
+static size_t counts_alloc_len(const struct hdr_histogram_bucket_config* cfg, uint32_t flags)
+{
+    size_t len = (size_t) cfg->counts_len;
+    if (flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        len += (size_t) occupancy_words(cfg->counts_len);
+    }
+    if (flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        len += HDR_MOMENTS_WORDS;
+    }
+
+    return len;
+}
+
+static int hdr_init_cache_aligned(
+        struct hdr_histogram_bucket_config* cfg,
+        uint32_t flags,
+        struct hdr_histogram** result)
+{
+    /* Place the struct so that min_value starts a new cache line.  Only    */
+    /* max_value and total_count follow it, so everything recording reads  */
+    /* sits on the lines before and the counts start on the line after.    */
+    const size_t config_offset =
+        (HDR_HISTOGRAM_CACHE_LINE_SIZE - offsetof(struct hdr_histogram, min_value) % HDR_HISTOGRAM_CACHE_LINE_SIZE) %
+        HDR_HISTOGRAM_CACHE_LINE_SIZE;
+    const size_t header_len = config_offset + sizeof(struct hdr_histogram) + HDR_HISTOGRAM_CACHE_LINE_SIZE;
+    struct hdr_histogram* histogram;
+    char* line;
+
+    void* allocation = hdr_calloc(
+        1, HDR_HISTOGRAM_CACHE_LINE_SIZE + header_len + counts_alloc_len(cfg, flags) * sizeof(int64_t));
+    if (!allocation)
+    {
+        return ENOMEM;
+    }
+
+    line = (char*) align_to_cache_line(allocation);
+    histogram = (struct hdr_histogram*) (line + config_offset);
+
+    hdr_init_preallocated(histogram, cfg);
+    histogram->counts = align_to_cache_line(histogram + 1);
+    histogram->flags = flags;
+    histogram->allocation = allocation;
+    *result = histogram;
+
+    return 0;
 }
 
 int hdr_init(
@@ -410,6 +697,16 @@ int hdr_init(
         int64_t highest_trackable_value,
         int significant_figures,
         struct hdr_histogram** result)
+{
+    return hdr_init_with_flags(lowest_discernible_value, highest_trackable_value, significant_figures, 0, result);
+}
+
+int hdr_init_with_flags(
+        int64_t lowest_discernible_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        uint32_t flags,
+        struct hdr_histogram** result)
 {
     int64_t* counts;
     struct hdr_histogram_bucket_config cfg;
@@ -421,7 +718,17 @@ int hdr_init(
         return r;
     }
 
-    counts = (int64_t*) hdr_calloc((size_t) cfg.counts_len, sizeof(int64_t));
+    if (flags & ~((uint32_t) (HDR_HISTOGRAM_CACHE_ALIGNED | HDR_HISTOGRAM_LAZY_MIN_MAX | HDR_HISTOGRAM_MOMENTS)))
+    {
+        return EINVAL;
+    }
+
+    if (flags & HDR_HISTOGRAM_CACHE_ALIGNED)
+    {
+        return hdr_init_cache_aligned(&cfg, flags, result);
+    }
+
+    counts = (int64_t*) hdr_calloc(counts_alloc_len(&cfg, flags), sizeof(int64_t));
     if (!counts)
     {
         return ENOMEM;
@@ -437,6 +744,7 @@ int hdr_init(
     histogram->counts = counts;
 
     hdr_init_preallocated(histogram, &cfg);
+    histogram->flags = flags;
     *result = histogram;
 
     return 0;
@@ -445,6 +753,10 @@ int hdr_init(
 void hdr_close(struct hdr_histogram* h)
 {
     if (h) {
+	if (h->allocation) {
+	    hdr_free(h->allocation);
+	    return;
+	}
 	hdr_free(h->counts);
 	hdr_free(h);
     }
@@ -462,119 +774,402 @@ void hdr_reset(struct hdr_histogram *h)
      h->min_value = INT64_MAX;
      h->max_value = 0;
      memset(h->counts, 0, (sizeof(int64_t) * h->counts_len));
+     if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+     {
+         memset(occupancy_of(h), 0, sizeof(int64_t) * (size_t) occupancy_words(h->counts_len));
+     }
+     if (h->flags & HDR_HISTOGRAM_MOMENTS)
+     {
+         memset(moments_of(h), 0, sizeof(int64_t) * HDR_MOMENTS_WORDS);
+     }
 }
 
 size_t hdr_get_memory_size(struct hdr_histogram *h)
 {
-    return sizeof(struct hdr_histogram) + h->counts_len * sizeof(int64_t);
+    size_t counts_len = (size_t) h->counts_len;
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        counts_len += (size_t) occupancy_words(h->counts_len);
+    }
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        counts_len += HDR_MOMENTS_WORDS;
+    }
+
+    return sizeof(struct hdr_histogram) + counts_len * sizeof(int64_t);
 }
 
-/* ##     ## ########  ########     ###    ######## ########  ######  */
-/* ##     ## ##     ## ##     ##   ## ##      ##    ##       ##    ## */
-/* ##     ## ##     ## ##     ##  ##   ##     ##    ##       ##       */
-/* ##     ## ########  ##     ## ##     ##    ##    ######    ######  */
-/* ##     ## ##        ##     ## #########    ##    ##             ## */
-/* ##     ## ##        ##     ## ##     ##    ##    ##       ##    ## */
-/*  #######  ##        ########  ##     ##    ##    ########  ######  */
+/* #### ######## ######## ########     ###    ########  #######  ########   ######  */
+/*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## ##    ## */
+/*  ##     ##    ##       ##     ##  ##   ##     ##    ##     ## ##     ## ##       */
+/*  ##     ##    ######   ########  ##     ##    ##    ##     ## ########   ######  */
+/*  ##     ##    ##       ##   ##   #########    ##    ##     ## ##   ##         ## */
+/*  ##     ##    ##       ##    ##  ##     ##    ##    ##     ## ##    ##  ##    ## */
+/* ####    ##    ######## ##     ## ##     ##    ##     #######  ##     ##  ######  */
 
 
-bool hdr_record_value(struct hdr_histogram* h, int64_t value)
+enum iter_type
 {
-    return hdr_record_values(h, value, 1);
-}
+    ITER_ALL_VALUES,
+    ITER_PERCENTILES,
+    ITER_RECORDED,
+    ITER_LINEAR,
+    ITER_LOG
+};
 
-bool hdr_record_value_atomic(struct hdr_histogram* h, int64_t value)
+static bool has_next(struct hdr_iter* iter)
 {
-    return hdr_record_values_atomic(h, value, 1);
+    return iter->cumulative_count < iter->total_count;
 }
 
-bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count)
+/* Steps [lowest, highest] from the equivalent value range of index - 1 to   */
+/* that of index, instead of recomputing it from the value.  Every bucket    */
+/* after the first starts half way through its sub buckets and spans twice   */
+/* the width of the one before, so the range only grows at a bucket's start. */
+static void next_equivalent_range(const struct hdr_histogram* h, int32_t index, int64_t* lowest, int64_t* highest)
 {
-    int32_t counts_index;
+    int64_t size_of_equivalent_value_range;
 
-    if (value < 0)
+    if (0 == index)
     {
-        return false;
+        *lowest = 0;
+        size_of_equivalent_value_range = INT64_C(1) << h->unit_magnitude;
+    }
+    else
+    {
+        size_of_equivalent_value_range = *highest - *lowest + 1;
+        *lowest = *highest + 1;
+
+        if (h->sub_bucket_count <= index && 0 == (index & (h->sub_bucket_half_count - 1)))
+        {
+            size_of_equivalent_value_range <<= 1;
+        }
     }
 
-    counts_index = counts_index_for(h, value);
+    *highest = *lowest + size_of_equivalent_value_range - 1;
+}
 
-    if (counts_index < 0 || h->counts_len <= counts_index)
+static bool move_next(struct hdr_iter* iter)
+{
+    const struct hdr_histogram* h = iter->h;
+    const int32_t index = ++iter->counts_index;
+    int64_t lowest = iter->lowest_equivalent_value;
+    int64_t highest = iter->highest_equivalent_value;
+
+    if (index >= h->counts_len)
     {
         return false;
     }
 
-    counts_inc_normalised(h, counts_index, count);
-    update_min_max(h, value);
+    next_equivalent_range(h, index, &lowest, &highest);
+    iter->count = counts_get_normalised(h, index);
+    iter->cumulative_count += iter->count;
+    iter->value = lowest;
+    iter->lowest_equivalent_value = lowest;
+    iter->highest_equivalent_value = highest;
+    iter->median_equivalent_value = lowest + ((highest - lowest + 1) >> 1);
 
     return true;
 }
 
-bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count)
+static int64_t peek_next_value_from_index(struct hdr_iter* iter)
 {
-    int32_t counts_index;
+    return iter->counts_index < 0 ? 0 : iter->highest_equivalent_value + 1;
+}
 
-    if (value < 0)
+static bool next_value_greater_than_reporting_level_upper_bound(
+    struct hdr_iter *iter, int64_t reporting_level_upper_bound)
+{
+    if (iter->counts_index >= iter->h->counts_len)
     {
         return false;
     }
 
-    counts_index = counts_index_for(h, value);
+    return peek_next_value_from_index(iter) > reporting_level_upper_bound;
+}
 
-    if (counts_index < 0 || h->counts_len <= counts_index)
+static bool basic_iter_next(struct hdr_iter *iter)
+{
+    if (!has_next(iter) || iter->counts_index >= iter->h->counts_len)
     {
         return false;
     }
 
-    counts_inc_normalised_atomic(h, counts_index, count);
-    update_min_max_atomic(h, value);
+    move_next(iter);
 
     return true;
 }
 
-bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
-{
-    return hdr_record_corrected_values(h, value, 1, expected_interval);
-}
-
-bool hdr_record_corrected_value_atomic(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+static void update_iterated_values(struct hdr_iter* iter, int64_t new_value_iterated_to)
 {
-    return hdr_record_corrected_values_atomic(h, value, 1, expected_interval);
+    iter->value_iterated_from = iter->value_iterated_to;
+    iter->value_iterated_to = new_value_iterated_to;
 }
 
-bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+static bool all_values_iter_next(struct hdr_iter* iter)
 {
-    int64_t missing_value;
-
-    if (!hdr_record_values(h, value, count))
-    {
-        return false;
-    }
-
-    if (expected_interval <= 0 || value <= expected_interval)
-    {
-        return true;
-    }
+    bool result = move_next(iter);
 
-    missing_value = value - expected_interval;
-    for (; missing_value >= expected_interval; missing_value -= expected_interval)
+    if (result)
     {
-        if (!hdr_record_values(h, missing_value, count))
-        {
-            return false;
-        }
+        update_iterated_values(iter, iter->value);
     }
 
-    return true;
+    return result;
 }
 
-bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+void hdr_iter_init(struct hdr_iter* iter, const struct hdr_histogram* h)
 {
-    int64_t missing_value;
+    iter->h = h;
 
-    if (!hdr_record_values_atomic(h, value, count))
-    {
-        return false;
+    iter->counts_index = -1;
+    iter->total_count = h->total_count;
+    iter->count = 0;
+    iter->cumulative_count = 0;
+    iter->value = 0;
+    iter->highest_equivalent_value = 0;
+    iter->lowest_equivalent_value = 0;
+    iter->median_equivalent_value = 0;
+    iter->value_iterated_from = 0;
+    iter->value_iterated_to = 0;
+
+    iter->_type = ITER_ALL_VALUES;
+}
+
+/* ########  ########  ######   #######  ########  ########  ######## ########   */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##     ## ##       ##     ##  */
+/* ##     ## ##       ##       ##     ## ##     ## ##     ## ##       ##     ##  */
+/* ########  ######   ##       ##     ## ########  ##     ## ######   ##     ##  */
+/* ##   ##   ##       ##       ##     ## ##   ##   ##     ## ##       ##     ##  */
+/* ##    ##  ##       ##    ## ##     ## ##    ##  ##     ## ##       ##     ##  */
+/* ##     ## ########  ######   #######  ##     ## ########  ######## ########   */
+
+
+static bool recorded_iter_next(struct hdr_iter* iter)
+{
+    while (basic_iter_next(iter))
+    {
+        if (iter->count != 0)
+        {
+            update_iterated_values(iter, iter->value);
+
+            iter->specifics.recorded.count_added_in_this_iteration_step = iter->count;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void hdr_iter_recorded_init(struct hdr_iter* iter, const struct hdr_histogram* h)
+{
+    hdr_iter_init(iter, h);
+
+    iter->specifics.recorded.count_added_in_this_iteration_step = 0;
+
+    iter->_type = ITER_RECORDED;
+}
+
+size_t hdr_iter_recorded_runs(struct hdr_iter* iter, struct hdr_iter_run* runs, size_t runs_len)
+{
+    /* Work on locals so stores to runs cannot alias the iterator's state. */
+    const struct hdr_histogram* h = iter->h;
+    int32_t index = iter->counts_index;
+    int64_t lowest = iter->lowest_equivalent_value;
+    int64_t highest = iter->highest_equivalent_value;
+    int64_t cumulative_count = iter->cumulative_count;
+    int64_t count = iter->count;
+    int64_t value_iterated_from = iter->value_iterated_from;
+    int64_t value_iterated_to = iter->value_iterated_to;
+    size_t runs_written = 0;
+
+    while (runs_written < runs_len && cumulative_count < iter->total_count && index + 1 < h->counts_len)
+    {
+        index++;
+        next_equivalent_range(h, index, &lowest, &highest);
+        count = counts_get_normalised(h, index);
+
+        if (0 != count)
+        {
+            cumulative_count += count;
+            value_iterated_from = value_iterated_to;
+            value_iterated_to = lowest;
+
+            runs[runs_written].lowest_value = lowest;
+            runs[runs_written].highest_value = highest;
+            runs[runs_written].count = count;
+            runs_written++;
+        }
+    }
+
+    iter->counts_index = index;
+    iter->count = count;
+    iter->cumulative_count = cumulative_count;
+    iter->value = lowest;
+    iter->lowest_equivalent_value = lowest;
+    iter->highest_equivalent_value = highest;
+    iter->median_equivalent_value = lowest + ((highest - lowest + 1) >> 1);
+    iter->value_iterated_from = value_iterated_from;
+    iter->value_iterated_to = value_iterated_to;
+    iter->specifics.recorded.count_added_in_this_iteration_step = count;
+
+    return runs_written;
+}
+
+
+/* ##     ## ########  ########     ###    ######## ########  ######  */
+/* ##     ## ##     ## ##     ##   ## ##      ##    ##       ##    ## */
+/* ##     ## ##     ## ##     ##  ##   ##     ##    ##       ##       */
+/* ##     ## ########  ##     ## ##     ##    ##    ######    ######  */
+/* ##     ## ##        ##     ## #########    ##    ##             ## */
+/* ##     ## ##        ##     ## ##     ##    ##    ##       ##    ## */
+/*  #######  ##        ########  ##     ##    ##    ########  ######  */
+
+
+bool hdr_record_value(struct hdr_histogram* h, int64_t value)
+{
+    bool result;
+    HDR_SELF_INSTRUMENT_BEGIN(record);
+
+    result = hdr_record_values(h, value, 1);
+
+    HDR_SELF_INSTRUMENT_END(record, HDR_SELF_RECORD_VALUE);
+    return result;
+}
+
+bool hdr_record_value_atomic(struct hdr_histogram* h, int64_t value)
+{
+    return hdr_record_values_atomic(h, value, 1);
+}
+
+bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    int32_t counts_index;
+
+    if (value < 0)
+    {
+        return false;
+    }
+
+    counts_index = counts_index_for(h, value);
+
+    if (counts_index < 0 || h->counts_len <= counts_index)
+    {
+        return false;
+    }
+
+    counts_inc_normalised(h, counts_index, count);
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        occupancy_mark(h, counts_index);
+    }
+    else
+    {
+        update_min_max(h, value);
+    }
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        moments_record(h, value, count);
+    }
+
+    return true;
+}
+
+void hdr_record_values_at_index(struct hdr_histogram* h, int32_t index, int64_t count)
+{
+    counts_inc_normalised(h, index, count);
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        occupancy_mark(h, index);
+    }
+    else
+    {
+        update_min_max(h, hdr_value_at_index(h, index));
+    }
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        moments_record(h, hdr_median_equivalent_value(h, hdr_value_at_index(h, index)), count);
+    }
+}
+
+bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    int32_t counts_index;
+
+    if (value < 0)
+    {
+        return false;
+    }
+
+    counts_index = counts_index_for(h, value);
+
+    if (counts_index < 0 || h->counts_len <= counts_index)
+    {
+        return false;
+    }
+
+    counts_inc_normalised_atomic(h, counts_index, count);
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        occupancy_mark_atomic(h, counts_index);
+    }
+    else
+    {
+        update_min_max_atomic(h, value);
+    }
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        uint64_t terms[HDR_MOMENTS_WORDS];
+        moment_terms(value, count, terms);
+        moments_add_atomic(moments_of(h), terms);
+    }
+
+    return true;
+}
+
+bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+{
+    return hdr_record_corrected_values(h, value, 1, expected_interval);
+}
+
+bool hdr_record_corrected_value_atomic(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+{
+    return hdr_record_corrected_values_atomic(h, value, 1, expected_interval);
+}
+
+bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+{
+    int64_t missing_value;
+
+    if (!hdr_record_values(h, value, count))
+    {
+        return false;
+    }
+
+    if (expected_interval <= 0 || value <= expected_interval)
+    {
+        return true;
+    }
+
+    missing_value = value - expected_interval;
+    for (; missing_value >= expected_interval; missing_value -= expected_interval)
+    {
+        if (!hdr_record_values(h, missing_value, count))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+{
+    int64_t missing_value;
+
+    if (!hdr_record_values_atomic(h, value, count))
+    {
+        return false;
     }
 
     if (expected_interval <= 0 || value <= expected_interval)
@@ -594,23 +1189,586 @@ bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value,
     return true;
 }
 
+static int32_t highest_recorded_index(const struct hdr_histogram* h)
+{
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        return highest_occupied_index(h);
+    }
+
+    return 0 == h->max_value ? 0 : counts_index_for(h, h->max_value);
+}
+
+/* Histograms with the same bucket layout can be added count by count, */
+/* without mapping each recorded value back to an index.                */
+static bool same_layout(const struct hdr_histogram* a, const struct hdr_histogram* b)
+{
+    return a->counts_len == b->counts_len &&
+        a->unit_magnitude == b->unit_magnitude &&
+        a->sub_bucket_half_count_magnitude == b->sub_bucket_half_count_magnitude &&
+        0 == a->normalizing_index_offset &&
+        0 == b->normalizing_index_offset;
+}
+
+static void add_min_max(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    bool lazy = 0 != (from->flags & HDR_HISTOGRAM_LAZY_MIN_MAX);
+    int64_t min = lazy ? hdr_min(from) : from->min_value;
+
+    /* min is INT64_MAX when only zeros have been recorded. */
+    if (INT64_MAX != min)
+    {
+        update_min_max(h, min);
+    }
+    update_min_max(h, lazy ? hdr_max(from) : from->max_value);
+}
+
+static void add_counts(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    int64_t* dst = h->counts;
+    const int64_t* src = from->counts;
+    int64_t total = 0;
+    int32_t i;
+
+    for (i = 0; i < from->counts_len; i++)
+    {
+        dst[i] += src[i];
+        total += src[i];
+    }
+
+    h->total_count += total;
+
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        for (i = 0; i < from->counts_len; i++)
+        {
+            if (0 != src[i])
+            {
+                occupancy_mark(h, i);
+            }
+        }
+    }
+    else if (0 != total)
+    {
+        add_min_max(h, from);
+    }
+}
+
+/* When h is no finer than from, every bucket of from lies within a bucket */
+/* of h, and each bucket of h covers a contiguous run of counts of from.   */
+static bool coarser_layout(const struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    return h->unit_magnitude >= from->unit_magnitude &&
+        h->sub_bucket_half_count_magnitude <= from->sub_bucket_half_count_magnitude &&
+        0 == h->normalizing_index_offset &&
+        0 == from->normalizing_index_offset;
+}
+
+static int64_t add_counts_downsampled(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    const int64_t* src = from->counts;
+    int64_t total = 0;
+    int64_t dropped = 0;
+    int32_t highest_index = -1;
+    int32_t i = 0;
+
+    while (i < from->counts_len)
+    {
+        int64_t value = hdr_value_at_index(from, i);
+        int32_t index = counts_index_for(h, value);
+        int64_t width = hdr_size_of_equivalent_value_range(h, value);
+        int64_t region_len = 1;
+        int32_t buckets = 1;
+        int32_t group;
+
+        if (h->counts_len <= index)
+        {
+            for (; i < from->counts_len; i++)
+            {
+                dropped += src[i];
+            }
+            break;
+        }
+
+        /* Bucket widths only change at powers of two, so up to the next one */
+        /* every bucket of h takes the same number of counts from from.       */
+        if (0 != value)
+        {
+            int64_t high_bit = INT64_C(1) << (63 - count_leading_zeros_64(value));
+            region_len = high_bit - (value - high_bit);
+        }
+
+        if (width <= region_len)
+        {
+            group = (int32_t) (width / hdr_size_of_equivalent_value_range(from, value));
+            buckets = (int32_t) (region_len / width);
+            buckets = buckets < h->counts_len - index ? buckets : h->counts_len - index;
+        }
+        else
+        {
+            group = counts_index_for(from, highest_equivalent_value(h, value)) + 1 - i;
+        }
+
+        for (; 0 < buckets && i < from->counts_len; buckets--, index++)
+        {
+            int32_t end = group < from->counts_len - i ? i + group : from->counts_len;
+            int64_t sum = 0;
+
+            for (; i < end; i++)
+            {
+                sum += src[i];
+            }
+
+            if (0 != sum)
+            {
+                h->counts[index] += sum;
+                total += sum;
+                highest_index = index;
+                if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+                {
+                    occupancy_mark(h, index);
+                }
+            }
+        }
+    }
+
+    h->total_count += total;
+
+    if (0 == (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX) && 0 != total)
+    {
+        bool lazy = 0 != (from->flags & HDR_HISTOGRAM_LAZY_MIN_MAX);
+        int64_t min = lazy ? hdr_min(from) : from->min_value;
+
+        if (INT64_MAX != min)
+        {
+            update_min_max(h, min);
+        }
+        if (0 == dropped)
+        {
+            update_min_max(h, lazy ? hdr_max(from) : from->max_value);
+        }
+        else
+        {
+            update_min_max(h, hdr_value_at_index(h, highest_index));
+        }
+    }
+
+    return dropped;
+}
+
+const int64_t* hdr_moments(const struct hdr_histogram* h)
+{
+    return (h->flags & HDR_HISTOGRAM_MOMENTS) ? moments_of(h) : NULL;
+}
+
+void hdr_set_moments(struct hdr_histogram* h, const int64_t* moments)
+{
+    memcpy(moments_of(h), moments, sizeof(int64_t) * HDR_MOMENTS_WORDS);
+}
+
+void hdr_add_moments(struct hdr_histogram* h, const int64_t* moments)
+{
+    uint64_t terms[HDR_MOMENTS_WORDS];
+    int i;
+
+    for (i = 0; i < HDR_MOMENTS_WORDS; i++)
+    {
+        terms[i] = (uint64_t) moments[i];
+    }
+    moments_add(moments_of(h), terms);
+}
+
+/* Adds the moments of from, or if it has none the moments of its counts */
+/* taken at their median equivalent values, as hdr_mean does.             */
+/* The exact moments of from only hold when none of its values were dropped, */
+/* otherwise each value kept contributes the median of its range.            */
+static void add_moments(struct hdr_histogram* h, const struct hdr_histogram* from, int64_t dropped)
+{
+    struct hdr_iter iter;
+
+    if ((from->flags & HDR_HISTOGRAM_MOMENTS) && 0 == dropped)
+    {
+        hdr_add_moments(h, moments_of(from));
+        return;
+    }
+
+    hdr_iter_recorded_init(&iter, from);
+    while (recorded_iter_next(&iter))
+    {
+        if (counts_index_for(h, iter.value) < h->counts_len)
+        {
+            moments_record(h, iter.median_equivalent_value, iter.count);
+        }
+    }
+}
+
 int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
 {
     struct hdr_iter iter;
+    int64_t moments[HDR_MOMENTS_WORDS];
     int64_t dropped = 0;
-    hdr_iter_recorded_init(&iter, from);
 
-    while (hdr_iter_next(&iter))
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
     {
-        int64_t value = iter.value;
-        int64_t count = iter.count;
+        memcpy(moments, moments_of(h), sizeof(moments));
+    }
+
+    if (same_layout(h, from))
+    {
+        add_counts(h, from);
+    }
+    else if (coarser_layout(h, from))
+    {
+        dropped = add_counts_downsampled(h, from);
+    }
+    else
+    {
+        hdr_iter_recorded_init(&iter, from);
+
+        while (recorded_iter_next(&iter))
+        {
+            int64_t value = iter.value;
+            int64_t count = iter.count;
+
+            if (!hdr_record_values(h, value, count))
+            {
+                dropped += count;
+            }
+        }
+    }
+
+    /* Recording above took each value at the bottom of its range. */
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        hdr_set_moments(h, moments);
+        add_moments(h, from, dropped);
+    }
+
+    return dropped;
+}
+
+int hdr_downsample(
+        const struct hdr_histogram* h,
+        int64_t lowest_discernible_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        struct hdr_histogram** result)
+{
+    struct hdr_histogram* downsampled;
+    int rc = hdr_init_with_flags(
+        lowest_discernible_value, highest_trackable_value, significant_figures, h->flags, &downsampled);
+    if (rc)
+    {
+        return rc;
+    }
+
+    hdr_add(downsampled, h);
+    *result = downsampled;
+
+    return 0;
+}
+
+void hdr_add_many_options_init(struct hdr_add_many_options* options)
+{
+    options->threads = 1;
+    options->run_tasks = NULL;
+    options->pool = NULL;
+}
+
+/* Counts added per input before moving on, small enough that the block of */
+/* the target stays in L1 while every input is added to it.                */
+#define ADD_MANY_BLOCK_LEN 1024
+
+struct add_many_context
+{
+    struct hdr_histogram* h;
+    const struct hdr_histogram* const* from;
+    const size_t* members;
+    const int32_t* limits;
+    size_t members_len;
+    int32_t slice_len;
+    int64_t* totals;
+};
+
+struct add_many_worker
+{
+    struct add_many_context* context;
+    int32_t slice;
+    hdr_thread thread;
+};
+
+/* Each slice of the counts of h is written by one task only. */
+static void add_many_slice(void* arg, int32_t slice)
+{
+    struct add_many_context* context = (struct add_many_context*) arg;
+    int64_t* dst = context->h->counts;
+    int32_t start = slice * context->slice_len;
+    int32_t end = context->h->counts_len - start < context->slice_len ?
+        context->h->counts_len : start + context->slice_len;
+    int64_t total = 0;
+    int32_t block;
+    size_t m;
+
+    for (block = start; block < end; block += ADD_MANY_BLOCK_LEN)
+    {
+        int32_t block_end = end - block < ADD_MANY_BLOCK_LEN ? end : block + ADD_MANY_BLOCK_LEN;
+
+        for (m = 0; m < context->members_len; m++)
+        {
+            const int64_t* src = context->from[context->members[m]]->counts;
+            int32_t limit = context->limits[m] < block_end ? context->limits[m] : block_end;
+            int32_t i;
+
+            for (i = block; i < limit; i++)
+            {
+                dst[i] += src[i];
+                total += src[i];
+            }
+        }
+    }
+
+    context->totals[slice] = total;
+}
+
+static void* add_many_worker_run(void* arg)
+{
+    struct add_many_worker* worker = (struct add_many_worker*) arg;
+    add_many_slice(worker->context, worker->slice);
+    return NULL;
+}
+
+/* Runs every slice, slice 0 on the calling thread.  A slice whose thread */
+/* can not be started is run on the calling thread instead.                */
+static void add_many_run_threads(struct add_many_context* context, int32_t tasks)
+{
+    struct add_many_worker* workers;
+    bool* started;
+    int32_t w;
+
+    workers = (struct add_many_worker*) hdr_calloc((size_t) tasks, sizeof(struct add_many_worker));
+    started = (bool*) hdr_calloc((size_t) tasks, sizeof(bool));
+    if (NULL == workers || NULL == started)
+    {
+        for (w = 0; w < tasks; w++)
+        {
+            add_many_slice(context, w);
+        }
+        hdr_free(workers);
+        hdr_free(started);
+        return;
+    }
+
+    for (w = 1; w < tasks; w++)
+    {
+        workers[w].context = context;
+        workers[w].slice = w;
+        started[w] = 0 == hdr_thread_create(&workers[w].thread, add_many_worker_run, &workers[w]);
+    }
+
+    add_many_slice(context, 0);
+
+    for (w = 1; w < tasks; w++)
+    {
+        if (started[w])
+        {
+            hdr_thread_join(&workers[w].thread);
+        }
+        else
+        {
+            add_many_slice(context, w);
+        }
+    }
+
+    hdr_free(workers);
+    hdr_free(started);
+}
+
+/* Adds members of from, which all have the layout of h, to h.  Rather */
+/* than reducing pairs in a tree, which needs intermediate histograms, */
+/* the counts of h are split into slices that each task sums alone.    */
+static int add_many_same_layout(
+    struct hdr_histogram* h,
+    const struct hdr_histogram* const* from,
+    const size_t* members,
+    size_t members_len,
+    const struct hdr_add_many_options* options)
+{
+    struct add_many_context context;
+    int32_t* limits;
+    int64_t* totals;
+    int32_t limit = 0;
+    int32_t tasks, slices;
+    size_t m;
+    int32_t i;
+
+    limits = (int32_t*) hdr_calloc(members_len, sizeof(int32_t));
+    totals = (int64_t*) hdr_calloc((size_t) (options->threads < 1 ? 1 : options->threads), sizeof(int64_t));
+    if (NULL == limits || NULL == totals)
+    {
+        hdr_free(limits);
+        hdr_free(totals);
+        return ENOMEM;
+    }
+
+    for (m = 0; m < members_len; m++)
+    {
+        limits[m] = highest_recorded_index(from[members[m]]) + 1;
+        limit = limits[m] > limit ? limits[m] : limit;
+    }
+
+    /* Slices are whole cache lines and at least a block long. */
+    tasks = options->threads < 1 ? 1 : options->threads;
+    slices = (limit + ADD_MANY_BLOCK_LEN - 1) / ADD_MANY_BLOCK_LEN;
+    tasks = slices < tasks ? (slices < 1 ? 1 : slices) : tasks;
+
+    context.h = h;
+    context.from = from;
+    context.members = members;
+    context.limits = limits;
+    context.members_len = members_len;
+    context.slice_len = (((limit + tasks - 1) / tasks) + 7) & ~7;
+    context.totals = totals;
+
+    if (1 == tasks)
+    {
+        add_many_slice(&context, 0);
+    }
+    else if (NULL != options->run_tasks)
+    {
+        options->run_tasks(options->pool, add_many_slice, &context, tasks);
+    }
+    else
+    {
+        add_many_run_threads(&context, tasks);
+    }
+
+    for (i = 0; i < tasks; i++)
+    {
+        h->total_count += totals[i];
+    }
+
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        for (i = 0; i < limit; i++)
+        {
+            if (0 != h->counts[i])
+            {
+                occupancy_mark(h, i);
+            }
+        }
+    }
+
+    for (m = 0; m < members_len; m++)
+    {
+        const struct hdr_histogram* member = from[members[m]];
+        if (0 == (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX) && 0 != member->total_count)
+        {
+            add_min_max(h, member);
+        }
+        if (h->flags & HDR_HISTOGRAM_MOMENTS)
+        {
+            add_moments(h, member, 0);
+        }
+    }
+
+    hdr_free(limits);
+    hdr_free(totals);
+
+    return 0;
+}
+
+int64_t hdr_add_many(
+        struct hdr_histogram* h,
+        const struct hdr_histogram* const* from,
+        size_t from_len,
+        const struct hdr_add_many_options* options)
+{
+    struct hdr_add_many_options defaults;
+    size_t* members = NULL;
+    bool* grouped = NULL;
+    int64_t dropped = 0;
+    size_t i, j;
+
+    if (NULL == options)
+    {
+        hdr_add_many_options_init(&defaults);
+        options = &defaults;
+    }
+
+    members = (size_t*) hdr_calloc(from_len + 1, sizeof(size_t));
+    grouped = (bool*) hdr_calloc(from_len + 1, sizeof(bool));
+    if (NULL == members || NULL == grouped)
+    {
+        hdr_free(members);
+        hdr_free(grouped);
+
+        for (i = 0; i < from_len; i++)
+        {
+            dropped += hdr_add(h, from[i]);
+        }
+
+        return dropped;
+    }
+
+    /* Inputs with the layout of h are summed straight into it, any other */
+    /* group sharing a layout is summed into a histogram of that layout    */
+    /* first, which is then added to h once.                               */
+    for (i = 0; i < from_len; i++)
+    {
+        const struct hdr_histogram* first = from[i];
+        struct hdr_histogram* target = h;
+        size_t members_len = 0;
+
+        if (grouped[i])
+        {
+            continue;
+        }
+
+        for (j = i; j < from_len; j++)
+        {
+            if (!grouped[j] && same_layout(first, from[j]))
+            {
+                members[members_len++] = j;
+                grouped[j] = true;
+            }
+        }
+
+        if (!same_layout(h, first))
+        {
+            if (1 == members_len ||
+                0 != hdr_init_with_flags(
+                    first->lowest_discernible_value,
+                    first->highest_trackable_value,
+                    first->significant_figures,
+                    h->flags & HDR_HISTOGRAM_MOMENTS,
+                    &target))
+            {
+                for (j = 0; j < members_len; j++)
+                {
+                    dropped += hdr_add(h, from[members[j]]);
+                }
+                continue;
+            }
+        }
 
-        if (!hdr_record_values(h, value, count))
+        if (0 != add_many_same_layout(target, from, members, members_len, options))
         {
-            dropped += count;
+            for (j = 0; j < members_len; j++)
+            {
+                dropped += hdr_add(target, from[members[j]]);
+            }
+        }
+
+        if (target != h)
+        {
+            dropped += hdr_add(h, target);
+            hdr_close(target);
         }
     }
 
+    hdr_free(members);
+    hdr_free(grouped);
+
     return dropped;
 }
 
@@ -621,7 +1779,7 @@ int64_t hdr_add_while_correcting_for_coordinated_omission(
     int64_t dropped = 0;
     hdr_iter_recorded_init(&iter, from);
 
-    while (hdr_iter_next(&iter))
+    while (recorded_iter_next(&iter))
     {
         int64_t value = iter.value;
         int64_t count = iter.count;
@@ -648,6 +1806,12 @@ int64_t hdr_add_while_correcting_for_coordinated_omission(
 
 int64_t hdr_max(const struct hdr_histogram* h)
 {
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        int32_t index = highest_occupied_index(h);
+        return index < 0 ? 0 : highest_equivalent_value(h, hdr_value_at_index(h, index));
+    }
+
     if (0 == h->max_value)
     {
         return 0;
@@ -658,6 +1822,17 @@ int64_t hdr_max(const struct hdr_histogram* h)
 
 int64_t hdr_min(const struct hdr_histogram* h)
 {
+    if (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX)
+    {
+        int32_t index = lowest_occupied_index(h);
+        if (index < 0)
+        {
+            return INT64_MAX;
+        }
+
+        return 0 == index ? 0 : hdr_value_at_index(h, index);
+    }
+
     if (0 < hdr_count_at_index(h, 0))
     {
         return 0;
@@ -666,6 +1841,26 @@ int64_t hdr_min(const struct hdr_histogram* h)
     return non_zero_min(h);
 }
 
+/* Ranks in the upper half are found by walking down from the max bucket,  */
+/* so tail percentiles only touch the few buckets above them.              */
+static int64_t get_value_from_idx_down_to_count(const struct hdr_histogram* h, int64_t count_at_percentile)
+{
+    int64_t count_to_idx = h->total_count;
+    int32_t idx = highest_recorded_index(h);
+
+    for (idx = idx < h->counts_len ? idx : h->counts_len - 1; 0 <= idx; idx--)
+    {
+        int64_t count_below_idx = count_to_idx - h->counts[idx];
+        if (count_below_idx < count_at_percentile)
+        {
+            return hdr_value_at_index(h, idx);
+        }
+        count_to_idx = count_below_idx;
+    }
+
+    return 0;
+}
+
 static int64_t get_value_from_idx_up_to_count(const struct hdr_histogram* h, int64_t count_at_percentile)
 {
     int64_t count_to_idx = 0;
@@ -683,13 +1878,22 @@ static int64_t get_value_from_idx_up_to_count(const struct hdr_histogram* h, int
     return 0;
 }
 
+static int64_t get_value_from_idx_at_count(const struct hdr_histogram* h, int64_t count_at_percentile)
+{
+    if (h->total_count / 2 < count_at_percentile && count_at_percentile <= h->total_count)
+    {
+        return get_value_from_idx_down_to_count(h, count_at_percentile);
+    }
+
+    return get_value_from_idx_up_to_count(h, count_at_percentile);
+}
 
 int64_t hdr_value_at_percentile(const struct hdr_histogram* h, double percentile)
 {
     double requested_percentile = percentile < 100.0 ? percentile : 100.0;
     int64_t count_at_percentile =
         (int64_t) (((requested_percentile / 100) * h->total_count) + 0.5);
-    int64_t value_from_idx = get_value_from_idx_up_to_count(h, count_at_percentile);
+    int64_t value_from_idx = get_value_from_idx_at_count(h, count_at_percentile);
     if (percentile == 0.0)
     {
         return lowest_equivalent_value(h, value_from_idx);
@@ -719,12 +1923,12 @@ int hdr_value_at_percentiles(const struct hdr_histogram *h, const double *percen
     hdr_iter_init(&iter, h);
     int64_t total = 0;
     size_t at_pos = 0;
-    while (hdr_iter_next(&iter) && at_pos < length)
+    while (at_pos < length && all_values_iter_next(&iter))
     {
         total += iter.count;
         while (at_pos < length && total >= values[at_pos])
         {
-            values[at_pos] = highest_equivalent_value(h, iter.value);
+            values[at_pos] = iter.highest_equivalent_value;
             at_pos++;
         }
     }
@@ -736,32 +1940,76 @@ double hdr_mean(const struct hdr_histogram* h)
     struct hdr_iter iter;
     int64_t total = 0;
 
+    if (h->flags & HDR_HISTOGRAM_MOMENTS)
+    {
+        const int64_t* moments = moments_of(h);
+        uint64_t sum[2];
+
+        sum[0] = (uint64_t) moments[HDR_MOMENT_SUM];
+        sum[1] = (uint64_t) moments[HDR_MOMENT_SUM + 1];
+        return double_of_128(sum) / h->total_count;
+    }
+
     hdr_iter_init(&iter, h);
 
-    while (hdr_iter_next(&iter))
+    while (all_values_iter_next(&iter))
     {
         if (0 != iter.count)
         {
-            total += iter.count * hdr_median_equivalent_value(h, iter.value);
+            total += iter.count * iter.median_equivalent_value;
         }
     }
 
     return (total * 1.0) / h->total_count;
 }
 
+/* Sum of squared deviations from the mean.  Taking the deviations from the */
+/* integer q nearest below the mean keeps the 128 bit arithmetic exact,     */
+/* sum((x - q)^2) = sum(x^2) - q * (2 * sum(x) - n * q), and rounding only  */
+/* enters through the small correction n * (mean - q)^2.                    */
+static double moments_squared_deviation(const struct hdr_histogram* h, double mean)
+{
+    const int64_t* moments = moments_of(h);
+    uint64_t q = mean <= 0 ? 0 : mean < (double) INT64_MAX ? (uint64_t) mean : (uint64_t) INT64_MAX;
+    uint64_t deviation[2], term[2], n_q[2];
+    double offset = mean - (double) q;
+
+    term[0] = (uint64_t) moments[HDR_MOMENT_SUM];
+    term[1] = (uint64_t) moments[HDR_MOMENT_SUM + 1];
+    add_128(term, term);
+    n_q[0] = multiply_64((uint64_t) h->total_count, q, &n_q[1]);
+    negate_128(n_q);
+    add_128(term, n_q);
+    multiply_128(term, q, deviation);
+    negate_128(deviation);
+
+    term[0] = (uint64_t) moments[HDR_MOMENT_SUM_OF_SQUARES];
+    term[1] = (uint64_t) moments[HDR_MOMENT_SUM_OF_SQUARES + 1];
+    add_128(deviation, term);
+
+    return double_of_128(deviation) - (double) h->total_count * offset * offset;
+}
+
 double hdr_stddev(const struct hdr_histogram* h)
 {
     double mean = hdr_mean(h);
     double geometric_dev_total = 0.0;
 
     struct hdr_iter iter;
+
+    if ((h->flags & HDR_HISTOGRAM_MOMENTS) && 0 < h->total_count)
+    {
+        double squared_deviation = moments_squared_deviation(h, mean);
+        return sqrt((squared_deviation < 0 ? 0 : squared_deviation) / h->total_count);
+    }
+
     hdr_iter_init(&iter, h);
 
-    while (hdr_iter_next(&iter))
+    while (all_values_iter_next(&iter))
     {
         if (0 != iter.count)
         {
-            double dev = (hdr_median_equivalent_value(h, iter.value) * 1.0) - mean;
+            double dev = (iter.median_equivalent_value * 1.0) - mean;
             geometric_dev_total += (dev * dev) * iter.count;
         }
     }
@@ -789,117 +2037,77 @@ int64_t hdr_count_at_index(const struct hdr_histogram* h, int32_t index)
     return counts_get_normalised(h, index);
 }
 
-
-/* #### ######## ######## ########     ###    ########  #######  ########   ######  */
-/*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## ##    ## */
-/*  ##     ##    ##       ##     ##  ##   ##     ##    ##     ## ##     ## ##       */
-/*  ##     ##    ######   ########  ##     ##    ##    ##     ## ########   ######  */
-/*  ##     ##    ##       ##   ##   #########    ##    ##     ## ##   ##         ## */
-/*  ##     ##    ##       ##    ##  ##     ##    ##    ##     ## ##    ##  ##    ## */
-/* ####    ##    ######## ##     ## ##     ##    ##     #######  ##     ##  ######  */
-
-
-static bool has_buckets(struct hdr_iter* iter)
-{
-    return iter->counts_index < iter->h->counts_len;
-}
-
-static bool has_next(struct hdr_iter* iter)
-{
-    return iter->cumulative_count < iter->total_count;
-}
-
-static bool move_next(struct hdr_iter* iter)
+/* Clamps the index of value to the counts, -1 for values below zero. */
+static int32_t bounded_counts_index_for(const struct hdr_histogram* h, int64_t value)
 {
-    iter->counts_index++;
+    int32_t index;
 
-    if (!has_buckets(iter))
+    if (value < 0)
     {
-        return false;
+        return -1;
     }
 
-    iter->count = counts_get_normalised(iter->h, iter->counts_index);
-    iter->cumulative_count += iter->count;
-    const int64_t value = hdr_value_at_index(iter->h, iter->counts_index);
-    const int32_t bucket_index = get_bucket_index(iter->h, value);
-    const int32_t sub_bucket_index = get_sub_bucket_index(value, bucket_index, iter->h->unit_magnitude);
-    const int64_t leq = lowest_equivalent_value_given_bucket_indices(iter->h, bucket_index, sub_bucket_index);
-    const int64_t size_of_equivalent_value_range = size_of_equivalent_value_range_given_bucket_indices(
-        iter->h, bucket_index, sub_bucket_index);
-    iter->lowest_equivalent_value = leq;
-    iter->value = value;
-    iter->highest_equivalent_value = leq + size_of_equivalent_value_range - 1;
-    iter->median_equivalent_value = leq + (size_of_equivalent_value_range >> 1);
-
-    return true;
+    index = counts_index_for(h, value);
+    return index < h->counts_len ? index : h->counts_len - 1;
 }
 
-static int64_t peek_next_value_from_index(struct hdr_iter* iter)
+static int64_t sum_counts(const struct hdr_histogram* h, int32_t from_index, int32_t to_index)
 {
-    return hdr_value_at_index(iter->h, iter->counts_index + 1);
-}
+    int64_t total = 0;
+    int32_t index;
 
-static bool next_value_greater_than_reporting_level_upper_bound(
-    struct hdr_iter *iter, int64_t reporting_level_upper_bound)
-{
-    if (iter->counts_index >= iter->h->counts_len)
+    for (index = from_index; index <= to_index; index++)
     {
-        return false;
+        total += counts_get_normalised(h, index);
     }
 
-    return peek_next_value_from_index(iter) > reporting_level_upper_bound;
+    return total;
 }
 
-static bool basic_iter_next(struct hdr_iter *iter)
+int64_t hdr_count_between_values(const struct hdr_histogram* h, int64_t lowest_value, int64_t highest_value)
 {
-    if (!has_next(iter) || iter->counts_index >= iter->h->counts_len)
+    int32_t from_index = counts_index_for(h, lowest_value < 0 ? 0 : lowest_value);
+    int32_t to_index;
+
+    /* Only the upper bound is clamped, a range starting above the counts is empty. */
+    if (h->counts_len <= from_index)
     {
-        return false;
+        return 0;
     }
 
-    move_next(iter);
+    to_index = bounded_counts_index_for(h, highest_value);
 
-    return true;
+    return sum_counts(h, from_index, to_index);
 }
 
-static void update_iterated_values(struct hdr_iter* iter, int64_t new_value_iterated_to)
+int64_t hdr_count_le_value(const struct hdr_histogram* h, int64_t value)
 {
-    iter->value_iterated_from = iter->value_iterated_to;
-    iter->value_iterated_to = new_value_iterated_to;
-}
+    int32_t index = bounded_counts_index_for(h, value);
+    int32_t top_index = highest_recorded_index(h);
 
-static bool all_values_iter_next(struct hdr_iter* iter)
-{
-    bool result = move_next(iter);
+    if (top_index <= index)
+    {
+        return h->total_count;
+    }
 
-    if (result)
+    if (top_index - index < index)
     {
-        update_iterated_values(iter, iter->value);
+        return h->total_count - sum_counts(h, index + 1, top_index);
     }
 
-    return result;
+    return sum_counts(h, 0, index);
 }
 
-void hdr_iter_init(struct hdr_iter* iter, const struct hdr_histogram* h)
+double hdr_percentile_at_or_below_value(const struct hdr_histogram* h, int64_t value)
 {
-    iter->h = h;
-
-    iter->counts_index = -1;
-    iter->total_count = h->total_count;
-    iter->count = 0;
-    iter->cumulative_count = 0;
-    iter->value = 0;
-    iter->highest_equivalent_value = 0;
-    iter->value_iterated_from = 0;
-    iter->value_iterated_to = 0;
+    if (0 == h->total_count)
+    {
+        return 100.0;
+    }
 
-    iter->_next_fp = all_values_iter_next;
+    return (100.0 * (double) hdr_count_le_value(h, value)) / (double) h->total_count;
 }
 
-bool hdr_iter_next(struct hdr_iter* iter)
-{
-    return iter->_next_fp(iter);
-}
 
 /* ########  ######## ########   ######  ######## ##    ## ######## #### ##       ########  ######  */
 /* ##     ## ##       ##     ## ##    ## ##       ###   ##    ##     ##  ##       ##       ##    ## */
@@ -909,10 +2117,23 @@ bool hdr_iter_next(struct hdr_iter* iter)
 /* ##        ##       ##    ##  ##    ## ##       ##   ###    ##     ##  ##       ##       ##    ## */
 /* ##        ######## ##     ##  ######  ######## ##    ##    ##    #### ######## ########  ######  */
 
-static bool percentile_iter_next(struct hdr_iter* iter)
+/* Steps to the next reported percentile.  Reporting ticks double each time  */
+/* the distance left to 100% halves, so the half distance is the smallest    */
+/* power of two above 100 / (100 - percentile), read off the exponent frexp  */
+/* returns instead of being computed with log() and pow().                   */
+static double next_reported_percentile(double percentile, int32_t ticks_per_half_distance)
 {
-    int64_t temp, half_distance, percentile_reporting_ticks;
+    int half_distance_magnitude;
+    int64_t percentile_reporting_ticks;
 
+    frexp(100.0 / (100.0 - percentile), &half_distance_magnitude);
+    percentile_reporting_ticks = (int64_t) ticks_per_half_distance << half_distance_magnitude;
+
+    return percentile + 100.0 / (double) percentile_reporting_ticks;
+}
+
+static bool percentile_iter_next(struct hdr_iter* iter)
+{
     struct hdr_iter_percentiles* percentiles = &iter->specifics.percentiles;
 
     if (!has_next(iter))
@@ -939,13 +2160,11 @@ static bool percentile_iter_next(struct hdr_iter* iter)
         if (iter->count != 0 &&
                 percentiles->percentile_to_iterate_to <= current_percentile)
         {
-            update_iterated_values(iter, highest_equivalent_value(iter->h, iter->value));
+            update_iterated_values(iter, iter->highest_equivalent_value);
 
             percentiles->percentile = percentiles->percentile_to_iterate_to;
-            temp = (int64_t)(log(100 / (100.0 - (percentiles->percentile_to_iterate_to))) / log(2)) + 1;
-            half_distance = (int64_t) pow(2, (double) temp);
-            percentile_reporting_ticks = percentiles->ticks_per_half_distance * half_distance;
-            percentiles->percentile_to_iterate_to += 100.0 / percentile_reporting_ticks;
+            percentiles->percentile_to_iterate_to = next_reported_percentile(
+                percentiles->percentile_to_iterate_to, percentiles->ticks_per_half_distance);
 
             return true;
         }
@@ -966,68 +2185,7 @@ void hdr_iter_percentile_init(struct hdr_iter* iter, const struct hdr_histogram*
     iter->specifics.percentiles.percentile_to_iterate_to = 0.0;
     iter->specifics.percentiles.percentile               = 0.0;
 
-    iter->_next_fp = percentile_iter_next;
-}
-
-static void format_line_string(char* str, size_t len, int significant_figures, format_type format)
-{
-#if defined(_MSC_VER)
-#define snprintf _snprintf
-#pragma warning(push)
-#pragma warning(disable: 4996)
-#endif
-    const char* format_str = "%s%d%s";
-
-    switch (format)
-    {
-        case CSV:
-            snprintf(str, len, format_str, "%.", significant_figures, "f,%f,%d,%.2f\n");
-            break;
-        case CLASSIC:
-            snprintf(str, len, format_str, "%12.", significant_figures, "f %12f %12d %12.2f\n");
-            break;
-        default:
-            snprintf(str, len, format_str, "%12.", significant_figures, "f %12f %12d %12.2f\n");
-    }
-#if defined(_MSC_VER)
-#undef snprintf
-#pragma warning(pop)
-#endif
-}
-
-
-/* ########  ########  ######   #######  ########  ########  ######## ########   */
-/* ##     ## ##       ##    ## ##     ## ##     ## ##     ## ##       ##     ##  */
-/* ##     ## ##       ##       ##     ## ##     ## ##     ## ##       ##     ##  */
-/* ########  ######   ##       ##     ## ########  ##     ## ######   ##     ##  */
-/* ##   ##   ##       ##       ##     ## ##   ##   ##     ## ##       ##     ##  */
-/* ##    ##  ##       ##    ## ##     ## ##    ##  ##     ## ##       ##     ##  */
-/* ##     ## ########  ######   #######  ##     ## ########  ######## ########   */
-
-
-static bool recorded_iter_next(struct hdr_iter* iter)
-{
-    while (basic_iter_next(iter))
-    {
-        if (iter->count != 0)
-        {
-            update_iterated_values(iter, iter->value);
-
-            iter->specifics.recorded.count_added_in_this_iteration_step = iter->count;
-            return true;
-        }
-    }
-
-    return false;
-}
-
-void hdr_iter_recorded_init(struct hdr_iter* iter, const struct hdr_histogram* h)
-{
-    hdr_iter_init(iter, h);
-
-    iter->specifics.recorded.count_added_in_this_iteration_step = 0;
-
-    iter->_next_fp = recorded_iter_next;
+    iter->_type = ITER_PERCENTILES;
 }
 
 /* ##       #### ##    ## ########    ###    ########  */
@@ -1085,7 +2243,7 @@ void hdr_iter_linear_init(struct hdr_iter* iter, const struct hdr_histogram* h,
     iter->specifics.linear.next_value_reporting_level = value_units_per_bucket;
     iter->specifics.linear.next_value_reporting_level_lowest_equivalent = lowest_equivalent_value(h, value_units_per_bucket);
 
-    iter->_next_fp = iter_linear_next;
+    iter->_type = ITER_LINEAR;
 }
 
 /* ##        #######   ######      ###    ########  #### ######## ##     ## ##     ## ####  ######  */
@@ -1143,82 +2301,268 @@ void hdr_iter_log_init(
     iter->specifics.log.next_value_reporting_level = value_units_first_bucket;
     iter->specifics.log.next_value_reporting_level_lowest_equivalent = lowest_equivalent_value(h, value_units_first_bucket);
 
-    iter->_next_fp = log_iter_next;
+    iter->_type = ITER_LOG;
+}
+
+size_t hdr_iter_log_runs(struct hdr_iter* iter, struct hdr_iter_run* runs, size_t runs_len)
+{
+    size_t runs_written = 0;
+
+    while (runs_written < runs_len && log_iter_next(iter))
+    {
+        runs[runs_written].lowest_value = iter->value_iterated_from;
+        runs[runs_written].highest_value = iter->value_iterated_to;
+        runs[runs_written].count = iter->specifics.log.count_added_in_this_iteration_step;
+        runs_written++;
+    }
+
+    return runs_written;
+}
+
+bool hdr_iter_next(struct hdr_iter* iter)
+{
+    switch (iter->_type)
+    {
+        case ITER_PERCENTILES:
+            return percentile_iter_next(iter);
+        case ITER_RECORDED:
+            return recorded_iter_next(iter);
+        case ITER_LINEAR:
+            return iter_linear_next(iter);
+        case ITER_LOG:
+            return log_iter_next(iter);
+        case ITER_ALL_VALUES:
+        default:
+            return all_values_iter_next(iter);
+    }
 }
 
 /* Printing. */
 
-static const char* format_head_string(format_type format)
+/* Output is formatted into a fixed buffer and written out in large blocks. */
+struct print_buffer
+{
+    FILE* stream;
+    size_t len;
+    char data[8192];
+};
+
+static int print_buffer_flush(struct print_buffer* buffer)
+{
+    if (0 < buffer->len && fwrite(buffer->data, 1, buffer->len, buffer->stream) != buffer->len)
+    {
+        return EIO;
+    }
+
+    buffer->len = 0;
+
+    return 0;
+}
+
+static int print_buffer_append(struct print_buffer* buffer, const char* format, ...)
+{
+    va_list args;
+    size_t available = sizeof(buffer->data) - buffer->len;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(buffer->data + buffer->len, available, format, args);
+    va_end(args);
+
+    if (len < 0)
+    {
+        return EIO;
+    }
+
+    if ((size_t) len >= available)
+    {
+        if (print_buffer_flush(buffer) != 0 || (size_t) len >= sizeof(buffer->data))
+        {
+            return EIO;
+        }
+
+        va_start(args, format);
+        len = vsnprintf(buffer->data, sizeof(buffer->data), format, args);
+        va_end(args);
+    }
+
+    buffer->len += (size_t) len;
+
+    return 0;
+}
+
+static int print_head(struct print_buffer* buffer, format_type format)
+{
+    switch (format)
+    {
+        case CSV:
+            return print_buffer_append(buffer, "%s,%s,%s,%s\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+        case JSON:
+            return print_buffer_append(buffer, "{\"percentiles\":[");
+        case CLASSIC:
+        default:
+            return print_buffer_append(
+                buffer, "%12s %12s %12s %12s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    }
+}
+
+static int print_line(
+    struct print_buffer* buffer, format_type format, int significant_figures, size_t line,
+    double value, double percentile, int64_t total_count)
 {
+    double inverted_percentile = 1.0 / (1.0 - percentile);
+
     switch (format)
     {
         case CSV:
-            return "%s,%s,%s,%s\n";
+            return print_buffer_append(
+                buffer, "%.*f,%f,%" PRId64 ",%.2f\n",
+                significant_figures, value, percentile, total_count, inverted_percentile);
+        case JSON:
+            if (isinf(inverted_percentile))
+            {
+                return print_buffer_append(
+                    buffer, "%s\n{\"value\":%.*f,\"percentile\":%f,\"total_count\":%" PRId64 ","
+                    "\"inverted_percentile\":null}",
+                    0 == line ? "" : ",", significant_figures, value, percentile, total_count);
+            }
+            return print_buffer_append(
+                buffer, "%s\n{\"value\":%.*f,\"percentile\":%f,\"total_count\":%" PRId64 ","
+                "\"inverted_percentile\":%.2f}",
+                0 == line ? "" : ",", significant_figures, value, percentile, total_count, inverted_percentile);
         case CLASSIC:
         default:
-            return "%12s %12s %12s %12s\n\n";
+            return print_buffer_append(
+                buffer, "%12.*f %12f %12" PRId64 " %12.2f\n",
+                significant_figures, value, percentile, total_count, inverted_percentile);
     }
 }
 
 static const char CLASSIC_FOOTER[] =
     "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n"
-    "#[Max     = %12.3f, Total count    = %12" PRIu64 "]\n"
+    "#[Max     = %12.3f, Total count    = %12" PRId64 "]\n"
     "#[Buckets = %12d, SubBuckets     = %12d]\n";
 
+/* JSON has no representation for the NaN mean of an empty histogram. */
+static int print_json_number(struct print_buffer* buffer, const char* name, double value)
+{
+    if (isfinite(value))
+    {
+        return print_buffer_append(buffer, ",\"%s\":%.3f", name, value);
+    }
+
+    return print_buffer_append(buffer, ",\"%s\":null", name);
+}
+
+static int print_json_footer(
+    struct print_buffer* buffer, const struct hdr_histogram* h, double mean, double stddev, double max)
+{
+    int rc;
+
+    if ((rc = print_buffer_append(buffer, "\n]")) != 0 ||
+        (rc = print_json_number(buffer, "mean", mean)) != 0 ||
+        (rc = print_json_number(buffer, "std_deviation", stddev)) != 0 ||
+        (rc = print_json_number(buffer, "max", max)) != 0)
+    {
+        return rc;
+    }
+
+    return print_buffer_append(
+        buffer, ",\"total_count\":%" PRId64 ",\"buckets\":%d,\"sub_buckets\":%d}\n",
+        h->total_count, h->bucket_count, h->sub_bucket_count);
+}
+
+/* Walks the counts once, reporting percentiles the way the percentile      */
+/* iterator does while accumulating the mean and the variance (by Welford's */
+/* method) for the footer.  Histograms with moments report the exact ones.  */
 int hdr_percentiles_print(
         struct hdr_histogram* h, FILE* stream, int32_t ticks_per_half_distance,
         double value_scale, format_type format)
 {
-    char line_format[25];
-    const char* head_format;
-    int rc = 0;
+    struct print_buffer buffer;
     struct hdr_iter iter;
-    struct hdr_iter_percentiles * percentiles;
-
-    format_line_string(line_format, 25, h->significant_figures, format);
-    head_format = format_head_string(format);
+    double percentile_to_iterate_to = 0.0;
+    double running_mean = 0.0;
+    double sum_of_squared_deviations = 0.0;
+    int64_t total = 0;
+    int significant_figures = (int) h->significant_figures;
+    size_t lines = 0;
+    int rc;
 
-    hdr_iter_percentile_init(&iter, h, ticks_per_half_distance);
+    buffer.stream = stream;
+    buffer.len = 0;
 
-    if (fprintf(
-            stream, head_format,
-            "Value", "Percentile", "TotalCount", "1/(1-Percentile)") < 0)
+    if ((rc = print_head(&buffer, format)) != 0)
     {
-        rc = EIO;
-        goto cleanup;
+        return rc;
     }
 
-    percentiles = &iter.specifics.percentiles;
-    while (hdr_iter_next(&iter))
+    hdr_iter_init(&iter, h);
+
+    while (iter.cumulative_count < iter.total_count && move_next(&iter))
     {
-        double  value               = iter.highest_equivalent_value / value_scale;
-        double  percentile          = percentiles->percentile / 100.0;
-        int64_t total_count         = iter.cumulative_count;
-        double  inverted_percentile = (1.0 / (1.0 - percentile));
+        double current_percentile;
+        double deviation;
 
-        if (fprintf(
-                stream, line_format, value, percentile, total_count, inverted_percentile) < 0)
+        if (0 == iter.count)
         {
-            rc = EIO;
-            goto cleanup;
+            continue;
         }
+
+        total += iter.count * iter.median_equivalent_value;
+        deviation = (double) iter.median_equivalent_value - running_mean;
+        running_mean += deviation * (double) iter.count / (double) iter.cumulative_count;
+        sum_of_squared_deviations +=
+            (double) iter.count * deviation * ((double) iter.median_equivalent_value - running_mean);
+
+        current_percentile = (100.0 * (double) iter.cumulative_count) / h->total_count;
+        while (percentile_to_iterate_to <= current_percentile)
+        {
+            if ((rc = print_line(
+                    &buffer, format, significant_figures, lines++, iter.highest_equivalent_value / value_scale,
+                    percentile_to_iterate_to / 100.0, iter.cumulative_count)) != 0)
+            {
+                return rc;
+            }
+
+            percentile_to_iterate_to = next_reported_percentile(percentile_to_iterate_to, ticks_per_half_distance);
+
+            /* Only one tick is reported from the last bucket, then 100%. */
+            if (iter.cumulative_count == iter.total_count)
+            {
+                break;
+            }
+        }
+    }
+
+    if ((rc = print_line(
+            &buffer, format, significant_figures, lines, iter.highest_equivalent_value / value_scale,
+            1.0, iter.cumulative_count)) != 0)
+    {
+        return rc;
     }
 
-    if (CLASSIC == format)
+    if (CLASSIC == format || JSON == format)
     {
-        double mean   = hdr_mean(h)   / value_scale;
-        double stddev = hdr_stddev(h) / value_scale;
-        double max    = hdr_max(h)    / value_scale;
+        double mean   = ((total * 1.0) / h->total_count) / value_scale;
+        double stddev = sqrt(sum_of_squared_deviations / h->total_count) / value_scale;
+        double max    = hdr_max(h) / value_scale;
+
+        if (h->flags & HDR_HISTOGRAM_MOMENTS)
+        {
+            mean   = hdr_mean(h) / value_scale;
+            stddev = hdr_stddev(h) / value_scale;
+        }
 
-        if (fprintf(
-                stream, CLASSIC_FOOTER,  mean, stddev, max,
-                h->total_count, h->bucket_count, h->sub_bucket_count) < 0)
+        rc = CLASSIC == format
+            ? print_buffer_append(
+                &buffer, CLASSIC_FOOTER, mean, stddev, max, h->total_count, h->bucket_count, h->sub_bucket_count)
+            : print_json_footer(&buffer, h, mean, stddev, max);
+        if (rc != 0)
         {
-            rc = EIO;
-            goto cleanup;
+            return rc;
         }
     }
 
-    cleanup:
-    return rc;
+    return print_buffer_flush(&buffer);
 }
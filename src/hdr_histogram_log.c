@@ -16,6 +16,9 @@
 #include <zlib.h>
 #include <errno.h>
 #include <time.h>
+#if !defined(_MSC_VER)
+#include <unistd.h>
+#endif
 
 #include <hdr/hdr_histogram.h>
 #include <hdr/hdr_histogram_log.h>
@@ -23,6 +26,7 @@
 #include "hdr_tests.h"
 
 #if defined(_MSC_VER)
+#include <io.h>
 #include <intsafe.h>
 typedef SSIZE_T ssize_t;
 #pragma comment(lib, "ws2_32.lib")
@@ -67,6 +71,9 @@ static const uint32_t V1_COMPRESSION_COOKIE = 0x1c849302;
 static const uint32_t V2_ENCODING_COOKIE = 0x1c849303;
 static const uint32_t V2_COMPRESSION_COOKIE = 0x1c849304;
 
+/* Follows the V2 counts of a histogram created with HDR_HISTOGRAM_MOMENTS. */
+static const uint32_t V2_MOMENTS_COOKIE = 0x1c849305;
+
 static uint32_t get_cookie_base(uint32_t cookie)
 {
     return (cookie & ~0xf0U);
@@ -162,98 +169,308 @@ typedef struct /*__attribute__((__packed__))*/
     int32_t length;
     uint8_t data[1];
 } compression_flyweight_t;
+
+typedef struct /*__attribute__((__packed__))*/
+{
+    uint32_t cookie;
+    int64_t moments[4];
+} moments_flyweight_t;
 #pragma pack(pop)
 
 #define SIZEOF_ENCODING_FLYWEIGHT_V0 (sizeof(encoding_flyweight_v0_t) - sizeof(int64_t))
 #define SIZEOF_ENCODING_FLYWEIGHT_V1 (sizeof(encoding_flyweight_v1_t) - sizeof(uint8_t))
 #define SIZEOF_COMPRESSION_FLYWEIGHT (sizeof(compression_flyweight_t) - sizeof(uint8_t))
 
-int hdr_encode_compressed(
-    struct hdr_histogram* h,
-    uint8_t** compressed_histogram,
+/* Uncompressed bytes handed to deflate per call. */
+#define ENCODER_CHUNK_LEN 4096
+
+struct hdr_log_encoder
+{
+    z_stream strm;
+    uint8_t* output;
+    size_t output_capacity;
+    uint8_t* base64;
+    size_t base64_capacity;
+    uint8_t* line;
+    size_t line_capacity;
+    uint32_t flags;
+    uint8_t chunk[ENCODER_CHUNK_LEN];
+};
+
+/* Grows *buffer to hold at least len bytes.  The buffer is kept on failure. */
+static int ensure_capacity(uint8_t** buffer, size_t* capacity, size_t len)
+{
+    uint8_t* grown;
+
+    if (len <= *capacity)
+    {
+        return 0;
+    }
+
+    if ((grown = (uint8_t*) hdr_realloc(*buffer, len)) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    *buffer = grown;
+    *capacity = len;
+
+    return 0;
+}
+
+static int32_t encoded_counts_limit(const struct hdr_histogram* h)
+{
+    int32_t len_to_max = counts_index_for(h, hdr_max(h)) + 1;
+    return len_to_max < h->counts_len ? len_to_max : h->counts_len;
+}
+
+int hdr_log_encoder_init(struct hdr_log_encoder** encoder)
+{
+    return hdr_log_encoder_init_with_flags(encoder, 0);
+}
+
+int hdr_log_encoder_init_with_flags(struct hdr_log_encoder** encoder, uint32_t flags)
+{
+    struct hdr_log_encoder* e;
+
+    if (0 != (flags & ~(uint32_t) HDR_LOG_ENCODE_MOMENTS))
+    {
+        return EINVAL;
+    }
+
+    e = (struct hdr_log_encoder*) hdr_calloc(1, sizeof(struct hdr_log_encoder));
+    if (NULL == e)
+    {
+        return ENOMEM;
+    }
+    e->flags = flags;
+
+    strm_init(&e->strm);
+    if (Z_OK != deflateInit(&e->strm, Z_DEFAULT_COMPRESSION))
+    {
+        hdr_free(e);
+        return HDR_DEFLATE_INIT_FAIL;
+    }
+
+    *encoder = e;
+
+    return 0;
+}
+
+void hdr_log_encoder_close(struct hdr_log_encoder* encoder)
+{
+    if (NULL == encoder)
+    {
+        return;
+    }
+
+    (void)deflateEnd(&encoder->strm);
+    hdr_free(encoder->output);
+    hdr_free(encoder->base64);
+    hdr_free(encoder->line);
+    hdr_free(encoder);
+}
+
+static size_t encoder_bound_for(int32_t counts_limit)
+{
+    uLong encoded_len = (uLong) (
+        SIZEOF_ENCODING_FLYWEIGHT_V1 + MAX_BYTES_LEB128 * (size_t) counts_limit +
+        sizeof(moments_flyweight_t));
+    return SIZEOF_COMPRESSION_FLYWEIGHT + compressBound(encoded_len);
+}
+
+size_t hdr_log_encoder_bound(const struct hdr_histogram* h)
+{
+    return encoder_bound_for(encoded_counts_limit(h));
+}
+
+size_t hdr_log_encoder_max_bound(void)
+{
+    struct hdr_histogram_bucket_config cfg;
+
+    /* The most counts: single unit resolution, 5 significant figures, up to INT64_MAX. */
+    hdr_calculate_bucket_config(1, INT64_MAX, 5, &cfg);
+
+    return encoder_bound_for(cfg.counts_len);
+}
+
+int hdr_log_encode_compressed_into(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    uint8_t* buffer,
+    size_t buffer_len,
     size_t* compressed_len)
 {
-    encoding_flyweight_v1_t* encoded = NULL;
-    compression_flyweight_t* compressed = NULL;
-    int i;
-    int result = 0;
-    int data_index = 0;
-    int32_t payload_len;
-    uLong encoded_size;
-    uLongf dest_len;
-    size_t compressed_size;
+    z_stream* strm = &encoder->strm;
+    encoding_flyweight_v1_t* encoded = (encoding_flyweight_v1_t*) encoder->chunk;
+    compression_flyweight_t* compressed = (compression_flyweight_t*) buffer;
+    const int64_t* moments = 0 != (encoder->flags & HDR_LOG_ENCODE_MOMENTS) ? hdr_moments(h) : NULL;
+    int32_t counts_limit = encoded_counts_limit(h);
+    int32_t counts_index = 0;
+    int32_t chunk_len;
+    size_t out_len;
+    int flush;
+    int rc;
 
-    int32_t len_to_max = counts_index_for(h, h->max_value) + 1;
-    int32_t counts_limit = len_to_max < h->counts_len ? len_to_max : h->counts_len;
+    if (buffer_len <= SIZEOF_COMPRESSION_FLYWEIGHT)
+    {
+        return ENOBUFS;
+    }
 
-    const size_t encoded_len = SIZEOF_ENCODING_FLYWEIGHT_V1 + MAX_BYTES_LEB128 * (size_t) counts_limit;
-    if ((encoded = (encoding_flyweight_v1_t*) hdr_calloc(encoded_len, sizeof(uint8_t))) == NULL)
+    if (Z_OK != deflateReset(strm))
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        return HDR_DEFLATE_FAIL;
     }
 
-    for (i = 0; i < counts_limit;)
+    /* The payload length precedes the counts, so it is measured up front. */
+    encoded->cookie                   = htobe32(V2_ENCODING_COOKIE | 0x10U);
+    encoded->payload_len              = htobe32(zig_zag_counts_encoded_len(h->counts, counts_limit));
+    encoded->normalizing_index_offset = htobe32(h->normalizing_index_offset);
+    encoded->significant_figures      = htobe32(h->significant_figures);
+    encoded->lowest_discernible_value   = htobe64(h->lowest_discernible_value);
+    encoded->highest_trackable_value  = htobe64(h->highest_trackable_value);
+    encoded->conversion_ratio_bits    = htobe64(double_to_int64_bits(h->conversion_ratio));
+    chunk_len = (int32_t) SIZEOF_ENCODING_FLYWEIGHT_V1;
+
+    out_len = buffer_len - SIZEOF_COMPRESSION_FLYWEIGHT;
+    strm->next_out = compressed->data;
+    strm->avail_out = out_len < UINT32_MAX ? (uInt) out_len : UINT32_MAX;
+
+    do
     {
-        int64_t value = h->counts[i];
-        i++;
+        chunk_len += zig_zag_encode_counts_chunk(
+            &encoder->chunk[chunk_len], ENCODER_CHUNK_LEN - chunk_len, h->counts, counts_limit, &counts_index);
 
-        if (value == 0)
+        /* Only decoders that know the trailer accept it, others fail on the */
+        /* bytes after the counts, hence it is written only when asked for.  */
+        if (NULL != moments && counts_index == counts_limit &&
+            (size_t) chunk_len + sizeof(moments_flyweight_t) <= ENCODER_CHUNK_LEN)
         {
-            int32_t zeros = 1;
+            moments_flyweight_t* trailer = (moments_flyweight_t*) &encoder->chunk[chunk_len];
+            int i;
 
-            while (i < counts_limit && 0 == h->counts[i])
+            trailer->cookie = htobe32(V2_MOMENTS_COOKIE);
+            for (i = 0; i < 4; i++)
             {
-                zeros++;
-                i++;
+                trailer->moments[i] = htobe64(moments[i]);
             }
+            chunk_len += (int32_t) sizeof(moments_flyweight_t);
+            moments = NULL;
+        }
+        flush = counts_index < counts_limit || NULL != moments ? Z_NO_FLUSH : Z_FINISH;
+
+        strm->next_in = encoder->chunk;
+        strm->avail_in = (uInt) chunk_len;
 
-            data_index += zig_zag_encode_i64(&encoded->counts[data_index], -zeros);
+        rc = deflate(strm, flush);
+        if (Z_OK != rc && Z_STREAM_END != rc && Z_BUF_ERROR != rc)
+        {
+            return HDR_DEFLATE_FAIL;
         }
-        else
+        if (0 != strm->avail_in)
         {
-            data_index += zig_zag_encode_i64(&encoded->counts[data_index], value);
+            return ENOBUFS;
         }
+
+        chunk_len = 0;
+    }
+    while (Z_FINISH != flush);
+
+    if (Z_STREAM_END != rc)
+    {
+        return ENOBUFS;
     }
 
-    payload_len = data_index;
-    encoded_size = SIZEOF_ENCODING_FLYWEIGHT_V1 + data_index;
+    compressed->cookie = htobe32(V2_COMPRESSION_COOKIE | 0x10U);
+    compressed->length = htobe32((int32_t) strm->total_out);
 
-    encoded->cookie                   = htobe32(V2_ENCODING_COOKIE | 0x10U);
-    encoded->payload_len              = htobe32(payload_len);
-    encoded->normalizing_index_offset = htobe32(h->normalizing_index_offset);
-    encoded->significant_figures      = htobe32(h->significant_figures);
-    encoded->lowest_discernible_value   = htobe64(h->lowest_discernible_value);
-    encoded->highest_trackable_value  = htobe64(h->highest_trackable_value);
-    encoded->conversion_ratio_bits    = htobe64(double_to_int64_bits(h->conversion_ratio));
+    *compressed_len = SIZEOF_COMPRESSION_FLYWEIGHT + strm->total_out;
 
+    return 0;
+}
 
-    /* Estimate the size of the compressed histogram. */
-    dest_len = compressBound(encoded_size);
-    compressed_size = SIZEOF_COMPRESSION_FLYWEIGHT + dest_len;
+int hdr_log_encode_compressed_to_sink(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    hdr_log_sink_fn sink,
+    void* sink_arg)
+{
+    size_t bound = hdr_log_encoder_bound(h);
+    size_t compressed_len;
+    int rc;
 
-    if ((compressed = (compression_flyweight_t*) hdr_malloc(compressed_size)) == NULL)
+    if ((rc = ensure_capacity(&encoder->output, &encoder->output_capacity, bound)) != 0 ||
+        (rc = hdr_log_encode_compressed_into(encoder, h, encoder->output, bound, &compressed_len)) != 0)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        return rc;
+    }
+
+    return sink(sink_arg, encoder->output, compressed_len);
+}
+
+int hdr_log_encode_with(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    const char** encoded_histogram,
+    size_t* encoded_len)
+{
+    size_t bound = hdr_log_encoder_bound(h);
+    size_t compressed_len;
+    size_t base64_len;
+    int rc;
+
+    if ((rc = ensure_capacity(&encoder->output, &encoder->output_capacity, bound)) != 0 ||
+        (rc = hdr_log_encode_compressed_into(encoder, h, encoder->output, bound, &compressed_len)) != 0)
+    {
+        return rc;
     }
 
-    if (Z_OK != compress(compressed->data, &dest_len, (Bytef*) encoded, encoded_size))
+    base64_len = hdr_base64_encoded_len(compressed_len);
+    if ((rc = ensure_capacity(&encoder->base64, &encoder->base64_capacity, base64_len + 1)) != 0 ||
+        (rc = hdr_base64_encode(encoder->output, compressed_len, (char*) encoder->base64, base64_len)) != 0)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_DEFLATE_FAIL);
+        return rc;
     }
 
-    compressed->cookie = htobe32(V2_COMPRESSION_COOKIE | 0x10U);
-    compressed->length = htobe32((int32_t)dest_len);
+    encoder->base64[base64_len] = '\0';
+    *encoded_histogram = (const char*) encoder->base64;
+    *encoded_len = base64_len;
+
+    return 0;
+}
+
+int hdr_encode_compressed(
+    struct hdr_histogram* h,
+    uint8_t** compressed_histogram,
+    size_t* compressed_len)
+{
+    struct hdr_log_encoder* encoder = NULL;
+    uint8_t* buffer = NULL;
+    size_t buffer_len;
+    int result;
+
+    if ((result = hdr_log_encoder_init(&encoder)) != 0)
+    {
+        return result;
+    }
 
-    *compressed_histogram = (uint8_t*) compressed;
-    *compressed_len = SIZEOF_COMPRESSION_FLYWEIGHT + dest_len;
+    buffer_len = hdr_log_encoder_bound(h);
+    if ((buffer = (uint8_t*) hdr_malloc(buffer_len)) == NULL)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+    }
 
-    cleanup:
-    hdr_free(encoded);
-    if (result == HDR_DEFLATE_FAIL)
+    if ((result = hdr_log_encode_compressed_into(encoder, h, buffer, buffer_len, compressed_len)) != 0)
     {
-        hdr_free(compressed);
+        hdr_free(buffer);
+        goto cleanup;
     }
 
+    *compressed_histogram = buffer;
+
+cleanup:
+    hdr_log_encoder_close(encoder);
+
     return result;
 }
 
@@ -292,39 +509,62 @@ static void apply_to_counts_64(struct hdr_histogram* h, const int64_t* counts_da
     }
 }
 
-static int apply_to_counts_zz(struct hdr_histogram* h, const uint8_t* counts_data, const int32_t data_limit)
+#define ZZ_DECODE_BATCH 256
+
+/* With a NULL h the stream is only validated against counts_len. */
+static int apply_to_counts_zz(
+    struct hdr_histogram* h, const int32_t counts_len, const uint8_t* counts_data, const int32_t data_limit)
 {
-    int64_t data_index = 0;
+    int64_t values[ZZ_DECODE_BATCH];
+    size_t data_index = 0;
     int32_t counts_index = 0;
-    int64_t value;
 
-    while (data_index < data_limit && counts_index < h->counts_len)
+    while (data_index < (size_t) data_limit && counts_index < counts_len)
     {
-        data_index += zig_zag_decode_i64(&counts_data[data_index], &value);
+        size_t bytes_read;
+        size_t i;
+        size_t values_read = zig_zag_decode_i64_bulk(
+            &counts_data[data_index], (size_t) data_limit - data_index, values, ZZ_DECODE_BATCH, &bytes_read);
+
+        if (0 == values_read)
+        {
+            return HDR_VALUE_TRUNCATED;
+        }
 
-        if (value < 0)
+        for (i = 0; i < values_read && counts_index < counts_len; i++)
         {
-            int64_t zeros = -value;
+            int64_t value = values[i];
 
-            if (value <= INT32_MIN || counts_index + zeros > h->counts_len)
+            if (value < 0)
             {
-                return HDR_TRAILING_ZEROS_INVALID;
-            }
+                int64_t zeros = -value;
+
+                if (value <= INT32_MIN || counts_index + zeros > counts_len)
+                {
+                    return HDR_TRAILING_ZEROS_INVALID;
+                }
 
-            counts_index += (int32_t) zeros;
+                counts_index += (int32_t) zeros;
+            }
+            else
+            {
+                if (NULL != h)
+                {
+                    h->counts[counts_index] = value;
+                }
+                counts_index++;
+            }
         }
-        else
+
+        if (i < values_read)
         {
-            h->counts[counts_index] = value;
-            counts_index++;
+            return HDR_ENCODED_INPUT_TOO_LONG;
         }
-    }
 
-    if (data_index > data_limit)
-    {
-        return HDR_VALUE_TRUNCATED;
+        data_index += bytes_read;
     }
-    else if (data_index < data_limit)
+
+    if (data_index < (size_t) data_limit)
     {
         return HDR_ENCODED_INPUT_TOO_LONG;
     }
@@ -350,14 +590,191 @@ static int apply_to_counts(
             return 0;
 
         case 1:
-            return apply_to_counts_zz(h, counts_data, counts_limit);
+            return apply_to_counts_zz(h, h->counts_len, counts_data, counts_limit);
 
         default:
             return -1;
     }
 }
 
+/* Decoding into an existing histogram adds each count straight into the */
+/* target.  'src' carries only the configuration of the encoded histogram. */
+/* Returns the count if it was dropped, otherwise 0.                       */
+static int64_t accumulate_count(
+    struct hdr_histogram* dst, const struct hdr_histogram* src, int32_t index, int64_t count)
+{
+    if (src->normalizing_index_offset != 0)
+    {
+        index = (int32_t) (((int64_t) index + src->normalizing_index_offset) % src->counts_len);
+        index = index < 0 ? index + src->counts_len : index;
+    }
+
+    if (dst->unit_magnitude == src->unit_magnitude &&
+        dst->sub_bucket_half_count_magnitude == src->sub_bucket_half_count_magnitude &&
+        index < dst->counts_len)
+    {
+        hdr_record_values_at_index(dst, index, count);
+        return 0;
+    }
+
+    /* Values beyond the range of dst are dropped, as with hdr_add. */
+    return hdr_record_values(dst, hdr_value_at_index(src, index), count) ? 0 : count;
+}
+
+static int64_t accumulate_counts(
+    struct hdr_histogram* dst,
+    const struct hdr_histogram* src,
+    const int32_t word_size,
+    const uint8_t* counts_data,
+    const int32_t counts_limit)
+{
+    int64_t dropped = 0;
+    int32_t i;
+    int32_t limit = counts_limit < src->counts_len ? counts_limit : src->counts_len;
+
+    for (i = 0; i < limit; i++)
+    {
+        int64_t count;
+        switch (word_size)
+        {
+            case 2:
+                count = (int16_t) be16toh(((const int16_t*) counts_data)[i]);
+                break;
+            case 4:
+                count = (int32_t) be32toh(((const int32_t*) counts_data)[i]);
+                break;
+            default:
+                count = (int64_t) be64toh(((const int64_t*) counts_data)[i]);
+                break;
+        }
+
+        if (count != 0)
+        {
+            dropped += accumulate_count(dst, src, i, count);
+        }
+    }
+
+    return dropped;
+}
+
+static int accumulate_counts_zz(
+    struct hdr_histogram* dst,
+    const struct hdr_histogram* src,
+    const uint8_t* counts_data,
+    const int32_t data_limit,
+    int64_t* dropped)
+{
+    int64_t values[ZZ_DECODE_BATCH];
+    size_t data_index = 0;
+    int32_t counts_index = 0;
+    int rc;
+
+    *dropped = 0;
+
+    /* Validate the whole stream first, so that a corrupt input leaves dst untouched. */
+    if ((rc = apply_to_counts_zz(NULL, src->counts_len, counts_data, data_limit)) != 0)
+    {
+        return rc;
+    }
+
+    while (data_index < (size_t) data_limit && counts_index < src->counts_len)
+    {
+        size_t bytes_read;
+        size_t i;
+        size_t values_read = zig_zag_decode_i64_bulk(
+            &counts_data[data_index], (size_t) data_limit - data_index, values, ZZ_DECODE_BATCH, &bytes_read);
+
+        for (i = 0; i < values_read; i++)
+        {
+            int64_t value = values[i];
+
+            if (value < 0)
+            {
+                counts_index += (int32_t) -value;
+            }
+            else
+            {
+                if (value != 0)
+                {
+                    *dropped += accumulate_count(dst, src, counts_index, value);
+                }
+                counts_index++;
+            }
+        }
+
+        data_index += bytes_read;
+    }
+
+    return 0;
+}
+
+struct hdr_log_decoder
+{
+    z_stream strm;
+    uint8_t* counts;
+    size_t counts_capacity;
+    uint8_t* compressed;
+    size_t compressed_capacity;
+    uint8_t* base64;
+    size_t base64_capacity;
+    /* Total count of values dropped when decoding into a histogram. */
+    int64_t dropped;
+};
+
+int hdr_log_decoder_init(struct hdr_log_decoder** decoder)
+{
+    struct hdr_log_decoder* d = (struct hdr_log_decoder*) hdr_calloc(1, sizeof(struct hdr_log_decoder));
+    if (NULL == d)
+    {
+        return ENOMEM;
+    }
+
+    strm_init(&d->strm);
+    if (Z_OK != inflateInit(&d->strm))
+    {
+        hdr_free(d);
+        return HDR_INFLATE_INIT_FAIL;
+    }
+
+    *decoder = d;
+
+    return 0;
+}
+
+void hdr_log_decoder_close(struct hdr_log_decoder* decoder)
+{
+    if (NULL == decoder)
+    {
+        return;
+    }
+
+    (void)inflateEnd(&decoder->strm);
+    hdr_free(decoder->counts);
+    hdr_free(decoder->compressed);
+    hdr_free(decoder->base64);
+    hdr_free(decoder);
+}
+
+int64_t hdr_log_decoder_dropped(const struct hdr_log_decoder* decoder)
+{
+    return decoder->dropped;
+}
+
+/* Zeroed scratch space for the inflated counts, reused between calls. */
+static uint8_t* decoder_counts(struct hdr_log_decoder* decoder, size_t len)
+{
+    if (0 == len || ensure_capacity(&decoder->counts, &decoder->counts_capacity, len) != 0)
+    {
+        return NULL;
+    }
+
+    memset(decoder->counts, 0, len);
+
+    return decoder->counts;
+}
+
 static int hdr_decode_compressed_v0(
+    struct hdr_log_decoder* decoder,
     compression_flyweight_t* compression_flyweight,
     size_t length,
     struct hdr_histogram** histogram)
@@ -366,13 +783,14 @@ static int hdr_decode_compressed_v0(
     int result = 0;
     uint8_t* counts_array = NULL;
     encoding_flyweight_v0_t encoding_flyweight;
-    z_stream strm;
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram src;
+    z_stream* strm = &decoder->strm;
     uint32_t encoding_cookie;
     int32_t compressed_len, word_size, significant_figures, counts_array_len;
     int64_t lowest_discernible_value, highest_trackable_value;
 
-    strm_init(&strm);
-    if (inflateInit(&strm) != Z_OK)
+    if (inflateReset(strm) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
@@ -384,12 +802,12 @@ static int hdr_decode_compressed_v0(
         FAIL_AND_CLEANUP(cleanup, result, EINVAL);
     }
 
-    strm.next_in = compression_flyweight->data;
-    strm.avail_in = (uInt) compressed_len;
-    strm.next_out = (uint8_t *) &encoding_flyweight;
-    strm.avail_out = SIZEOF_ENCODING_FLYWEIGHT_V0;
+    strm->next_in = compression_flyweight->data;
+    strm->avail_in = (uInt) compressed_len;
+    strm->next_out = (uint8_t *) &encoding_flyweight;
+    strm->avail_out = SIZEOF_ENCODING_FLYWEIGHT_V0;
 
-    if (inflate(&strm, Z_SYNC_FLUSH) != Z_OK)
+    if (inflate(strm, Z_SYNC_FLUSH) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
@@ -405,57 +823,59 @@ static int hdr_decode_compressed_v0(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    if (hdr_init(
-        lowest_discernible_value,
-        highest_trackable_value,
-        significant_figures,
-        &h) != 0)
+    if (hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg) != 0 ||
+        (NULL == *histogram && hdr_init(
+            lowest_discernible_value,
+            highest_trackable_value,
+            significant_figures,
+            &h) != 0))
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
 
-    counts_array_len = h->counts_len * word_size;
-    if ((counts_array = (uint8_t*) hdr_calloc(1, (size_t) counts_array_len)) == NULL)
+    counts_array_len = cfg.counts_len * word_size;
+    if ((counts_array = decoder_counts(decoder, (size_t) counts_array_len)) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
 
-    strm.next_out = counts_array;
-    strm.avail_out = (uInt) counts_array_len;
+    strm->next_out = counts_array;
+    strm->avail_out = (uInt) counts_array_len;
 
-    if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+    if (inflate(strm, Z_FINISH) != Z_STREAM_END)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
 
-    apply_to_counts(h, word_size, counts_array, h->counts_len);
+    if (NULL == h)
+    {
+        hdr_init_preallocated(&src, &cfg);
+        decoder->dropped += accumulate_counts(*histogram, &src, word_size, counts_array, src.counts_len);
+    }
+    else
+    {
+        apply_to_counts(h, word_size, counts_array, h->counts_len);
 
-    hdr_reset_internal_counters(h);
-    h->normalizing_index_offset = 0;
-    h->conversion_ratio = 1.0;
+        hdr_reset_internal_counters(h);
+        h->normalizing_index_offset = 0;
+        h->conversion_ratio = 1.0;
+    }
 
 cleanup:
-    (void)inflateEnd(&strm);
-    hdr_free(counts_array);
-
     if (result != 0)
     {
-        hdr_free(h);
+        hdr_close(h);
     }
-    else if (NULL == *histogram)
+    else if (NULL != h)
     {
         *histogram = h;
     }
-    else
-    {
-        hdr_add(*histogram, h);
-        hdr_free(h);
-    }
 
     return result;
 }
 
 static int hdr_decode_compressed_v1(
+    struct hdr_log_decoder* decoder,
     compression_flyweight_t* compression_flyweight,
     size_t length,
     struct hdr_histogram** histogram)
@@ -464,13 +884,14 @@ static int hdr_decode_compressed_v1(
     int result = 0;
     uint8_t* counts_array = NULL;
     encoding_flyweight_v1_t encoding_flyweight;
-    z_stream strm;
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram src;
+    z_stream* strm = &decoder->strm;
     uint32_t encoding_cookie;
     int32_t compressed_length, word_size, significant_figures, counts_limit, counts_array_len;
     int64_t lowest_discernible_value, highest_trackable_value;
 
-    strm_init(&strm);
-    if (inflateInit(&strm) != Z_OK)
+    if (inflateReset(strm) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
@@ -482,12 +903,12 @@ static int hdr_decode_compressed_v1(
         FAIL_AND_CLEANUP(cleanup, result, EINVAL);
     }
 
-    strm.next_in = compression_flyweight->data;
-    strm.avail_in = (uInt) compressed_length;
-    strm.next_out = (uint8_t *) &encoding_flyweight;
-    strm.avail_out = SIZEOF_ENCODING_FLYWEIGHT_V1;
+    strm->next_in = compression_flyweight->data;
+    strm->avail_in = (uInt) compressed_length;
+    strm->next_out = (uint8_t *) &encoding_flyweight;
+    strm->avail_out = SIZEOF_ENCODING_FLYWEIGHT_V1;
 
-    if (inflate(&strm, Z_SYNC_FLUSH) != Z_OK)
+    if (inflate(strm, Z_SYNC_FLUSH) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
@@ -504,11 +925,12 @@ static int hdr_decode_compressed_v1(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    if (hdr_init(
-        lowest_discernible_value,
-        highest_trackable_value,
-        significant_figures,
-        &h) != 0)
+    if (hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg) != 0 ||
+        (NULL == *histogram && hdr_init(
+            lowest_discernible_value,
+            highest_trackable_value,
+            significant_figures,
+            &h) != 0))
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
@@ -516,47 +938,49 @@ static int hdr_decode_compressed_v1(
     /* Give the temp uncompressed array a little bif of extra */
     counts_array_len = counts_limit * word_size;
 
-    if ((counts_array = (uint8_t*) hdr_calloc(1, (size_t) counts_array_len)) == NULL)
+    if ((counts_array = decoder_counts(decoder, (size_t) counts_array_len)) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
 
-    strm.next_out = counts_array;
-    strm.avail_out = (uInt) counts_array_len;
+    strm->next_out = counts_array;
+    strm->avail_out = (uInt) counts_array_len;
 
-    if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+    if (inflate(strm, Z_FINISH) != Z_STREAM_END)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
 
-    apply_to_counts(h, word_size, counts_array, counts_limit);
+    if (NULL == h)
+    {
+        hdr_init_preallocated(&src, &cfg);
+        src.normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+        decoder->dropped += accumulate_counts(*histogram, &src, word_size, counts_array, counts_limit);
+    }
+    else
+    {
+        apply_to_counts(h, word_size, counts_array, counts_limit);
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
-    h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
-    hdr_reset_internal_counters(h);
+        h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+        h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
+        hdr_reset_internal_counters(h);
+    }
 
 cleanup:
-    (void)inflateEnd(&strm);
-    hdr_free(counts_array);
-
     if (result != 0)
     {
-        hdr_free(h);
+        hdr_close(h);
     }
-    else if (NULL == *histogram)
+    else if (NULL != h)
     {
         *histogram = h;
     }
-    else
-    {
-        hdr_add(*histogram, h);
-        hdr_free(h);
-    }
 
     return result;
 }
 
 static int hdr_decode_compressed_v2(
+    struct hdr_log_decoder* decoder,
     compression_flyweight_t* compression_flyweight,
     size_t length,
     struct hdr_histogram** histogram)
@@ -566,13 +990,18 @@ static int hdr_decode_compressed_v2(
     int rc = 0;
     uint8_t* counts_array = NULL;
     encoding_flyweight_v1_t encoding_flyweight;
-    z_stream strm;
+    moments_flyweight_t moments_flyweight;
+    int64_t moments[4];
+    bool has_moments = false;
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram src;
+    z_stream* strm = &decoder->strm;
     uint32_t encoding_cookie;
     int32_t compressed_length, counts_limit, significant_figures;
     int64_t lowest_discernible_value, highest_trackable_value;
+    int i;
 
-    strm_init(&strm);
-    if (inflateInit(&strm) != Z_OK)
+    if (inflateReset(strm) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
@@ -584,12 +1013,12 @@ static int hdr_decode_compressed_v2(
         FAIL_AND_CLEANUP(cleanup, result, EINVAL);
     }
 
-    strm.next_in = compression_flyweight->data;
-    strm.avail_in = (uInt) compressed_length;
-    strm.next_out = (uint8_t *) &encoding_flyweight;
-    strm.avail_out = SIZEOF_ENCODING_FLYWEIGHT_V1;
+    strm->next_in = compression_flyweight->data;
+    strm->avail_in = (uInt) compressed_length;
+    strm->next_out = (uint8_t *) &encoding_flyweight;
+    strm->avail_out = SIZEOF_ENCODING_FLYWEIGHT_V1;
 
-    if (inflate(&strm, Z_SYNC_FLUSH) != Z_OK)
+    if (inflate(strm, Z_SYNC_FLUSH) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
@@ -605,7 +1034,7 @@ static int hdr_decode_compressed_v2(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    rc = hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, &h);
+    rc = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
     if (rc)
     {
         FAIL_AND_CLEANUP(cleanup, result, rc);
@@ -614,52 +1043,105 @@ static int hdr_decode_compressed_v2(
     /* Make sure there at least 9 bytes to read */
     /* if there is a corrupt value at the end */
     /* of the array we won't read corrupt data or crash. */
-    if ((counts_array = (uint8_t*) hdr_calloc(1, (size_t) counts_limit + 9)) == NULL)
+    if ((counts_array = decoder_counts(decoder, (size_t) counts_limit + 9)) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
 
-    strm.next_out = counts_array;
-    strm.avail_out = (uInt) counts_limit;
+    strm->next_out = counts_array;
+    strm->avail_out = (uInt) counts_limit;
 
-    if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+    rc = inflate(strm, Z_SYNC_FLUSH);
+    if ((Z_OK == rc || Z_BUF_ERROR == rc) && 0 == strm->avail_out)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
-    }
+        strm->next_out = (uint8_t*) &moments_flyweight;
+        strm->avail_out = sizeof(moments_flyweight_t);
+        rc = inflate(strm, Z_FINISH);
+        if (Z_STREAM_END != rc || V2_MOMENTS_COOKIE != be32toh(moments_flyweight.cookie))
+        {
+            FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        }
 
-    rc = apply_to_counts_zz(h, counts_array, counts_limit);
-    if (rc)
-    {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        for (i = 0; i < 4; i++)
+        {
+            moments[i] = be64toh(moments_flyweight.moments[i]);
+        }
+        has_moments = true;
+    }
+    else if (Z_STREAM_END != rc)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
     }
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
-    h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
-    hdr_reset_internal_counters(h);
+    if (NULL == *histogram)
+    {
+        rc = hdr_init_with_flags(
+            lowest_discernible_value, highest_trackable_value, significant_figures,
+            has_moments ? HDR_HISTOGRAM_MOMENTS : 0, &h);
+        if (rc)
+        {
+            FAIL_AND_CLEANUP(cleanup, result, rc);
+        }
 
-cleanup:
-    (void)inflateEnd(&strm);
-    hdr_free(counts_array);
+        rc = apply_to_counts_zz(h, h->counts_len, counts_array, counts_limit);
+        if (rc)
+        {
+            FAIL_AND_CLEANUP(cleanup, result, rc);
+        }
 
-    if (result != 0)
+        h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+        h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
+        hdr_reset_internal_counters(h);
+        if (has_moments)
+        {
+            hdr_set_moments(h, moments);
+        }
+    }
+    else
     {
-        hdr_free(h);
+        struct hdr_histogram* dst = *histogram;
+        const int64_t* dst_moments = hdr_moments(dst);
+        int64_t saved_moments[4];
+        int64_t dropped;
+
+        if (NULL != dst_moments)
+        {
+            memcpy(saved_moments, dst_moments, sizeof(saved_moments));
+        }
+
+        hdr_init_preallocated(&src, &cfg);
+        src.normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+        rc = accumulate_counts_zz(dst, &src, counts_array, counts_limit, &dropped);
+        decoder->dropped += dropped;
+        if (rc)
+        {
+            FAIL_AND_CLEANUP(cleanup, result, rc);
+        }
+
+        /* Exact moments replace those accumulated from the counts, unless */
+        /* some values were dropped and so are not in dst's counts.        */
+        if (NULL != dst_moments && has_moments && 0 == dropped)
+        {
+            hdr_set_moments(dst, saved_moments);
+            hdr_add_moments(dst, moments);
+        }
     }
-    else if (NULL == *histogram)
+
+cleanup:
+    if (result != 0)
     {
-        *histogram = h;
+        hdr_close(h);
     }
-    else
+    else if (NULL != h)
     {
-        hdr_add(*histogram, h);
-        hdr_free(h);
+        *histogram = h;
     }
 
     return result;
 }
 
-int hdr_decode_compressed(
-    uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+int hdr_log_decode_compressed_from(
+    struct hdr_log_decoder* decoder, uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
 {
     uint32_t compression_cookie;
     compression_flyweight_t* compression_flyweight;
@@ -674,20 +1156,56 @@ int hdr_decode_compressed(
     compression_cookie = get_cookie_base(be32toh(compression_flyweight->cookie));
     if (V0_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v0(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v0(decoder, compression_flyweight, length, histogram);
     }
     else if (V1_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v1(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v1(decoder, compression_flyweight, length, histogram);
     }
     else if (V2_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v2(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v2(decoder, compression_flyweight, length, histogram);
     }
 
     return HDR_COMPRESSION_COOKIE_MISMATCH;
 }
 
+int hdr_log_decode_with(
+    struct hdr_log_decoder* decoder, struct hdr_histogram** histogram, const char* base64_histogram, size_t base64_len)
+{
+    size_t compressed_len = hdr_base64_decoded_len(base64_len);
+    int rc;
+
+    if ((rc = ensure_capacity(&decoder->compressed, &decoder->compressed_capacity, compressed_len)) != 0)
+    {
+        return rc;
+    }
+
+    if ((rc = hdr_base64_decode(base64_histogram, base64_len, decoder->compressed, compressed_len)) != 0)
+    {
+        return rc;
+    }
+
+    return hdr_log_decode_compressed_from(decoder, decoder->compressed, compressed_len, histogram);
+}
+
+int hdr_decode_compressed(
+    uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    struct hdr_log_decoder* decoder = NULL;
+    int result;
+
+    if ((result = hdr_log_decoder_init(&decoder)) != 0)
+    {
+        return result;
+    }
+
+    result = hdr_log_decode_compressed_from(decoder, buffer, length, histogram);
+    hdr_log_decoder_close(decoder);
+
+    return result;
+}
+
 /* ##      ## ########  #### ######## ######## ########  */
 /* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
 /* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
@@ -698,85 +1216,92 @@ int hdr_decode_compressed(
 
 int hdr_log_writer_init(struct hdr_log_writer* writer)
 {
-    (void)writer;
+    writer->nonce = 0;
+    writer->encoder = NULL;
+
     return 0;
 }
 
-#define LOG_VERSION "1.2"
-#define LOG_MAJOR_VERSION 1
-
-static int print_user_prefix(FILE* f, const char* prefix)
+int hdr_log_writer_init_with_encoder(struct hdr_log_writer* writer)
 {
-    if (!prefix)
-    {
-        return 0;
-    }
+    hdr_log_writer_init(writer);
 
-    return fprintf(f, "#[%s]\n", prefix);
+    return hdr_log_encoder_init(&writer->encoder);
 }
 
-static int print_version(FILE* f, const char* version)
+void hdr_log_writer_close(struct hdr_log_writer* writer)
 {
-    return fprintf(f, "#[Histogram log format version %s]\n", version);
+    hdr_log_encoder_close(writer->encoder);
+    writer->encoder = NULL;
 }
 
-static int print_time(FILE* f, hdr_timespec* timestamp)
+#define LOG_VERSION "1.2"
+#define LOG_MAJOR_VERSION 1
+
+/* Example log                                                                       */
+/* #[Logged with jHiccup version 2.0.3-SNAPSHOT]                                     */
+/* #[Histogram log format version 1.01]                                              */
+/* #[StartTime: 1403476110.183 (seconds since epoch), Mon Jun 23 10:28:30 NZST 2014] */
+/* "StartTimestamp","EndTimestamp","Interval_Max","Interval_Compressed_Histogram"    */
+static int format_header(char* buffer, size_t len, const char* user_prefix, const hdr_timespec* timestamp)
 {
-    char time_str[128];
-    struct tm date_time;
+    char start_time[256] = "";
 
-    if (!timestamp)
+    if (NULL != timestamp)
     {
-        return 0;
-    }
+        char time_str[128];
+        char seconds[HDR_TIMESPEC_MAX_LEN + 1];
+        struct tm date_time;
 
 #if defined(__WINDOWS__)
-    _gmtime32_s(&date_time, &timestamp->tv_sec);
+        _gmtime32_s(&date_time, &timestamp->tv_sec);
 #else
-    gmtime_r(&timestamp->tv_sec, &date_time);
+        gmtime_r(&timestamp->tv_sec, &date_time);
 #endif
 
-    strftime(time_str, 128, "%a %b %X %Z %Y", &date_time);
-
-    return fprintf(
-        f, "#[StartTime: %.3f (seconds since epoch), %s]\n",
-        hdr_timespec_as_double(timestamp), time_str);
-}
+        strftime(time_str, 128, "%a %b %X %Z %Y", &date_time);
+        seconds[hdr_timespec_format(seconds, timestamp)] = '\0';
+        snprintf(
+            start_time, sizeof(start_time), "#[StartTime: %s (seconds since epoch), %s]\n", seconds, time_str);
+    }
 
-static int print_header(FILE* f)
-{
-    return fprintf(f, "\"StartTimestamp\",\"EndTimestamp\",\"Interval_Max\",\"Interval_Compressed_Histogram\"\n");
+    return snprintf(
+        buffer, len,
+        "%s%s%s#[Histogram log format version %s]\n%s"
+        "\"StartTimestamp\",\"EndTimestamp\",\"Interval_Max\",\"Interval_Compressed_Histogram\"\n",
+        NULL != user_prefix ? "#[" : "", NULL != user_prefix ? user_prefix : "", NULL != user_prefix ? "]\n" : "",
+        LOG_VERSION, start_time);
 }
 
-/* Example log                                                                       */
-/* #[Logged with jHiccup version 2.0.3-SNAPSHOT]                                     */
-/* #[Histogram log format version 1.01]                                              */
-/* #[StartTime: 1403476110.183 (seconds since epoch), Mon Jun 23 10:28:30 NZST 2014] */
-/* "StartTimestamp","EndTimestamp","Interval_Max","Interval_Compressed_Histogram"    */
 int hdr_log_write_header(
     struct hdr_log_writer* writer, FILE* file,
     const char* user_prefix, hdr_timespec* timestamp)
 {
+    char* header;
+    int len;
+    int result = 0;
+
     (void)writer;
 
-    if (print_user_prefix(file, user_prefix) < 0)
+    if ((len = format_header(NULL, 0, user_prefix, timestamp)) < 0)
     {
         return EIO;
     }
-    if (print_version(file, LOG_VERSION) < 0)
-    {
-        return EIO;
-    }
-    if (print_time(file, timestamp) < 0)
+
+    if ((header = (char*) hdr_malloc((size_t) len + 1)) == NULL)
     {
-        return EIO;
+        return ENOMEM;
     }
-    if (print_header(file) < 0)
+
+    format_header(header, (size_t) len + 1, user_prefix, timestamp);
+    if (fwrite(header, 1, (size_t) len, file) != (size_t) len)
     {
-        return EIO;
+        result = EIO;
     }
 
-    return 0;
+    hdr_free(header);
+
+    return result;
 }
 
 int hdr_log_write(
@@ -786,46 +1311,102 @@ int hdr_log_write(
     const hdr_timespec* end_timestamp,
     struct hdr_histogram* histogram)
 {
-    uint8_t* compressed_histogram = NULL;
-    size_t compressed_len = 0;
-    char* encoded_histogram = NULL;
-    int rc = 0;
-    int result = 0;
-    size_t encoded_len;
+    struct hdr_log_entry entry;
 
-    (void)writer;
+    memset(&entry, 0, sizeof(entry));
+    entry.start_timestamp = *start_timestamp;
+    entry.interval = *end_timestamp;
 
-    rc = hdr_encode_compressed(histogram, &compressed_histogram, &compressed_len);
-    if (rc != 0)
+    return hdr_log_write_entry(writer, file, &entry, histogram);
+}
+
+/* Room for the fields of an entry line other than the tag and histogram: */
+/* "Tag=", two signed timestamps, the max and the separators.             */
+#define ENTRY_FIELDS_MAX_LEN 96
+
+static size_t format_uint64(char* buffer, uint64_t value)
+{
+    char digits[20];
+    size_t len = 0;
+    size_t i;
+
+    do
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        digits[len++] = (char) ('0' + value % 10);
+        value /= 10;
     }
+    while (0 != value);
 
-    encoded_len = hdr_base64_encoded_len(compressed_len);
-    encoded_histogram = (char*) hdr_calloc(encoded_len + 1, sizeof(char));
+    for (i = 0; i < len; i++)
+    {
+        buffer[i] = digits[len - 1 - i];
+    }
 
-    rc = hdr_base64_encode(
-        compressed_histogram, compressed_len, encoded_histogram, encoded_len);
-    if (rc != 0)
+    return len;
+}
+
+/* Appends an entry line to *buffer at *len, growing the buffer as needed. */
+/* The histogram is base64 encoded straight into the line.                 */
+static int format_entry(
+    struct hdr_log_encoder* encoder,
+    uint8_t** buffer,
+    size_t* capacity,
+    size_t* len,
+    const struct hdr_log_entry* entry,
+    const struct hdr_histogram* histogram)
+{
+    size_t bound = hdr_log_encoder_bound(histogram);
+    size_t tag_len = 0;
+    size_t compressed_len;
+    size_t base64_len;
+    char* p;
+    int rc;
+
+    if (NULL != entry->tag && 0 < entry->tag_len)
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        const char* tag_end = (const char*) memchr(entry->tag, '\0', entry->tag_len);
+        tag_len = NULL != tag_end ? (size_t) (tag_end - entry->tag) : entry->tag_len;
     }
 
-    if (fprintf(
-        file, "%.3f,%.3f,%" PRIu64 ".0,%s\n",
-        hdr_timespec_as_double(start_timestamp),
-        hdr_timespec_as_double(end_timestamp),
-        hdr_max(histogram),
-        encoded_histogram) < 0)
+    if ((rc = ensure_capacity(&encoder->output, &encoder->output_capacity, bound)) != 0 ||
+        (rc = hdr_log_encode_compressed_into(encoder, histogram, encoder->output, bound, &compressed_len)) != 0)
     {
-        result = EIO;
+        return rc;
     }
 
-cleanup:
-    hdr_free(compressed_histogram);
-    hdr_free(encoded_histogram);
+    base64_len = hdr_base64_encoded_len(compressed_len);
+    if ((rc = ensure_capacity(buffer, capacity, *len + tag_len + ENTRY_FIELDS_MAX_LEN + base64_len)) != 0)
+    {
+        return rc;
+    }
 
-    return result;
+    p = (char*) *buffer + *len;
+    if (0 < tag_len)
+    {
+        memcpy(p, "Tag=", 4);
+        memcpy(p + 4, entry->tag, tag_len);
+        p += 4 + tag_len;
+        *p++ = ',';
+    }
+
+    p += hdr_timespec_format(p, &entry->start_timestamp);
+    *p++ = ',';
+    p += hdr_timespec_format(p, &entry->interval);
+    *p++ = ',';
+    p += format_uint64(p, (uint64_t) hdr_max(histogram));
+    memcpy(p, ".0,", 3);
+    p += 3;
+
+    if ((rc = hdr_base64_encode(encoder->output, compressed_len, p, base64_len)) != 0)
+    {
+        return rc;
+    }
+    p += base64_len;
+    *p++ = '\n';
+
+    *len = (size_t) (p - (char*) *buffer);
+
+    return 0;
 }
 
 int hdr_log_write_entry(
@@ -834,54 +1415,166 @@ int hdr_log_write_entry(
     struct hdr_log_entry* entry,
     struct hdr_histogram* histogram)
 {
-    uint8_t* compressed_histogram = NULL;
-    size_t compressed_len = 0;
-    char* encoded_histogram = NULL;
+    struct hdr_log_encoder* encoder = NULL != writer ? writer->encoder : NULL;
+    struct hdr_log_encoder* owned_encoder = NULL;
+    size_t line_len = 0;
     int rc = 0;
     int result = 0;
-    size_t encoded_len;
-    int has_tag = 0;
-    const char* tag_prefix;
-    const char* tag_value;
-    const char* tag_separator;
 
-    (void)writer;
+    /* Without a writer's encoder fall back to one just for this entry. */
+    if (NULL == encoder)
+    {
+        if ((rc = hdr_log_encoder_init(&owned_encoder)) != 0)
+        {
+            return rc;
+        }
+        encoder = owned_encoder;
+    }
 
-    rc = hdr_encode_compressed(histogram, &compressed_histogram, &compressed_len);
+    rc = format_entry(encoder, &encoder->line, &encoder->line_capacity, &line_len, entry, histogram);
     if (rc != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, rc);
     }
 
-    encoded_len = hdr_base64_encoded_len(compressed_len);
-    encoded_histogram = (char*) hdr_calloc(encoded_len + 1, sizeof(char));
+    if (fwrite(encoder->line, 1, line_len, file) != line_len)
+    {
+        result = EIO;
+    }
 
-    rc = hdr_base64_encode(
-        compressed_histogram, compressed_len, encoded_histogram, encoded_len);
-    if (rc != 0)
+cleanup:
+    hdr_log_encoder_close(owned_encoder);
+
+    return result;
+}
+
+static int file_sink(void* sink_arg, const uint8_t* data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE*) sink_arg) == len ? 0 : EIO;
+}
+
+static int fd_sink(void* sink_arg, const uint8_t* data, size_t len)
+{
+    int fd = (int) (intptr_t) sink_arg;
+
+    while (0 < len)
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+#if defined(_MSC_VER)
+        int written = _write(fd, data, (unsigned int) len);
+#else
+        ssize_t written = write(fd, data, len);
+#endif
+        if (written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return EIO;
+        }
+
+        data += written;
+        len -= (size_t) written;
     }
 
-    has_tag = NULL != entry->tag && 0 < entry->tag_len;
-    tag_prefix = has_tag ? "Tag=" : "";
-    tag_value = has_tag ? entry->tag : "";
-    tag_separator = has_tag ? "," : "";
+    return 0;
+}
 
-    if (fprintf(
-        file, "%s%.*s%s%.3f,%.3f,%" PRIu64 ".0,%s\n",
-        tag_prefix, (int) entry->tag_len, tag_value, tag_separator,
-        hdr_timespec_as_double(&entry->start_timestamp),
-        hdr_timespec_as_double(&entry->interval),
-        hdr_max(histogram),
-        encoded_histogram) < 0)
+int hdr_log_buffered_writer_init(
+    struct hdr_log_buffered_writer* writer, hdr_log_sink_fn sink, void* sink_arg, size_t flush_threshold)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->flush_threshold = flush_threshold;
+    writer->sink = sink;
+    writer->sink_arg = sink_arg;
+
+    return hdr_log_encoder_init(&writer->encoder);
+}
+
+int hdr_log_buffered_writer_init_file(struct hdr_log_buffered_writer* writer, FILE* file, size_t flush_threshold)
+{
+    return hdr_log_buffered_writer_init(writer, file_sink, file, flush_threshold);
+}
+
+int hdr_log_buffered_writer_init_fd(struct hdr_log_buffered_writer* writer, int fd, size_t flush_threshold)
+{
+    return hdr_log_buffered_writer_init(writer, fd_sink, (void*) (intptr_t) fd, flush_threshold);
+}
+
+static int flush_if_full(struct hdr_log_buffered_writer* writer)
+{
+    if (0 < writer->flush_threshold && writer->flush_threshold <= writer->len)
     {
-        result = EIO;
+        return hdr_log_buffered_writer_flush(writer);
     }
 
-    cleanup:
-    hdr_free(compressed_histogram);
-    hdr_free(encoded_histogram);
+    return 0;
+}
+
+int hdr_log_buffered_write_header(
+    struct hdr_log_buffered_writer* writer, const char* user_prefix, const hdr_timespec* timestamp)
+{
+    int len;
+    int rc;
+
+    if ((len = format_header(NULL, 0, user_prefix, timestamp)) < 0)
+    {
+        return EIO;
+    }
+
+    if ((rc = ensure_capacity(&writer->buffer, &writer->capacity, writer->len + (size_t) len + 1)) != 0)
+    {
+        return rc;
+    }
+
+    format_header((char*) writer->buffer + writer->len, (size_t) len + 1, user_prefix, timestamp);
+    writer->len += (size_t) len;
+
+    return flush_if_full(writer);
+}
+
+int hdr_log_buffered_write_entry(
+    struct hdr_log_buffered_writer* writer,
+    const struct hdr_log_entry* entry,
+    const struct hdr_histogram* histogram)
+{
+    int rc;
+
+    if ((rc = format_entry(
+        writer->encoder, &writer->buffer, &writer->capacity, &writer->len, entry, histogram)) != 0)
+    {
+        return rc;
+    }
+
+    return flush_if_full(writer);
+}
+
+int hdr_log_buffered_writer_flush(struct hdr_log_buffered_writer* writer)
+{
+    int rc;
+
+    if (0 == writer->len)
+    {
+        return 0;
+    }
+
+    if ((rc = writer->sink(writer->sink_arg, writer->buffer, writer->len)) != 0)
+    {
+        return rc;
+    }
+
+    writer->len = 0;
+
+    return 0;
+}
+
+int hdr_log_buffered_writer_close(struct hdr_log_buffered_writer* writer)
+{
+    int result = hdr_log_buffered_writer_flush(writer);
+
+    hdr_log_encoder_close(writer->encoder);
+    hdr_free(writer->buffer);
+    memset(writer, 0, sizeof(*writer));
 
     return result;
 }
@@ -900,10 +1593,24 @@ int hdr_log_reader_init(struct hdr_log_reader* reader)
     reader->minor_version = 0;
     reader->start_timestamp.tv_sec = 0;
     reader->start_timestamp.tv_nsec = 0;
+    reader->decoder = NULL;
 
     return 0;
 }
 
+int hdr_log_reader_init_with_decoder(struct hdr_log_reader* reader)
+{
+    hdr_log_reader_init(reader);
+
+    return hdr_log_decoder_init(&reader->decoder);
+}
+
+void hdr_log_reader_close(struct hdr_log_reader* reader)
+{
+    hdr_log_decoder_close(reader->decoder);
+    reader->decoder = NULL;
+}
+
 static void scan_log_format(struct hdr_log_reader* reader, const char* line)
 {
     const char* format = "#[Histogram log format version %d.%d]";
@@ -912,12 +1619,14 @@ static void scan_log_format(struct hdr_log_reader* reader, const char* line)
 
 static void scan_start_time(struct hdr_log_reader* reader, const char* line)
 {
-    const char* format = "#[StartTime: %lf [^\n]";
-    double timestamp = 0.0;
+    const char* prefix = "#[StartTime: ";
+    size_t prefix_len = strlen(prefix);
+    hdr_timespec timestamp;
 
-    if (sscanf(line, format, &timestamp) == 1)
+    if (0 == strncmp(line, prefix, prefix_len) &&
+        0 < hdr_timespec_parse(&timestamp, line + prefix_len, strlen(line + prefix_len)))
     {
-        hdr_timespec_from_double(&reader->start_timestamp, timestamp);
+        reader->start_timestamp = timestamp;
     }
 }
 
@@ -1007,216 +1716,142 @@ int hdr_log_read(
     return result;
 }
 
-static int read_ahead(FILE* f, const char* prefix, size_t prefix_len)
+/* Reads the next non-empty line into the decoder's buffer, without its line */
+/* terminator.  Returns EOF if there are no more lines.                      */
+static int read_line(struct hdr_log_decoder* decoder, FILE* file, size_t* line_len)
 {
-    size_t i;
-    for (i = 0; i < prefix_len; i++)
+    size_t len = 0;
+    char* line;
+
+    while (true)
     {
-        if (prefix[i] != fgetc(f))
+        if (len + 1 >= decoder->base64_capacity &&
+            ensure_capacity(&decoder->base64, &decoder->base64_capacity, decoder->base64_capacity * 2) != 0)
         {
-            return 0;
+            return -ENOMEM;
         }
-    }
-
-    return 1;
-}
-
-static int read_ahead_timestamp(FILE* f, hdr_timespec* timestamp, char expected_terminator)
-{
-    int c;
-    int is_seconds = 1;
-    long sec = 0;
-    long nsec = 0;
-    long nsec_multipler = 1000000000;
+        line = (char*) decoder->base64;
 
-    while (EOF != (c = fgetc(f)))
-    {
-        if (expected_terminator == c)
+        if (fgets(line + len, (int) (decoder->base64_capacity - len), file) == NULL)
         {
-            timestamp->tv_sec = sec;
-            timestamp->tv_nsec = (nsec * nsec_multipler);
-            return 1;
+            if (0 == len)
+            {
+                return EOF;
+            }
+            break;
         }
-        else if ('.' == c)
+
+        len += strlen(line + len);
+        if (0 == len || '\n' != line[len - 1])
         {
-            is_seconds = 0;
+            /* Longer than the buffer, or the last line in the file. */
+            continue;
         }
-        else if ('0' <= c && c <= '9')
+
+        while (0 < len && ('\r' == line[len - 1] || '\n' == line[len - 1]))
         {
-            if (is_seconds)
-            {
-                sec = (sec * 10) + (c - '0');
-            }
-            else
-            {
-                nsec = (nsec * 10) + (c - '0');
-                nsec_multipler /= 10;
-            }
+            len--;
         }
-        else
+        if (0 < len)
         {
-            return 0;
+            break;
         }
     }
 
+    while (0 < len && '\r' == line[len - 1])
+    {
+        len--;
+    }
+    *line_len = len;
+
     return 0;
 }
 
-enum parse_log_state {
-    INIT, TAG, BEGIN_TIMESTAMP, INTERVAL, MAX, HISTOGRAM, DONE
-};
+/* Parses a timestamp field along with the ',' that terminates it. */
+static const char* parse_timestamp_field(const char* p, const char* end, hdr_timespec* timestamp)
+{
+    size_t len = hdr_timespec_parse(timestamp, p, (size_t) (end - p));
+
+    if (0 == len || end <= p + len || ',' != p[len])
+    {
+        return NULL;
+    }
+
+    return p + len + 1;
+}
 
 int hdr_log_read_entry(
     struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry *entry, struct hdr_histogram** histogram)
 {
-    enum parse_log_state state = INIT;
-    size_t capacity = 1024;
-    size_t base64_len = 0;
-    size_t tag_offset = 0;
-    char* base64_histogram = hdr_calloc(capacity, sizeof(char));
-    size_t compressed_len = 0;
-    uint8_t* compressed_histogram = NULL;
-    int result = -EINVAL;
-
-    (void)reader;
+    struct hdr_log_decoder* decoder = NULL != reader ? reader->decoder : NULL;
+    struct hdr_log_decoder* owned_decoder = NULL;
+    const char* p;
+    const char* end;
+    size_t line_len;
+    int result;
 
     if (NULL == entry)
     {
         return -EINVAL;
     }
 
-    do
+    /* Without a reader's decoder fall back to one just for this entry. */
+    if (NULL == decoder)
     {
-        int c;
-
-        switch (state)
+        if (hdr_log_decoder_init(&owned_decoder) != 0)
         {
-            case INIT:
-                c = fgetc(file);
-                if ('T' == c)
-                {
-                    if (read_ahead(file, "ag=", 3))
-                    {
-                        state = TAG;
-                    }
-                    else
-                    {
-                        FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
-                    }
-                }
-                else if ('0' <= c && c <= '9')
-                {
-                    ungetc(c, file);
-                    state = BEGIN_TIMESTAMP;
-                }
-                else if ('\r' == c || '\n' == c)
-                {
-                    /* Skip over trailing/preceding new lines. */
-                }
-                else if (EOF == c)
-                {
-                    FAIL_AND_CLEANUP(cleanup, result, EOF);
-                }
-                else
-                {
-                    FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
-                }
-                break;
-            case TAG:
-                c = fgetc(file);
-                if (',' == c)
-                {
-                    if (NULL != entry->tag && tag_offset < entry->tag_len)
-                    {
-                        entry->tag[tag_offset] = '\0';
-                    }
-                    state = BEGIN_TIMESTAMP;
-                }
-                else if ('\r' == c || '\n' == c || EOF == c)
-                {
-                    FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
-                }
-                else
-                {
-                    if (NULL != entry->tag && tag_offset < entry->tag_len)
-                    {
-                        entry->tag[tag_offset] = (char) c;
-                        tag_offset++;
-                    }
-                }
-                break;
-            case BEGIN_TIMESTAMP:
-                if (read_ahead_timestamp(file, &entry->start_timestamp, ','))
-                {
-                    state = INTERVAL;
-                }
-                else
-                {
-                    FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
-                }
-                break;
-            case INTERVAL:
-                if (read_ahead_timestamp(file, &entry->interval, ','))
-                {
-                    state = MAX;
-                }
-                else
-                {
-                    FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
-                }
-                break;
-            case MAX:
-                if (read_ahead_timestamp(file, &entry->max, ','))
-                {
-                    state = HISTOGRAM;
-                }
-                else
-                {
-                    FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
-                }
-                break;
-            case HISTOGRAM:
-                c = fgetc(file);
-                if (c != '\r' && c != '\n' && c != EOF)
-                {
-                    if (base64_len == capacity)
-                    {
-                        capacity *= 2;
-                        base64_histogram = hdr_realloc(base64_histogram, capacity * sizeof(char));
-                        if (NULL == base64_histogram)
-                        {
-                            FAIL_AND_CLEANUP(cleanup, result, -ENOMEM);
-                        }
-                    }
-                    base64_histogram[base64_len++] = (char) c;
-                }
-                else
-                {
-                    state = DONE;
-                }
-                break;
-
-            default:
-                FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
+            return -ENOMEM;
         }
+        decoder = owned_decoder;
     }
-    while (DONE != state);
 
-    compressed_histogram = hdr_calloc(base64_len, sizeof(uint8_t));
-    compressed_len = hdr_base64_decoded_len(base64_len);
+    if (ensure_capacity(&decoder->base64, &decoder->base64_capacity, 1024) != 0)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, -ENOMEM);
+    }
 
-    result = hdr_base64_decode(
-        base64_histogram, base64_len, compressed_histogram, compressed_len);
-    if (result != 0)
+    if ((result = read_line(decoder, file, &line_len)) != 0)
     {
         goto cleanup;
     }
 
-    result = hdr_decode_compressed(compressed_histogram, compressed_len, histogram);
+    p = (const char*) decoder->base64;
+    end = p + line_len;
+
+    if ('T' == *p)
+    {
+        const char* tag_end;
+        size_t tag_len;
+
+        if (line_len < 4 || 0 != memcmp(p, "Tag=", 4) ||
+            (tag_end = (const char*) memchr(p + 4, ',', (size_t) (end - p - 4))) == NULL)
+        {
+            FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
+        }
+
+        tag_len = (size_t) (tag_end - p - 4);
+        if (NULL != entry->tag && 0 < entry->tag_len)
+        {
+            memcpy(entry->tag, p + 4, tag_len < entry->tag_len ? tag_len : entry->tag_len);
+            if (tag_len < entry->tag_len)
+            {
+                entry->tag[tag_len] = '\0';
+            }
+        }
+        p = tag_end + 1;
+    }
+
+    if ((p = parse_timestamp_field(p, end, &entry->start_timestamp)) == NULL ||
+        (p = parse_timestamp_field(p, end, &entry->interval)) == NULL ||
+        (p = parse_timestamp_field(p, end, &entry->max)) == NULL)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, -EINVAL);
+    }
+
+    result = hdr_log_decode_with(decoder, histogram, p, (size_t) (end - p));
 
 cleanup:
-    hdr_free(base64_histogram);
-    hdr_free(compressed_histogram);
+    hdr_log_decoder_close(owned_decoder);
     return result;
 }
 
@@ -43,6 +43,111 @@ const char* hdr_strerror(int errnum)
     }
 }
 
+int hdr_log_encoder_init(struct hdr_log_encoder** encoder)
+{
+    UNUSED(encoder);
+
+    return -1;
+}
+
+int hdr_log_encoder_init_with_flags(struct hdr_log_encoder** encoder, uint32_t flags)
+{
+    UNUSED(encoder);
+    UNUSED(flags);
+
+    return -1;
+}
+
+void hdr_log_encoder_close(struct hdr_log_encoder* encoder)
+{
+    UNUSED(encoder);
+}
+
+size_t hdr_log_encoder_bound(const struct hdr_histogram* h)
+{
+    UNUSED(h);
+
+    return 0;
+}
+
+int hdr_log_encode_compressed_into(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    uint8_t* buffer,
+    size_t buffer_len,
+    size_t* compressed_len)
+{
+    UNUSED(encoder);
+    UNUSED(h);
+    UNUSED(buffer);
+    UNUSED(buffer_len);
+    UNUSED(compressed_len);
+
+    return -1;
+}
+
+int hdr_log_encode_compressed_to_sink(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    hdr_log_sink_fn sink,
+    void* sink_arg)
+{
+    UNUSED(encoder);
+    UNUSED(h);
+    UNUSED(sink);
+    UNUSED(sink_arg);
+
+    return -1;
+}
+
+int hdr_log_encode_with(
+    struct hdr_log_encoder* encoder,
+    const struct hdr_histogram* h,
+    const char** encoded_histogram,
+    size_t* encoded_len)
+{
+    UNUSED(encoder);
+    UNUSED(h);
+    UNUSED(encoded_histogram);
+    UNUSED(encoded_len);
+
+    return -1;
+}
+
+int hdr_log_decoder_init(struct hdr_log_decoder** decoder)
+{
+    UNUSED(decoder);
+
+    return -1;
+}
+
+void hdr_log_decoder_close(struct hdr_log_decoder* decoder)
+{
+    UNUSED(decoder);
+}
+
+int hdr_log_decode_compressed_from(
+    struct hdr_log_decoder* decoder, uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    UNUSED(decoder);
+    UNUSED(buffer);
+    UNUSED(length);
+    UNUSED(histogram);
+
+    return -1;
+}
+
+int hdr_log_decode_with(
+    struct hdr_log_decoder* decoder, struct hdr_histogram** histogram, const char* base64_histogram, size_t base64_len)
+{
+    UNUSED(decoder);
+    UNUSED(histogram);
+    UNUSED(base64_histogram);
+    UNUSED(base64_len);
+
+    return -1;
+}
+
 int hdr_encode_compressed(
     struct hdr_histogram* h,
     uint8_t** compressed_histogram,
@@ -72,6 +177,18 @@ int hdr_log_writer_init(struct hdr_log_writer* writer)
     return -1;
 }
 
+int hdr_log_writer_init_with_encoder(struct hdr_log_writer* writer)
+{
+    UNUSED(writer);
+
+    return -1;
+}
+
+void hdr_log_writer_close(struct hdr_log_writer* writer)
+{
+    UNUSED(writer);
+}
+
 int hdr_log_write_header(
     struct hdr_log_writer* writer, FILE* file,
     const char* user_prefix, hdr_timespec* timestamp)
@@ -114,6 +231,71 @@ int hdr_log_write_entry(
     return -1;
 }
 
+int hdr_log_buffered_writer_init(
+    struct hdr_log_buffered_writer* writer, hdr_log_sink_fn sink, void* sink_arg, size_t flush_threshold)
+{
+    UNUSED(writer);
+    UNUSED(sink);
+    UNUSED(sink_arg);
+    UNUSED(flush_threshold);
+
+    return -1;
+}
+
+int hdr_log_buffered_writer_init_file(struct hdr_log_buffered_writer* writer, FILE* file, size_t flush_threshold)
+{
+    UNUSED(writer);
+    UNUSED(file);
+    UNUSED(flush_threshold);
+
+    return -1;
+}
+
+int hdr_log_buffered_writer_init_fd(struct hdr_log_buffered_writer* writer, int fd, size_t flush_threshold)
+{
+    UNUSED(writer);
+    UNUSED(fd);
+    UNUSED(flush_threshold);
+
+    return -1;
+}
+
+int hdr_log_buffered_write_header(
+    struct hdr_log_buffered_writer* writer, const char* user_prefix, const hdr_timespec* timestamp)
+{
+    UNUSED(writer);
+    UNUSED(user_prefix);
+    UNUSED(timestamp);
+
+    return -1;
+}
+
+int hdr_log_buffered_write_entry(
+    struct hdr_log_buffered_writer* writer,
+    const struct hdr_log_entry* entry,
+    const struct hdr_histogram* histogram)
+{
+    UNUSED(writer);
+    UNUSED(entry);
+    UNUSED(histogram);
+
+    return -1;
+}
+
+int hdr_log_buffered_writer_flush(struct hdr_log_buffered_writer* writer)
+{
+    UNUSED(writer);
+
+    return -1;
+}
+
+int hdr_log_buffered_writer_close(struct hdr_log_buffered_writer* writer)
+{
+    UNUSED(writer);
+
+    return -1;
+}
+
 int hdr_log_reader_init(struct hdr_log_reader* reader)
 {
     UNUSED(reader);
@@ -121,6 +303,18 @@ int hdr_log_reader_init(struct hdr_log_reader* reader)
     return -1;
 }
 
+int hdr_log_reader_init_with_decoder(struct hdr_log_reader* reader)
+{
+    UNUSED(reader);
+
+    return -1;
+}
+
+void hdr_log_reader_close(struct hdr_log_reader* reader)
+{
+    UNUSED(reader);
+}
+
 int hdr_log_read_header(struct hdr_log_reader* reader, FILE* file)
 {
     UNUSED(reader);
@@ -0,0 +1,51 @@
+/**
+ * hdr_instrument.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Hooks for timing the library's own operations, see
+ * hdr/hdr_self_instrumentation.h.  Compiled out unless HDR_SELF_INSTRUMENTATION
+ * is defined.
+ */
+
+#ifndef HDR_SELF_INSTRUMENTATION_PRIVATE_H
+#define HDR_SELF_INSTRUMENTATION_PRIVATE_H 1
+
+#include <hdr/hdr_self_instrumentation.h>
+
+#if defined(HDR_SELF_INSTRUMENTATION)
+
+#include <hdr/hdr_time.h>
+
+bool hdr_self_instrumentation_sample(hdr_timespec* start);
+void hdr_self_instrumentation_record(hdr_self_operation operation, const hdr_timespec* start);
+
+#define HDR_SELF_INSTRUMENT_BEGIN(name) \
+    hdr_timespec name##_start; \
+    const bool name##_sampled = hdr_self_instrumentation_sample(&name##_start)
+
+/* For infrequent operations, times every call rather than a sample. */
+#define HDR_SELF_INSTRUMENT_BEGIN_EVERY(name) \
+    hdr_timespec name##_start; \
+    const bool name##_sampled = true; \
+    hdr_gettime(&name##_start)
+
+#define HDR_SELF_INSTRUMENT_END(name, operation) \
+    do \
+    { \
+        if (name##_sampled) \
+        { \
+            hdr_self_instrumentation_record(operation, &name##_start); \
+        } \
+    } \
+    while (0)
+
+#else
+
+#define HDR_SELF_INSTRUMENT_BEGIN(name) do {} while (0)
+#define HDR_SELF_INSTRUMENT_BEGIN_EVERY(name) do {} while (0)
+#define HDR_SELF_INSTRUMENT_END(name, operation) do {} while (0)
+
+#endif
+
+#endif
@@ -6,6 +6,7 @@
 
 #include <hdr/hdr_interval_recorder.h>
 #include "hdr_atomic.h"
+#include "hdr_instrument.h"
 
 #ifndef HDR_MALLOC_INCLUDE
 #define HDR_MALLOC_INCLUDE "hdr_malloc.h"
@@ -58,7 +59,7 @@ struct hdr_histogram* hdr_interval_recorder_sample_and_recycle(
         int64_t lo = r->active->lowest_discernible_value;
         int64_t hi = r->active->highest_trackable_value;
         int significant_figures = r->active->significant_figures;
-        hdr_init(lo, hi, significant_figures, &histogram_to_recycle);
+        hdr_init_with_flags(lo, hi, significant_figures, r->active->flags, &histogram_to_recycle);
     }
     else
     {
@@ -134,7 +135,13 @@ int64_t hdr_interval_recorder_record_value(
     int64_t value
 )
 {
-    return hdr_interval_recorder_record_values(r, value, 1);
+    int64_t result;
+    HDR_SELF_INSTRUMENT_BEGIN(record);
+
+    result = hdr_interval_recorder_record_values(r, value, 1);
+
+    HDR_SELF_INSTRUMENT_END(record, HDR_SELF_INTERVAL_RECORDER_RECORD_VALUE);
+    return result;
 }
 
 static void update_corrected_values(struct hdr_histogram* data, void* arg)
@@ -182,7 +189,13 @@ int64_t hdr_interval_recorder_record_value_atomic(
     int64_t value
 )
 {
-    return hdr_interval_recorder_record_values_atomic(r, value, 1);
+    int64_t result;
+    HDR_SELF_INSTRUMENT_BEGIN(record);
+
+    result = hdr_interval_recorder_record_values_atomic(r, value, 1);
+
+    HDR_SELF_INSTRUMENT_END(record, HDR_SELF_INTERVAL_RECORDER_RECORD_VALUE);
+    return result;
 }
 
 int64_t hdr_interval_recorder_record_values_atomic(
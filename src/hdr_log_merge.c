@@ -0,0 +1,609 @@
+/**
+ * hdr_log_merge.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_log_merge.h>
+#include <hdr/hdr_thread.h>
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+#define FAIL_AND_CLEANUP(label, error_name, error) \
+    do                      \
+    {                       \
+        error_name = error; \
+        goto label;         \
+    }                       \
+    while (0)
+
+#define NANOS_PER_SECOND INT64_C(1000000000)
+
+enum merge_phase
+{
+    MERGE_PRIME,
+    MERGE_READ,
+    MERGE_COMBINE
+};
+
+/* An input log and the next entry read from it, decoded into 'pending'. */
+struct merge_input
+{
+    FILE* file;
+    struct hdr_log_reader reader;
+    struct hdr_histogram* pending;
+    int64_t pending_start;
+    bool has_pending;
+    int64_t log_start;
+};
+
+struct merge_worker
+{
+    struct merge_context* context;
+    int id;
+    /* One histogram per bucket of the current round. */
+    struct hdr_histogram** buckets;
+    bool* filled;
+    char tag[HDR_LOG_TAG_MAX_BUFFER_LEN];
+    /* Count of values outside the range of the merged histograms. */
+    int64_t dropped;
+    int result;
+    hdr_thread thread;
+};
+
+struct merge_context
+{
+    struct merge_input* inputs;
+    size_t input_count;
+    struct merge_worker* workers;
+    int worker_count;
+    int buckets_per_round;
+    int64_t interval;
+    int64_t origin;
+    int64_t base_bucket;
+    int64_t first_open_bucket;
+    enum merge_phase phase;
+};
+
+static int64_t to_nanos(const hdr_timespec* t)
+{
+    return (int64_t) t->tv_sec * NANOS_PER_SECOND + t->tv_nsec;
+}
+
+static void from_nanos(int64_t nanos, hdr_timespec* t)
+{
+    t->tv_sec = (time_t) (nanos / NANOS_PER_SECOND);
+    t->tv_nsec = (long) (nanos % NANOS_PER_SECOND);
+}
+
+void hdr_log_merge_options_init(struct hdr_log_merge_options* options)
+{
+    memset(options, 0, sizeof(*options));
+    options->lowest_discernible_value = 1;
+    options->highest_trackable_value = INT64_C(24) * 60 * 60 * 1000000;
+    options->significant_figures = 3;
+    options->interval.tv_sec = 1;
+    options->threads = 4;
+    options->buckets_per_round = 64;
+}
+
+/* ########  ########    ###    ########  */
+/* ##     ## ##         ## ##   ##     ## */
+/* ##     ## ##        ##   ##  ##     ## */
+/* ########  ######   ##     ## ##     ## */
+/* ##   ##   ##       ######### ##     ## */
+/* ##    ##  ##       ##     ## ##     ## */
+/* ##     ## ######## ##     ## ########  */
+
+static int read_pending(struct merge_input* input, char* tag)
+{
+    struct hdr_log_entry entry;
+    int64_t start;
+    int rc;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.tag = tag;
+    entry.tag_len = HDR_LOG_TAG_MAX_BUFFER_LEN - 1;
+
+    hdr_reset(input->pending);
+    rc = hdr_log_read_entry(&input->reader, input->file, &entry, &input->pending);
+    if (EOF == rc)
+    {
+        input->has_pending = false;
+        return 0;
+    }
+    if (0 != rc)
+    {
+        input->has_pending = false;
+        return rc;
+    }
+
+    start = to_nanos(&entry.start_timestamp);
+    if (entry.start_timestamp.tv_sec < input->reader.start_timestamp.tv_sec)
+    {
+        /* An offset from the log's StartTime. */
+        start += input->log_start;
+    }
+
+    input->pending_start = start;
+    input->has_pending = true;
+
+    return 0;
+}
+
+static int prime_input(struct merge_input* input, char* tag)
+{
+    int rc;
+
+    if ((rc = hdr_log_read_header(&input->reader, input->file)) != 0)
+    {
+        return rc;
+    }
+
+    input->log_start = to_nanos(&input->reader.start_timestamp);
+
+    return read_pending(input, tag);
+}
+
+/* Slot of the current round for the pending entry, or -1 if it belongs to a */
+/* later round.  Entries that arrive late are added to the first slot.       */
+static int32_t slot_for(const struct merge_context* context, const struct merge_input* input)
+{
+    int64_t bucket;
+
+    if (input->pending_start < context->origin)
+    {
+        return 0;
+    }
+
+    bucket = (input->pending_start - context->origin) / context->interval;
+    if (bucket < context->base_bucket)
+    {
+        return 0;
+    }
+    if (bucket - context->base_bucket >= context->buckets_per_round)
+    {
+        return -1;
+    }
+
+    return (int32_t) (bucket - context->base_bucket);
+}
+
+static int read_inputs(struct merge_worker* worker)
+{
+    struct merge_context* context = worker->context;
+    size_t i;
+    int rc;
+
+    for (i = (size_t) worker->id; i < context->input_count; i += (size_t) context->worker_count)
+    {
+        struct merge_input* input = &context->inputs[i];
+
+        while (input->has_pending)
+        {
+            int32_t slot = slot_for(context, input);
+            if (slot < 0)
+            {
+                break;
+            }
+
+            worker->dropped += hdr_add(worker->buckets[slot], input->pending);
+            worker->filled[slot] = true;
+
+            if ((rc = read_pending(input, worker->tag)) != 0)
+            {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Each worker combines a share of the round's buckets into worker 0's. */
+static void combine_buckets(struct merge_worker* worker)
+{
+    struct merge_context* context = worker->context;
+    struct merge_worker* target = &context->workers[0];
+    int slot, w;
+
+    for (slot = worker->id; slot < context->buckets_per_round; slot += context->worker_count)
+    {
+        for (w = 1; w < context->worker_count; w++)
+        {
+            struct merge_worker* source = &context->workers[w];
+            if (source->filled[slot])
+            {
+                worker->dropped += hdr_add(target->buckets[slot], source->buckets[slot]);
+                target->filled[slot] = true;
+                hdr_reset(source->buckets[slot]);
+                source->filled[slot] = false;
+            }
+        }
+    }
+}
+
+static void* run_worker(void* arg)
+{
+    struct merge_worker* worker = (struct merge_worker*) arg;
+    struct merge_context* context = worker->context;
+    size_t i;
+    int rc;
+
+    switch (context->phase)
+    {
+        case MERGE_PRIME:
+            for (i = (size_t) worker->id; i < context->input_count; i += (size_t) context->worker_count)
+            {
+                if ((rc = prime_input(&context->inputs[i], worker->tag)) != 0)
+                {
+                    worker->result = rc;
+                    break;
+                }
+            }
+            break;
+
+        case MERGE_READ:
+            worker->result = read_inputs(worker);
+            break;
+
+        case MERGE_COMBINE:
+            combine_buckets(worker);
+            break;
+    }
+
+    return NULL;
+}
+
+/* Runs a phase on every worker, worker 0 on the calling thread.  A worker */
+/* whose thread can not be started is run on the calling thread instead.   */
+static int run_phase(struct merge_context* context, enum merge_phase phase)
+{
+    bool* started;
+    int w;
+
+    if ((started = (bool*) hdr_calloc((size_t) context->worker_count, sizeof(bool))) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    context->phase = phase;
+    for (w = 1; w < context->worker_count; w++)
+    {
+        started[w] = 0 == hdr_thread_create(&context->workers[w].thread, run_worker, &context->workers[w]);
+    }
+
+    run_worker(&context->workers[0]);
+
+    for (w = 1; w < context->worker_count; w++)
+    {
+        if (started[w])
+        {
+            hdr_thread_join(&context->workers[w].thread);
+        }
+        else
+        {
+            run_worker(&context->workers[w]);
+        }
+    }
+
+    hdr_free(started);
+
+    for (w = 0; w < context->worker_count; w++)
+    {
+        if (0 != context->workers[w].result)
+        {
+            return context->workers[w].result;
+        }
+    }
+
+    return 0;
+}
+
+/* ##     ## ######## ########   ######   ########  */
+/* ###   ### ##       ##     ## ##    ##  ##        */
+/* #### #### ##       ##     ## ##        ##        */
+/* ## ### ## ######   ########  ##   #### ######    */
+/* ##     ## ##       ##   ##   ##    ##  ##        */
+/* ##     ## ##       ##    ##  ##    ##  ##        */
+/* ##     ## ######## ##     ##  ######   ########  */
+
+/* Earliest bucket of any pending entry, or -1 when every input is exhausted. */
+static int64_t next_bucket(const struct merge_context* context)
+{
+    int64_t next = -1;
+    size_t i;
+
+    for (i = 0; i < context->input_count; i++)
+    {
+        const struct merge_input* input = &context->inputs[i];
+        int64_t bucket;
+
+        if (!input->has_pending)
+        {
+            continue;
+        }
+
+        bucket = input->pending_start < context->origin ?
+            0 : (input->pending_start - context->origin) / context->interval;
+        bucket = bucket < context->first_open_bucket ? context->first_open_bucket : bucket;
+        next = next < 0 || bucket < next ? bucket : next;
+    }
+
+    return next;
+}
+
+static int write_round(
+    struct merge_context* context, struct hdr_log_writer* writer, FILE* output, const hdr_timespec* interval)
+{
+    struct merge_worker* target = &context->workers[0];
+    int slot;
+    int rc;
+
+    for (slot = 0; slot < context->buckets_per_round; slot++)
+    {
+        struct hdr_log_entry entry;
+
+        if (!target->filled[slot])
+        {
+            continue;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        from_nanos((context->base_bucket + slot) * context->interval, &entry.start_timestamp);
+        entry.interval = *interval;
+
+        if ((rc = hdr_log_write_entry(writer, output, &entry, target->buckets[slot])) != 0)
+        {
+            return rc;
+        }
+
+        hdr_reset(target->buckets[slot]);
+        target->filled[slot] = false;
+    }
+
+    return 0;
+}
+
+static int init_workers(struct merge_context* context, const struct hdr_log_merge_options* options)
+{
+    int w, slot;
+    int rc;
+
+    context->workers = (struct merge_worker*) hdr_calloc(
+        (size_t) context->worker_count, sizeof(struct merge_worker));
+    if (NULL == context->workers)
+    {
+        return ENOMEM;
+    }
+
+    for (w = 0; w < context->worker_count; w++)
+    {
+        struct merge_worker* worker = &context->workers[w];
+
+        worker->context = context;
+        worker->id = w;
+        worker->buckets = (struct hdr_histogram**) hdr_calloc(
+            (size_t) context->buckets_per_round, sizeof(struct hdr_histogram*));
+        worker->filled = (bool*) hdr_calloc((size_t) context->buckets_per_round, sizeof(bool));
+        if (NULL == worker->buckets || NULL == worker->filled)
+        {
+            return ENOMEM;
+        }
+
+        for (slot = 0; slot < context->buckets_per_round; slot++)
+        {
+            rc = hdr_init(
+                options->lowest_discernible_value,
+                options->highest_trackable_value,
+                options->significant_figures,
+                &worker->buckets[slot]);
+            if (0 != rc)
+            {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int init_inputs(struct merge_context* context, FILE* const* inputs, const struct hdr_log_merge_options* options)
+{
+    size_t i;
+    int rc;
+
+    context->inputs = (struct merge_input*) hdr_calloc(context->input_count, sizeof(struct merge_input));
+    if (NULL == context->inputs)
+    {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < context->input_count; i++)
+    {
+        struct merge_input* input = &context->inputs[i];
+
+        input->file = inputs[i];
+        if ((rc = hdr_log_reader_init_with_decoder(&input->reader)) != 0)
+        {
+            return rc;
+        }
+
+        rc = hdr_init(
+            options->lowest_discernible_value,
+            options->highest_trackable_value,
+            options->significant_figures,
+            &input->pending);
+        if (0 != rc)
+        {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+static void close_context(struct merge_context* context)
+{
+    size_t i;
+    int w, slot;
+
+    if (NULL != context->inputs)
+    {
+        for (i = 0; i < context->input_count; i++)
+        {
+            hdr_log_reader_close(&context->inputs[i].reader);
+            hdr_close(context->inputs[i].pending);
+        }
+        hdr_free(context->inputs);
+    }
+
+    if (NULL != context->workers)
+    {
+        for (w = 0; w < context->worker_count; w++)
+        {
+            struct merge_worker* worker = &context->workers[w];
+            if (NULL != worker->buckets)
+            {
+                for (slot = 0; slot < context->buckets_per_round; slot++)
+                {
+                    hdr_close(worker->buckets[slot]);
+                }
+            }
+            hdr_free(worker->buckets);
+            hdr_free(worker->filled);
+        }
+        hdr_free(context->workers);
+    }
+}
+
+/* Values dropped while decoding into the pending histograms and adding */
+/* them and the workers' buckets together.                              */
+static int64_t dropped_values(const struct merge_context* context)
+{
+    int64_t dropped = 0;
+    size_t i;
+    int w;
+
+    for (i = 0; NULL != context->inputs && i < context->input_count; i++)
+    {
+        if (NULL != context->inputs[i].reader.decoder)
+        {
+            dropped += hdr_log_decoder_dropped(context->inputs[i].reader.decoder);
+        }
+    }
+
+    for (w = 0; NULL != context->workers && w < context->worker_count; w++)
+    {
+        dropped += context->workers[w].dropped;
+    }
+
+    return dropped;
+}
+
+int hdr_log_merge(
+    FILE* const* inputs,
+    size_t input_count,
+    FILE* output,
+    const struct hdr_log_merge_options* options,
+    int64_t* dropped)
+{
+    struct hdr_log_merge_options defaults;
+    struct merge_context context;
+    struct hdr_log_writer writer;
+    bool writer_initialised = false;
+    hdr_timespec origin;
+    size_t i;
+    int result = 0;
+    int rc;
+
+    if (NULL != dropped)
+    {
+        *dropped = 0;
+    }
+
+    if (NULL == options)
+    {
+        hdr_log_merge_options_init(&defaults);
+        options = &defaults;
+    }
+
+    if (options->threads < 1 || options->buckets_per_round < 1 || to_nanos(&options->interval) <= 0)
+    {
+        return EINVAL;
+    }
+
+    memset(&context, 0, sizeof(context));
+    context.input_count = input_count;
+    context.worker_count = 0 < input_count && input_count < (size_t) options->threads ?
+        (int) input_count : options->threads;
+    context.buckets_per_round = options->buckets_per_round;
+    context.interval = to_nanos(&options->interval);
+
+    if ((rc = init_inputs(&context, inputs, options)) != 0 ||
+        (rc = init_workers(&context, options)) != 0 ||
+        (rc = run_phase(&context, MERGE_PRIME)) != 0)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+
+    context.origin = INT64_MAX;
+    for (i = 0; i < input_count; i++)
+    {
+        if (context.inputs[i].has_pending && context.inputs[i].pending_start < context.origin)
+        {
+            context.origin = context.inputs[i].pending_start;
+        }
+    }
+    context.origin = INT64_MAX == context.origin ? 0 : context.origin;
+    from_nanos(context.origin, &origin);
+
+    if ((rc = hdr_log_writer_init_with_encoder(&writer)) != 0)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+    writer_initialised = true;
+
+    if ((rc = hdr_log_write_header(&writer, output, NULL, &origin)) != 0)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+
+    while ((context.base_bucket = next_bucket(&context)) >= 0)
+    {
+        if ((rc = run_phase(&context, MERGE_READ)) != 0 ||
+            (rc = run_phase(&context, MERGE_COMBINE)) != 0 ||
+            (rc = write_round(&context, &writer, output, &options->interval)) != 0)
+        {
+            FAIL_AND_CLEANUP(cleanup, result, rc);
+        }
+
+        context.first_open_bucket = context.base_bucket + context.buckets_per_round;
+    }
+
+cleanup:
+    if (NULL != dropped)
+    {
+        *dropped = dropped_values(&context);
+    }
+    if (writer_initialised)
+    {
+        hdr_log_writer_close(&writer);
+    }
+    close_context(&context);
+
+    return result;
+}
@@ -0,0 +1,303 @@
+/**
+ * hdr_registry.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_registry.h>
+#include "hdr_atomic.h"
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+#define HDR_REGISTRY_MIN_BUCKETS 16
+
+/* FNV-1a */
+static uint64_t hash_labels(const char* labels, size_t labels_len)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+    size_t i;
+
+    for (i = 0; i < labels_len; i++)
+    {
+        hash ^= (uint8_t) labels[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
+static bool valid_labels(const char* labels, size_t labels_len)
+{
+    size_t i;
+
+    if (NULL == labels || 0 == labels_len)
+    {
+        return false;
+    }
+
+    for (i = 0; i < labels_len; i++)
+    {
+        char c = labels[i];
+        if (',' == c || ' ' == c || '\t' == c || '\r' == c || '\n' == c || '\0' == c)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static struct hdr_registry_series* find_series(
+    struct hdr_registry* r, uint64_t hash, const char* labels, size_t labels_len)
+{
+    struct hdr_registry_series* series = hdr_atomic_load_pointer(&r->buckets[hash & r->bucket_mask]);
+
+    while (NULL != series)
+    {
+        if (hash == series->hash &&
+            labels_len == series->labels_len &&
+            0 == memcmp(labels, series->labels, labels_len))
+        {
+            return series;
+        }
+        series = series->next;
+    }
+
+    return NULL;
+}
+
+int hdr_registry_init(
+    struct hdr_registry* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    size_t expected_series)
+{
+    struct hdr_histogram_bucket_config cfg;
+    size_t bucket_count = HDR_REGISTRY_MIN_BUCKETS;
+    int rc;
+
+    memset(r, 0, sizeof(struct hdr_registry));
+
+    rc = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (rc)
+    {
+        return rc;
+    }
+
+    while (bucket_count < expected_series && bucket_count <= SIZE_MAX / 2 / sizeof(struct hdr_registry_series*))
+    {
+        bucket_count <<= 1;
+    }
+
+    r->buckets = (struct hdr_registry_series**) hdr_calloc(bucket_count, sizeof(struct hdr_registry_series*));
+    r->create_mutex = hdr_mutex_alloc();
+    if (NULL == r->buckets || NULL == r->create_mutex)
+    {
+        hdr_registry_destroy(r);
+        return ENOMEM;
+    }
+
+    rc = hdr_mutex_init(r->create_mutex);
+    if (0 != rc)
+    {
+        hdr_mutex_free(r->create_mutex);
+        r->create_mutex = NULL;
+        hdr_registry_destroy(r);
+        return rc;
+    }
+
+    r->bucket_mask = (uint64_t) bucket_count - 1;
+    r->lowest_discernible_value = lowest_discernible_value;
+    r->highest_trackable_value = highest_trackable_value;
+    r->significant_figures = significant_figures;
+
+    return 0;
+}
+
+void hdr_registry_destroy(struct hdr_registry* r)
+{
+    struct hdr_registry_series* series = r->first;
+
+    while (NULL != series)
+    {
+        struct hdr_registry_series* next = series->next_created;
+        hdr_interval_recorder_destroy(&series->recorder);
+        hdr_free(series);
+        series = next;
+    }
+
+    if (r->create_mutex)
+    {
+        hdr_mutex_destroy(r->create_mutex);
+        hdr_mutex_free(r->create_mutex);
+    }
+
+    hdr_free(r->buckets);
+
+    r->buckets = NULL;
+    r->create_mutex = NULL;
+    r->first = NULL;
+    r->last = NULL;
+    r->series_count = 0;
+}
+
+struct hdr_interval_recorder* hdr_registry_find(
+    struct hdr_registry* r, const char* labels, size_t labels_len)
+{
+    struct hdr_registry_series* series = find_series(r, hash_labels(labels, labels_len), labels, labels_len);
+
+    return NULL != series ? &series->recorder : NULL;
+}
+
+int hdr_registry_recorder(
+    struct hdr_registry* r, const char* labels, size_t labels_len, struct hdr_interval_recorder** result)
+{
+    struct hdr_registry_series* series;
+    struct hdr_registry_series** bucket;
+    uint64_t hash;
+    char* labels_copy;
+    int rc = 0;
+
+    if (!valid_labels(labels, labels_len))
+    {
+        return EINVAL;
+    }
+
+    hash = hash_labels(labels, labels_len);
+    if ((series = find_series(r, hash, labels, labels_len)) != NULL)
+    {
+        *result = &series->recorder;
+        return 0;
+    }
+
+    hdr_mutex_lock(r->create_mutex);
+
+    /* Another thread may have created it while this one waited. */
+    if ((series = find_series(r, hash, labels, labels_len)) != NULL)
+    {
+        *result = &series->recorder;
+        goto cleanup;
+    }
+
+    /* The labels live in the same allocation, just after the series. */
+    series = (struct hdr_registry_series*) hdr_calloc(1, sizeof(struct hdr_registry_series) + labels_len + 1);
+    if (NULL == series)
+    {
+        rc = ENOMEM;
+        goto cleanup;
+    }
+
+    rc = hdr_interval_recorder_init_all(
+        &series->recorder, r->lowest_discernible_value, r->highest_trackable_value, r->significant_figures);
+    if (0 != rc)
+    {
+        hdr_interval_recorder_destroy(&series->recorder);
+        hdr_free(series);
+        goto cleanup;
+    }
+
+    labels_copy = (char*) (series + 1);
+    memcpy(labels_copy, labels, labels_len);
+    series->labels = labels_copy;
+    series->labels_len = labels_len;
+    series->hash = hash;
+
+    /* Fully initialised before it becomes visible to lock-free readers. */
+    bucket = &r->buckets[hash & r->bucket_mask];
+    series->next = *bucket;
+    hdr_atomic_store_pointer(bucket, series);
+
+    if (NULL == r->last)
+    {
+        hdr_atomic_store_pointer(&r->first, series);
+    }
+    else
+    {
+        hdr_atomic_store_pointer(&r->last->next_created, series);
+    }
+    r->last = series;
+    hdr_atomic_add_fetch_64(&r->series_count, 1);
+
+    *result = &series->recorder;
+
+cleanup:
+    hdr_mutex_unlock(r->create_mutex);
+
+    return rc;
+}
+
+int64_t hdr_registry_series_count(struct hdr_registry* r)
+{
+    return hdr_atomic_load_64(&r->series_count);
+}
+
+int64_t hdr_registry_sample(struct hdr_registry* r)
+{
+    struct hdr_registry_series* series = hdr_atomic_load_pointer(&r->first);
+    int64_t sampled = 0;
+
+    while (NULL != series)
+    {
+        struct hdr_interval_recorder* recorder = &series->recorder;
+        struct hdr_histogram* active = hdr_atomic_load_pointer(&recorder->active);
+
+        /* Only this thread swaps the active histogram, so it stays valid to */
+        /* read.  A value recorded just after the read is not lost, it is     */
+        /* simply reported with the next interval.                            */
+        series->sampled = 0 < hdr_atomic_load_64(&active->total_count);
+        if (series->sampled)
+        {
+            recorder->inactive = hdr_interval_recorder_sample_and_recycle(recorder, recorder->inactive);
+            sampled++;
+        }
+
+        series = hdr_atomic_load_pointer(&series->next_created);
+    }
+
+    return sampled;
+}
+
+int hdr_registry_write(
+    struct hdr_registry* r,
+    struct hdr_log_writer* writer,
+    FILE* file,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* interval)
+{
+    struct hdr_registry_series* series = hdr_atomic_load_pointer(&r->first);
+    struct hdr_log_entry entry;
+    int rc;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.start_timestamp = *start_timestamp;
+    entry.interval = *interval;
+
+    while (NULL != series)
+    {
+        if (series->sampled)
+        {
+            entry.tag = (char*) series->labels;
+            entry.tag_len = series->labels_len;
+
+            if ((rc = hdr_log_write_entry(writer, file, &entry, series->recorder.inactive)) != 0)
+            {
+                return rc;
+            }
+        }
+
+        series = hdr_atomic_load_pointer(&series->next_created);
+    }
+
+    return 0;
+}
@@ -0,0 +1,386 @@
+/**
+ * hdr_sample_queue.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <hdr/hdr_sample_queue.h>
+#include "hdr_atomic.h"
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+#define HDR_SAMPLE_QUEUE_MAX_DRAIN_BATCH 4096
+
+static int64_t round_up_to_power_of_2(int64_t value)
+{
+    int64_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+int hdr_sample_queue_init(
+    struct hdr_sample_queue* q,
+    struct hdr_interval_recorder* recorder,
+    int32_t producer_count,
+    int64_t capacity,
+    hdr_sample_queue_policy policy)
+{
+    int32_t i;
+    uintptr_t aligned;
+    int rc;
+
+    if (NULL == q || NULL == recorder || producer_count < 1 ||
+        capacity < 1 || INT32_MAX < capacity)
+    {
+        return EINVAL;
+    }
+
+    capacity = round_up_to_power_of_2(capacity);
+
+    q->recorder = recorder;
+    q->producer_count = producer_count;
+    q->producers_acquired = 0;
+    q->running = 0;
+    q->idle_sleep_us = 0;
+    q->drain_buffer_len = capacity < HDR_SAMPLE_QUEUE_MAX_DRAIN_BATCH ? capacity : HDR_SAMPLE_QUEUE_MAX_DRAIN_BATCH;
+    q->drain_buffer = NULL;
+    q->drain_mutex = NULL;
+
+    /* Align the producers so that each one starts on its own cache line. */
+    q->producers_allocation = hdr_calloc(
+        1, (size_t) producer_count * sizeof(struct hdr_sample_queue_producer) + HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE);
+    if (!q->producers_allocation)
+    {
+        return ENOMEM;
+    }
+
+    aligned = ((uintptr_t) q->producers_allocation + HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE - 1) &
+        ~((uintptr_t) HDR_SAMPLE_QUEUE_CACHE_LINE_SIZE - 1);
+    q->producers = (struct hdr_sample_queue_producer*) aligned;
+
+    for (i = 0; i < producer_count; i++)
+    {
+        struct hdr_sample_queue_producer* p = &q->producers[i];
+
+        p->mask = capacity - 1;
+        p->policy = policy;
+        p->buffer = (int64_t*) hdr_calloc((size_t) capacity, sizeof(int64_t));
+        if (!p->buffer)
+        {
+            hdr_sample_queue_destroy(q);
+            return ENOMEM;
+        }
+    }
+
+    q->drain_buffer = (int64_t*) hdr_calloc((size_t) q->drain_buffer_len, sizeof(int64_t));
+    q->drain_mutex = hdr_mutex_alloc();
+    if (!q->drain_buffer || !q->drain_mutex)
+    {
+        hdr_sample_queue_destroy(q);
+        return ENOMEM;
+    }
+
+    rc = hdr_mutex_init(q->drain_mutex);
+    if (0 != rc)
+    {
+        hdr_mutex_free(q->drain_mutex);
+        q->drain_mutex = NULL;
+        hdr_sample_queue_destroy(q);
+        return rc;
+    }
+
+    return 0;
+}
+
+void hdr_sample_queue_destroy(struct hdr_sample_queue* q)
+{
+    int32_t i;
+
+    hdr_sample_queue_stop(q);
+
+    if (q->producers)
+    {
+        for (i = 0; i < q->producer_count; i++)
+        {
+            hdr_free(q->producers[i].buffer);
+        }
+    }
+
+    if (q->drain_mutex)
+    {
+        hdr_mutex_destroy(q->drain_mutex);
+        hdr_mutex_free(q->drain_mutex);
+    }
+
+    hdr_free(q->drain_buffer);
+    hdr_free(q->producers_allocation);
+
+    q->producers = NULL;
+    q->producers_allocation = NULL;
+    q->drain_buffer = NULL;
+    q->drain_mutex = NULL;
+}
+
+struct hdr_sample_queue_producer* hdr_sample_queue_acquire_producer(struct hdr_sample_queue* q)
+{
+    int64_t index = hdr_atomic_add_fetch_64(&q->producers_acquired, 1) - 1;
+
+    return index < q->producer_count ? &q->producers[index] : NULL;
+}
+
+/* ########  ########   #######  ########  ##     ##  ######  ######## */
+/* ##     ## ##     ## ##     ## ##     ## ##     ## ##    ## ##       */
+/* ##     ## ##     ## ##     ## ##     ## ##     ## ##       ##       */
+/* ########  ########  ##     ## ##     ## ##     ## ##       ######   */
+/* ##        ##   ##   ##     ## ##     ## ##     ## ##       ##       */
+/* ##        ##    ##  ##     ## ##     ## ##     ## ##    ## ##       */
+/* ##        ##     ##  #######  ########   #######   ######  ######## */
+
+static bool make_room(struct hdr_sample_queue_producer* p, int64_t write_index)
+{
+    const int64_t capacity = p->mask + 1;
+
+    switch (p->policy)
+    {
+        case HDR_SAMPLE_QUEUE_OVERWRITE:
+            /* Take the oldest value away from the drain, if the drain has */
+            /* moved on in the meantime then there is room already.        */
+            do
+            {
+                int64_t read_index = p->cached_read_index;
+                if (hdr_atomic_compare_exchange_64(&p->read_index, &read_index, read_index + 1))
+                {
+                    p->cached_read_index = read_index + 1;
+                    hdr_atomic_add_fetch_64(&p->overwritten_count, 1);
+                    return true;
+                }
+
+                p->cached_read_index = hdr_atomic_load_64(&p->read_index);
+            }
+            while (write_index - p->cached_read_index >= capacity);
+
+            return true;
+
+        case HDR_SAMPLE_QUEUE_BLOCK:
+            do
+            {
+                hdr_yield();
+                p->cached_read_index = hdr_atomic_load_acquire_64(&p->read_index);
+            }
+            while (write_index - p->cached_read_index >= capacity);
+
+            return true;
+
+        case HDR_SAMPLE_QUEUE_DROP:
+        default:
+            hdr_atomic_add_fetch_64(&p->dropped_count, 1);
+            return false;
+    }
+}
+
+bool hdr_sample_queue_record_value(struct hdr_sample_queue_producer* p, int64_t value)
+{
+    const int64_t write_index = p->write_index;
+    const int64_t capacity = p->mask + 1;
+
+    if (write_index - p->cached_read_index >= capacity)
+    {
+        p->cached_read_index = hdr_atomic_load_acquire_64(&p->read_index);
+
+        if (write_index - p->cached_read_index >= capacity && !make_room(p, write_index))
+        {
+            return false;
+        }
+    }
+
+    p->buffer[write_index & p->mask] = value;
+    hdr_atomic_store_release_64(&p->write_index, write_index + 1);
+
+    return true;
+}
+
+/* ########  ########     ###    #### ##    ## */
+/* ##     ## ##     ##   ## ##    ##  ###   ## */
+/* ##     ## ##     ##  ##   ##   ##  ####  ## */
+/* ##     ## ########  ##     ##  ##  ## ## ## */
+/* ##     ## ##   ##   #########  ##  ##  #### */
+/* ##     ## ##    ##  ##     ##  ##  ##   ### */
+/* ########  ##     ## ##     ## #### ##    ## */
+
+static void record_batch(struct hdr_interval_recorder* r, const int64_t* values, int64_t length)
+{
+    int64_t i = 0;
+    int64_t val = hdr_phaser_writer_enter(&r->phaser);
+
+    struct hdr_histogram* active = hdr_atomic_load_pointer(&r->active);
+
+    while (i < length)
+    {
+        int64_t value = values[i];
+        int64_t count = 1;
+
+        for (i++; i < length && values[i] == value; i++)
+        {
+            count++;
+        }
+
+        hdr_record_values(active, value, count);
+    }
+
+    hdr_phaser_writer_exit(&r->phaser, val);
+}
+
+static int64_t drain_producer(struct hdr_sample_queue* q, struct hdr_sample_queue_producer* p)
+{
+    int64_t drained = 0;
+    int64_t batch_limit = q->drain_buffer_len;
+    /* Only drain what is visible now, so busy producers can't keep us here. */
+    const int64_t drain_to = hdr_atomic_load_acquire_64(&p->write_index);
+
+    while (true)
+    {
+        int64_t read_index = hdr_atomic_load_64(&p->read_index);
+        int64_t available = drain_to - read_index;
+        int64_t i;
+
+        if (available <= 0)
+        {
+            break;
+        }
+
+        available = available < batch_limit ? available : batch_limit;
+
+        for (i = 0; i < available; i++)
+        {
+            q->drain_buffer[i] = p->buffer[(read_index + i) & p->mask];
+        }
+
+        if (!hdr_atomic_compare_exchange_64(&p->read_index, &read_index, read_index + available))
+        {
+            /* An overwriting producer reclaimed values while they were being */
+            /* copied, retry with a smaller batch to reduce the window.        */
+            batch_limit = batch_limit > 1 ? batch_limit / 2 : 1;
+            continue;
+        }
+
+        record_batch(q->recorder, q->drain_buffer, available);
+        drained += available;
+    }
+
+    return drained;
+}
+
+int64_t hdr_sample_queue_drain(struct hdr_sample_queue* q)
+{
+    int64_t drained = 0;
+    int64_t acquired = hdr_atomic_load_64(&q->producers_acquired);
+    int32_t producers = acquired < q->producer_count ? (int32_t) acquired : q->producer_count;
+    int32_t i;
+
+    hdr_mutex_lock(q->drain_mutex);
+
+    for (i = 0; i < producers; i++)
+    {
+        drained += drain_producer(q, &q->producers[i]);
+    }
+
+    hdr_mutex_unlock(q->drain_mutex);
+
+    return drained;
+}
+
+struct hdr_histogram* hdr_sample_queue_sample_and_recycle(
+    struct hdr_sample_queue* q,
+    struct hdr_histogram* histogram_to_recycle)
+{
+    hdr_sample_queue_drain(q);
+
+    return hdr_interval_recorder_sample_and_recycle(q->recorder, histogram_to_recycle);
+}
+
+static void* drain_loop(void* arg)
+{
+    struct hdr_sample_queue* q = arg;
+
+    while (hdr_atomic_load_64(&q->running))
+    {
+        if (0 == hdr_sample_queue_drain(q))
+        {
+            hdr_usleep(q->idle_sleep_us);
+        }
+    }
+
+    hdr_sample_queue_drain(q);
+
+    return NULL;
+}
+
+int hdr_sample_queue_start(struct hdr_sample_queue* q, unsigned int idle_sleep_us)
+{
+    int rc;
+
+    if (hdr_atomic_load_64(&q->running))
+    {
+        return EINVAL;
+    }
+
+    q->idle_sleep_us = idle_sleep_us;
+    hdr_atomic_store_64(&q->running, 1);
+
+    rc = hdr_thread_create(&q->drain_thread, drain_loop, q);
+    if (0 != rc)
+    {
+        hdr_atomic_store_64(&q->running, 0);
+    }
+
+    return rc;
+}
+
+void hdr_sample_queue_stop(struct hdr_sample_queue* q)
+{
+    if (!hdr_atomic_load_64(&q->running))
+    {
+        return;
+    }
+
+    hdr_atomic_store_64(&q->running, 0);
+    hdr_thread_join(&q->drain_thread);
+}
+
+int64_t hdr_sample_queue_dropped_count(struct hdr_sample_queue* q)
+{
+    int64_t total = 0;
+    int32_t i;
+
+    for (i = 0; i < q->producer_count; i++)
+    {
+        total += hdr_atomic_load_64(&q->producers[i].dropped_count);
+    }
+
+    return total;
+}
+
+int64_t hdr_sample_queue_overwritten_count(struct hdr_sample_queue* q)
+{
+    int64_t total = 0;
+    int32_t i;
+
+    for (i = 0; i < q->producer_count; i++)
+    {
+        total += hdr_atomic_load_64(&q->producers[i].overwritten_count);
+    }
+
+    return total;
+}
@@ -0,0 +1,196 @@
+/**
+ * hdr_self_instrumentation.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_self_instrumentation.h>
+
+#if defined(HDR_SELF_INSTRUMENTATION)
+
+#include <hdr/hdr_thread.h>
+#include <hdr/hdr_time.h>
+#include "hdr_atomic.h"
+#include "hdr_instrument.h"
+
+#ifndef HDR_SELF_INSTRUMENTATION_SAMPLE_INTERVAL
+#define HDR_SELF_INSTRUMENTATION_SAMPLE_INTERVAL 1024
+#endif
+
+#if defined(_MSC_VER)
+#define HDR_THREAD_LOCAL __declspec(thread)
+#else
+#define HDR_THREAD_LOCAL __thread
+#endif
+
+#define HDR_SELF_UNINITIALISED 0
+#define HDR_SELF_INITIALISING 1
+#define HDR_SELF_READY 2
+
+/* Calls taking longer than 10 seconds are clamped. */
+static const int64_t self_highest_trackable_value = INT64_C(10) * 1000 * 1000 * 1000;
+
+static struct hdr_histogram* self_histograms[HDR_SELF_OPERATION_COUNT];
+static int64_t self_state = HDR_SELF_UNINITIALISED;
+static int64_t self_sample_interval = HDR_SELF_INSTRUMENTATION_SAMPLE_INTERVAL;
+static HDR_THREAD_LOCAL int64_t self_countdown = 0;
+
+static bool self_init(void)
+{
+    int64_t expected = HDR_SELF_UNINITIALISED;
+    int i;
+
+    if (HDR_SELF_READY == hdr_atomic_load_64(&self_state))
+    {
+        return true;
+    }
+
+    if (hdr_atomic_compare_exchange_64(&self_state, &expected, HDR_SELF_INITIALISING))
+    {
+        for (i = 0; i < HDR_SELF_OPERATION_COUNT; i++)
+        {
+            if (0 != hdr_init(1, self_highest_trackable_value, 2, &self_histograms[i]))
+            {
+                while (--i >= 0)
+                {
+                    hdr_close(self_histograms[i]);
+                    self_histograms[i] = NULL;
+                }
+
+                hdr_atomic_store_64(&self_state, HDR_SELF_UNINITIALISED);
+                return false;
+            }
+        }
+
+        hdr_atomic_store_64(&self_state, HDR_SELF_READY);
+        return true;
+    }
+
+    while (HDR_SELF_INITIALISING == hdr_atomic_load_64(&self_state))
+    {
+        hdr_yield();
+    }
+
+    return HDR_SELF_READY == hdr_atomic_load_64(&self_state);
+}
+
+bool hdr_self_instrumentation_sample(hdr_timespec* start)
+{
+    if (0 < --self_countdown)
+    {
+        return false;
+    }
+
+    self_countdown = hdr_atomic_load_64(&self_sample_interval);
+    hdr_gettime(start);
+
+    return true;
+}
+
+void hdr_self_instrumentation_record(hdr_self_operation operation, const hdr_timespec* start)
+{
+    hdr_timespec end;
+    int64_t duration_ns;
+
+    hdr_gettime(&end);
+
+    if (!self_init())
+    {
+        return;
+    }
+
+    duration_ns = ((int64_t) end.tv_sec - (int64_t) start->tv_sec) * 1000000000 +
+        ((int64_t) end.tv_nsec - (int64_t) start->tv_nsec);
+    duration_ns = duration_ns < self_highest_trackable_value ? duration_ns : self_highest_trackable_value;
+
+    hdr_record_value_atomic(self_histograms[operation], duration_ns);
+}
+
+bool hdr_self_instrumentation_enabled(void)
+{
+    return true;
+}
+
+int hdr_self_instrumentation_set_sample_interval(uint32_t sample_interval)
+{
+    if (0 == sample_interval)
+    {
+        return EINVAL;
+    }
+
+    hdr_atomic_store_64(&self_sample_interval, (int64_t) sample_interval);
+    return 0;
+}
+
+int hdr_self_instrumentation_snapshot(hdr_self_operation operation, struct hdr_histogram** result)
+{
+    struct hdr_histogram* h;
+    int rc;
+
+    if ((int) operation < 0 || HDR_SELF_OPERATION_COUNT <= operation)
+    {
+        return EINVAL;
+    }
+
+    if (!self_init())
+    {
+        return ENOMEM;
+    }
+
+    rc = hdr_init(1, self_highest_trackable_value, 2, &h);
+    if (0 != rc)
+    {
+        return rc;
+    }
+
+    hdr_add(h, self_histograms[operation]);
+    *result = h;
+
+    return 0;
+}
+
+void hdr_self_instrumentation_reset(void)
+{
+    int i;
+
+    if (!self_init())
+    {
+        return;
+    }
+
+    for (i = 0; i < HDR_SELF_OPERATION_COUNT; i++)
+    {
+        hdr_reset(self_histograms[i]);
+    }
+}
+
+#else
+
+bool hdr_self_instrumentation_enabled(void)
+{
+    return false;
+}
+
+int hdr_self_instrumentation_set_sample_interval(uint32_t sample_interval)
+{
+    (void) sample_interval;
+    return EINVAL;
+}
+
+int hdr_self_instrumentation_snapshot(hdr_self_operation operation, struct hdr_histogram** result)
+{
+    (void) operation;
+    (void) result;
+    return EINVAL;
+}
+
+void hdr_self_instrumentation_reset(void)
+{
+}
+
+#endif
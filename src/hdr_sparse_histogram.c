@@ -0,0 +1,506 @@
+/**
+ * hdr_sparse_histogram.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_sparse_histogram.h>
+#include "hdr_tests.h"
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+/* Pairs are 12 bytes against 8 for a count, so at an eighth of counts_len */
+/* the pairs take about a fifth of the memory of the dense layout.          */
+#define HDR_SPARSE_DENSITY_SHIFT 3
+#define HDR_SPARSE_MIN_CAPACITY 8
+
+static int32_t sparse_limit(const struct hdr_sparse_histogram* h)
+{
+    return h->layout.counts_len >> HDR_SPARSE_DENSITY_SHIFT;
+}
+
+static int64_t highest_equivalent_value(const struct hdr_histogram* h, int64_t value)
+{
+    return hdr_next_non_equivalent_value(h, value) - 1;
+}
+
+/* Position of the first pair whose index is not below index. */
+static int32_t find_position(const struct hdr_sparse_histogram* h, int32_t index)
+{
+    int32_t low = 0;
+    int32_t high = h->len;
+
+    while (low < high)
+    {
+        int32_t middle = low + ((high - low) >> 1);
+        if (h->indices[middle] < index)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static int convert_to_dense(struct hdr_sparse_histogram* h)
+{
+    struct hdr_histogram* dense;
+    int32_t i;
+    int rc;
+
+    rc = hdr_init(
+        h->layout.lowest_discernible_value,
+        h->layout.highest_trackable_value,
+        h->layout.significant_figures,
+        &dense);
+    if (rc)
+    {
+        return rc;
+    }
+
+    for (i = 0; i < h->len; i++)
+    {
+        dense->counts[h->indices[i]] = h->counts[i];
+    }
+    dense->total_count = h->layout.total_count;
+    dense->min_value = h->layout.min_value;
+    dense->max_value = h->layout.max_value;
+
+    hdr_free(h->indices);
+    hdr_free(h->counts);
+    h->indices = NULL;
+    h->counts = NULL;
+    h->len = 0;
+    h->capacity = 0;
+    h->dense = dense;
+
+    return 0;
+}
+
+static int grow(struct hdr_sparse_histogram* h)
+{
+    int32_t capacity = h->capacity < HDR_SPARSE_MIN_CAPACITY ? HDR_SPARSE_MIN_CAPACITY : h->capacity * 2;
+    int32_t* indices;
+    int64_t* counts;
+
+    capacity = capacity < sparse_limit(h) ? capacity : sparse_limit(h);
+
+    if ((indices = (int32_t*) hdr_realloc(h->indices, (size_t) capacity * sizeof(int32_t))) == NULL)
+    {
+        return ENOMEM;
+    }
+    h->indices = indices;
+
+    if ((counts = (int64_t*) hdr_realloc(h->counts, (size_t) capacity * sizeof(int64_t))) == NULL)
+    {
+        return ENOMEM;
+    }
+    h->counts = counts;
+    h->capacity = capacity;
+
+    return 0;
+}
+
+int hdr_sparse_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_sparse_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_sparse_histogram* h;
+    int rc;
+
+    rc = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (rc)
+    {
+        return rc;
+    }
+
+    if ((h = (struct hdr_sparse_histogram*) hdr_calloc(1, sizeof(struct hdr_sparse_histogram))) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    hdr_init_preallocated(&h->layout, &cfg);
+    h->layout.counts = NULL;
+    *result = h;
+
+    return 0;
+}
+
+void hdr_sparse_close(struct hdr_sparse_histogram* h)
+{
+    if (NULL == h)
+    {
+        return;
+    }
+
+    hdr_close(h->dense);
+    hdr_free(h->indices);
+    hdr_free(h->counts);
+    hdr_free(h);
+}
+
+void hdr_sparse_reset(struct hdr_sparse_histogram* h)
+{
+    hdr_close(h->dense);
+    h->dense = NULL;
+    h->len = 0;
+    h->layout.total_count = 0;
+    h->layout.min_value = INT64_MAX;
+    h->layout.max_value = 0;
+}
+
+size_t hdr_sparse_get_memory_size(const struct hdr_sparse_histogram* h)
+{
+    size_t size = sizeof(struct hdr_sparse_histogram);
+
+    if (NULL != h->dense)
+    {
+        return size + hdr_get_memory_size(h->dense);
+    }
+
+    return size + (size_t) h->capacity * (sizeof(int32_t) + sizeof(int64_t));
+}
+
+/* Adds count at index, converting when a new pair would pass the limit. */
+static bool record_at_index(struct hdr_sparse_histogram* h, int32_t index, int64_t count)
+{
+    int32_t position;
+
+    if (NULL != h->dense)
+    {
+        hdr_record_values_at_index(h->dense, index, count);
+        return true;
+    }
+
+    position = find_position(h, index);
+    if (position == h->len || h->indices[position] != index)
+    {
+        if (h->len == h->capacity)
+        {
+            if (h->len == sparse_limit(h) ? 0 != convert_to_dense(h) : 0 != grow(h))
+            {
+                return false;
+            }
+            if (NULL != h->dense)
+            {
+                hdr_record_values_at_index(h->dense, index, count);
+                return true;
+            }
+        }
+
+        memmove(&h->indices[position + 1], &h->indices[position], (size_t) (h->len - position) * sizeof(int32_t));
+        memmove(&h->counts[position + 1], &h->counts[position], (size_t) (h->len - position) * sizeof(int64_t));
+        h->indices[position] = index;
+        h->counts[position] = 0;
+        h->len++;
+    }
+
+    h->counts[position] += count;
+    h->layout.total_count += count;
+
+    return true;
+}
+
+/* As update_min_max in hdr_histogram.c, for the sparse or converted histogram. */
+static void update_min_max(struct hdr_sparse_histogram* h, int64_t value)
+{
+    struct hdr_histogram* target = NULL != h->dense ? h->dense : &h->layout;
+
+    if (value < target->min_value && value != 0)
+    {
+        target->min_value = value;
+    }
+    if (value > target->max_value)
+    {
+        target->max_value = value;
+    }
+}
+
+bool hdr_sparse_record_value(struct hdr_sparse_histogram* h, int64_t value)
+{
+    return hdr_sparse_record_values(h, value, 1);
+}
+
+bool hdr_sparse_record_values(struct hdr_sparse_histogram* h, int64_t value, int64_t count)
+{
+    int32_t index;
+
+    if (NULL != h->dense)
+    {
+        return hdr_record_values(h->dense, value, count);
+    }
+
+    if (value < 0)
+    {
+        return false;
+    }
+
+    index = counts_index_for(&h->layout, value);
+    if (index < 0 || h->layout.counts_len <= index || !record_at_index(h, index, count))
+    {
+        return false;
+    }
+
+    update_min_max(h, value);
+
+    return true;
+}
+
+int64_t hdr_sparse_total_count(const struct hdr_sparse_histogram* h)
+{
+    return NULL != h->dense ? h->dense->total_count : h->layout.total_count;
+}
+
+int64_t hdr_sparse_min(const struct hdr_sparse_histogram* h)
+{
+    if (NULL != h->dense)
+    {
+        return hdr_min(h->dense);
+    }
+
+    if (0 < h->len && 0 == h->indices[0] && 0 < h->counts[0])
+    {
+        return 0;
+    }
+
+    if (INT64_MAX == h->layout.min_value)
+    {
+        return INT64_MAX;
+    }
+
+    return hdr_lowest_equivalent_value(&h->layout, h->layout.min_value);
+}
+
+int64_t hdr_sparse_max(const struct hdr_sparse_histogram* h)
+{
+    if (NULL != h->dense)
+    {
+        return hdr_max(h->dense);
+    }
+
+    if (0 == h->layout.max_value)
+    {
+        return 0;
+    }
+
+    return highest_equivalent_value(&h->layout, h->layout.max_value);
+}
+
+int64_t hdr_sparse_value_at_percentile(const struct hdr_sparse_histogram* h, double percentile)
+{
+    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
+    int64_t count_at_percentile;
+    int64_t cumulative_count = 0;
+    int64_t value = 0;
+    int32_t i;
+
+    if (NULL != h->dense)
+    {
+        return hdr_value_at_percentile(h->dense, percentile);
+    }
+
+    count_at_percentile = (int64_t) (((requested_percentile / 100) * h->layout.total_count) + 0.5);
+    count_at_percentile = 0 < count_at_percentile ? count_at_percentile : 1;
+
+    for (i = 0; i < h->len; i++)
+    {
+        cumulative_count += h->counts[i];
+        if (cumulative_count >= count_at_percentile)
+        {
+            value = hdr_value_at_index(&h->layout, h->indices[i]);
+            break;
+        }
+    }
+
+    if (percentile == 0.0)
+    {
+        return hdr_lowest_equivalent_value(&h->layout, value);
+    }
+
+    return highest_equivalent_value(&h->layout, value);
+}
+
+void hdr_sparse_iter_init(struct hdr_sparse_iter* iter, const struct hdr_sparse_histogram* h)
+{
+    memset(iter, 0, sizeof(struct hdr_sparse_iter));
+    iter->h = h;
+    if (NULL != h->dense)
+    {
+        hdr_iter_recorded_init(&iter->dense_iter, h->dense);
+    }
+}
+
+bool hdr_sparse_iter_next(struct hdr_sparse_iter* iter)
+{
+    const struct hdr_sparse_histogram* h = iter->h;
+
+    if (NULL != h->dense)
+    {
+        if (!hdr_iter_next(&iter->dense_iter))
+        {
+            return false;
+        }
+
+        iter->count = iter->dense_iter.count;
+        iter->cumulative_count = iter->dense_iter.cumulative_count;
+        iter->value = iter->dense_iter.value;
+        iter->highest_equivalent_value = iter->dense_iter.highest_equivalent_value;
+        iter->lowest_equivalent_value = iter->dense_iter.lowest_equivalent_value;
+        iter->median_equivalent_value = iter->dense_iter.median_equivalent_value;
+        return true;
+    }
+
+    while (iter->position < h->len && 0 == h->counts[iter->position])
+    {
+        iter->position++;
+    }
+
+    if (h->len <= iter->position)
+    {
+        return false;
+    }
+
+    iter->count = h->counts[iter->position];
+    iter->cumulative_count += iter->count;
+    iter->value = hdr_value_at_index(&h->layout, h->indices[iter->position]);
+    iter->lowest_equivalent_value = iter->value;
+    iter->highest_equivalent_value = highest_equivalent_value(&h->layout, iter->value);
+    iter->median_equivalent_value = hdr_median_equivalent_value(&h->layout, iter->value);
+    iter->position++;
+
+    return true;
+}
+
+static bool same_layout(const struct hdr_histogram* a, const struct hdr_histogram* b)
+{
+    return a->counts_len == b->counts_len &&
+        a->unit_magnitude == b->unit_magnitude &&
+        a->sub_bucket_half_count_magnitude == b->sub_bucket_half_count_magnitude &&
+        0 == a->normalizing_index_offset;
+}
+
+int64_t hdr_sparse_add(struct hdr_sparse_histogram* h, const struct hdr_sparse_histogram* from)
+{
+    struct hdr_sparse_iter iter;
+    int64_t dropped = 0;
+    int32_t i;
+
+    if (NULL != h->dense)
+    {
+        return hdr_sparse_add_to(h->dense, from);
+    }
+
+    if (NULL != from->dense || !same_layout(&h->layout, &from->layout))
+    {
+        hdr_sparse_iter_init(&iter, from);
+        while (hdr_sparse_iter_next(&iter))
+        {
+            if (!hdr_sparse_record_values(h, iter.value, iter.count))
+            {
+                dropped += iter.count;
+            }
+        }
+
+        return dropped;
+    }
+
+    for (i = 0; i < from->len; i++)
+    {
+        if (0 != from->counts[i] && !record_at_index(h, from->indices[i], from->counts[i]))
+        {
+            dropped += from->counts[i];
+        }
+    }
+
+    if (INT64_MAX != from->layout.min_value)
+    {
+        update_min_max(h, from->layout.min_value);
+    }
+    update_min_max(h, from->layout.max_value);
+
+    return dropped;
+}
+
+int64_t hdr_sparse_add_to(struct hdr_histogram* h, const struct hdr_sparse_histogram* from)
+{
+    bool by_index;
+    int64_t dropped = 0;
+    int32_t i;
+
+    if (NULL != from->dense)
+    {
+        return hdr_add(h, from->dense);
+    }
+
+    by_index = same_layout(h, &from->layout);
+
+    for (i = 0; i < from->len; i++)
+    {
+        if (0 == from->counts[i])
+        {
+            continue;
+        }
+
+        if (by_index)
+        {
+            hdr_record_values_at_index(h, from->indices[i], from->counts[i]);
+        }
+        else if (!hdr_record_values(h, hdr_value_at_index(&from->layout, from->indices[i]), from->counts[i]))
+        {
+            dropped += from->counts[i];
+        }
+    }
+
+    /* Recording by index only knows the bucket, so fold in the exact values. */
+    if (by_index && 0 == (h->flags & HDR_HISTOGRAM_LAZY_MIN_MAX) && 0 < from->len)
+    {
+        if (from->layout.min_value < h->min_value)
+        {
+            h->min_value = from->layout.min_value;
+        }
+        if (from->layout.max_value > h->max_value)
+        {
+            h->max_value = from->layout.max_value;
+        }
+    }
+
+    return dropped;
+}
+
+int hdr_sparse_to_dense(const struct hdr_sparse_histogram* h, struct hdr_histogram** result)
+{
+    struct hdr_histogram* dense;
+    int rc;
+
+    rc = hdr_init(
+        h->layout.lowest_discernible_value,
+        h->layout.highest_trackable_value,
+        h->layout.significant_figures,
+        &dense);
+    if (rc)
+    {
+        return rc;
+    }
+
+    hdr_sparse_add_to(dense, h);
+    *result = dense;
+
+    return 0;
+}
@@ -5,6 +5,7 @@
 */
 
 #include <stdlib.h>
+#include <errno.h>
 #include <hdr/hdr_thread.h>
 
 #ifndef HDR_MALLOC_INCLUDE
@@ -31,6 +32,7 @@ void hdr_mutex_free(struct hdr_mutex* mutex)
 
 #include <windows.h>
 #include <WinSock2.h>
+#include <process.h>
 
 int hdr_mutex_init(struct hdr_mutex* mutex)
 {
@@ -53,6 +55,53 @@ void hdr_mutex_unlock(struct hdr_mutex* mutex)
     LeaveCriticalSection((CRITICAL_SECTION*)(mutex->_critical_section));
 }
 
+struct hdr_thread_start
+{
+    void* (*start_routine)(void*);
+    void* arg;
+};
+
+static unsigned __stdcall hdr_thread_trampoline(void* context)
+{
+    struct hdr_thread_start start = *(struct hdr_thread_start*) context;
+    hdr_free(context);
+
+    start.start_routine(start.arg);
+
+    return 0;
+}
+
+int hdr_thread_create(struct hdr_thread* thread, void* (*start_routine)(void*), void* arg)
+{
+    struct hdr_thread_start* start = hdr_malloc(sizeof(struct hdr_thread_start));
+    uintptr_t handle;
+
+    if (!start)
+    {
+        return ENOMEM;
+    }
+
+    start->start_routine = start_routine;
+    start->arg = arg;
+
+    handle = _beginthreadex(NULL, 0, hdr_thread_trampoline, start, 0, NULL);
+    if (0 == handle)
+    {
+        hdr_free(start);
+        return EAGAIN;
+    }
+
+    thread->_handle = (void*) handle;
+    return 0;
+}
+
+int hdr_thread_join(struct hdr_thread* thread)
+{
+    WaitForSingleObject((HANDLE) thread->_handle, INFINITE);
+    CloseHandle((HANDLE) thread->_handle);
+    return 0;
+}
+
 void hdr_yield()
 {
     Sleep(0);
@@ -94,6 +143,16 @@ void hdr_mutex_unlock(struct hdr_mutex* mutex)
     pthread_mutex_unlock(&mutex->_mutex);
 }
 
+int hdr_thread_create(struct hdr_thread* thread, void* (*start_routine)(void*), void* arg)
+{
+    return pthread_create(&thread->_thread, NULL, start_routine, arg);
+}
+
+int hdr_thread_join(struct hdr_thread* thread)
+{
+    return pthread_join(thread->_thread, NULL);
+}
+
 void hdr_yield(void)
 {
     sched_yield();
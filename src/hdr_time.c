@@ -5,6 +5,7 @@
 */
 
 #include <math.h>
+#include <stdint.h>
 
 #include <hdr/hdr_time.h>
 
@@ -95,3 +96,125 @@ void hdr_timespec_from_double(hdr_timespec* t, double value)
     t->tv_sec = seconds;
     t->tv_nsec = milliseconds * 1000000;
 }
+
+#define NANOS_PER_SECOND 1000000000
+#define MAX_SECONDS_DIGITS 18
+
+size_t hdr_timespec_parse(hdr_timespec* t, const char* str, size_t len)
+{
+    size_t i = 0;
+    size_t digits = 0;
+    int64_t sec = 0;
+    long nsec = 0;
+    long nsec_multiplier = NANOS_PER_SECOND;
+    int negative = 0;
+
+    if (i < len && '-' == str[i])
+    {
+        negative = 1;
+        i++;
+    }
+
+    for (; i < len && '0' <= str[i] && str[i] <= '9'; i++, digits++)
+    {
+        if (MAX_SECONDS_DIGITS <= digits)
+        {
+            return 0;
+        }
+        sec = (sec * 10) + (str[i] - '0');
+    }
+
+    if (i < len && '.' == str[i])
+    {
+        for (i++; i < len && '0' <= str[i] && str[i] <= '9'; i++, digits++)
+        {
+            if (1 < nsec_multiplier)
+            {
+                nsec_multiplier /= 10;
+                nsec += (str[i] - '0') * nsec_multiplier;
+            }
+        }
+    }
+
+    if (0 == digits)
+    {
+        return 0;
+    }
+
+    if (negative && 0 < nsec)
+    {
+        sec = -sec - 1;
+        nsec = NANOS_PER_SECOND - nsec;
+    }
+    else if (negative)
+    {
+        sec = -sec;
+    }
+
+    t->tv_sec = (time_t) sec;
+    t->tv_nsec = nsec;
+
+    return i;
+}
+
+size_t hdr_timespec_format(char* buffer, const hdr_timespec* t)
+{
+    char digits[20];
+    int64_t sec = (int64_t) t->tv_sec + t->tv_nsec / NANOS_PER_SECOND;
+    long nsec = t->tv_nsec % NANOS_PER_SECOND;
+    uint64_t magnitude;
+    long place;
+    size_t digits_len = 0;
+    size_t len = 0;
+
+    if (nsec < 0)
+    {
+        nsec += NANOS_PER_SECOND;
+        sec--;
+    }
+
+    magnitude = (uint64_t) sec;
+    if (sec < 0)
+    {
+        buffer[len++] = '-';
+        /* Negated unsigned, as -sec overflows for INT64_MIN. */
+        magnitude = (0 - (uint64_t) sec) - (0 < nsec ? 1 : 0);
+        nsec = 0 < nsec ? NANOS_PER_SECOND - nsec : 0;
+    }
+
+    do
+    {
+        digits[digits_len++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    while (0 != magnitude);
+
+    while (0 < digits_len)
+    {
+        buffer[len++] = digits[--digits_len];
+    }
+
+    /* Milliseconds, microseconds or nanoseconds, whichever is exact. */
+    if (0 == nsec % 1000000)
+    {
+        nsec /= 1000000;
+        place = 100;
+    }
+    else if (0 == nsec % 1000)
+    {
+        nsec /= 1000;
+        place = 100000;
+    }
+    else
+    {
+        place = 100000000;
+    }
+
+    buffer[len++] = '.';
+    for (; 0 < place; place /= 10)
+    {
+        buffer[len++] = (char) ('0' + (nsec / place) % 10);
+    }
+
+    return len;
+}
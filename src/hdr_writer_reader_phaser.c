@@ -11,6 +11,7 @@
 #include <hdr/hdr_thread.h>
 #include <hdr/hdr_writer_reader_phaser.h>
 #include "hdr_atomic.h"
+#include "hdr_instrument.h"
 
 #ifndef HDR_MALLOC_INCLUDE
 #define HDR_MALLOC_INCLUDE "hdr_malloc.h"
@@ -99,6 +100,8 @@ void hdr_phaser_flip_phase(
     /* TODO: is_held_by_current_thread */
     unsigned int sleep_time_us = sleep_time_ns < 1000000000 ? (unsigned int) (sleep_time_ns / 1000) : 1000000;
 
+    HDR_SELF_INSTRUMENT_BEGIN_EVERY(flip);
+
     int64_t start_epoch = _hdr_phaser_get_epoch(&p->start_epoch);
 
     bool next_phase_is_even = (start_epoch < 0);
@@ -139,4 +142,6 @@ void hdr_phaser_flip_phase(
         }
     }
     while (!caught_up);
+
+    HDR_SELF_INSTRUMENT_END(flip, HDR_SELF_PHASER_FLIP_PHASE);
 }
@@ -0,0 +1,457 @@
+/**
+ * hdr_binary_log_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_binary_log.h>
+
+#include "minunit.h"
+#include "hdr_test_util.h"
+
+int tests_run = 0;
+
+#define RECORD_COUNT 10
+
+static struct hdr_histogram* histogram_for(int i)
+{
+    struct hdr_histogram* h;
+    int j;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    for (j = 1; j <= 200; j++)
+    {
+        hdr_record_value(h, (int64_t) j * (i + 1));
+    }
+
+    return h;
+}
+
+static void entry_for(int i, struct hdr_log_entry* entry, char* tag)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->start_timestamp.tv_sec = 1000 + i * 10;
+    entry->start_timestamp.tv_nsec = 250000000;
+    entry->interval.tv_sec = 10;
+    if (i % 2 == 0)
+    {
+        snprintf(tag, HDR_LOG_TAG_MAX_BUFFER_LEN, "tag-%d", i);
+        entry->tag = tag;
+        entry->tag_len = strlen(tag);
+    }
+}
+
+static FILE* write_binary_log(void)
+{
+    struct hdr_binary_log_writer writer;
+    hdr_timespec start;
+    FILE* f = tmpfile();
+    int i;
+
+    start.tv_sec = 1000;
+    start.tv_nsec = 0;
+    hdr_binary_log_writer_init(&writer, f, &start);
+
+    for (i = 0; i < RECORD_COUNT; i++)
+    {
+        struct hdr_log_entry entry;
+        char tag[HDR_LOG_TAG_MAX_BUFFER_LEN];
+        struct hdr_histogram* h = histogram_for(i);
+
+        entry_for(i, &entry, tag);
+        hdr_binary_log_write(&writer, &entry, h);
+        hdr_close(h);
+    }
+
+    hdr_binary_log_writer_close(&writer);
+    rewind(f);
+
+    return f;
+}
+
+static char* read_records_from(struct hdr_binary_log_reader* reader, int first)
+{
+    int i;
+
+    for (i = first; i < RECORD_COUNT; i++)
+    {
+        struct hdr_log_entry expected_entry;
+        struct hdr_log_entry actual_entry;
+        char expected_tag[HDR_LOG_TAG_MAX_BUFFER_LEN];
+        char actual_tag[HDR_LOG_TAG_MAX_BUFFER_LEN];
+        struct hdr_histogram* expected = histogram_for(i);
+        struct hdr_histogram* actual = NULL;
+        char* result;
+
+        entry_for(i, &expected_entry, expected_tag);
+        memset(&actual_entry, 0, sizeof(actual_entry));
+        memset(actual_tag, 0, sizeof(actual_tag));
+        actual_entry.tag = actual_tag;
+        actual_entry.tag_len = sizeof(actual_tag);
+
+        mu_assert("Should read record", 0 == hdr_binary_log_read(reader, &actual_entry, &actual));
+        mu_assert(
+            "Start seconds",
+            compare_int64(expected_entry.start_timestamp.tv_sec, actual_entry.start_timestamp.tv_sec));
+        mu_assert(
+            "Start nanoseconds",
+            compare_int64(expected_entry.start_timestamp.tv_nsec, actual_entry.start_timestamp.tv_nsec));
+        mu_assert("Interval", compare_int64(expected_entry.interval.tv_sec, actual_entry.interval.tv_sec));
+        mu_assert("Max", compare_int64(hdr_max(expected), actual_entry.max.tv_sec));
+        mu_assert(
+            "Tag",
+            0 == strcmp(NULL != expected_entry.tag ? expected_entry.tag : "", actual_tag));
+
+        result = compare_histograms(expected, actual);
+        hdr_close(expected);
+        hdr_close(actual);
+        if (result)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static char* test_write_and_read_binary_log(void)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    FILE* f = write_binary_log();
+    char* result;
+
+    mu_assert("Init reader", 0 == hdr_binary_log_reader_init(&reader, f));
+    mu_assert("Start timestamp", compare_int64(1000, reader.start_timestamp.tv_sec));
+    mu_assert("Index loaded", compare_int64(RECORD_COUNT, (int64_t) reader.index_len));
+
+    if ((result = read_records_from(&reader, 0)) != 0)
+    {
+        return result;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    mu_assert("EOF before footer", EOF == hdr_binary_log_read(&reader, &entry, &h));
+
+    hdr_binary_log_reader_close(&reader);
+    fclose(f);
+
+    return 0;
+}
+
+static char* test_seek_by_timestamp(void)
+{
+    struct hdr_binary_log_reader reader;
+    hdr_timespec timestamp;
+    FILE* f = write_binary_log();
+    char* result;
+
+    hdr_binary_log_reader_init(&reader, f);
+
+    timestamp.tv_sec = 1065;
+    timestamp.tv_nsec = 0;
+    mu_assert("Seek", 0 == hdr_binary_log_seek(&reader, &timestamp));
+    if ((result = read_records_from(&reader, 7)) != 0)
+    {
+        return result;
+    }
+
+    timestamp.tv_sec = 1030;
+    timestamp.tv_nsec = 250000000;
+    mu_assert("Seek back to exact start", 0 == hdr_binary_log_seek(&reader, &timestamp));
+    if ((result = read_records_from(&reader, 3)) != 0)
+    {
+        return result;
+    }
+
+    timestamp.tv_sec = 2000;
+    mu_assert("Seek past end", EOF == hdr_binary_log_seek(&reader, &timestamp));
+
+    hdr_binary_log_reader_close(&reader);
+    fclose(f);
+
+    return 0;
+}
+
+static char* test_reads_log_without_footer(void)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    hdr_timespec timestamp;
+    FILE* f = write_binary_log();
+    FILE* truncated = tmpfile();
+    /* The end of records marker, index entries and trailer. */
+    const long footer_len = 4 + RECORD_COUNT * 20 + 16;
+    long len, i;
+    char* result;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f) - footer_len;
+    rewind(f);
+    for (i = 0; i < len; i++)
+    {
+        fputc(fgetc(f), truncated);
+    }
+    rewind(truncated);
+
+    mu_assert("Init reader", 0 == hdr_binary_log_reader_init(&reader, truncated));
+    mu_assert("No index", compare_int64(0, (int64_t) reader.index_len));
+
+    if ((result = read_records_from(&reader, 0)) != 0)
+    {
+        return result;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    mu_assert("EOF at end of file", EOF == hdr_binary_log_read(&reader, &entry, &h));
+
+    timestamp.tv_sec = 1000;
+    timestamp.tv_nsec = 0;
+    mu_assert("Cannot seek without index", EINVAL == hdr_binary_log_seek(&reader, &timestamp));
+
+    hdr_binary_log_reader_close(&reader);
+    fclose(truncated);
+    fclose(f);
+
+    return 0;
+}
+
+#if !defined(_WIN32)
+static char* test_reads_log_from_pipe(void)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    FILE* f = write_binary_log();
+    FILE* piped;
+    char buffer[4096];
+    size_t len;
+    int fds[2];
+    char* result;
+
+    /* The whole log fits in the pipe's buffer, so it is written up front. */
+    mu_assert("Open pipe", 0 == pipe(fds));
+    while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        mu_assert("Write to pipe", (ssize_t) len == write(fds[1], buffer, len));
+    }
+    close(fds[1]);
+    piped = fdopen(fds[0], "r");
+    mu_assert("Open read end", NULL != piped);
+
+    mu_assert("Init reader", 0 == hdr_binary_log_reader_init(&reader, piped));
+    mu_assert("No index", compare_int64(0, (int64_t) reader.index_len));
+
+    if ((result = read_records_from(&reader, 0)) != 0)
+    {
+        return result;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    mu_assert("EOF at end of records", EOF == hdr_binary_log_read(&reader, &entry, &h));
+
+    hdr_binary_log_reader_close(&reader);
+    fclose(piped);
+    fclose(f);
+
+    return 0;
+}
+#endif
+
+static char* test_rejects_text_log(void)
+{
+    struct hdr_binary_log_reader reader;
+    FILE* f = fopen("jHiccup-2.0.7S.logV2.hlog", "rb");
+
+    mu_assert("Open log", NULL != f);
+    mu_assert("Invalid version", HDR_LOG_INVALID_VERSION == hdr_binary_log_reader_init(&reader, f));
+
+    fclose(f);
+
+    return 0;
+}
+
+static int64_t total_count_of_text_log(FILE* f)
+{
+    struct hdr_log_reader reader;
+    struct hdr_histogram* h = NULL;
+    int64_t total = 0;
+
+    hdr_log_reader_init(&reader);
+    hdr_log_read_header(&reader, f);
+    while (0 == hdr_log_read(&reader, f, &h, NULL, NULL))
+    {
+        total += h->total_count;
+        hdr_close(h);
+        h = NULL;
+    }
+    hdr_log_reader_close(&reader);
+
+    return total;
+}
+
+static char* test_converts_text_to_binary_and_back(void)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    FILE* text = fopen("jHiccup-2.0.7S.logV2.hlog", "r");
+    FILE* binary = tmpfile();
+    FILE* round_trip = tmpfile();
+    int64_t expected_total;
+    int count = 0;
+
+    mu_assert("Open log", NULL != text);
+    expected_total = total_count_of_text_log(text);
+    rewind(text);
+
+    mu_assert("To binary", 0 == hdr_binary_log_from_text(text, binary));
+    rewind(binary);
+
+    hdr_binary_log_reader_init(&reader, binary);
+    memset(&entry, 0, sizeof(entry));
+    while (0 == hdr_binary_log_read(&reader, &entry, &h))
+    {
+        count++;
+    }
+    mu_assert("Record count", compare_int64(62, count));
+    mu_assert("Accumulated total", compare_int64(expected_total, h->total_count));
+    mu_assert("Start timestamp", compare_int64(1441812279, reader.start_timestamp.tv_sec));
+    hdr_binary_log_reader_close(&reader);
+    hdr_close(h);
+    rewind(binary);
+
+    mu_assert("To text", 0 == hdr_binary_log_to_text(binary, round_trip));
+    rewind(round_trip);
+    mu_assert("Round trip total", compare_int64(expected_total, total_count_of_text_log(round_trip)));
+
+    fclose(round_trip);
+    fclose(binary);
+    fclose(text);
+
+    return 0;
+}
+
+static void put_record_len(FILE* f, int64_t offset, uint32_t len)
+{
+    uint8_t bytes[4];
+
+    bytes[0] = (uint8_t) (len >> 24);
+    bytes[1] = (uint8_t) (len >> 16);
+    bytes[2] = (uint8_t) (len >> 8);
+    bytes[3] = (uint8_t) len;
+    fseek(f, (long) offset, SEEK_SET);
+    fwrite(bytes, 1, sizeof(bytes), f);
+    rewind(f);
+}
+
+static uint32_t get_record_len(FILE* f, int64_t offset)
+{
+    uint8_t bytes[4];
+
+    fseek(f, (long) offset, SEEK_SET);
+    if (fread(bytes, 1, sizeof(bytes), f) != sizeof(bytes))
+    {
+        return 0;
+    }
+    rewind(f);
+
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+static char* test_rejects_corrupt_record_length(void)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    FILE* f = write_binary_log();
+    int64_t last_offset;
+    uint32_t last_len;
+    int i;
+
+    mu_assert("Init reader", 0 == hdr_binary_log_reader_init(&reader, f));
+    mu_assert("Index", compare_int64(RECORD_COUNT, (int64_t) reader.index_len));
+    last_offset = reader.index[RECORD_COUNT - 1].offset;
+    hdr_binary_log_reader_close(&reader);
+
+    /* Far longer than any record a writer can produce. */
+    put_record_len(f, 24, UINT32_C(0xFFFFFFF0));
+    mu_assert("Init reader", 0 == hdr_binary_log_reader_init(&reader, f));
+    memset(&entry, 0, sizeof(entry));
+    mu_assert("Implausible length", -EINVAL == hdr_binary_log_read(&reader, &entry, &h));
+    mu_assert("Record buffer", compare_int64(0, (int64_t) reader.record_capacity));
+    hdr_binary_log_reader_close(&reader);
+    fclose(f);
+
+    /* Running on into the index, which would otherwise be read as the record's tail. */
+    f = write_binary_log();
+    last_len = get_record_len(f, last_offset);
+    put_record_len(f, last_offset, last_len + 20);
+    mu_assert("Init reader", 0 == hdr_binary_log_reader_init(&reader, f));
+    for (i = 0; i < RECORD_COUNT - 1; i++)
+    {
+        memset(&entry, 0, sizeof(entry));
+        mu_assert("Should read record", 0 == hdr_binary_log_read(&reader, &entry, &h));
+        hdr_close(h);
+        h = NULL;
+    }
+    memset(&entry, 0, sizeof(entry));
+    mu_assert("Beyond the records", -EINVAL == hdr_binary_log_read(&reader, &entry, &h));
+    hdr_binary_log_reader_close(&reader);
+    fclose(f);
+
+    return 0;
+}
+
+static struct mu_result all_tests(void)
+{
+    mu_run_test(test_write_and_read_binary_log);
+    mu_run_test(test_seek_by_timestamp);
+    mu_run_test(test_reads_log_without_footer);
+#if !defined(_WIN32)
+    mu_run_test(test_reads_log_from_pipe);
+#endif
+    mu_run_test(test_rejects_text_log);
+    mu_run_test(test_converts_text_to_binary_and_back);
+    mu_run_test(test_rejects_corrupt_record_length);
+
+    mu_ok;
+}
+
+static int hdr_binary_log_run_tests(void)
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_binary_log_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main(void)
+{
+    return hdr_binary_log_run_tests();
+}
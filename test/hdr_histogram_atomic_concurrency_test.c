@@ -40,21 +40,39 @@ static void* record_values(void* thread_context)
 }
 
 
-static char* test_recording_concurrently(void)
+#define RECORDING_THREADS 4
+
+static void record_concurrently(struct hdr_histogram* h, int64_t* values, int value_count)
+{
+    struct test_histogram_data thread_data[RECORDING_THREADS];
+    pthread_t threads[RECORDING_THREADS];
+    int i;
+
+    for (i = 0; i < RECORDING_THREADS; i++)
+    {
+        thread_data[i].histogram = h;
+        thread_data[i].values = &values[i * (value_count / RECORDING_THREADS)];
+        thread_data[i].values_len = value_count / RECORDING_THREADS;
+        pthread_create(&threads[i], NULL, record_values, &thread_data[i]);
+    }
+
+    for (i = 0; i < RECORDING_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static char* test_recording_concurrently_with_flags(uint32_t flags)
 {
     const int value_count = 10000000;
     int64_t* values = calloc(value_count, sizeof(int64_t));
     struct hdr_histogram* expected_histogram;
     struct hdr_histogram* actual_histogram;
-    struct test_histogram_data thread_data[2];
-    struct hdr_iter expected_iter;
-    struct hdr_iter actual_iter;
-    pthread_t threads[2];
+    char* result;
     int i;
 
     mu_assert("init", 0 == hdr_init(1, 10000000, 2, &expected_histogram));
-    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &actual_histogram));
-
+    mu_assert("init", 0 == hdr_init_with_flags(1, 10000000, 2, flags, &actual_histogram));
 
     for (i = 0; i < value_count; i++)
     {
@@ -66,28 +84,100 @@ static char* test_recording_concurrently(void)
         hdr_record_value(expected_histogram, values[i]);
     }
 
-    thread_data[0].histogram = actual_histogram;
-    thread_data[0].values = values;
-    thread_data[0].values_len = value_count / 2;
-    pthread_create(&threads[0], NULL, record_values, &thread_data[0]);
+    record_concurrently(actual_histogram, values, value_count);
+
+    result = compare_histograms(expected_histogram, actual_histogram);
+
+    hdr_close(expected_histogram);
+    hdr_close(actual_histogram);
+    free(values);
+
+    return result;
+}
+
+static char* test_recording_concurrently(void)
+{
+    return test_recording_concurrently_with_flags(0);
+}
+
+static char* test_recording_concurrently_cache_aligned(void)
+{
+    return test_recording_concurrently_with_flags(HDR_HISTOGRAM_CACHE_ALIGNED);
+}
+
+static char* test_recording_concurrently_lazy_min_max(void)
+{
+    const int value_count = 4000000;
+    int64_t* values = calloc(value_count, sizeof(int64_t));
+    struct hdr_histogram* expected_histogram;
+    struct hdr_histogram* actual_histogram;
+    int i;
+
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &expected_histogram));
+    mu_assert("init", 0 == hdr_init_with_flags(
+        1, 10000000, 2, HDR_HISTOGRAM_LAZY_MIN_MAX | HDR_HISTOGRAM_CACHE_ALIGNED, &actual_histogram));
+
+    for (i = 0; i < value_count; i++)
+    {
+        values[i] = rand() % 20000;
+        hdr_record_value(expected_histogram, values[i]);
+    }
+
+    record_concurrently(actual_histogram, values, value_count);
 
-    thread_data[1].histogram = actual_histogram;
-    thread_data[1].values = &values[value_count / 2];
-    thread_data[1].values_len = value_count / 2;
-    pthread_create(&threads[1], NULL, record_values, &thread_data[1]);
+    mu_assert("Total", compare_int64(expected_histogram->total_count, actual_histogram->total_count));
+    mu_assert("Min", compare_int64(hdr_min(expected_histogram), hdr_min(actual_histogram)));
+    mu_assert("Max", compare_int64(hdr_max(expected_histogram), hdr_max(actual_histogram)));
 
-    pthread_join(threads[0], NULL);
-    pthread_join(threads[1], NULL);
+    hdr_close(expected_histogram);
+    hdr_close(actual_histogram);
+    free(values);
 
-    hdr_iter_init(&expected_iter, expected_histogram);
-    hdr_iter_init(&actual_iter, actual_histogram);
+    return 0;
+}
 
-    return compare_histograms(expected_histogram, actual_histogram);
+#define LINE_OF(p) (((uintptr_t) (p)) / HDR_HISTOGRAM_CACHE_LINE_SIZE)
+
+static char* test_cache_aligned_layout(void)
+{
+    struct hdr_histogram* h;
+    uintptr_t written;
+
+    mu_assert("init", 0 == hdr_init_with_flags(1, 10000000, 3, HDR_HISTOGRAM_CACHE_ALIGNED, &h));
+
+    written = LINE_OF(&h->total_count);
+    mu_assert("min_value should start a new line", 0 == ((uintptr_t) &h->min_value % HDR_HISTOGRAM_CACHE_LINE_SIZE));
+    mu_assert("max_value should share the written line", written == LINE_OF(&h->max_value));
+    mu_assert("min_value should share the written line", written == LINE_OF(&h->min_value));
+
+    /* Everything recording reads to find and address a count. */
+    mu_assert("unit_magnitude on its own line", written != LINE_OF(&h->unit_magnitude));
+    mu_assert("sub_bucket_mask on its own line", written != LINE_OF(&h->sub_bucket_mask));
+    mu_assert("sub_bucket_half_count on its own line", written != LINE_OF(&h->sub_bucket_half_count));
+    mu_assert(
+        "sub_bucket_half_count_magnitude on its own line",
+        written != LINE_OF(&h->sub_bucket_half_count_magnitude));
+    mu_assert("normalizing_index_offset on its own line", written != LINE_OF(&h->normalizing_index_offset));
+    mu_assert("counts_len on its own line", written != LINE_OF(&h->counts_len));
+    mu_assert("counts on its own line", written != LINE_OF(&h->counts));
+    mu_assert("flags on its own line", written != LINE_OF(&h->flags));
+    mu_assert("counts should be aligned", 0 == ((uintptr_t) h->counts % HDR_HISTOGRAM_CACHE_LINE_SIZE));
+    mu_assert("counts should not share the written line", written != LINE_OF(h->counts));
+
+    mu_assert("Should record", hdr_record_value_atomic(h, 10000000));
+    mu_assert("Should reject unknown flags", EINVAL == hdr_init_with_flags(1, 10000000, 3, 0x80, &h));
+
+    hdr_close(h);
+
+    return 0;
 }
 
 static struct mu_result all_tests(void)
 {
     mu_run_test(test_recording_concurrently);
+    mu_run_test(test_recording_concurrently_cache_aligned);
+    mu_run_test(test_recording_concurrently_lazy_min_max);
+    mu_run_test(test_cache_aligned_layout);
 
     mu_ok;
 }
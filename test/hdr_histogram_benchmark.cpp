@@ -1,7 +1,15 @@
 #include <benchmark/benchmark.h>
 #include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_interval_recorder.h>
+#include <hdr/hdr_registry.h>
+#include <hdr/hdr_sample_queue.h>
+#include "hdr_encoding.h"
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <random>
+#include <vector>
 
 #ifdef _WIN32
 #pragma comment(lib, "Shlwapi.lib")
@@ -56,6 +64,21 @@ static void BM_hdr_record_values(benchmark::State &state) {
   }
 }
 
+static void BM_hdr_record_values_moments(benchmark::State &state) {
+  const int64_t precision = state.range(0);
+  const int64_t max_value = state.range(1);
+  struct hdr_histogram *histogram;
+  hdr_init_with_flags(min_value, max_value, precision, HDR_HISTOGRAM_MOMENTS,
+                      &histogram);
+  benchmark::DoNotOptimize(histogram->counts);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_record_values(histogram, 1000000, 1));
+    // read/write barrier
+    benchmark::ClobberMemory();
+  }
+}
+
 static void BM_hdr_value_at_percentile(benchmark::State &state) {
   srand(12345);
   const int64_t precision = state.range(0);
@@ -141,12 +164,652 @@ static void BM_hdr_value_at_percentiles_given_array(benchmark::State &state) {
   state.SetItemsProcessed(items_processed);
 }
 
+// Latency-like value distributions, used by the concurrent benchmarks
+enum distribution { LOGNORMAL = 0, BIMODAL = 1, PARETO = 2 };
+
+static const char *distribution_names[] = {"lognormal", "bimodal", "pareto"};
+static const int64_t distribution_max_value = INT64_C(3600) * 1000 * 1000;
+static const size_t distribution_size = 1 << 20;
+
+static std::vector<int64_t> generate_distribution(int kind) {
+  std::mt19937_64 generator(12345);
+  std::vector<int64_t> values(distribution_size);
+  // ~100us median with a long tail
+  std::lognormal_distribution<double> lognormal(std::log(100000.0), 1.0);
+  // fast path ~50us and slow path ~5ms, 5% of requests taking the slow path
+  std::normal_distribution<double> fast(50000.0, 10000.0);
+  std::normal_distribution<double> slow(5000000.0, 1000000.0);
+  std::bernoulli_distribution slow_path(0.05);
+  // scale 10us, shape 1.1
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  for (size_t i = 0; i < distribution_size; i++) {
+    double value;
+    switch (kind) {
+    case LOGNORMAL:
+      value = lognormal(generator);
+      break;
+    case BIMODAL:
+      value = slow_path(generator) ? slow(generator) : fast(generator);
+      break;
+    default:
+      value = 10000.0 / std::pow(1.0 - uniform(generator), 1.0 / 1.1);
+      break;
+    }
+    value = value < 1.0 ? 1.0 : value;
+    values[i] = value > (double)distribution_max_value
+                    ? distribution_max_value
+                    : (int64_t)value;
+  }
+
+  return values;
+}
+
+static const std::vector<int64_t> &distribution_values(int kind) {
+  static const std::vector<int64_t> values[] = {
+      generate_distribution(LOGNORMAL), generate_distribution(BIMODAL),
+      generate_distribution(PARETO)};
+  return values[kind];
+}
+
+static struct hdr_histogram *distribution_histogram(int kind,
+                                                   uint32_t flags = 0) {
+  struct hdr_histogram *histogram;
+  hdr_init_with_flags(1, distribution_max_value, 3, flags, &histogram);
+  for (int64_t value : distribution_values(kind)) {
+    hdr_record_value(histogram, value);
+  }
+  return histogram;
+}
+
+static void distribution_arguments(benchmark::internal::Benchmark *b) {
+  for (int kind = LOGNORMAL; kind <= PARETO; kind++) {
+    b->Arg(kind);
+  }
+}
+
+// Each thread walks the shared values from its own offset
+static size_t thread_offset(const benchmark::State &state) {
+  return ((size_t)state.thread_index() * 7919) & (distribution_size - 1);
+}
+
+static struct hdr_histogram *shared_histogram;
+
+static void record_shared_atomic(benchmark::State &state, uint32_t flags) {
+  const std::vector<int64_t> &values = distribution_values((int)state.range(0));
+  size_t i = thread_offset(state);
+
+  if (state.thread_index() == 0) {
+    hdr_init_with_flags(1, distribution_max_value, 3, flags, &shared_histogram);
+    state.SetLabel(distribution_names[state.range(0)]);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        hdr_record_value_atomic(shared_histogram, values[i]));
+    i = (i + 1) & (distribution_size - 1);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    hdr_close(shared_histogram);
+  }
+}
+
+static void BM_hdr_record_value_atomic_shared(benchmark::State &state) {
+  record_shared_atomic(state, 0);
+}
+
+static void
+BM_hdr_record_value_atomic_shared_cache_aligned(benchmark::State &state) {
+  record_shared_atomic(state, HDR_HISTOGRAM_CACHE_ALIGNED);
+}
+
+static void
+BM_hdr_record_value_atomic_shared_cache_aligned_lazy(benchmark::State &state) {
+  record_shared_atomic(state, HDR_HISTOGRAM_CACHE_ALIGNED |
+                                  HDR_HISTOGRAM_LAZY_MIN_MAX);
+}
+
+// Sharded: each thread records into its own histogram without atomics
+static void BM_hdr_record_value_per_thread(benchmark::State &state) {
+  const std::vector<int64_t> &values = distribution_values((int)state.range(0));
+  size_t i = thread_offset(state);
+  struct hdr_histogram *histogram;
+  hdr_init(1, distribution_max_value, 3, &histogram);
+
+  if (state.thread_index() == 0) {
+    state.SetLabel(distribution_names[state.range(0)]);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_record_value(histogram, values[i]));
+    i = (i + 1) & (distribution_size - 1);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  hdr_close(histogram);
+}
+
+static struct hdr_interval_recorder shared_recorder;
+
+static void BM_hdr_interval_recorder_record_value(benchmark::State &state) {
+  const std::vector<int64_t> &values = distribution_values((int)state.range(0));
+  size_t i = thread_offset(state);
+
+  if (state.thread_index() == 0) {
+    hdr_interval_recorder_init_all(&shared_recorder, 1, distribution_max_value,
+                                   3);
+    state.SetLabel(distribution_names[state.range(0)]);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        hdr_interval_recorder_record_value_atomic(&shared_recorder, values[i]));
+    i = (i + 1) & (distribution_size - 1);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    hdr_interval_recorder_destroy(&shared_recorder);
+  }
+}
+
+static struct hdr_interval_recorder queue_recorder;
+static struct hdr_sample_queue shared_queue;
+
+static void BM_hdr_sample_queue_record_value(benchmark::State &state) {
+  const std::vector<int64_t> &values = distribution_values((int)state.range(0));
+  size_t i = thread_offset(state);
+
+  if (state.thread_index() == 0) {
+    hdr_interval_recorder_init_all(&queue_recorder, 1, distribution_max_value,
+                                   3);
+    hdr_sample_queue_init(&shared_queue, &queue_recorder, state.threads(),
+                          64 * 1024, HDR_SAMPLE_QUEUE_DROP);
+    hdr_sample_queue_start(&shared_queue, 50);
+    state.SetLabel(distribution_names[state.range(0)]);
+  }
+
+  struct hdr_sample_queue_producer *producer = NULL;
+  for (auto _ : state) {
+    if (producer == NULL) {
+      producer = hdr_sample_queue_acquire_producer(&shared_queue);
+    }
+    benchmark::DoNotOptimize(
+        hdr_sample_queue_record_value(producer, values[i]));
+    i = (i + 1) & (distribution_size - 1);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    hdr_sample_queue_stop(&shared_queue);
+    state.counters["dropped"] =
+        (double)hdr_sample_queue_dropped_count(&shared_queue);
+    hdr_sample_queue_destroy(&shared_queue);
+    hdr_interval_recorder_destroy(&queue_recorder);
+  }
+}
+
+static void BM_hdr_add(benchmark::State &state) {
+  struct hdr_histogram *from = distribution_histogram((int)state.range(0));
+  struct hdr_histogram *to;
+  hdr_init(1, distribution_max_value, 3, &to);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_add(to, from));
+    benchmark::ClobberMemory();
+  }
+
+  hdr_close(to);
+  hdr_close(from);
+}
+
+static void BM_hdr_add_downsampled(benchmark::State &state) {
+  struct hdr_histogram *from = distribution_histogram((int)state.range(0));
+  struct hdr_histogram *to;
+  hdr_init(1, distribution_max_value, 2, &to);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_add(to, from));
+    benchmark::ClobberMemory();
+  }
+
+  hdr_close(to);
+  hdr_close(from);
+}
+
+// Merges 256 interval histograms, serially with hdr_add for 0 threads
+static void BM_hdr_add_many(benchmark::State &state) {
+  const int threads = (int)state.range(1);
+  std::vector<struct hdr_histogram *> inputs;
+  struct hdr_histogram *to;
+  struct hdr_add_many_options options;
+
+  for (int i = 0; i < 256; i++) {
+    inputs.push_back(distribution_histogram((int)state.range(0)));
+  }
+  hdr_init(1, distribution_max_value, 3, &to);
+  hdr_add_many_options_init(&options);
+  options.threads = threads;
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    if (0 == threads) {
+      for (struct hdr_histogram *from : inputs) {
+        benchmark::DoNotOptimize(hdr_add(to, from));
+      }
+    } else {
+      benchmark::DoNotOptimize(hdr_add_many(to, inputs.data(), inputs.size(), &options));
+    }
+    benchmark::ClobberMemory();
+  }
+
+  for (struct hdr_histogram *from : inputs) {
+    hdr_close(from);
+  }
+  hdr_close(to);
+}
+
+static void BM_hdr_registry_sample(benchmark::State &state) {
+  const int series = (int)state.range(0);
+  const int active_every = (int)state.range(1);
+  std::vector<struct hdr_interval_recorder *> recorders;
+  struct hdr_registry registry;
+
+  hdr_registry_init(&registry, 1, 1000000, 2, (size_t)series);
+  for (int i = 0; i < series; i++) {
+    char labels[32];
+    struct hdr_interval_recorder *recorder;
+    int len = snprintf(labels, sizeof(labels), "series=%d", i);
+    hdr_registry_recorder(&registry, labels, (size_t)len, &recorder);
+    recorders.push_back(recorder);
+  }
+
+  for (auto _ : state) {
+    for (int i = 0; i < series; i += active_every) {
+      hdr_interval_recorder_record_value(recorders[i], i + 1);
+    }
+    benchmark::DoNotOptimize(hdr_registry_sample(&registry));
+  }
+
+  hdr_registry_destroy(&registry);
+}
+
+static void BM_hdr_log_encode(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    char *encoded = NULL;
+    benchmark::DoNotOptimize(hdr_log_encode(histogram, &encoded));
+    free(encoded);
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_log_encode_reused_encoder(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  struct hdr_log_encoder *encoder = NULL;
+  hdr_log_encoder_init(&encoder);
+  std::vector<uint8_t> buffer(hdr_log_encoder_bound(histogram));
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    size_t compressed_len;
+    benchmark::DoNotOptimize(hdr_log_encode_compressed_into(
+        encoder, histogram, buffer.data(), buffer.size(), &compressed_len));
+  }
+
+  hdr_log_encoder_close(encoder);
+  hdr_close(histogram);
+}
+
+static void BM_hdr_log_decode(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  char *encoded = NULL;
+  hdr_log_encode(histogram, &encoded);
+  const size_t encoded_len = encoded != NULL ? strlen(encoded) : 0;
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    struct hdr_histogram *decoded = NULL;
+    benchmark::DoNotOptimize(hdr_log_decode(&decoded, encoded, encoded_len));
+    hdr_close(decoded);
+  }
+
+  state.SetBytesProcessed(state.iterations() * (int64_t)encoded_len);
+  free(encoded);
+  hdr_close(histogram);
+}
+
+static void BM_hdr_log_decode_reused_decoder(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  struct hdr_log_decoder *decoder = NULL;
+  char *encoded = NULL;
+  hdr_log_encode(histogram, &encoded);
+  hdr_log_decoder_init(&decoder);
+  const size_t encoded_len = encoded != NULL ? strlen(encoded) : 0;
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    struct hdr_histogram *decoded = NULL;
+    benchmark::DoNotOptimize(
+        hdr_log_decode_with(decoder, &decoded, encoded, encoded_len));
+    hdr_close(decoded);
+  }
+
+  state.SetBytesProcessed(state.iterations() * (int64_t)encoded_len);
+  hdr_log_decoder_close(decoder);
+  free(encoded);
+  hdr_close(histogram);
+}
+
+static void BM_hdr_log_write_entry(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  struct hdr_log_writer writer;
+  struct hdr_log_entry entry = {};
+  FILE *null_stream = fopen("/dev/null", "w");
+  hdr_log_writer_init_with_encoder(&writer);
+  entry.tag = (char *)"host-a";
+  entry.tag_len = strlen(entry.tag);
+  entry.interval.tv_sec = 1;
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    entry.start_timestamp.tv_sec++;
+    benchmark::DoNotOptimize(hdr_log_write_entry(&writer, null_stream, &entry, histogram));
+  }
+
+  hdr_log_writer_close(&writer);
+  fclose(null_stream);
+  hdr_close(histogram);
+}
+
+static void BM_hdr_log_buffered_write_entry(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  struct hdr_log_buffered_writer writer;
+  struct hdr_log_entry entry = {};
+  FILE *null_stream = fopen("/dev/null", "w");
+  hdr_log_buffered_writer_init_fd(&writer, fileno(null_stream), 64 * 1024);
+  entry.tag = (char *)"host-a";
+  entry.tag_len = strlen(entry.tag);
+  entry.interval.tv_sec = 1;
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    entry.start_timestamp.tv_sec++;
+    benchmark::DoNotOptimize(hdr_log_buffered_write_entry(&writer, &entry, histogram));
+  }
+
+  hdr_log_buffered_writer_close(&writer);
+  fclose(null_stream);
+  hdr_close(histogram);
+}
+
+static void BM_hdr_percentiles_print(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  FILE *null_stream = fopen("/dev/null", "w");
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        hdr_percentiles_print(histogram, null_stream, 5, 1000.0, CLASSIC));
+  }
+
+  fclose(null_stream);
+  hdr_close(histogram);
+}
+
+static void BM_hdr_value_at_percentile_tail(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  const double percentiles[3] = {99.0, 99.9, 99.99};
+  size_t i = 0;
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_value_at_percentile(histogram, percentiles[i]));
+    i = i == 2 ? 0 : i + 1;
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_percentile_at_or_below_value(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  const int64_t slo = hdr_value_at_percentile(histogram, 99.0);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_percentile_at_or_below_value(histogram, slo));
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_mean(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_mean(histogram));
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_stddev(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_stddev(histogram));
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_stddev_moments(benchmark::State &state) {
+  struct hdr_histogram *histogram =
+      distribution_histogram((int)state.range(0), HDR_HISTOGRAM_MOMENTS);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdr_stddev(histogram));
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_iter_recorded(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    struct hdr_iter iter;
+    int64_t total = 0;
+    hdr_iter_recorded_init(&iter, histogram);
+    while (hdr_iter_next(&iter)) {
+      total += iter.count;
+    }
+    benchmark::DoNotOptimize(total);
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_hdr_iter_recorded_runs(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  struct hdr_iter_run runs[256];
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    struct hdr_iter iter;
+    int64_t total = 0;
+    size_t runs_len;
+    hdr_iter_recorded_init(&iter, histogram);
+    while ((runs_len = hdr_iter_recorded_runs(&iter, runs, 256)) > 0) {
+      for (size_t i = 0; i < runs_len; i++) {
+        total += runs[i].count;
+      }
+    }
+    benchmark::DoNotOptimize(total);
+  }
+
+  hdr_close(histogram);
+}
+
+static void BM_zig_zag_encode_scalar(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  std::vector<uint8_t> buffer((size_t)histogram->counts_len * MAX_BYTES_LEB128);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  // The same V2 payload as zig_zag_encode_counts, a value at a time.
+  for (auto _ : state) {
+    int32_t data_index = 0;
+    for (int32_t i = 0; i < histogram->counts_len;) {
+      int64_t value = histogram->counts[i++];
+      if (value == 0) {
+        int64_t zeros = 1;
+        while (i < histogram->counts_len && histogram->counts[i] == 0) {
+          zeros++;
+          i++;
+        }
+        value = -zeros;
+      }
+      data_index += zig_zag_encode_i64(&buffer[data_index], value);
+    }
+    benchmark::DoNotOptimize(data_index);
+  }
+
+  state.SetItemsProcessed(state.iterations() * histogram->counts_len);
+  hdr_close(histogram);
+}
+
+static void BM_zig_zag_encode_bulk(benchmark::State &state) {
+  struct hdr_histogram *histogram = distribution_histogram((int)state.range(0));
+  std::vector<uint8_t> buffer((size_t)histogram->counts_len * MAX_BYTES_LEB128);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(zig_zag_encode_counts(
+        buffer.data(), histogram->counts, histogram->counts_len));
+  }
+
+  state.SetItemsProcessed(state.iterations() * histogram->counts_len);
+  hdr_close(histogram);
+}
+
+// The V2 payload of the distribution, zero runs collapsed, and the number of
+// values in it.
+static std::vector<uint8_t> zig_zag_encoded_counts(int distribution,
+                                                   int32_t *values_len) {
+  struct hdr_histogram *histogram = distribution_histogram(distribution);
+  std::vector<uint8_t> buffer((size_t)histogram->counts_len * MAX_BYTES_LEB128);
+  int32_t data_index = zig_zag_encode_counts(
+      buffer.data(), histogram->counts, histogram->counts_len);
+  *values_len = 0;
+  for (int32_t i = 0; i < data_index; (*values_len)++) {
+    int64_t value;
+    i += zig_zag_decode_i64(&buffer[i], &value);
+  }
+  buffer.resize((size_t)data_index);
+  hdr_close(histogram);
+  return buffer;
+}
+
+static void BM_zig_zag_decode_scalar(benchmark::State &state) {
+  int32_t values_len;
+  std::vector<uint8_t> buffer =
+      zig_zag_encoded_counts((int)state.range(0), &values_len);
+  std::vector<int64_t> values((size_t)values_len);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    size_t data_index = 0;
+    for (int32_t i = 0; data_index < buffer.size(); i++) {
+      data_index += zig_zag_decode_i64(&buffer[data_index], &values[i]);
+    }
+    benchmark::DoNotOptimize(values.data());
+  }
+
+  state.SetBytesProcessed(state.iterations() * (int64_t)buffer.size());
+}
+
+static void BM_zig_zag_decode_bulk(benchmark::State &state) {
+  int32_t values_len;
+  std::vector<uint8_t> buffer =
+      zig_zag_encoded_counts((int)state.range(0), &values_len);
+  std::vector<int64_t> values((size_t)values_len);
+  state.SetLabel(distribution_names[state.range(0)]);
+
+  for (auto _ : state) {
+    size_t bytes_read;
+    benchmark::DoNotOptimize(zig_zag_decode_i64_bulk(
+        buffer.data(), buffer.size(), values.data(), values.size(), &bytes_read));
+  }
+
+  state.SetBytesProcessed(state.iterations() * (int64_t)buffer.size());
+}
+
 // Register the functions as a benchmark
 BENCHMARK(BM_hdr_init)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_hdr_record_values)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_hdr_record_values_moments)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_hdr_value_at_percentile)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_hdr_value_at_percentile_given_array)
     ->Apply(generate_arguments_pairs);
 BENCHMARK(BM_hdr_value_at_percentiles_given_array)
     ->Apply(generate_arguments_pairs);
+BENCHMARK(BM_hdr_record_value_atomic_shared)
+    ->Apply(distribution_arguments)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_hdr_record_value_atomic_shared_cache_aligned)
+    ->Apply(distribution_arguments)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_hdr_record_value_atomic_shared_cache_aligned_lazy)
+    ->Apply(distribution_arguments)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_hdr_record_value_per_thread)
+    ->Apply(distribution_arguments)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_hdr_interval_recorder_record_value)
+    ->Apply(distribution_arguments)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_hdr_sample_queue_record_value)
+    ->Apply(distribution_arguments)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_hdr_add)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_add_downsampled)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_add_many)
+    ->ArgsProduct({{LOGNORMAL, BIMODAL, PARETO}, {0, 1, 4}})
+    ->UseRealTime();
+BENCHMARK(BM_hdr_registry_sample)->ArgsProduct({{1000, 100000}, {1, 100}});
+BENCHMARK(BM_hdr_log_encode)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_log_encode_reused_encoder)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_log_decode)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_log_decode_reused_decoder)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_log_write_entry)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_log_buffered_write_entry)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_percentiles_print)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_value_at_percentile_tail)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_percentile_at_or_below_value)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_mean)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_stddev)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_stddev_moments)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_iter_recorded)->Apply(distribution_arguments);
+BENCHMARK(BM_hdr_iter_recorded_runs)->Apply(distribution_arguments);
+BENCHMARK(BM_zig_zag_encode_scalar)->Apply(distribution_arguments);
+BENCHMARK(BM_zig_zag_encode_bulk)->Apply(distribution_arguments);
+BENCHMARK(BM_zig_zag_decode_scalar)->Apply(distribution_arguments);
+BENCHMARK(BM_zig_zag_decode_bulk)->Apply(distribution_arguments);
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -257,6 +257,97 @@ static char* test_encode_and_decode_compressed2(void)
     return 0;
 }
 
+static char* test_encode_and_decode_lazy_min_max(void)
+{
+    uint8_t* buffer = NULL;
+    size_t len = 0;
+    int rc = 0;
+    struct hdr_histogram* actual = NULL;
+    struct hdr_histogram* expected;
+    int i;
+
+    load_histograms();
+
+    hdr_init_with_flags(1, INT64_C(3600) * 1000 * 1000, 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &expected);
+    for (i = 0; i < 10000; i++)
+    {
+        hdr_record_value(expected, 1000);
+    }
+    hdr_record_value(expected, 100000000);
+
+    rc = hdr_encode_compressed(expected, &buffer, &len);
+    mu_assert("Did not encode", validate_return_code(rc));
+
+    rc = hdr_decode_compressed(buffer, len, &actual);
+    mu_assert("Did not decode", validate_return_code(rc));
+
+    mu_assert("Min", compare_int64(hdr_min(expected), hdr_min(actual)));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(actual)));
+    mu_assert("Total", compare_int64(expected->total_count, actual->total_count));
+
+    hdr_close(expected);
+    hdr_close(actual);
+    free(buffer);
+
+    return 0;
+}
+
+static char* decode_accumulates_into(int64_t lowest, int64_t highest, int significant_figures)
+{
+    uint8_t* buffer = NULL;
+    size_t len = 0;
+    struct hdr_histogram* source;
+    struct hdr_histogram* target;
+    struct hdr_histogram* expected;
+    struct hdr_iter expected_iter;
+    struct hdr_iter target_iter;
+    int i;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &source);
+    hdr_init(lowest, highest, significant_figures, &target);
+    hdr_init(lowest, highest, significant_figures, &expected);
+
+    for (i = 0; i < 10000; i++)
+    {
+        hdr_record_value(source, 1 + (i * 7919) % 5000000);
+        hdr_record_value(target, 2000 + i);
+        hdr_record_value(expected, 2000 + i);
+    }
+    hdr_add(expected, source);
+
+    mu_assert("Did not encode", validate_return_code(hdr_encode_compressed(source, &buffer, &len)));
+    mu_assert("Did not decode", validate_return_code(hdr_decode_compressed(buffer, len, &target)));
+
+    hdr_iter_init(&expected_iter, expected);
+    hdr_iter_init(&target_iter, target);
+    while (hdr_iter_next(&expected_iter))
+    {
+        mu_assert("Should have next", hdr_iter_next(&target_iter));
+        mu_assert("Counts", compare_int64(expected_iter.count, target_iter.count));
+    }
+
+    mu_assert("Total", compare_int64(expected->total_count, target->total_count));
+    mu_assert("Min", compare_int64(hdr_min(expected), hdr_min(target)));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(target)));
+
+    hdr_close(source);
+    hdr_close(target);
+    hdr_close(expected);
+    free(buffer);
+
+    return 0;
+}
+
+static char* test_decode_accumulates_same_config(void)
+{
+    return decode_accumulates_into(1, INT64_C(3600) * 1000 * 1000, 3);
+}
+
+static char* test_decode_accumulates_different_config(void)
+{
+    return decode_accumulates_into(1000, INT64_C(3600) * 1000, 2);
+}
+
 static char* test_bounds_check_on_decode(void)
 {
     uint8_t* buffer = NULL;
@@ -373,6 +464,145 @@ static char* test_encode_and_decode_compressed_large(void)
 }
 
 
+static char* test_encoder_reuses_state_across_histograms(void)
+{
+    const int64_t limit = INT64_C(3600) * 1000 * 1000;
+    struct hdr_log_encoder* encoder = NULL;
+    struct hdr_histogram* expected = NULL;
+    size_t len = 0;
+    int round, i;
+
+    mu_assert("Encoder init", validate_return_code(hdr_log_encoder_init(&encoder)));
+    hdr_init(1, limit, 4, &expected);
+    srand(7);
+
+    for (round = 0; round < 3; round++)
+    {
+        struct hdr_histogram* actual = NULL;
+        uint8_t* buffer;
+        size_t buffer_len;
+
+        for (i = 0; i < 5000; i++)
+        {
+            hdr_record_value(expected, rand() % limit);
+        }
+
+        buffer_len = hdr_log_encoder_bound(expected);
+        buffer = (uint8_t*) malloc(buffer_len);
+        mu_assert(
+            "Did not encode",
+            validate_return_code(hdr_log_encode_compressed_into(encoder, expected, buffer, buffer_len, &len)));
+        mu_assert("Did not decode", validate_return_code(hdr_decode_compressed(buffer, len, &actual)));
+        mu_assert("Comparison did not match", compare_histogram(expected, actual));
+
+        free(buffer);
+        hdr_close(actual);
+    }
+
+    hdr_close(expected);
+    hdr_log_encoder_close(encoder);
+
+    return 0;
+}
+
+static char* test_encoder_fails_when_buffer_too_small(void)
+{
+    struct hdr_log_encoder* encoder = NULL;
+    uint8_t buffer[16];
+    size_t len = 0;
+
+    load_histograms();
+    hdr_log_encoder_init(&encoder);
+
+    mu_assert(
+        "Should not fit",
+        ENOBUFS == hdr_log_encode_compressed_into(encoder, raw_histogram, buffer, sizeof(buffer), &len));
+    mu_assert(
+        "Should not fit header",
+        ENOBUFS == hdr_log_encode_compressed_into(encoder, raw_histogram, buffer, 8, &len));
+
+    hdr_log_encoder_close(encoder);
+
+    return 0;
+}
+
+struct capture_sink
+{
+    uint8_t* data;
+    size_t len;
+};
+
+static int capture_to_sink(void* sink_arg, const uint8_t* data, size_t len)
+{
+    struct capture_sink* capture = (struct capture_sink*) sink_arg;
+
+    capture->data = (uint8_t*) malloc(len);
+    memcpy(capture->data, data, len);
+    capture->len = len;
+
+    return 0;
+}
+
+static char* test_encoder_writes_to_sink(void)
+{
+    struct hdr_log_encoder* encoder = NULL;
+    struct hdr_histogram* actual = NULL;
+    struct capture_sink capture = { NULL, 0 };
+
+    load_histograms();
+    hdr_log_encoder_init(&encoder);
+
+    mu_assert(
+        "Did not encode",
+        validate_return_code(hdr_log_encode_compressed_to_sink(encoder, cor_histogram, capture_to_sink, &capture)));
+    mu_assert("Did not decode", validate_return_code(hdr_decode_compressed(capture.data, capture.len, &actual)));
+    mu_assert("Comparison did not match", compare_histogram(cor_histogram, actual));
+
+    free(capture.data);
+    hdr_close(actual);
+    hdr_log_encoder_close(encoder);
+
+    return 0;
+}
+
+static char* test_encode_with_and_decode_with_reuse_contexts(void)
+{
+    struct hdr_log_encoder* encoder = NULL;
+    struct hdr_log_decoder* decoder = NULL;
+    struct hdr_histogram* accumulated = NULL;
+    struct hdr_histogram* expected = NULL;
+    const char* encoded;
+    size_t encoded_len;
+    int i;
+
+    load_histograms();
+    mu_assert("Encoder init", validate_return_code(hdr_log_encoder_init(&encoder)));
+    mu_assert("Decoder init", validate_return_code(hdr_log_decoder_init(&decoder)));
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+
+    for (i = 0; i < 3; i++)
+    {
+        struct hdr_histogram* source = (i % 2 == 0) ? raw_histogram : cor_histogram;
+
+        mu_assert("Did not encode", validate_return_code(hdr_log_encode_with(encoder, source, &encoded, &encoded_len)));
+        mu_assert("Terminated", '\0' == encoded[encoded_len]);
+        mu_assert(
+            "Did not decode",
+            validate_return_code(hdr_log_decode_with(decoder, &accumulated, encoded, encoded_len)));
+        hdr_add(expected, source);
+    }
+
+    mu_assert("Total count", compare_int64(expected->total_count, accumulated->total_count));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(accumulated)));
+
+    hdr_close(expected);
+    hdr_close(accumulated);
+    hdr_log_decoder_close(decoder);
+    hdr_log_encoder_close(encoder);
+
+    return 0;
+}
+
 static bool assert_base64_encode(const char* input, const char* expected)
 {
     size_t input_len = strlen(input);
@@ -388,6 +618,230 @@ static bool assert_base64_encode(const char* input, const char* expected)
     return result;
 }
 
+#define ZIG_ZAG_VALUES 1024
+
+static void fill_zig_zag_values(int64_t* values, int len)
+{
+    static const int64_t edges[] = {
+        0, 1, -1, 63, -64, 64, 8191, -8192, 8192,
+        INT64_C(0x7FFFFFFFFFFFFF), INT64_C(0x80000000000000),
+        INT64_MAX, INT64_MIN, INT64_MIN + 1
+    };
+    const int edges_len = (int) (sizeof(edges) / sizeof(edges[0]));
+    int i;
+
+    srand(17);
+    for (i = 0; i < len; i++)
+    {
+        if (i < edges_len)
+        {
+            values[i] = edges[i];
+        }
+        else
+        {
+            /* Spread the magnitudes so every encoded length is exercised. */
+            int64_t value = ((int64_t) rand() << 32) ^ rand();
+            value >>= rand() % 63;
+            values[i] = (i & 1) ? -value : value;
+        }
+    }
+}
+
+static char* zig_zag_bulk_decode_matches_scalar(void)
+{
+    int64_t values[ZIG_ZAG_VALUES];
+    int64_t decoded[ZIG_ZAG_VALUES];
+    uint8_t buffer[ZIG_ZAG_VALUES * MAX_BYTES_LEB128];
+    size_t buffer_len = 0;
+    size_t bytes_read = 0;
+    size_t values_read;
+    int i;
+
+    fill_zig_zag_values(values, ZIG_ZAG_VALUES);
+    for (i = 0; i < ZIG_ZAG_VALUES; i++)
+    {
+        buffer_len += (size_t) zig_zag_encode_i64(&buffer[buffer_len], values[i]);
+    }
+
+    values_read = zig_zag_decode_i64_bulk(buffer, buffer_len, decoded, ZIG_ZAG_VALUES, &bytes_read);
+
+    mu_assert("Values read", compare_int64(ZIG_ZAG_VALUES, (int64_t) values_read));
+    mu_assert("Bytes read", compare_int64((int64_t) buffer_len, (int64_t) bytes_read));
+    for (i = 0; i < ZIG_ZAG_VALUES; i++)
+    {
+        mu_assert("Decoded value", compare_int64(values[i], decoded[i]));
+    }
+
+    return 0;
+}
+
+static char* zig_zag_bulk_decode_stops_before_truncated_value(void)
+{
+    int64_t decoded[4];
+    uint8_t buffer[4 * MAX_BYTES_LEB128];
+    size_t buffer_len = 0;
+    size_t bytes_read = 0;
+    size_t values_read;
+
+    buffer_len += (size_t) zig_zag_encode_i64(&buffer[buffer_len], 5);
+    buffer_len += (size_t) zig_zag_encode_i64(&buffer[buffer_len], 300);
+    buffer_len += (size_t) zig_zag_encode_i64(&buffer[buffer_len], INT64_MAX);
+
+    values_read = zig_zag_decode_i64_bulk(buffer, buffer_len - 1, decoded, 4, &bytes_read);
+
+    mu_assert("Values read", compare_int64(2, (int64_t) values_read));
+    mu_assert("Bytes read", compare_int64(3, (int64_t) bytes_read));
+    mu_assert("First value", compare_int64(5, decoded[0]));
+    mu_assert("Second value", compare_int64(300, decoded[1]));
+
+    return 0;
+}
+
+/* The V2 payload written a count at a time, collapsing zero runs. */
+static int32_t zig_zag_encode_counts_scalar(uint8_t* buffer, const int64_t* counts, int32_t counts_len)
+{
+    int32_t buffer_len = 0;
+    int32_t i;
+
+    for (i = 0; i < counts_len;)
+    {
+        int64_t value = counts[i++];
+
+        if (value == 0)
+        {
+            int64_t zeros = 1;
+            while (i < counts_len && 0 == counts[i])
+            {
+                zeros++;
+                i++;
+            }
+            value = -zeros;
+        }
+
+        buffer_len += zig_zag_encode_i64(&buffer[buffer_len], value);
+    }
+
+    return buffer_len;
+}
+
+static char* zig_zag_encode_counts_matches_scalar(void)
+{
+    int64_t counts[ZIG_ZAG_VALUES];
+    uint8_t expected[ZIG_ZAG_VALUES * MAX_BYTES_LEB128];
+    uint8_t actual[ZIG_ZAG_VALUES * MAX_BYTES_LEB128];
+    int32_t expected_len;
+    int32_t actual_len;
+    int i;
+
+    for (i = 0; i < ZIG_ZAG_VALUES; i++)
+    {
+        counts[i] = (i % 7 == 0 || i % 11 == 0) ? ((int64_t) i * i * i * i) : 0;
+    }
+
+    expected_len = zig_zag_encode_counts_scalar(expected, counts, ZIG_ZAG_VALUES);
+    actual_len = zig_zag_encode_counts(actual, counts, ZIG_ZAG_VALUES);
+
+    mu_assert("Encoded length", compare_int64(expected_len, actual_len));
+    mu_assert("Encoded bytes", 0 == memcmp(expected, actual, (size_t) actual_len));
+
+    return 0;
+}
+
+/* Long runs of single byte values take the 16 wide paths where available. */
+static char* zig_zag_codecs_handle_runs_of_small_counts(void)
+{
+    int64_t counts[ZIG_ZAG_VALUES];
+    int64_t expected_values[ZIG_ZAG_VALUES];
+    int64_t decoded[ZIG_ZAG_VALUES];
+    uint8_t expected[ZIG_ZAG_VALUES * MAX_BYTES_LEB128];
+    uint8_t actual[ZIG_ZAG_VALUES * MAX_BYTES_LEB128];
+    int32_t expected_len;
+    int32_t actual_len;
+    int32_t values_len = 0;
+    size_t bytes_read = 0;
+    size_t values_read;
+    int i;
+
+    srand(29);
+    for (i = 0; i < ZIG_ZAG_VALUES; i++)
+    {
+        /* Mostly 1 to 63, with the odd zero run, 64 and multi-byte count. */
+        int r = rand() % 100;
+        counts[i] = (r < 85) ? 1 + (i % 63)
+            : (r < 92) ? 0
+            : (r < 96) ? 64
+            : ((int64_t) rand() << (rand() % 32));
+    }
+
+    expected_len = zig_zag_encode_counts_scalar(expected, counts, ZIG_ZAG_VALUES);
+    actual_len = zig_zag_encode_counts(actual, counts, ZIG_ZAG_VALUES);
+
+    mu_assert("Encoded length", compare_int64(expected_len, actual_len));
+    mu_assert("Encoded bytes", 0 == memcmp(expected, actual, (size_t) actual_len));
+    mu_assert(
+        "Computed length",
+        compare_int64(expected_len, zig_zag_counts_encoded_len(counts, ZIG_ZAG_VALUES)));
+
+    for (i = 0; i < expected_len;)
+    {
+        i += zig_zag_decode_i64(&expected[i], &expected_values[values_len++]);
+    }
+
+    values_read = zig_zag_decode_i64_bulk(expected, (size_t) expected_len, decoded, ZIG_ZAG_VALUES, &bytes_read);
+
+    mu_assert("Values read", compare_int64(values_len, (int64_t) values_read));
+    mu_assert("Bytes read", compare_int64(expected_len, (int64_t) bytes_read));
+    for (i = 0; i < values_len; i++)
+    {
+        mu_assert("Decoded value", compare_int64(expected_values[i], decoded[i]));
+    }
+
+    return 0;
+}
+
+static char* base64_round_trips_all_lengths(void)
+{
+    uint8_t input[64];
+    char encoded[88];
+    uint8_t decoded[66];
+    size_t len;
+
+    for (len = 0; len < sizeof(input); len++)
+    {
+        input[len] = (uint8_t) (len * 37 + 11);
+    }
+
+    for (len = 1; len <= sizeof(input); len++)
+    {
+        size_t encoded_len = hdr_base64_encoded_len(len);
+        size_t i;
+
+        mu_assert("Encode", 0 == hdr_base64_encode(input, len, encoded, encoded_len));
+        for (i = 0; i + 4 <= encoded_len && (i / 4) * 3 + 3 <= len; i += 4)
+        {
+            char block[5] = { 0 };
+            hdr_base64_encode_block(&input[(i / 4) * 3], block);
+            mu_assert("Matches block encoding", compare_string(block, &encoded[i], 4));
+        }
+
+        mu_assert("Decode", 0 == hdr_base64_decode(encoded, encoded_len, decoded, hdr_base64_decoded_len(encoded_len)));
+        mu_assert("Round trip", 0 == memcmp(input, decoded, len));
+    }
+
+    return 0;
+}
+
+static char* base64_decode_fails_with_invalid_characters(void)
+{
+    uint8_t output[9];
+
+    mu_assert("Invalid in unrolled loop", -EINVAL == hdr_base64_decode("TW*uTWFu", 8, output, 6));
+    mu_assert("Invalid in last block", -EINVAL == hdr_base64_decode("TWFuTWFuTW\\u", 12, output, 9));
+    mu_assert("Valid", 0 == hdr_base64_decode("TWFuTWFu", 8, output, 6));
+
+    return 0;
+}
+
 static char* base64_encode_encodes_without_padding(void)
 {
     mu_assert(
@@ -585,6 +1039,305 @@ static char* writes_and_reads_log(void)
     return 0;
 }
 
+static char* writes_and_reads_log_with_encoder_and_decoder(void)
+{
+    struct hdr_log_writer writer;
+    struct hdr_log_reader reader;
+    struct hdr_histogram* read_cor_histogram = NULL;
+    struct hdr_histogram* read_raw_histogram = NULL;
+    const char* file_name = "histogram.log";
+    int rc = 0;
+    FILE* log_file;
+    const char* tag = "tag_value";
+    char read_tag[32];
+    struct hdr_log_entry write_entry;
+    struct hdr_log_entry read_entry;
+
+    hdr_gettime(&write_entry.start_timestamp);
+
+    write_entry.interval.tv_sec = 5;
+    write_entry.interval.tv_nsec = 2000000;
+
+    mu_assert("Failed writer init", 0 == hdr_log_writer_init_with_encoder(&writer));
+    mu_assert("Failed reader init", 0 == hdr_log_reader_init_with_decoder(&reader));
+
+    log_file = fopen(file_name, "w+");
+
+    rc = hdr_log_write_header(&writer, log_file, "Test log", &write_entry.start_timestamp);
+    mu_assert("Failed header write", validate_return_code(rc));
+
+    /* Both entries go through the writer's encoder and the reader's decoder. */
+    write_entry.tag = (char *) tag;
+    write_entry.tag_len = strlen(tag);
+    rc = hdr_log_write_entry(&writer, log_file, &write_entry, cor_histogram);
+    mu_assert("Failed corrected write", validate_return_code(rc));
+
+    write_entry.tag = NULL;
+    rc = hdr_log_write_entry(&writer, log_file, &write_entry, raw_histogram);
+    mu_assert("Failed raw write", validate_return_code(rc));
+
+    fflush(log_file);
+    fclose(log_file);
+
+    log_file = fopen(file_name, "r");
+
+    rc = hdr_log_read_header(&reader, log_file);
+    mu_assert("Failed header read", validate_return_code(rc));
+
+    read_entry.tag = read_tag;
+    read_entry.tag_len = sizeof(read_tag);
+    read_entry.tag[0] = '\0';
+    read_entry.tag[read_entry.tag_len - 1] = '\0';
+
+    rc = hdr_log_read_entry(&reader, log_file, &read_entry, &read_cor_histogram);
+    mu_assert("Failed corrected read", validate_return_code(rc));
+    mu_assert("Incorrect tag", compare_string(read_entry.tag, tag, strlen(tag)));
+
+    read_entry.tag[0] = '\0';
+    rc = hdr_log_read_entry(&reader, log_file, &read_entry, &read_raw_histogram);
+    mu_assert("Failed raw read", validate_return_code(rc));
+    mu_assert("Should not find tag", read_entry.tag[0] == '\0');
+
+    mu_assert(
+        "Histograms do not match",
+        compare_histogram(cor_histogram, read_cor_histogram));
+
+    mu_assert(
+        "Histograms do not match",
+        compare_histogram(raw_histogram, read_raw_histogram));
+
+    rc = hdr_log_read(&reader, log_file, &read_cor_histogram, NULL, NULL);
+    mu_assert("No EOF at end of file", rc == EOF);
+
+    fclose(log_file);
+    remove(file_name);
+
+    hdr_close(read_cor_histogram);
+    hdr_close(read_raw_histogram);
+    hdr_log_writer_close(&writer);
+    hdr_log_reader_close(&reader);
+
+    return 0;
+}
+
+static bool parses_as(const char* text, size_t expected_len, long sec, long nsec)
+{
+    hdr_timespec t;
+    size_t len = hdr_timespec_parse(&t, text, strlen(text));
+
+    return len == expected_len && (0 == len || (sec == (long) t.tv_sec && nsec == t.tv_nsec));
+}
+
+static bool timespec_formats_as(const hdr_timespec* t, const char* expected)
+{
+    char buffer[HDR_TIMESPEC_MAX_LEN];
+    size_t len = hdr_timespec_format(buffer, t);
+
+    return len == strlen(expected) && 0 == memcmp(buffer, expected, len);
+}
+
+static bool formats_as(long sec, long nsec, const char* expected)
+{
+    hdr_timespec t;
+
+    t.tv_sec = (time_t) sec;
+    t.tv_nsec = nsec;
+
+    return timespec_formats_as(&t, expected);
+}
+
+static char* parses_and_formats_timestamps(void)
+{
+    mu_assert("Millis", parses_as("1438869961.225", 14, 1438869961, 225000000));
+    mu_assert("Nanos", parses_as("0.000000001,", 11, 0, 1));
+    mu_assert("No fraction", parses_as("7,", 1, 7, 0));
+    mu_assert("Truncated", parses_as("2.1234567899", 12, 2, 123456789));
+    mu_assert("Negative", parses_as("-0.25", 5, -1, 750000000));
+    mu_assert("Empty", parses_as("", 0, 0, 0));
+    mu_assert("Sign only", parses_as("-.", 0, 0, 0));
+    mu_assert("Not a number", parses_as("a7.133", 0, 0, 0));
+    mu_assert("Too many digits", parses_as("1234567890123456789.0", 0, 0, 0));
+
+    mu_assert("Format millis", formats_as(5, 2000000, "5.002"));
+    mu_assert("Format micros", formats_as(0, 123000, "0.000123"));
+    mu_assert("Format nanos", formats_as(1, 1500, "1.000001500"));
+    mu_assert("Format negative", formats_as(-1, 750000000, "-0.250"));
+
+    if (sizeof(time_t) == sizeof(int64_t))
+    {
+        hdr_timespec t;
+
+        t.tv_sec = (time_t) INT64_MIN;
+        t.tv_nsec = 0;
+        mu_assert("Format most negative", timespec_formats_as(&t, "-9223372036854775808.000"));
+
+        t.tv_nsec = 500000000;
+        mu_assert("Format most negative fraction", timespec_formats_as(&t, "-9223372036854775807.500"));
+    }
+
+    return 0;
+}
+
+static char* timestamps_round_trip_to_nanoseconds(void)
+{
+    struct hdr_log_writer writer;
+    struct hdr_log_reader reader;
+    struct hdr_log_entry write_entry;
+    struct hdr_log_entry read_entry;
+    struct hdr_histogram* read_histogram = NULL;
+    FILE* log_file = tmpfile();
+    int rc;
+
+    memset(&write_entry, 0, sizeof(write_entry));
+    memset(&read_entry, 0, sizeof(read_entry));
+    write_entry.start_timestamp.tv_sec = 1438869961;
+    write_entry.start_timestamp.tv_nsec = 225000001;
+    write_entry.interval.tv_sec = 0;
+    write_entry.interval.tv_nsec = 999999;
+
+    hdr_log_writer_init(&writer);
+    hdr_log_reader_init(&reader);
+
+    rc = hdr_log_write_header(&writer, log_file, NULL, &write_entry.start_timestamp);
+    mu_assert("Failed header write", validate_return_code(rc));
+    rc = hdr_log_write_entry(&writer, log_file, &write_entry, raw_histogram);
+    mu_assert("Failed entry write", validate_return_code(rc));
+    rewind(log_file);
+
+    rc = hdr_log_read_header(&reader, log_file);
+    mu_assert("Failed header read", validate_return_code(rc));
+    mu_assert("Start seconds", compare_int64(1438869961, reader.start_timestamp.tv_sec));
+    mu_assert("Start nanoseconds", compare_int64(225000001, reader.start_timestamp.tv_nsec));
+
+    rc = hdr_log_read_entry(&reader, log_file, &read_entry, &read_histogram);
+    mu_assert("Failed entry read", validate_return_code(rc));
+    mu_assert("Timestamp seconds", compare_int64(1438869961, read_entry.start_timestamp.tv_sec));
+    mu_assert("Timestamp nanoseconds", compare_int64(225000001, read_entry.start_timestamp.tv_nsec));
+    mu_assert("Interval seconds", compare_int64(0, read_entry.interval.tv_sec));
+    mu_assert("Interval nanoseconds", compare_int64(999999, read_entry.interval.tv_nsec));
+    mu_assert("Histograms do not match", compare_histogram(raw_histogram, read_histogram));
+
+    fclose(log_file);
+    hdr_close(read_histogram);
+    hdr_log_writer_close(&writer);
+    hdr_log_reader_close(&reader);
+
+    return 0;
+}
+
+struct append_sink
+{
+    uint8_t data[65536];
+    size_t len;
+    int calls;
+};
+
+static int append_to_sink(void* sink_arg, const uint8_t* data, size_t len)
+{
+    struct append_sink* sink = (struct append_sink*) sink_arg;
+
+    if (sizeof(sink->data) - sink->len < len)
+    {
+        return ENOSPC;
+    }
+
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    sink->calls++;
+
+    return 0;
+}
+
+static char* buffered_writer_matches_write_entry(void)
+{
+    struct hdr_log_writer writer;
+    struct hdr_log_buffered_writer buffered;
+    struct append_sink* sink = (struct append_sink*) calloc(1, sizeof(struct append_sink));
+    struct hdr_log_entry entry;
+    hdr_timespec start;
+    char expected[65536];
+    size_t expected_len;
+    FILE* f = tmpfile();
+
+    load_histograms();
+    memset(&entry, 0, sizeof(entry));
+    start.tv_sec = 1441812279;
+    start.tv_nsec = 474000000;
+    entry.start_timestamp.tv_sec = 12;
+    entry.start_timestamp.tv_nsec = 345678901;
+    entry.interval.tv_sec = 5;
+    entry.interval.tv_nsec = 2000000;
+    entry.tag = (char*) "tag_value";
+    entry.tag_len = strlen(entry.tag);
+
+    mu_assert("Writer init", validate_return_code(hdr_log_writer_init(&writer)));
+    mu_assert("Writer init should not allocate", NULL == writer.encoder);
+    hdr_log_write_header(&writer, f, "Test log", &start);
+    hdr_log_write_entry(&writer, f, &entry, cor_histogram);
+    hdr_log_writer_close(&writer);
+    rewind(f);
+    expected_len = fread(expected, 1, sizeof(expected), f);
+    fclose(f);
+
+    mu_assert("Init", validate_return_code(hdr_log_buffered_writer_init(&buffered, append_to_sink, sink, 0)));
+    mu_assert("Header", validate_return_code(hdr_log_buffered_write_header(&buffered, "Test log", &start)));
+    mu_assert("Entry", validate_return_code(hdr_log_buffered_write_entry(&buffered, &entry, cor_histogram)));
+    mu_assert("Nothing written before flush", compare_int(0, sink->calls));
+    mu_assert("Close", validate_return_code(hdr_log_buffered_writer_close(&buffered)));
+
+    mu_assert("Single write", compare_int(1, sink->calls));
+    mu_assert("Length", compare_int64((int64_t) expected_len, (int64_t) sink->len));
+    mu_assert("Same output", 0 == memcmp(expected, sink->data, expected_len));
+
+    free(sink);
+
+    return 0;
+}
+
+static char* buffered_writer_writes_to_fd(void)
+{
+    struct hdr_log_buffered_writer buffered;
+    struct hdr_log_reader reader;
+    struct hdr_histogram* read_histogram = NULL;
+    struct hdr_log_entry entry;
+    hdr_timespec start;
+    FILE* f = tmpfile();
+    int i;
+
+    load_histograms();
+    memset(&entry, 0, sizeof(entry));
+    hdr_gettime(&start);
+    entry.interval.tv_sec = 1;
+
+    mu_assert("Init", validate_return_code(hdr_log_buffered_writer_init_fd(&buffered, fileno(f), 4096)));
+    mu_assert("Header", validate_return_code(hdr_log_buffered_write_header(&buffered, NULL, &start)));
+    for (i = 0; i < 10; i++)
+    {
+        entry.start_timestamp.tv_sec = i;
+        mu_assert("Entry", validate_return_code(hdr_log_buffered_write_entry(&buffered, &entry, raw_histogram)));
+    }
+    mu_assert("Close", validate_return_code(hdr_log_buffered_writer_close(&buffered)));
+
+    rewind(f);
+    hdr_log_reader_init(&reader);
+    mu_assert("Read header", validate_return_code(hdr_log_read_header(&reader, f)));
+    for (i = 0; i < 10; i++)
+    {
+        hdr_timespec timestamp;
+        mu_assert("Read entry", validate_return_code(hdr_log_read(&reader, f, &read_histogram, &timestamp, NULL)));
+        mu_assert("Timestamp", compare_int64(i, timestamp.tv_sec));
+        mu_assert("Histograms do not match", compare_histogram(raw_histogram, read_histogram));
+        hdr_close(read_histogram);
+        read_histogram = NULL;
+    }
+    mu_assert("No EOF at end of file", EOF == hdr_log_read(&reader, f, &read_histogram, NULL, NULL));
+
+    hdr_log_reader_close(&reader);
+    fclose(f);
+
+    return 0;
+}
+
 static char* log_reader_aggregates_into_single_histogram(void)
 {
     const char* file_name = "histogram.log";
@@ -647,6 +1400,9 @@ static char* log_reader_aggregates_into_single_histogram(void)
     remove(file_name);
     free(histogram);
 
+    hdr_log_writer_close(&writer);
+    hdr_log_reader_close(&reader);
+
     return 0;
 }
 
@@ -676,6 +1432,8 @@ static char* log_reader_fails_with_incorrect_version(void)
     fclose(log_file);
     remove(file_name);
 
+    hdr_log_reader_close(&reader);
+
     return 0;
 }
 
@@ -716,6 +1474,97 @@ static char* test_string_encode_decode(void)
     return 0;
 }
 
+static char* test_moments_encode_decode(void)
+{
+    int i;
+    char *data, *plain_data;
+    const char* encoded;
+    size_t encoded_len;
+    struct hdr_log_encoder* encoder = NULL;
+    struct hdr_histogram *histogram, *hdr_new = NULL, *plain = NULL;
+
+    hdr_init_with_flags(1, INT64_C(3600) * 1000 * 1000, 3, HDR_HISTOGRAM_MOMENTS, &histogram);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &plain);
+
+    for (i = 1; i < 100; i++)
+    {
+        hdr_record_value(histogram, 1000000 + i);
+        hdr_record_value(plain, 1000000 + i);
+    }
+
+    /* By default the moments are left out, so any decoder can read it. */
+    mu_assert("Failed to encode histogram data", hdr_log_encode(histogram, &data) == 0);
+    mu_assert("Failed to encode plain histogram data", hdr_log_encode(plain, &plain_data) == 0);
+    mu_assert("Should encode as a plain histogram", 0 == strcmp(plain_data, data));
+    mu_assert("Failed to decode histogram data", hdr_log_decode(&hdr_new, data, strlen(data)) == 0);
+    mu_assert("Moments should not be decoded", NULL == hdr_moments(hdr_new));
+    hdr_close(hdr_new);
+    hdr_new = NULL;
+    free(plain_data);
+    free(data);
+
+    mu_assert("Unknown flag", EINVAL == hdr_log_encoder_init_with_flags(&encoder, 0x2));
+    mu_assert("Failed to init encoder", hdr_log_encoder_init_with_flags(&encoder, HDR_LOG_ENCODE_MOMENTS) == 0);
+    mu_assert("Failed to encode histogram data", hdr_log_encode_with(encoder, histogram, &encoded, &encoded_len) == 0);
+    data = (char*) encoded;
+
+    mu_assert("Failed to decode histogram data", hdr_log_decode(&hdr_new, data, encoded_len) == 0);
+    mu_assert("Histograms should be the same", compare_histogram(histogram, hdr_new));
+    mu_assert("Moments should be decoded", NULL != hdr_moments(hdr_new));
+    mu_assert("Moments should be the same", 0 == memcmp(hdr_moments(histogram), hdr_moments(hdr_new), 4 * sizeof(int64_t)));
+
+    mu_assert("Failed to accumulate histogram data", hdr_log_decode(&hdr_new, data, encoded_len) == 0);
+    mu_assert("Accumulated mean", compare_double(hdr_mean(histogram), hdr_mean(hdr_new), 1e-9));
+    mu_assert("Accumulated stddev", compare_double(hdr_stddev(histogram), hdr_stddev(hdr_new), 1e-9));
+
+    hdr_reset(plain);
+    mu_assert("Failed to decode into plain histogram", hdr_log_decode(&plain, data, encoded_len) == 0);
+    mu_assert("Plain histogram count", histogram->total_count == plain->total_count);
+    mu_assert("Plain histogram p50",
+        hdr_value_at_percentile(histogram, 50.0) == hdr_value_at_percentile(plain, 50.0));
+
+    /* Histograms without moments encode the same with the flag. */
+    mu_assert("Failed to encode plain histogram data", hdr_log_encode_with(encoder, plain, &encoded, &encoded_len) == 0);
+    mu_assert("Failed to encode plain histogram data", hdr_log_encode(plain, &plain_data) == 0);
+    mu_assert("Should encode without moments", 0 == strcmp(plain_data, encoded));
+
+    hdr_log_encoder_close(encoder);
+    hdr_close(histogram);
+    hdr_close(hdr_new);
+    hdr_close(plain);
+    free(plain_data);
+
+    return 0;
+}
+
+static char* test_moments_decode_into_narrower(void)
+{
+    const char* encoded;
+    size_t encoded_len;
+    struct hdr_log_encoder* encoder = NULL;
+    struct hdr_histogram *histogram, *narrow;
+
+    hdr_init_with_flags(1, INT64_C(3600) * 1000 * 1000, 3, HDR_HISTOGRAM_MOMENTS, &histogram);
+    hdr_init_with_flags(1, 3600000, 3, HDR_HISTOGRAM_MOMENTS, &narrow);
+    hdr_record_value(histogram, 1000);
+    hdr_record_value(histogram, INT64_C(1000000000));
+
+    mu_assert("Failed to init encoder", hdr_log_encoder_init_with_flags(&encoder, HDR_LOG_ENCODE_MOMENTS) == 0);
+    mu_assert("Failed to encode histogram data", hdr_log_encode_with(encoder, histogram, &encoded, &encoded_len) == 0);
+
+    /* The value out of range is dropped, so the exact moments do not apply. */
+    mu_assert("Failed to decode histogram data", hdr_log_decode(&narrow, (char*) encoded, encoded_len) == 0);
+    mu_assert("Should drop the value out of range", compare_int64(1, narrow->total_count));
+    mu_assert("Mean of the values kept", compare_double(1000.0, hdr_mean(narrow), 1e-9));
+    mu_assert("Stddev of the values kept", compare_double(0.0, hdr_stddev(narrow), 1e-9));
+
+    hdr_log_encoder_close(encoder);
+    hdr_close(histogram);
+    hdr_close(narrow);
+
+    return 0;
+}
+
 static char* test_string_encode_decode_2(void)
 {
     int i;
@@ -784,6 +1633,8 @@ static char* decode_v1_log(void)
     mu_assert("Seconds wrong", compare_int64(1438867590, reader.start_timestamp.tv_sec));
     mu_assert("Nanoseconds wrong", compare_int64(285000000, reader.start_timestamp.tv_nsec));
 
+    hdr_log_reader_close(&reader);
+
     return 0;
 }
 
@@ -831,6 +1682,8 @@ static char* decode_v2_log(void)
     mu_assert("Seconds wrong", compare_int64(1441812279, reader.start_timestamp.tv_sec));
     mu_assert("Nanoseconds wrong", compare_int64(474000000, reader.start_timestamp.tv_nsec));
 
+    hdr_log_reader_close(&reader);
+
     return 0;
 }
 
@@ -881,6 +1734,8 @@ static char* decode_v3_log(void)
     mu_assert("Seconds wrong", compare_int64(1441812279, reader.start_timestamp.tv_sec));
     mu_assert("Nanoseconds wrong", compare_int64(474000000, reader.start_timestamp.tv_nsec));
 
+    hdr_log_reader_close(&reader);
+
     return 0;
 }
 
@@ -956,6 +1811,8 @@ static char* decode_v0_log(void)
     mu_assert("Seconds wrong", compare_int64(1438869961, reader.start_timestamp.tv_sec));
     mu_assert("Nanoseconds wrong", compare_int64(225000000, reader.start_timestamp.tv_nsec));
 
+    hdr_log_reader_close(&reader);
+
     return 0;
 }
 
@@ -967,13 +1824,27 @@ static struct mu_result all_tests(void)
     mu_run_test(test_encode_and_decode_compressed);
     mu_run_test(test_encode_and_decode_compressed2);
     mu_run_test(test_encode_and_decode_compressed_large);
+    mu_run_test(test_encoder_reuses_state_across_histograms);
+    mu_run_test(test_encoder_fails_when_buffer_too_small);
+    mu_run_test(test_encoder_writes_to_sink);
+    mu_run_test(test_encode_with_and_decode_with_reuse_contexts);
     mu_run_test(test_encode_and_decode_base64);
     mu_run_test(test_bounds_check_on_decode);
+    mu_run_test(test_encode_and_decode_lazy_min_max);
+    mu_run_test(test_decode_accumulates_same_config);
+    mu_run_test(test_decode_accumulates_different_config);
+
+    mu_run_test(zig_zag_bulk_decode_matches_scalar);
+    mu_run_test(zig_zag_bulk_decode_stops_before_truncated_value);
+    mu_run_test(zig_zag_encode_counts_matches_scalar);
+    mu_run_test(zig_zag_codecs_handle_runs_of_small_counts);
 
     mu_run_test(base64_decode_block_decodes_4_chars);
     mu_run_test(base64_decode_fails_with_invalid_lengths);
     mu_run_test(base64_decode_decodes_strings_without_padding);
     mu_run_test(base64_decode_decodes_strings_with_padding);
+    mu_run_test(base64_decode_fails_with_invalid_characters);
+    mu_run_test(base64_round_trips_all_lengths);
 
     mu_run_test(base64_encode_block_encodes_3_bytes);
     mu_run_test(base64_encode_fails_with_invalid_lengths);
@@ -981,11 +1852,18 @@ static struct mu_result all_tests(void)
     mu_run_test(base64_encode_encodes_with_padding);
 
     mu_run_test(writes_and_reads_log);
+    mu_run_test(writes_and_reads_log_with_encoder_and_decoder);
+    mu_run_test(parses_and_formats_timestamps);
+    mu_run_test(timestamps_round_trip_to_nanoseconds);
+    mu_run_test(buffered_writer_matches_write_entry);
+    mu_run_test(buffered_writer_writes_to_fd);
     mu_run_test(log_reader_aggregates_into_single_histogram);
     mu_run_test(log_reader_fails_with_incorrect_version);
 
     mu_run_test(test_string_encode_decode);
     mu_run_test(test_string_encode_decode_2);
+    mu_run_test(test_moments_encode_decode);
+    mu_run_test(test_moments_decode_into_narrower);
 
     mu_run_test(decode_v3_log);
     mu_run_test(decode_v2_log);
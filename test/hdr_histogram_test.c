@@ -8,6 +8,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <math.h>
 
 #include <stdio.h>
 #include <hdr/hdr_histogram.h>
@@ -417,6 +419,685 @@ static char* test_reset(void)
     return 0;
 }
 
+static char* test_lazy_min_max(void)
+{
+    struct hdr_histogram* eager;
+    struct hdr_histogram* lazy;
+    int64_t value;
+    int i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &eager);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &lazy);
+
+    mu_assert("Empty min", compare_int64(hdr_min(eager), hdr_min(lazy)));
+    mu_assert("Empty max", compare_int64(hdr_max(eager), hdr_max(lazy)));
+
+    for (i = 0; i < 10000; i++)
+    {
+        value = 3 + ((int64_t) i * 7919 * 7919) % INT64_C(3600000000);
+        hdr_record_value(eager, value);
+        if (i % 2)
+        {
+            hdr_record_value(lazy, value);
+        }
+        else
+        {
+            hdr_record_value_atomic(lazy, value);
+        }
+    }
+
+    mu_assert("Total", compare_int64(eager->total_count, lazy->total_count));
+    mu_assert("Min", compare_int64(hdr_min(eager), hdr_min(lazy)));
+    mu_assert("Max", compare_int64(hdr_max(eager), hdr_max(lazy)));
+    mu_assert("Lazy min_value untouched", compare_int64(INT64_MAX, lazy->min_value));
+    mu_assert("Lazy max_value untouched", compare_int64(0, lazy->max_value));
+    mu_assert("p99", compare_int64(hdr_value_at_percentile(eager, 99.0), hdr_value_at_percentile(lazy, 99.0)));
+
+    hdr_record_value(eager, 0);
+    hdr_record_value(lazy, 0);
+    mu_assert("Min with zero", compare_int64(0, hdr_min(lazy)));
+
+    hdr_reset(lazy);
+    mu_assert("Reset min", compare_int64(INT64_MAX, hdr_min(lazy)));
+    mu_assert("Reset max", compare_int64(0, hdr_max(lazy)));
+
+    hdr_record_value(lazy, 1000);
+    mu_assert("Min after reset", compare_int64(1000, hdr_min(lazy)));
+    mu_assert("Max after reset", hdr_values_are_equivalent(lazy, 1000, hdr_max(lazy)));
+
+    hdr_close(eager);
+    hdr_close(lazy);
+
+    return 0;
+}
+
+static char* test_runs_match_iterator(void)
+{
+    struct hdr_iter expected;
+    struct hdr_iter iter;
+    struct hdr_iter_run runs[7];
+    size_t runs_len;
+    size_t i;
+    int recorded = 0;
+    int buckets = 0;
+
+    load_histograms();
+
+    hdr_iter_recorded_init(&expected, cor_histogram);
+    hdr_iter_recorded_init(&iter, cor_histogram);
+    while ((runs_len = hdr_iter_recorded_runs(&iter, runs, 7)) > 0)
+    {
+        for (i = 0; i < runs_len; i++)
+        {
+            mu_assert("Fewer recorded values", hdr_iter_next(&expected));
+            mu_assert("Lowest", compare_int64(expected.lowest_equivalent_value, runs[i].lowest_value));
+            mu_assert("Highest", compare_int64(expected.highest_equivalent_value, runs[i].highest_value));
+            mu_assert("Count", compare_int64(expected.count, runs[i].count));
+            recorded++;
+        }
+    }
+    mu_assert("More recorded values", !hdr_iter_next(&expected));
+    mu_assert("Recorded some values", 1 < recorded);
+
+    hdr_iter_log_init(&expected, cor_histogram, 10000, 2.0);
+    hdr_iter_log_init(&iter, cor_histogram, 10000, 2.0);
+    while ((runs_len = hdr_iter_log_runs(&iter, runs, 7)) > 0)
+    {
+        for (i = 0; i < runs_len; i++)
+        {
+            mu_assert("Fewer log buckets", hdr_iter_next(&expected));
+            mu_assert("From", compare_int64(expected.value_iterated_from, runs[i].lowest_value));
+            mu_assert("To", compare_int64(expected.value_iterated_to, runs[i].highest_value));
+            mu_assert(
+                "Added", compare_int64(expected.specifics.log.count_added_in_this_iteration_step, runs[i].count));
+            buckets++;
+        }
+    }
+    mu_assert("More log buckets", !hdr_iter_next(&expected));
+    mu_assert("Log buckets", compare_int64(15, buckets));
+
+    return 0;
+}
+
+static int64_t value_at_percentile_by_iteration(struct hdr_histogram* h, double percentile)
+{
+    struct hdr_iter iter;
+    int64_t count_at_percentile = (int64_t) (((percentile / 100) * h->total_count) + 0.5);
+
+    count_at_percentile = 0 < count_at_percentile ? count_at_percentile : 1;
+    hdr_iter_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        if (iter.cumulative_count >= count_at_percentile)
+        {
+            return iter.highest_equivalent_value;
+        }
+    }
+
+    return 0;
+}
+
+static char* test_moments(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* other;
+    struct hdr_histogram* plain;
+    const int64_t* moments;
+    double sum = 0.0;
+    double mean, squared_deviation = 0.0;
+    int64_t value;
+    int i;
+
+    mu_assert("Moments flag accepted",
+        0 == hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_MOMENTS | HDR_HISTOGRAM_LAZY_MIN_MAX, &h));
+    hdr_init_with_flags(1, INT64_C(3600000000), 2, HDR_HISTOGRAM_MOMENTS | HDR_HISTOGRAM_CACHE_ALIGNED, &other);
+    hdr_init(1, INT64_C(3600000000), 3, &plain);
+
+    mu_assert("Only moments histograms have moments", NULL == hdr_moments(plain));
+
+    for (i = 0; i < 10000; i++)
+    {
+        value = 1000003 + ((int64_t) i * 7919) % 1000;
+        sum += (double) value;
+        if (i % 2)
+        {
+            hdr_record_value(h, value);
+        }
+        else
+        {
+            hdr_record_value_atomic(h, value);
+        }
+    }
+
+    mean = sum / 10000;
+    for (i = 0; i < 10000; i++)
+    {
+        double deviation = (double) (1000003 + ((int64_t) i * 7919) % 1000) - mean;
+        squared_deviation += deviation * deviation;
+    }
+
+    /* Buckets at this magnitude are 512 wide, far coarser than the spread. */
+    mu_assert("Exact mean", compare_double(mean, hdr_mean(h), 1e-6));
+    mu_assert("Exact stddev", compare_double(sqrt(squared_deviation / 10000), hdr_stddev(h), 1e-6));
+
+    /* Sum of squares beyond 64 bits. */
+    hdr_record_values(other, INT64_C(3000000000), INT64_C(1000000000));
+    hdr_record_values_atomic(other, INT64_C(1000000000), INT64_C(1000000000));
+    moments = hdr_moments(other);
+    mu_assert("Sum high word", compare_int64(0, moments[1]));
+    mu_assert("Sum of squares high word", compare_int64(542101086, moments[3]));
+    mu_assert("Large mean", compare_double(2e9, hdr_mean(other), 1e-3));
+    mu_assert("Large stddev", compare_double(1e9, hdr_stddev(other), 1e-3));
+
+    hdr_reset(other);
+    moments = hdr_moments(other);
+    mu_assert("Reset moments", 0 == moments[0] && 0 == moments[1] && 0 == moments[2] && 0 == moments[3]);
+
+    /* Different layout, and no moments from the plain histogram. */
+    hdr_add(other, h);
+    mu_assert("Added exact mean", compare_double(mean, hdr_mean(other), 1e-6));
+
+    hdr_record_value(plain, 1000);
+    hdr_add(other, plain);
+    mu_assert("Added median equivalent",
+        compare_double((sum + (double) hdr_median_equivalent_value(plain, 1000)) / 10001, hdr_mean(other), 1e-6));
+
+    hdr_close(h);
+    hdr_close(other);
+    hdr_close(plain);
+
+    /* Values dropped by the add take no part in the moments. */
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_MOMENTS, &h);
+    hdr_init_with_flags(1, 3600000, 3, HDR_HISTOGRAM_MOMENTS, &other);
+    hdr_record_value(h, 1000);
+    hdr_record_value(h, INT64_C(1000000000));
+    mu_assert("Should drop the value out of range", compare_int64(1, hdr_add(other, h)));
+    mu_assert("Mean of the values kept", compare_double(1000.0, hdr_mean(other), 1e-9));
+    mu_assert("Stddev of the values kept", compare_double(0.0, hdr_stddev(other), 1e-9));
+
+    hdr_close(h);
+    hdr_close(other);
+
+    return 0;
+}
+
+static char* test_tail_percentiles_match_iteration(void)
+{
+    const double percentiles[] = { 0.1, 25.0, 50.0, 50.001, 75.0, 90.0, 99.0, 99.9, 99.99, 99.999, 100.0 };
+    struct hdr_histogram* eager;
+    struct hdr_histogram* lazy;
+    size_t i;
+    int j;
+
+    hdr_init(1, INT64_C(3600000000), 3, &eager);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &lazy);
+
+    for (j = 0; j < 5000; j++)
+    {
+        int64_t value = 1 + ((int64_t) j * 7919 * 7919) % INT64_C(3600000);
+        int64_t count = 1 + j % 7;
+
+        hdr_record_values(eager, value, count);
+        hdr_record_values(lazy, value, count);
+    }
+
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        int64_t expected = value_at_percentile_by_iteration(eager, percentiles[i]);
+
+        mu_assert("Eager", compare_int64(expected, hdr_value_at_percentile(eager, percentiles[i])));
+        mu_assert("Lazy", compare_int64(expected, hdr_value_at_percentile(lazy, percentiles[i])));
+    }
+
+    hdr_reset(eager);
+    hdr_record_value(eager, 0);
+    mu_assert("Only zeros", compare_int64(0, hdr_value_at_percentile(eager, 99.0)));
+
+    hdr_close(eager);
+    hdr_close(lazy);
+
+    return 0;
+}
+
+static int64_t count_between_by_iteration(struct hdr_histogram* h, int64_t lowest_value, int64_t highest_value)
+{
+    struct hdr_iter iter;
+    int64_t total = 0;
+
+    hdr_iter_recorded_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        if (hdr_lowest_equivalent_value(h, lowest_value) <= iter.value && iter.value <= highest_value)
+        {
+            total += iter.count;
+        }
+    }
+
+    return total;
+}
+
+/* The highest value equivalent to value, -1 for negative values, which */
+/* hdr_next_non_equivalent_value does not take.                         */
+static int64_t highest_equivalent_or_negative(struct hdr_histogram* h, int64_t value)
+{
+    return value < 0 ? -1 : hdr_next_non_equivalent_value(h, value) - 1;
+}
+
+static char* test_count_between_and_at_or_below_values(void)
+{
+    const int64_t values[] = { -1, 0, 1, 1000, 2047, 2048, 123456, 1800000, 3599999, 3600000, INT64_C(3600000000) };
+    const size_t values_len = sizeof(values) / sizeof(values[0]);
+    struct hdr_histogram* eager;
+    struct hdr_histogram* lazy;
+    size_t i;
+    size_t j;
+    int k;
+
+    hdr_init(1, INT64_C(3600000000), 3, &eager);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &lazy);
+
+    mu_assert("Empty", compare_int64(0, hdr_count_le_value(eager, 1000)));
+    mu_assert("Empty percentile", compare_double(100.0, hdr_percentile_at_or_below_value(lazy, 1000), 1e-9));
+
+    for (k = 0; k < 5000; k++)
+    {
+        int64_t value = ((int64_t) k * 7919 * 7919) % INT64_C(3600000);
+
+        hdr_record_values(eager, value, 1 + k % 3);
+        hdr_record_values(lazy, value, 1 + k % 3);
+    }
+
+    for (i = 0; i < values_len; i++)
+    {
+        int64_t highest = highest_equivalent_or_negative(eager, values[i]);
+        int64_t expected = count_between_by_iteration(eager, 0, highest);
+
+        mu_assert("Count at or below", compare_int64(expected, hdr_count_le_value(eager, values[i])));
+        mu_assert("Count at or below lazy", compare_int64(expected, hdr_count_le_value(lazy, values[i])));
+        mu_assert(
+            "Percentile at or below",
+            compare_double(100.0 * expected / eager->total_count, hdr_percentile_at_or_below_value(eager, values[i]), 1e-9));
+
+        for (j = i; j < values_len; j++)
+        {
+            int64_t to = highest_equivalent_or_negative(eager, values[j]);
+            expected = count_between_by_iteration(eager, values[i] < 0 ? 0 : values[i], to);
+
+            mu_assert("Count between", compare_int64(expected, hdr_count_between_values(eager, values[i], values[j])));
+        }
+    }
+
+    mu_assert("Inverse of value at percentile", 99.0 <= hdr_percentile_at_or_below_value(
+        eager, hdr_value_at_percentile(eager, 99.0)));
+    mu_assert("Everything", compare_int64(eager->total_count, hdr_count_between_values(eager, 0, INT64_MAX)));
+    mu_assert("Inverted range", compare_int64(0, hdr_count_between_values(eager, 1000, 10)));
+
+    hdr_close(eager);
+    hdr_close(lazy);
+
+    /* Only the upper end of a range is clamped to the top bucket. */
+    hdr_init(1, 3600000, 3, &eager);
+    hdr_record_value(eager, hdr_value_at_index(eager, eager->counts_len - 1));
+    mu_assert(
+        "Above range",
+        compare_int64(0, hdr_count_between_values(eager, INT64_C(10000000000), INT64_C(20000000000))));
+    mu_assert("Into above range", compare_int64(1, hdr_count_between_values(eager, 3600000, INT64_C(20000000000))));
+    mu_assert("Above range at or below", compare_int64(1, hdr_count_le_value(eager, INT64_C(20000000000))));
+    hdr_close(eager);
+
+    return 0;
+}
+
+static size_t print_to_buffer(struct hdr_histogram* h, format_type format, char* buffer, size_t len)
+{
+    FILE* f = tmpfile();
+    size_t read_len;
+
+    hdr_percentiles_print(h, f, 5, 1000.0, format);
+    rewind(f);
+    read_len = fread(buffer, 1, len - 1, f);
+    buffer[read_len] = '\0';
+    fclose(f);
+
+    return read_len;
+}
+
+static char* test_percentiles_print_formats(void)
+{
+    static char classic[65536];
+    static char csv[65536];
+    static char json[65536];
+    char expected[256];
+    const char* json_footer;
+
+    load_histograms();
+
+    mu_assert("Classic", 0 < print_to_buffer(cor_histogram, CLASSIC, classic, sizeof(classic)));
+    mu_assert("CSV", 0 < print_to_buffer(cor_histogram, CSV, csv, sizeof(csv)));
+    mu_assert("JSON", 0 < print_to_buffer(cor_histogram, JSON, json, sizeof(json)));
+
+    snprintf(
+        expected, sizeof(expected), "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+        hdr_mean(cor_histogram) / 1000.0, hdr_stddev(cor_histogram) / 1000.0);
+    mu_assert("Classic mean and stddev", NULL != strstr(classic, expected));
+
+    mu_assert("CSV header", 0 == strncmp(csv, "Value,Percentile,TotalCount,1/(1-Percentile)\n", 45));
+    mu_assert("CSV last line", NULL != strstr(csv, ",1.000000,20000,inf\n"));
+
+    mu_assert("JSON start", 0 == strncmp(json, "{\"percentiles\":[\n{\"value\":", 26));
+    mu_assert("JSON last percentile", NULL != strstr(json, "\"percentile\":1.000000,\"total_count\":20000,\"inverted_percentile\":null}\n]"));
+    json_footer = strstr(json, "\n],");
+    mu_assert("JSON footer", NULL != json_footer);
+    snprintf(
+        expected, sizeof(expected), "\n],\"mean\":%.3f,\"std_deviation\":%.3f,\"max\":%.3f,\"total_count\":20000,",
+        hdr_mean(cor_histogram) / 1000.0, hdr_stddev(cor_histogram) / 1000.0, hdr_max(cor_histogram) / 1000.0);
+    mu_assert("JSON summary", 0 == strncmp(json_footer, expected, strlen(expected)));
+    mu_assert("JSON end", 0 == strcmp(json + strlen(json) - 2, "}\n"));
+
+    return 0;
+}
+
+static char* test_percentiles_print_exact_moments(void)
+{
+    static char classic[65536];
+    char expected[256];
+    struct hdr_histogram* h;
+    int64_t i;
+
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_MOMENTS, &h);
+    for (i = 1; i < 100; i++)
+    {
+        hdr_record_value(h, 1000000 + i);
+    }
+
+    /* The values share a bucket whose median is far from their mean. */
+    mu_assert("Classic", 0 < print_to_buffer(h, CLASSIC, classic, sizeof(classic)));
+    snprintf(
+        expected, sizeof(expected), "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+        1000050 / 1000.0, hdr_stddev(h) / 1000.0);
+    mu_assert("Exact mean and stddev", NULL != strstr(classic, expected));
+    mu_assert("Exact stddev", compare_double(28.577, hdr_stddev(h), 0.001));
+
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_iter_equivalent_ranges_match_values(void)
+{
+    const int64_t lowest[] = { 1, 1, 1000, 1 };
+    const int64_t highest[] = { INT64_C(3600000000), INT64_C(3600000000), INT64_C(3600000000000), INT64_MAX / 2 };
+    const int significant_figures[] = { 3, 1, 2, 5 };
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        struct hdr_histogram* h;
+        struct hdr_iter iter;
+        int32_t index = 0;
+
+        hdr_init(lowest[i], highest[i], significant_figures[i], &h);
+        hdr_iter_init(&iter, h);
+
+        while (hdr_iter_next(&iter))
+        {
+            int64_t value = hdr_value_at_index(h, index);
+
+            mu_assert("Index", compare_int64(index, iter.counts_index));
+            mu_assert("Value", compare_int64(value, iter.value));
+            mu_assert("Lowest", compare_int64(hdr_lowest_equivalent_value(h, value), iter.lowest_equivalent_value));
+            mu_assert(
+                "Highest", compare_int64(hdr_next_non_equivalent_value(h, value) - 1, iter.highest_equivalent_value));
+            mu_assert("Median", compare_int64(hdr_median_equivalent_value(h, value), iter.median_equivalent_value));
+            index++;
+        }
+
+        mu_assert("Visited every index", compare_int64(h->counts_len, index));
+        hdr_close(h);
+    }
+
+    return 0;
+}
+
+static char* test_add_with_same_layout(void)
+{
+    struct hdr_histogram* a;
+    struct hdr_histogram* b;
+    struct hdr_histogram* zeros;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* eager;
+    struct hdr_histogram* lazy;
+    int64_t value;
+    int i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &a);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &b);
+    hdr_init(1, INT64_C(3600000000), 3, &zeros);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+    hdr_init(1, INT64_C(3600000000), 3, &eager);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &lazy);
+
+    for (i = 0; i < 10000; i++)
+    {
+        value = 3 + ((int64_t) i * 7919 * 7919) % INT64_C(3600000000);
+        hdr_record_value(i % 2 ? a : b, value);
+        hdr_record_value(expected, value);
+    }
+    hdr_record_value(zeros, 0);
+    hdr_record_value(expected, 0);
+
+    mu_assert("Nothing dropped", compare_int64(0, hdr_add(eager, a) + hdr_add(eager, b) + hdr_add(eager, zeros)));
+    mu_assert("Nothing dropped lazy", compare_int64(0, hdr_add(lazy, zeros) + hdr_add(lazy, a) + hdr_add(lazy, b)));
+
+    mu_assert("Total", compare_int64(expected->total_count, eager->total_count));
+    mu_assert("Min", compare_int64(hdr_min(expected), hdr_min(eager)));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(eager)));
+    mu_assert("Lazy total", compare_int64(expected->total_count, lazy->total_count));
+    mu_assert("Lazy min", compare_int64(0, hdr_min(lazy)));
+    mu_assert("Lazy max", compare_int64(hdr_max(expected), hdr_max(lazy)));
+    mu_assert(
+        "p99.9", compare_int64(hdr_value_at_percentile(expected, 99.9), hdr_value_at_percentile(eager, 99.9)));
+    mu_assert(
+        "Lazy p50", compare_int64(hdr_value_at_percentile(expected, 50.0), hdr_value_at_percentile(lazy, 50.0)));
+
+    hdr_close(a);
+    hdr_close(b);
+    hdr_close(zeros);
+    hdr_close(expected);
+    hdr_close(eager);
+    hdr_close(lazy);
+
+    return 0;
+}
+
+static char* test_downsample(void)
+{
+    const int64_t lowest[] = { 1000, 1, 1000000, 64 };
+    const int significant_figures[] = { 2, 1, 1, 3 };
+    struct hdr_histogram* fine;
+    struct hdr_histogram* lazy;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* coarse;
+    struct hdr_histogram* coarse_lazy;
+    int64_t value;
+    int64_t dropped = 0;
+    int c, i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &fine);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, HDR_HISTOGRAM_LAZY_MIN_MAX, &lazy);
+
+    for (i = 0; i < 10000; i++)
+    {
+        value = 3 + ((int64_t) i * 7919 * 7919) % INT64_C(3600000000);
+        hdr_record_value(fine, value);
+        hdr_record_value(lazy, value);
+    }
+
+    for (c = 0; c < 4; c++)
+    {
+        hdr_init(lowest[c], INT64_C(3600000000), significant_figures[c], &expected);
+        for (i = 0; i < 10000; i++)
+        {
+            hdr_record_value(expected, 3 + ((int64_t) i * 7919 * 7919) % INT64_C(3600000000));
+        }
+
+        mu_assert("Downsample",
+            0 == hdr_downsample(fine, lowest[c], INT64_C(3600000000), significant_figures[c], &coarse));
+        mu_assert("Downsample lazy",
+            0 == hdr_downsample(lazy, lowest[c], INT64_C(3600000000), significant_figures[c], &coarse_lazy));
+
+        for (i = 0; i < expected->counts_len; i++)
+        {
+            mu_assert("Counts", compare_int64(hdr_count_at_index(expected, i), hdr_count_at_index(coarse, i)));
+            mu_assert("Lazy counts",
+                compare_int64(hdr_count_at_index(expected, i), hdr_count_at_index(coarse_lazy, i)));
+        }
+        mu_assert("Total", compare_int64(expected->total_count, coarse->total_count));
+        mu_assert("Min", compare_int64(hdr_min(expected), hdr_min(coarse)));
+        mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(coarse)));
+        mu_assert("Lazy min", compare_int64(hdr_min(expected), hdr_min(coarse_lazy)));
+        mu_assert("Lazy max", compare_int64(hdr_max(expected), hdr_max(coarse_lazy)));
+
+        hdr_close(expected);
+        hdr_close(coarse);
+        hdr_close(coarse_lazy);
+    }
+
+    mu_assert("Invalid configuration", EINVAL == hdr_downsample(fine, 1000, INT64_C(3600000000), 6, &coarse));
+
+    /* A shorter range drops the values above it. */
+    hdr_init(1, INT64_C(1000000000), 1, &expected);
+    hdr_init(1, INT64_C(1000000000), 1, &coarse);
+    for (i = 0; i < 10000; i++)
+    {
+        if (!hdr_record_value(expected, 3 + ((int64_t) i * 7919 * 7919) % INT64_C(3600000000)))
+        {
+            dropped++;
+        }
+    }
+
+    mu_assert("Dropped", compare_int64(dropped, hdr_add(coarse, fine)));
+    for (i = 0; i < expected->counts_len; i++)
+    {
+        mu_assert("Short counts", compare_int64(hdr_count_at_index(expected, i), hdr_count_at_index(coarse, i)));
+    }
+    mu_assert("Short total", compare_int64(expected->total_count, coarse->total_count));
+    mu_assert("Short max", compare_int64(hdr_max(expected), hdr_max(coarse)));
+
+    hdr_close(fine);
+    hdr_close(lazy);
+    hdr_close(expected);
+    hdr_close(coarse);
+
+    return 0;
+}
+
+static void run_tasks_in_reverse(void* pool, void (*task)(void*, int32_t), void* task_arg, int32_t tasks)
+{
+    int32_t i;
+
+    *(int32_t*) pool = tasks;
+    for (i = tasks - 1; i >= 0; i--)
+    {
+        task(task_arg, i);
+    }
+}
+
+static char* add_many_and_compare(uint32_t flags, struct hdr_add_many_options* options)
+{
+    struct hdr_histogram* inputs[40];
+    struct hdr_histogram* expected;
+    struct hdr_histogram* actual;
+    int64_t expected_dropped = 0;
+    int64_t dropped;
+    int i, j;
+
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, flags, &expected);
+    hdr_init_with_flags(1, INT64_C(3600000000), 3, flags, &actual);
+
+    /* Mostly the layout of the target, some of two others and one that */
+    /* covers a wider range than the target.                              */
+    for (i = 0; i < 40; i++)
+    {
+        if (i % 10 == 3)
+        {
+            hdr_init(1, INT64_C(3600000000), 2, &inputs[i]);
+        }
+        else if (i == 17)
+        {
+            hdr_init(1, INT64_C(7200000000), 3, &inputs[i]);
+        }
+        else
+        {
+            hdr_init_with_flags(
+                1, INT64_C(3600000000), 3, i % 4 == 1 ? HDR_HISTOGRAM_LAZY_MIN_MAX : HDR_HISTOGRAM_MOMENTS, &inputs[i]);
+        }
+
+        for (j = 0; j < 500; j++)
+        {
+            hdr_record_value(inputs[i], 1 + ((int64_t) (i * 500 + j) * 7919 * 7919) % INT64_C(3600000000));
+        }
+    }
+    hdr_record_value(inputs[17], INT64_C(7000000000));
+
+    for (i = 0; i < 40; i++)
+    {
+        expected_dropped += hdr_add(expected, inputs[i]);
+    }
+    mu_assert("Expected a drop", compare_int64(1, expected_dropped));
+
+    dropped = hdr_add_many(actual, (const struct hdr_histogram* const*) inputs, 40, options);
+
+    mu_assert("Dropped", compare_int64(expected_dropped, dropped));
+    mu_assert("Total", compare_int64(expected->total_count, actual->total_count));
+    mu_assert("Min", compare_int64(hdr_min(expected), hdr_min(actual)));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(actual)));
+    for (i = 0; i < expected->counts_len; i++)
+    {
+        mu_assert("Counts", compare_int64(hdr_count_at_index(expected, i), hdr_count_at_index(actual, i)));
+    }
+    mu_assert("Mean", compare_double(hdr_mean(expected), hdr_mean(actual), 1e-6));
+
+    for (i = 0; i < 40; i++)
+    {
+        hdr_close(inputs[i]);
+    }
+    hdr_close(expected);
+    hdr_close(actual);
+
+    return 0;
+}
+
+static char* test_add_many(void)
+{
+    struct hdr_add_many_options options;
+    int32_t tasks = 0;
+    char* result;
+
+    if ((result = add_many_and_compare(0, NULL)) != NULL)
+    {
+        return result;
+    }
+
+    hdr_add_many_options_init(&options);
+    options.threads = 4;
+    if ((result = add_many_and_compare(HDR_HISTOGRAM_LAZY_MIN_MAX, &options)) != NULL ||
+        (result = add_many_and_compare(HDR_HISTOGRAM_MOMENTS, &options)) != NULL)
+    {
+        return result;
+    }
+
+    options.run_tasks = run_tasks_in_reverse;
+    options.pool = &tasks;
+    if ((result = add_many_and_compare(0, &options)) != NULL)
+    {
+        return result;
+    }
+    mu_assert("Executor used", 1 < tasks);
+
+    return 0;
+}
+
 static char* test_scaling_equivalence(void)
 {
     int64_t expected_99th, scaled_99th;
@@ -576,6 +1257,17 @@ static struct mu_result all_tests(void)
     mu_run_test(test_linear_values);
     mu_run_test(test_logarithmic_values);
     mu_run_test(test_reset);
+    mu_run_test(test_lazy_min_max);
+    mu_run_test(test_moments);
+    mu_run_test(test_tail_percentiles_match_iteration);
+    mu_run_test(test_percentiles_print_formats);
+    mu_run_test(test_percentiles_print_exact_moments);
+    mu_run_test(test_count_between_and_at_or_below_values);
+    mu_run_test(test_iter_equivalent_ranges_match_values);
+    mu_run_test(test_runs_match_iterator);
+    mu_run_test(test_add_with_same_layout);
+    mu_run_test(test_downsample);
+    mu_run_test(test_add_many);
     mu_run_test(test_scaling_equivalence);
     mu_run_test(test_out_of_range_values);
     mu_run_test(test_linear_iter_buckets_correctly);
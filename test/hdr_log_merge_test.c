@@ -0,0 +1,259 @@
+/**
+ * hdr_log_merge_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_log_merge.h>
+
+#include "minunit.h"
+#include "hdr_test_util.h"
+
+int tests_run = 0;
+
+#define INPUT_COUNT 5
+#define ENTRIES_PER_INPUT 30
+#define BUCKET_COUNT 8
+
+static const int64_t highest_trackable_value = INT64_C(24) * 60 * 60 * 1000000;
+
+/* Input i starts at 1000 + i seconds and logs an entry every 2.5 seconds */
+/* holding the value 100 * (i + 1), recorded j + 1 times.  Odd inputs log */
+/* offsets from their StartTime, even inputs log absolute timestamps.     */
+static FILE* write_input(int i, struct hdr_histogram* expected[BUCKET_COUNT])
+{
+    struct hdr_log_writer writer;
+    struct hdr_histogram* h;
+    hdr_timespec start;
+    FILE* f = tmpfile();
+    int64_t log_start = (int64_t) (1000 + i) * 1000;
+    int j;
+
+    hdr_init(1, highest_trackable_value, 3, &h);
+    hdr_log_writer_init_with_encoder(&writer);
+
+    start.tv_sec = (time_t) (log_start / 1000);
+    start.tv_nsec = 0;
+    hdr_log_write_header(&writer, f, NULL, &start);
+
+    for (j = 0; j < ENTRIES_PER_INPUT; j++)
+    {
+        struct hdr_log_entry entry;
+        int64_t offset = (int64_t) j * 2500;
+        int64_t timestamp = 0 == i % 2 ? log_start + offset : offset;
+        int64_t bucket = (log_start + offset - 1000000) / 10000;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.start_timestamp.tv_sec = (time_t) (timestamp / 1000);
+        entry.start_timestamp.tv_nsec = (long) ((timestamp % 1000) * 1000000);
+        entry.interval.tv_sec = 2;
+        entry.interval.tv_nsec = 500000000;
+
+        hdr_reset(h);
+        hdr_record_values(h, 100 * (i + 1), j + 1);
+        hdr_log_write_entry(&writer, f, &entry, h);
+        hdr_record_values(expected[bucket], 100 * (i + 1), j + 1);
+    }
+
+    hdr_log_writer_close(&writer);
+    hdr_close(h);
+    rewind(f);
+
+    return f;
+}
+
+static char* merge_and_compare(int threads, int buckets_per_round)
+{
+    struct hdr_log_merge_options options;
+    struct hdr_histogram* expected[BUCKET_COUNT];
+    struct hdr_log_reader reader;
+    FILE* inputs[INPUT_COUNT];
+    FILE* output = tmpfile();
+    int64_t dropped = -1;
+    int bucket = 0;
+    int i;
+
+    for (i = 0; i < BUCKET_COUNT; i++)
+    {
+        hdr_init(1, highest_trackable_value, 3, &expected[i]);
+    }
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        inputs[i] = write_input(i, expected);
+    }
+
+    hdr_log_merge_options_init(&options);
+    options.interval.tv_sec = 10;
+    options.threads = threads;
+    options.buckets_per_round = buckets_per_round;
+
+    mu_assert("Merge", 0 == hdr_log_merge(inputs, INPUT_COUNT, output, &options, &dropped));
+    mu_assert("Dropped", compare_int64(0, dropped));
+    rewind(output);
+
+    hdr_log_reader_init_with_decoder(&reader);
+    mu_assert("Header", 0 == hdr_log_read_header(&reader, output));
+    mu_assert("Origin", compare_int64(1000, reader.start_timestamp.tv_sec));
+
+    while (true)
+    {
+        struct hdr_log_entry entry;
+        struct hdr_histogram* actual = NULL;
+        char* result;
+        int rc;
+
+        memset(&entry, 0, sizeof(entry));
+        rc = hdr_log_read_entry(&reader, output, &entry, &actual);
+        if (EOF == rc)
+        {
+            break;
+        }
+
+        mu_assert("Read entry", 0 == rc);
+        mu_assert("Too many entries", bucket < BUCKET_COUNT);
+        mu_assert("Bucket start", compare_int64(bucket * 10, entry.start_timestamp.tv_sec));
+        mu_assert("Bucket interval", compare_int64(10, entry.interval.tv_sec));
+
+        result = compare_histograms(expected[bucket], actual);
+        hdr_close(actual);
+        if (result)
+        {
+            return result;
+        }
+
+        bucket++;
+    }
+
+    mu_assert("Entry count", compare_int64(BUCKET_COUNT, bucket));
+
+    hdr_log_reader_close(&reader);
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        fclose(inputs[i]);
+    }
+    for (i = 0; i < BUCKET_COUNT; i++)
+    {
+        hdr_close(expected[i]);
+    }
+    fclose(output);
+
+    return 0;
+}
+
+static char* test_merge_single_thread(void)
+{
+    return merge_and_compare(1, 64);
+}
+
+static char* test_merge_with_workers_over_many_rounds(void)
+{
+    return merge_and_compare(3, 2);
+}
+
+static char* test_merge_with_more_threads_than_inputs(void)
+{
+    return merge_and_compare(16, 3);
+}
+
+static char* test_invalid_options(void)
+{
+    struct hdr_log_merge_options options;
+    FILE* output = tmpfile();
+
+    hdr_log_merge_options_init(&options);
+    options.threads = 0;
+    mu_assert("No threads", EINVAL == hdr_log_merge(NULL, 0, output, &options, NULL));
+
+    hdr_log_merge_options_init(&options);
+    options.interval.tv_sec = 0;
+    mu_assert("No interval", EINVAL == hdr_log_merge(NULL, 0, output, &options, NULL));
+
+    fclose(output);
+
+    return 0;
+}
+
+static char* test_merge_counts_values_out_of_range(void)
+{
+    struct hdr_log_merge_options options;
+    struct hdr_histogram* expected[BUCKET_COUNT];
+    FILE* inputs[INPUT_COUNT];
+    FILE* output = tmpfile();
+    int64_t dropped = -1;
+    int i;
+
+    for (i = 0; i < BUCKET_COUNT; i++)
+    {
+        hdr_init(1, highest_trackable_value, 3, &expected[i]);
+    }
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        inputs[i] = write_input(i, expected);
+    }
+
+    /* Every input value, 100 or more, is beyond the merged histograms. */
+    hdr_log_merge_options_init(&options);
+    options.highest_trackable_value = 2;
+    options.significant_figures = 1;
+    options.threads = 2;
+
+    mu_assert("Merge", 0 == hdr_log_merge(inputs, INPUT_COUNT, output, &options, &dropped));
+    mu_assert(
+        "Dropped",
+        compare_int64(INPUT_COUNT * ENTRIES_PER_INPUT * (ENTRIES_PER_INPUT + 1) / 2, dropped));
+
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        fclose(inputs[i]);
+    }
+    for (i = 0; i < BUCKET_COUNT; i++)
+    {
+        hdr_close(expected[i]);
+    }
+    fclose(output);
+
+    return 0;
+}
+
+static struct mu_result all_tests(void)
+{
+    mu_run_test(test_merge_single_thread);
+    mu_run_test(test_merge_with_workers_over_many_rounds);
+    mu_run_test(test_merge_with_more_threads_than_inputs);
+    mu_run_test(test_invalid_options);
+    mu_run_test(test_merge_counts_values_out_of_range);
+
+    mu_ok;
+}
+
+static int hdr_log_merge_run_tests(void)
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_log_merge_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main(void)
+{
+    return hdr_log_merge_run_tests();
+}
@@ -0,0 +1,271 @@
+/**
+ * hdr_registry_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+#include <hdr/hdr_registry.h>
+#include <hdr/hdr_thread.h>
+
+#include "minunit.h"
+
+int tests_run = 0;
+
+#define THREAD_COUNT 4
+#define SERIES_PER_THREAD 200
+
+static const int64_t highest_trackable_value = INT64_C(24) * 60 * 60 * 1000000;
+
+static int format_labels(char* buffer, size_t len, int i)
+{
+    return snprintf(buffer, len, "endpoint=/e%d;method=GET", i);
+}
+
+static char* test_invalid(void)
+{
+    struct hdr_registry registry;
+    struct hdr_interval_recorder* recorder;
+
+    mu_assert("Should fail with lowest of 0", EINVAL == hdr_registry_init(&registry, 0, 100, 3, 16));
+
+    mu_assert("Should init", 0 == hdr_registry_init(&registry, 1, highest_trackable_value, 3, 16));
+    mu_assert("Should reject empty labels", EINVAL == hdr_registry_recorder(&registry, "", 0, &recorder));
+    mu_assert("Should reject a comma", EINVAL == hdr_registry_recorder(&registry, "a,b", 3, &recorder));
+    mu_assert("Should reject a space", EINVAL == hdr_registry_recorder(&registry, "a b", 3, &recorder));
+    mu_assert("Should reject a newline", EINVAL == hdr_registry_recorder(&registry, "a\n", 2, &recorder));
+    mu_assert("Should have no series", compare_int64(0, hdr_registry_series_count(&registry)));
+
+    hdr_registry_destroy(&registry);
+
+    return 0;
+}
+
+static char* test_lookup(void)
+{
+    struct hdr_registry registry;
+    struct hdr_interval_recorder* recorders[1000];
+    struct hdr_interval_recorder* recorder;
+    char labels[64];
+    int len;
+    int i;
+
+    /* Far more series than buckets, so the chains are long. */
+    hdr_registry_init(&registry, 1, highest_trackable_value, 3, 16);
+
+    mu_assert("Should not find a missing series", NULL == hdr_registry_find(&registry, "a=b", 3));
+
+    for (i = 0; i < 1000; i++)
+    {
+        len = format_labels(labels, sizeof(labels), i);
+        mu_assert("Should create", 0 == hdr_registry_recorder(&registry, labels, (size_t) len, &recorders[i]));
+    }
+    mu_assert("Should count series", compare_int64(1000, hdr_registry_series_count(&registry)));
+
+    for (i = 0; i < 1000; i++)
+    {
+        len = format_labels(labels, sizeof(labels), i);
+        mu_assert("Should find", recorders[i] == hdr_registry_find(&registry, labels, (size_t) len));
+        mu_assert("Should reuse", 0 == hdr_registry_recorder(&registry, labels, (size_t) len, &recorder));
+        mu_assert("Should be the same recorder", recorders[i] == recorder);
+    }
+    mu_assert("Should not find a prefix", NULL == hdr_registry_find(&registry, "endpoint=/e1", 12));
+    mu_assert("Should not create duplicates", compare_int64(1000, hdr_registry_series_count(&registry)));
+
+    hdr_registry_destroy(&registry);
+
+    return 0;
+}
+
+static char* read_entry(
+    struct hdr_log_reader* reader, FILE* f, const char* tag, int64_t value, int64_t count)
+{
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    char read_tag[64];
+
+    memset(&entry, 0, sizeof(entry));
+    entry.tag = read_tag;
+    entry.tag_len = sizeof(read_tag);
+    read_tag[0] = '\0';
+
+    mu_assert("Should read entry", 0 == hdr_log_read_entry(reader, f, &entry, &h));
+    mu_assert("Tag mismatch", 0 == strcmp(tag, read_tag));
+    mu_assert("Interval mismatch", 5 == entry.interval.tv_sec);
+    mu_assert("Total mismatch", compare_int64(count, h->total_count));
+    mu_assert("Count mismatch", compare_int64(count, hdr_count_at_value(h, value)));
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_sample_and_write(void)
+{
+    struct hdr_registry registry;
+    struct hdr_interval_recorder* get;
+    struct hdr_interval_recorder* put;
+    struct hdr_interval_recorder* idle;
+    struct hdr_log_writer writer;
+    struct hdr_log_reader reader;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* h = NULL;
+    hdr_timespec start;
+    hdr_timespec interval;
+    FILE* f = tmpfile();
+    char* result;
+
+    hdr_registry_init(&registry, 1, highest_trackable_value, 3, 16);
+    hdr_registry_recorder(&registry, "method=GET", 10, &get);
+    hdr_registry_recorder(&registry, "method=IDLE", 11, &idle);
+    hdr_registry_recorder(&registry, "method=PUT", 10, &put);
+
+    hdr_interval_recorder_record_values(put, 300, 3);
+    hdr_interval_recorder_record_values(get, 100, 1);
+    mu_assert("Should sample the active series", compare_int64(2, hdr_registry_sample(&registry)));
+
+    start.tv_sec = 1000;
+    start.tv_nsec = 0;
+    interval.tv_sec = 5;
+    interval.tv_nsec = 0;
+    hdr_log_writer_init_with_encoder(&writer);
+    hdr_log_write_header(&writer, f, NULL, &start);
+    mu_assert("Should write", 0 == hdr_registry_write(&registry, &writer, f, &start, &interval));
+
+    /* Nothing recorded, so nothing is sampled or written. */
+    mu_assert("Should skip idle series", compare_int64(0, hdr_registry_sample(&registry)));
+    mu_assert("Should write", 0 == hdr_registry_write(&registry, &writer, f, &start, &interval));
+
+    hdr_interval_recorder_record_values(get, 200, 2);
+    mu_assert("Should sample the active series", compare_int64(1, hdr_registry_sample(&registry)));
+    mu_assert("Should write", 0 == hdr_registry_write(&registry, &writer, f, &start, &interval));
+    hdr_log_writer_close(&writer);
+
+    rewind(f);
+    hdr_log_reader_init_with_decoder(&reader);
+    mu_assert("Should read header", 0 == hdr_log_read_header(&reader, f));
+    if ((result = read_entry(&reader, f, "method=GET", 100, 1)) ||
+        (result = read_entry(&reader, f, "method=PUT", 300, 3)) ||
+        (result = read_entry(&reader, f, "method=GET", 200, 2)))
+    {
+        return result;
+    }
+    memset(&entry, 0, sizeof(entry));
+    mu_assert("Should be at the end", EOF == hdr_log_read_entry(&reader, f, &entry, &h));
+    hdr_log_reader_close(&reader);
+
+    hdr_registry_destroy(&registry);
+    fclose(f);
+
+    return 0;
+}
+
+struct create_context
+{
+    struct hdr_registry* registry;
+    struct hdr_interval_recorder* recorders[SERIES_PER_THREAD];
+    int failures;
+};
+
+static void* create_series(void* arg)
+{
+    struct create_context* context = (struct create_context*) arg;
+    char labels[64];
+    int i;
+
+    for (i = 0; i < SERIES_PER_THREAD; i++)
+    {
+        int len = format_labels(labels, sizeof(labels), i);
+        if (0 != hdr_registry_recorder(context->registry, labels, (size_t) len, &context->recorders[i]))
+        {
+            context->failures++;
+        }
+        hdr_interval_recorder_record_value_atomic(context->recorders[i], i + 1);
+    }
+
+    return NULL;
+}
+
+static char* test_concurrent_create(void)
+{
+    struct hdr_registry registry;
+    struct create_context contexts[THREAD_COUNT];
+    hdr_thread threads[THREAD_COUNT];
+    int i;
+    int j;
+
+    hdr_registry_init(&registry, 1, highest_trackable_value, 3, SERIES_PER_THREAD);
+
+    for (i = 0; i < THREAD_COUNT; i++)
+    {
+        memset(&contexts[i], 0, sizeof(contexts[i]));
+        contexts[i].registry = &registry;
+        mu_assert("Should start thread", 0 == hdr_thread_create(&threads[i], create_series, &contexts[i]));
+    }
+    for (i = 0; i < THREAD_COUNT; i++)
+    {
+        hdr_thread_join(&threads[i]);
+        mu_assert("Should not fail", 0 == contexts[i].failures);
+    }
+
+    mu_assert("Should create each series once", compare_int64(SERIES_PER_THREAD, hdr_registry_series_count(&registry)));
+    for (j = 0; j < SERIES_PER_THREAD; j++)
+    {
+        for (i = 1; i < THREAD_COUNT; i++)
+        {
+            mu_assert("Should share recorders", contexts[0].recorders[j] == contexts[i].recorders[j]);
+        }
+    }
+
+    mu_assert("Should sample every series", compare_int64(SERIES_PER_THREAD, hdr_registry_sample(&registry)));
+    for (j = 0; j < SERIES_PER_THREAD; j++)
+    {
+        mu_assert(
+            "Should hold every thread's value",
+            compare_int64(THREAD_COUNT, contexts[0].recorders[j]->inactive->total_count));
+    }
+
+    hdr_registry_destroy(&registry);
+
+    return 0;
+}
+
+static struct mu_result all_tests(void)
+{
+    mu_run_test(test_invalid);
+    mu_run_test(test_lookup);
+    mu_run_test(test_sample_and_write);
+    mu_run_test(test_concurrent_create);
+
+    mu_ok;
+}
+
+static int hdr_registry_run_tests(void)
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_registry_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main(void)
+{
+    return hdr_registry_run_tests();
+}
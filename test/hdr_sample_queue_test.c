@@ -0,0 +1,256 @@
+/**
+ * hdr_sample_queue_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_interval_recorder.h>
+#include <hdr/hdr_sample_queue.h>
+#include <hdr/hdr_thread.h>
+
+#include "minunit.h"
+#include "hdr_test_util.h"
+
+int tests_run = 0;
+
+static const int64_t highest_trackable_value = INT64_C(24) * 60 * 60 * 1000000;
+
+static char* test_invalid_init(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_sample_queue queue;
+
+    hdr_interval_recorder_init_all(&recorder, 1, highest_trackable_value, 3);
+
+    mu_assert("Should fail without recorder", EINVAL == hdr_sample_queue_init(&queue, NULL, 1, 16, HDR_SAMPLE_QUEUE_DROP));
+    mu_assert("Should fail without producers", EINVAL == hdr_sample_queue_init(&queue, &recorder, 0, 16, HDR_SAMPLE_QUEUE_DROP));
+    mu_assert("Should fail without capacity", EINVAL == hdr_sample_queue_init(&queue, &recorder, 1, 0, HDR_SAMPLE_QUEUE_DROP));
+
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+static char* test_records_and_drains_into_recorder(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_sample_queue queue;
+    struct hdr_sample_queue_producer* producer;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* sample;
+    char* result;
+    int i;
+
+    hdr_init(1, highest_trackable_value, 3, &expected);
+    hdr_interval_recorder_init_all(&recorder, 1, highest_trackable_value, 3);
+    mu_assert("Init", 0 == hdr_sample_queue_init(&queue, &recorder, 2, 1024, HDR_SAMPLE_QUEUE_DROP));
+
+    producer = hdr_sample_queue_acquire_producer(&queue);
+    mu_assert("Should acquire producer", NULL != producer);
+
+    for (i = 0; i < 1000; i++)
+    {
+        int64_t value = (i % 10) * 1000 + 17;
+        mu_assert("Should queue value", hdr_sample_queue_record_value(producer, value));
+        hdr_record_value(expected, value);
+    }
+
+    sample = hdr_sample_queue_sample_and_recycle(&queue, NULL);
+    result = compare_histograms(expected, sample);
+    if (result)
+    {
+        return result;
+    }
+
+    mu_assert("Nothing left to drain", compare_int64(0, hdr_sample_queue_drain(&queue)));
+    mu_assert("Nothing dropped", compare_int64(0, hdr_sample_queue_dropped_count(&queue)));
+
+    hdr_sample_queue_destroy(&queue);
+    hdr_interval_recorder_destroy(&recorder);
+    hdr_close(sample);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_acquire_beyond_producer_count(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_sample_queue queue;
+
+    hdr_interval_recorder_init_all(&recorder, 1, highest_trackable_value, 3);
+    hdr_sample_queue_init(&queue, &recorder, 2, 16, HDR_SAMPLE_QUEUE_DROP);
+
+    mu_assert("First producer", NULL != hdr_sample_queue_acquire_producer(&queue));
+    mu_assert("Second producer", NULL != hdr_sample_queue_acquire_producer(&queue));
+    mu_assert("No third producer", NULL == hdr_sample_queue_acquire_producer(&queue));
+
+    hdr_sample_queue_destroy(&queue);
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+static char* test_drop_policy_counts_dropped_values(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_sample_queue queue;
+    struct hdr_sample_queue_producer* producer;
+    int i, queued = 0;
+
+    hdr_interval_recorder_init_all(&recorder, 1, highest_trackable_value, 3);
+    hdr_sample_queue_init(&queue, &recorder, 1, 3, HDR_SAMPLE_QUEUE_DROP);
+    producer = hdr_sample_queue_acquire_producer(&queue);
+
+    for (i = 1; i <= 10; i++)
+    {
+        queued += hdr_sample_queue_record_value(producer, i) ? 1 : 0;
+    }
+
+    mu_assert("Capacity rounded up to 4", compare_int64(4, queued));
+    mu_assert("Dropped count", compare_int64(6, hdr_sample_queue_dropped_count(&queue)));
+    mu_assert("Drained count", compare_int64(4, hdr_sample_queue_drain(&queue)));
+    mu_assert("Oldest values kept", compare_int64(4, hdr_max(recorder.active)));
+    mu_assert("Room after drain", hdr_sample_queue_record_value(producer, 5));
+
+    hdr_sample_queue_destroy(&queue);
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+static char* test_overwrite_policy_keeps_newest_values(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_sample_queue queue;
+    struct hdr_sample_queue_producer* producer;
+    int i;
+
+    hdr_interval_recorder_init_all(&recorder, 1, highest_trackable_value, 3);
+    hdr_sample_queue_init(&queue, &recorder, 1, 4, HDR_SAMPLE_QUEUE_OVERWRITE);
+    producer = hdr_sample_queue_acquire_producer(&queue);
+
+    for (i = 1; i <= 10; i++)
+    {
+        mu_assert("Overwrite never drops", hdr_sample_queue_record_value(producer, i));
+    }
+
+    mu_assert("Overwritten count", compare_int64(6, hdr_sample_queue_overwritten_count(&queue)));
+    mu_assert("Drained count", compare_int64(4, hdr_sample_queue_drain(&queue)));
+    mu_assert("Min", compare_int64(7, hdr_min(recorder.active)));
+    mu_assert("Max", compare_int64(10, hdr_max(recorder.active)));
+
+    hdr_sample_queue_destroy(&queue);
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+#define PRODUCER_THREADS 4
+#define VALUES_PER_THREAD 200000
+
+static void* produce_values(void* arg)
+{
+    struct hdr_sample_queue_producer* producer = hdr_sample_queue_acquire_producer(arg);
+    int i;
+
+    for (i = 0; i < VALUES_PER_THREAD; i++)
+    {
+        hdr_sample_queue_record_value(producer, (i % 20000) + 1);
+    }
+
+    return NULL;
+}
+
+static char* test_block_policy_with_background_drain(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_sample_queue queue;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* sample;
+    hdr_thread threads[PRODUCER_THREADS];
+    char* result;
+    int i, j;
+
+    hdr_init(1, highest_trackable_value, 3, &expected);
+    hdr_interval_recorder_init_all(&recorder, 1, highest_trackable_value, 3);
+    hdr_sample_queue_init(&queue, &recorder, PRODUCER_THREADS, 256, HDR_SAMPLE_QUEUE_BLOCK);
+
+    mu_assert("Start", 0 == hdr_sample_queue_start(&queue, 10));
+    mu_assert("Already started", EINVAL == hdr_sample_queue_start(&queue, 10));
+
+    for (i = 0; i < PRODUCER_THREADS; i++)
+    {
+        for (j = 0; j < VALUES_PER_THREAD; j++)
+        {
+            hdr_record_value(expected, (j % 20000) + 1);
+        }
+
+        hdr_thread_create(&threads[i], produce_values, &queue);
+    }
+
+    for (i = 0; i < PRODUCER_THREADS; i++)
+    {
+        hdr_thread_join(&threads[i]);
+    }
+
+    hdr_sample_queue_stop(&queue);
+
+    sample = hdr_sample_queue_sample_and_recycle(&queue, NULL);
+    result = compare_histograms(expected, sample);
+    if (result)
+    {
+        return result;
+    }
+
+    mu_assert("Nothing dropped", compare_int64(0, hdr_sample_queue_dropped_count(&queue)));
+
+    hdr_sample_queue_destroy(&queue);
+    hdr_interval_recorder_destroy(&recorder);
+    hdr_close(sample);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static struct mu_result all_tests(void)
+{
+    mu_run_test(test_invalid_init);
+    mu_run_test(test_records_and_drains_into_recorder);
+    mu_run_test(test_acquire_beyond_producer_count);
+    mu_run_test(test_drop_policy_counts_dropped_values);
+    mu_run_test(test_overwrite_policy_keeps_newest_values);
+    mu_run_test(test_block_policy_with_background_drain);
+
+    mu_ok;
+}
+
+static int hdr_sample_queue_run_tests(void)
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_sample_queue_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main(void)
+{
+    return hdr_sample_queue_run_tests();
+}
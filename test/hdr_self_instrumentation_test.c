@@ -0,0 +1,147 @@
+/**
+ * hdr_self_instrumentation_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_interval_recorder.h>
+#include <hdr/hdr_self_instrumentation.h>
+
+#include "minunit.h"
+
+int tests_run = 0;
+
+static char* test_disabled_without_build_option(void)
+{
+    struct hdr_histogram* h = NULL;
+
+    if (hdr_self_instrumentation_enabled())
+    {
+        return 0;
+    }
+
+    mu_assert("Should not set interval", EINVAL == hdr_self_instrumentation_set_sample_interval(1));
+    mu_assert("Should not snapshot", EINVAL == hdr_self_instrumentation_snapshot(HDR_SELF_RECORD_VALUE, &h));
+    mu_assert("Should not allocate", NULL == h);
+
+    return 0;
+}
+
+static char* test_samples_record_value(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* timings;
+    int i;
+
+    if (!hdr_self_instrumentation_enabled())
+    {
+        return 0;
+    }
+
+    mu_assert("Should reject 0", EINVAL == hdr_self_instrumentation_set_sample_interval(0));
+    mu_assert("Should set interval", 0 == hdr_self_instrumentation_set_sample_interval(10));
+    hdr_self_instrumentation_reset();
+
+    hdr_init(1, 1000000, 3, &h);
+    /* The first call on a thread is always sampled. */
+    for (i = 0; i < 1001; i++)
+    {
+        hdr_record_value(h, i + 1);
+    }
+
+    mu_assert("Snapshot", 0 == hdr_self_instrumentation_snapshot(HDR_SELF_RECORD_VALUE, &timings));
+    mu_assert("1 in 10 calls timed", compare_int64(101, timings->total_count));
+    hdr_close(timings);
+
+    hdr_self_instrumentation_reset();
+    mu_assert("Snapshot", 0 == hdr_self_instrumentation_snapshot(HDR_SELF_RECORD_VALUE, &timings));
+    mu_assert("Reset", compare_int64(0, timings->total_count));
+    hdr_close(timings);
+
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_times_every_phase_flip(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_histogram* timings;
+    struct hdr_histogram* h;
+    int i;
+
+    if (!hdr_self_instrumentation_enabled())
+    {
+        return 0;
+    }
+
+    /* Run down the countdown left from the previous interval. */
+    hdr_self_instrumentation_set_sample_interval(1);
+    hdr_init(1, 1000000, 3, &h);
+    for (i = 0; i < 10; i++)
+    {
+        hdr_record_value(h, 1);
+    }
+    hdr_close(h);
+    hdr_self_instrumentation_reset();
+
+    hdr_interval_recorder_init_all(&recorder, 1, 1000000, 3);
+    for (i = 0; i < 5; i++)
+    {
+        hdr_interval_recorder_record_value(&recorder, 1000);
+        hdr_interval_recorder_sample(&recorder);
+    }
+
+    mu_assert("Snapshot", 0 == hdr_self_instrumentation_snapshot(HDR_SELF_PHASER_FLIP_PHASE, &timings));
+    mu_assert("Every flip timed", compare_int64(5, timings->total_count));
+    hdr_close(timings);
+
+    mu_assert("Snapshot", 0 == hdr_self_instrumentation_snapshot(HDR_SELF_INTERVAL_RECORDER_RECORD_VALUE, &timings));
+    mu_assert("Every record timed", compare_int64(5, timings->total_count));
+    hdr_close(timings);
+
+    mu_assert("Unknown operation", EINVAL == hdr_self_instrumentation_snapshot(HDR_SELF_OPERATION_COUNT, &timings));
+
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+static struct mu_result all_tests(void)
+{
+    mu_run_test(test_disabled_without_build_option);
+    mu_run_test(test_samples_record_value);
+    mu_run_test(test_times_every_phase_flip);
+
+    mu_ok;
+}
+
+static int hdr_self_instrumentation_run_tests(void)
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_self_instrumentation_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main(void)
+{
+    return hdr_self_instrumentation_run_tests();
+}
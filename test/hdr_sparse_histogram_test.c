@@ -0,0 +1,297 @@
+/**
+ * hdr_sparse_histogram_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_sparse_histogram.h>
+
+#include "minunit.h"
+#include "hdr_test_util.h"
+
+int tests_run = 0;
+
+static const int64_t highest_trackable_value = INT64_C(3600) * 1000 * 1000;
+static const int significant_figures = 3;
+
+static const double percentiles[] = { 0.0, 1.0, 25.0, 50.0, 75.0, 90.0, 99.0, 99.9, 100.0 };
+
+static char* compare_sparse(struct hdr_histogram* expected, struct hdr_sparse_histogram* actual)
+{
+    struct hdr_iter expected_iter;
+    struct hdr_sparse_iter actual_iter;
+    size_t i;
+
+    mu_assert("Total mismatch", compare_int64(expected->total_count, hdr_sparse_total_count(actual)));
+    mu_assert("Min mismatch", compare_int64(hdr_min(expected), hdr_sparse_min(actual)));
+    mu_assert("Max mismatch", compare_int64(hdr_max(expected), hdr_sparse_max(actual)));
+
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        mu_assert(
+            "Percentile mismatch",
+            compare_int64(
+                hdr_value_at_percentile(expected, percentiles[i]),
+                hdr_sparse_value_at_percentile(actual, percentiles[i])));
+    }
+
+    hdr_iter_recorded_init(&expected_iter, expected);
+    hdr_sparse_iter_init(&actual_iter, actual);
+    while (hdr_iter_next(&expected_iter))
+    {
+        mu_assert("Should have next", hdr_sparse_iter_next(&actual_iter));
+        mu_assert("Value mismatch", compare_int64(expected_iter.value, actual_iter.value));
+        mu_assert("Count mismatch", compare_int64(expected_iter.count, actual_iter.count));
+        mu_assert(
+            "Cumulative count mismatch",
+            compare_int64(expected_iter.cumulative_count, actual_iter.cumulative_count));
+        mu_assert(
+            "Highest equivalent mismatch",
+            compare_int64(expected_iter.highest_equivalent_value, actual_iter.highest_equivalent_value));
+        mu_assert(
+            "Median equivalent mismatch",
+            compare_int64(expected_iter.median_equivalent_value, actual_iter.median_equivalent_value));
+    }
+    mu_assert("Should not have next", !hdr_sparse_iter_next(&actual_iter));
+
+    return 0;
+}
+
+static char* test_invalid_init(void)
+{
+    struct hdr_sparse_histogram* h;
+
+    mu_assert("Should fail with lowest of 0", EINVAL == hdr_sparse_init(0, 100, 3, &h));
+    mu_assert("Should fail with 6 significant figures", EINVAL == hdr_sparse_init(1, 100, 6, &h));
+
+    return 0;
+}
+
+static char* test_empty(void)
+{
+    struct hdr_sparse_histogram* h;
+    struct hdr_sparse_iter iter;
+
+    mu_assert("Should init", 0 == hdr_sparse_init(1, highest_trackable_value, significant_figures, &h));
+
+    mu_assert("Should be empty", compare_int64(0, hdr_sparse_total_count(h)));
+    mu_assert("Min should be INT64_MAX", compare_int64(INT64_MAX, hdr_sparse_min(h)));
+    mu_assert("Max should be 0", compare_int64(0, hdr_sparse_max(h)));
+    mu_assert("P99 should be 0", compare_int64(0, hdr_sparse_value_at_percentile(h, 99.0)));
+    hdr_sparse_iter_init(&iter, h);
+    mu_assert("Should not have next", !hdr_sparse_iter_next(&iter));
+
+    hdr_sparse_close(h);
+
+    return 0;
+}
+
+static char* test_record_matches_histogram(void)
+{
+    static const int64_t values[] = { 0, 1, 7, 1000, 1001, 1024, 1000000, 7, 3000000, 1000 };
+    struct hdr_histogram* expected;
+    struct hdr_sparse_histogram* h;
+    size_t i;
+    char* result;
+
+    hdr_init(1, highest_trackable_value, significant_figures, &expected);
+    hdr_sparse_init(1, highest_trackable_value, significant_figures, &h);
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        hdr_record_values(expected, values[i], (int64_t) i + 1);
+        mu_assert("Should record", hdr_sparse_record_values(h, values[i], (int64_t) i + 1));
+    }
+
+    mu_assert("Should reject negative values", !hdr_sparse_record_value(h, -1));
+    mu_assert("Should reject values out of range", !hdr_sparse_record_value(h, highest_trackable_value * 2));
+    mu_assert("Should still be sparse", NULL == h->dense);
+    mu_assert("Should hold a pair per bucket", compare_int64(8, h->len));
+    mu_assert(
+        "Should use less memory than a histogram",
+        hdr_sparse_get_memory_size(h) < hdr_get_memory_size(expected) / 100);
+
+    if ((result = compare_sparse(expected, h)))
+    {
+        return result;
+    }
+
+    hdr_close(expected);
+    hdr_sparse_close(h);
+
+    return 0;
+}
+
+static char* test_converts_to_dense(void)
+{
+    struct hdr_histogram* expected;
+    struct hdr_sparse_histogram* h;
+    int32_t limit;
+    int32_t i;
+    char* result;
+
+    hdr_init(1, highest_trackable_value, significant_figures, &expected);
+    hdr_sparse_init(1, highest_trackable_value, significant_figures, &h);
+    limit = h->layout.counts_len / 8;
+
+    /* Every other bucket from the top down, so each pair goes in at the front. */
+    for (i = limit; i > 0; i--)
+    {
+        int64_t value = hdr_value_at_index(&h->layout, i * 2 - 1);
+        hdr_record_value(expected, value);
+        hdr_sparse_record_value(h, value);
+    }
+    mu_assert("Should be sparse at the limit", NULL == h->dense);
+    mu_assert("Should hold the limit", compare_int64(limit, h->len));
+
+    hdr_record_value(expected, 0);
+    hdr_sparse_record_value(h, 0);
+    mu_assert("Should be dense past the limit", NULL != h->dense);
+    mu_assert("Should release the pairs", NULL == h->indices && NULL == h->counts);
+
+    hdr_record_value(expected, 1000000);
+    hdr_sparse_record_value(h, 1000000);
+
+    if ((result = compare_sparse(expected, h)))
+    {
+        return result;
+    }
+
+    hdr_sparse_reset(h);
+    mu_assert("Should be sparse after reset", NULL == h->dense);
+    mu_assert("Should be empty after reset", compare_int64(0, hdr_sparse_total_count(h)));
+    mu_assert("Should reset min", compare_int64(INT64_MAX, hdr_sparse_min(h)));
+    mu_assert("Should reset max", compare_int64(0, hdr_sparse_max(h)));
+
+    hdr_reset(expected);
+    hdr_record_value(expected, 42);
+    hdr_sparse_record_value(h, 42);
+    if ((result = compare_sparse(expected, h)))
+    {
+        return result;
+    }
+
+    hdr_close(expected);
+    hdr_sparse_close(h);
+
+    return 0;
+}
+
+static char* test_add(void)
+{
+    struct hdr_histogram* expected;
+    struct hdr_histogram* other;
+    struct hdr_sparse_histogram* h;
+    struct hdr_sparse_histogram* from;
+    char* result;
+
+    hdr_init(1, highest_trackable_value, significant_figures, &expected);
+    hdr_sparse_init(1, highest_trackable_value, significant_figures, &h);
+    hdr_sparse_init(1, highest_trackable_value, significant_figures, &from);
+
+    hdr_record_values(expected, 100, 3);
+    hdr_record_values(expected, 5000, 2);
+    hdr_record_values(expected, 100, 4);
+    hdr_record_values(expected, 70000, 1);
+    hdr_sparse_record_values(h, 100, 3);
+    hdr_sparse_record_values(h, 5000, 2);
+    hdr_sparse_record_values(from, 100, 4);
+    hdr_sparse_record_values(from, 70000, 1);
+
+    mu_assert("Should drop nothing", compare_int64(0, hdr_sparse_add(h, from)));
+    if ((result = compare_sparse(expected, h)))
+    {
+        return result;
+    }
+
+    /* Same configuration goes by index, a different one by value. */
+    hdr_init(1, highest_trackable_value, significant_figures, &other);
+    mu_assert("Should drop nothing", compare_int64(0, hdr_sparse_add_to(other, h)));
+    if ((result = compare_histograms(expected, other)))
+    {
+        return result;
+    }
+    hdr_close(other);
+
+    hdr_init(1, 10000, 2, &other);
+    mu_assert("Should drop the value out of range", compare_int64(1, hdr_sparse_add_to(other, h)));
+    mu_assert("Should hold the rest", compare_int64(9, other->total_count));
+    hdr_close(other);
+
+    hdr_close(expected);
+    hdr_sparse_close(h);
+    hdr_sparse_close(from);
+
+    return 0;
+}
+
+static char* test_to_dense(void)
+{
+    struct hdr_histogram* expected;
+    struct hdr_histogram* dense;
+    struct hdr_sparse_histogram* h;
+    char* result;
+
+    hdr_init(1, highest_trackable_value, significant_figures, &expected);
+    hdr_sparse_init(1, highest_trackable_value, significant_figures, &h);
+
+    hdr_record_values(expected, 1234, 10);
+    hdr_record_values(expected, 98765, 5);
+    hdr_sparse_record_values(h, 1234, 10);
+    hdr_sparse_record_values(h, 98765, 5);
+
+    mu_assert("Should convert", 0 == hdr_sparse_to_dense(h, &dense));
+    mu_assert("Should be an equivalent histogram", compare_int64(expected->counts_len, dense->counts_len));
+    if ((result = compare_histograms(expected, dense)))
+    {
+        return result;
+    }
+
+    hdr_close(expected);
+    hdr_close(dense);
+    hdr_sparse_close(h);
+
+    return 0;
+}
+
+static struct mu_result all_tests(void)
+{
+    mu_run_test(test_invalid_init);
+    mu_run_test(test_empty);
+    mu_run_test(test_record_matches_histogram);
+    mu_run_test(test_converts_to_dense);
+    mu_run_test(test_add);
+    mu_run_test(test_to_dense);
+
+    mu_ok;
+}
+
+static int hdr_sparse_histogram_run_tests(void)
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_sparse_histogram_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main(void)
+{
+    return hdr_sparse_histogram_run_tests();
+}